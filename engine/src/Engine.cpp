@@ -67,15 +67,19 @@ namespace imp
 
     static VkResult CreateDescriptorPool(VkDevice device, VkDescriptorPool* pool)
     {
-        VkDescriptorPoolSize poolSize {};
-        poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSize.descriptorCount = 100; // Arbitrary large number
+        // Arbitrary large numbers
+        VkDescriptorPoolSize poolSizes[] = {
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 100 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 100 },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 100 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 100 },
+        };
 
         VkDescriptorPoolCreateInfo dpci {};
         dpci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         dpci.maxSets = 100; // Arbitrary large number
-        dpci.poolSizeCount = 1;
-        dpci.pPoolSizes = &poolSize;
+        dpci.poolSizeCount = static_cast<uint32_t>(std::size(poolSizes));
+        dpci.pPoolSizes = poolSizes;
 
         VkResult result = vkt.vkCreateDescriptorPool(device, &dpci, nullptr, pool);
         if (result != VK_SUCCESS)
@@ -314,6 +318,8 @@ namespace imp
 
         std::vector<VkSubmitInfo> submits;
         submits.resize(paramsCount);
+        std::vector<std::vector<VkSemaphore>> signalSemaphores;
+        signalSemaphores.resize(paramsCount);
         VkPipelineStageFlags waitMasks = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
 
         for (uint32_t i = 0; i < paramsCount; i++)
@@ -326,8 +332,10 @@ namespace imp
             si.pWaitSemaphores = lastSubmitSync ? &lastSubmitSync->semaphore : nullptr;
             si.waitSemaphoreCount = lastSubmitSync ? 1 : 0;
             si.pWaitDstStageMask = &waitMasks;
-            si.pSignalSemaphores = &submitSync.semaphore;
-            si.signalSemaphoreCount = 1;
+            signalSemaphores[i].push_back(submitSync.semaphore);
+            signalSemaphores[i].insert(signalSemaphores[i].end(), pParams[i].pSignalSemaphores, pParams[i].pSignalSemaphores + pParams[i].signalSemaphoreCount);
+            si.pSignalSemaphores = signalSemaphores[i].data();
+            si.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores[i].size());
             si.pCommandBuffers = pParams[i].pCommandBuffers;
             si.commandBufferCount = pParams[i].commandBufferCount;
 
@@ -358,6 +366,10 @@ namespace imp
 
     VkResult Engine::Present(Window& window, uint32_t imageIndex)
     {
+        // Nothing to present to, the next submit waits on the last one instead
+        if (window.GetSwapchain().IsOffscreen())
+            return VK_SUCCESS;
+
         const SubmitSync* lastSubmit = m_SubmitSyncManager.GetLastSubmitSync();
         VkSwapchainKHR swapchain = window.GetSwapchain().GetSwapchain();
 
@@ -370,7 +382,9 @@ namespace imp
         pi.pImageIndices = &imageIndex;
 
         VkResult result = vkt.vkQueuePresentKHR(m_Queue.GetGraphicsQueue(), &pi);
-        if (result != VK_SUCCESS)
+        if (result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR)
+            m_SwapchainOutOfDate = true;
+        else if (result != VK_SUCCESS)
             g_Log("Failed to present to Swapchain with result %d\n", result);
         return result;
     }
@@ -421,12 +435,38 @@ namespace imp
 
     SubmitSync Engine::AcquireNextImage(Window& window, uint32_t* nextImageIndex, uint64_t timeout)
     {
+        if (window.GetSwapchain().IsOffscreen())
+        {
+            // Submits are serialized on the queue, so the image is free once the last frame using it is
+            *nextImageIndex = window.GetSwapchain().AcquireNextOffscreenImage();
+            const SubmitSync* lastSubmit = m_SubmitSyncManager.GetLastSubmitSync();
+            return lastSubmit ? *lastSubmit : CreateFailedSubmitSync();
+        }
+
+        if (window.ConsumeResize())
+            m_SwapchainOutOfDate = true;
+        if (m_SwapchainOutOfDate)
+            RecreateSwapchain(window);
+
         SubmitSync sync = m_SubmitSyncManager.GetSubmitSync(m_Queue.GetDevice());
 
-        VkSwapchainKHR swapchain = window.GetSwapchain().GetSwapchain();
-        VkResult result = vkt.vkAcquireNextImageKHR(m_Queue.GetDevice(), swapchain, timeout,
+        VkResult result = vkt.vkAcquireNextImageKHR(m_Queue.GetDevice(), window.GetSwapchain().GetSwapchain(), timeout,
             sync.semaphore, sync.fence, nextImageIndex);
 
+        // Nothing was signalled, so the same sync can be used for the new swapchain
+        if (result == VK_ERROR_OUT_OF_DATE_KHR && RecreateSwapchain(window) == VK_SUCCESS)
+        {
+            result = vkt.vkAcquireNextImageKHR(m_Queue.GetDevice(), window.GetSwapchain().GetSwapchain(), timeout,
+                sync.semaphore, sync.fence, nextImageIndex);
+        }
+
+        // The image is usable, the swapchain gets replaced next frame
+        if (result == VK_SUBOPTIMAL_KHR)
+        {
+            m_SwapchainOutOfDate = true;
+            result = VK_SUCCESS;
+        }
+
         if (result != VK_SUCCESS)
         {
             g_Log("Failed to acquire next image from Swapchain with result %d\n", result);
@@ -436,6 +476,22 @@ namespace imp
         return sync;
     }
 
+    VkResult Engine::RecreateSwapchain(Window& window)
+    {
+        // Frames in flight may still use the old images and presentation isn't fenced,
+        // so they are retired a few submits after the last one instead of waiting for the device
+        static constexpr uint64_t kRetireDelay = 4;
+        const SubmitSync* lastSubmit = m_SubmitSyncManager.GetLastSubmitSync();
+        const uint64_t retirePoint = (lastSubmit ? lastSubmit->submit : m_SubmitSyncManager.GetLastSyncedPoint()) + kRetireDelay;
+
+        VkResult result = window.RecreateSwapchain(m_PhysicalDevice, m_Queue.GetDevice(), m_SafeResourceDestroyer, retirePoint);
+        if (result == VK_SUCCESS)
+            m_SwapchainOutOfDate = false;
+        else if (result != VK_NOT_READY)
+            g_Log("Failed to recreate the Swapchain with result %d\n", result);
+        return result;
+    }
+
     VkResult Engine::CreateInstance(const EngineCreateParams& params)
     {
         VkApplicationInfo appInfo{};
@@ -510,8 +566,10 @@ namespace imp
 
         VkPhysicalDevice discreteGPU = VK_NULL_HANDLE;
         VkPhysicalDevice integratedGPU = VK_NULL_HANDLE;
+        VkPhysicalDevice cpuDevice = VK_NULL_HANDLE;
         VkPhysicalDeviceProperties discreteProps = {};
         VkPhysicalDeviceProperties integratedProps = {};
+        VkPhysicalDeviceProperties cpuProps = {};
 
         VkPhysicalDeviceProperties props;
         for (const auto& device : devices)
@@ -528,6 +586,11 @@ namespace imp
                 integratedGPU = device;
                 integratedProps = props;
             }
+            else if (props.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU && cpuDevice == VK_NULL_HANDLE)
+            {
+                cpuDevice = device;
+                cpuProps = props;
+            }
         }
 
         if (discreteGPU != VK_NULL_HANDLE)
@@ -542,8 +605,16 @@ namespace imp
             g_Log("Selected Physical Device (Integrated): \"%s\"\n", integratedProps.deviceName);
             return VK_SUCCESS;
         }
+        else if (cpuDevice != VK_NULL_HANDLE)
+        {
+            // Software implementations like lavapipe, mostly for headless runs on machines without a GPU
+            m_PhysicalDevice = cpuDevice;
+            g_Log("Selected Physical Device (CPU): \"%s\"\n", cpuProps.deviceName);
+            return VK_SUCCESS;
+        }
 
-        return VK_ERROR_DEVICE_LOST;
+        g_Log("Error: Could not find a GPU or CPU Vulkan Physical Device.\n");
+        return VK_ERROR_FEATURE_NOT_PRESENT;
     }
 
     
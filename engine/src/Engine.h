@@ -27,6 +27,9 @@ namespace imp
         VkQueue queue; // Probably need to wrap VkQueue so I can differentiate between types of queues
         const VkCommandBuffer* pCommandBuffers;
         uint32_t commandBufferCount;
+        // Signalled together with the engine's own semaphore, for example to hand the frame to another process
+        const VkSemaphore* pSignalSemaphores;
+        uint32_t signalSemaphoreCount;
     };
 
     enum class CommandBufferType
@@ -81,6 +84,7 @@ namespace imp
         void DestroyInstance();
 
         VkResult SelectPhysicalDevice(const EngineCreateParams& params);
+        VkResult RecreateSwapchain(Window& window);
 
         VkInstance m_Instance = VK_NULL_HANDLE;
         VkPhysicalDevice m_PhysicalDevice = VK_NULL_HANDLE;
@@ -103,5 +107,8 @@ namespace imp
         SafeResourceDestroyer m_SafeResourceDestroyer = {};
 
         Queue m_Queue = {};
+
+        // Set when presenting reported the swapchain as suboptimal or out of date
+        bool m_SwapchainOutOfDate = false;
     };   
 }
\ No newline at end of file
@@ -0,0 +1,392 @@
+#include "FrameExport.h"
+#include "Engine.h"
+#include "Log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace imp
+{
+    using namespace FrameExportProtocol;
+
+    static uint32_t FindMemoryType(const VkPhysicalDeviceMemoryProperties& props, uint32_t typeBits, VkMemoryPropertyFlags preferred)
+    {
+        for (uint32_t i = 0; i < props.memoryTypeCount; i++)
+            if ((typeBits & (1u << i)) && (props.memoryTypes[i].propertyFlags & preferred) == preferred)
+                return i;
+        for (uint32_t i = 0; i < props.memoryTypeCount; i++)
+            if (typeBits & (1u << i))
+                return i;
+        return ~0u;
+    }
+
+#if defined(__linux__)
+    static int CreateListenSocket(const std::string& path)
+    {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            g_Log("Frame export socket path is too long: %s\n", path.c_str());
+            return -1;
+        }
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return -1;
+
+        // A previous run may have left the socket file behind
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1 || listen(fd, 1) == -1)
+        {
+            g_Log("Failed to listen on %s\n", path.c_str());
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static bool SendWithFds(int socket, const void* pData, size_t size, const int* pFds, uint32_t fdCount)
+    {
+        iovec iov {};
+        iov.iov_base = const_cast<void*>(pData);
+        iov.iov_len = size;
+
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * fdCount));
+        msghdr msg {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg);
+        pCmsg->cmsg_level = SOL_SOCKET;
+        pCmsg->cmsg_type = SCM_RIGHTS;
+        pCmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+        memcpy(CMSG_DATA(pCmsg), pFds, sizeof(int) * fdCount);
+
+        return sendmsg(socket, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(size);
+    }
+#endif
+
+    VkResult FrameExporter::Initialize(Engine& engine, const FrameExportParams& params)
+    {
+#if !defined(__linux__)
+        g_Log("Frame export needs file descriptor handles, it's only supported on Linux\n");
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+#else
+        if (params.slotCount == 0 || params.slotCount > kMaxSlots)
+            return VK_ERROR_INITIALIZATION_FAILED;
+
+        m_Params = params;
+        m_Device = engine.GetWorkQueue().GetDevice();
+
+        VkPhysicalDeviceIDProperties idProps {};
+        idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+        VkPhysicalDeviceProperties2 props {};
+        props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props.pNext = &idProps;
+        vkGetPhysicalDeviceProperties2(engine.GetPhysicalDevice(), &props);
+        memcpy(m_DeviceUUID, idProps.deviceUUID, VK_UUID_SIZE);
+        memcpy(m_DriverUUID, idProps.driverUUID, VK_UUID_SIZE);
+
+        const VkPhysicalDeviceMemoryProperties memoryProps = engine.GetMemoryProperties();
+
+        m_Slots.resize(params.slotCount);
+        for (auto& slot : m_Slots)
+        {
+            VkExternalMemoryImageCreateInfo emici {};
+            emici.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+            emici.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+            VkImageCreateInfo ici {};
+            ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            ici.pNext = &emici;
+            ici.imageType = VK_IMAGE_TYPE_2D;
+            ici.format = params.format;
+            ici.extent = { params.width, params.height, 1 };
+            ici.mipLevels = 1;
+            ici.arrayLayers = 1;
+            ici.samples = VK_SAMPLE_COUNT_1_BIT;
+            ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+            ici.usage = kImageUsage;
+            ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            VkResult result = vkt.vkCreateImage(m_Device, &ici, nullptr, &slot.image);
+            if (result != VK_SUCCESS)
+            {
+                g_Log("Failed to create an exportable image with result %d\n", result);
+                return result;
+            }
+
+            VkMemoryRequirements reqs;
+            vkt.vkGetImageMemoryRequirements(m_Device, slot.image, &reqs);
+
+            // Dedicated, so the importer can bind the whole allocation to its own image
+            VkMemoryDedicatedAllocateInfo mdai {};
+            mdai.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+            mdai.image = slot.image;
+
+            VkExportMemoryAllocateInfo emai {};
+            emai.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO;
+            emai.pNext = &mdai;
+            emai.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+            VkMemoryAllocateInfo mai {};
+            mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            mai.pNext = &emai;
+            mai.allocationSize = reqs.size;
+            mai.memoryTypeIndex = FindMemoryType(memoryProps, reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+            result = vkt.vkAllocateMemory(m_Device, &mai, nullptr, &slot.memory);
+            if (result != VK_SUCCESS)
+            {
+                g_Log("Failed to allocate exportable memory with result %d\n", result);
+                return result;
+            }
+            slot.memorySize = reqs.size;
+
+            result = vkt.vkBindImageMemory(m_Device, slot.image, slot.memory, 0);
+            if (result != VK_SUCCESS)
+                return result;
+
+            VkImageViewCreateInfo ivci {};
+            ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            ivci.image = slot.image;
+            ivci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            ivci.format = params.format;
+            ivci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            ivci.subresourceRange.levelCount = 1;
+            ivci.subresourceRange.layerCount = 1;
+
+            result = vkt.vkCreateImageView(m_Device, &ivci, nullptr, &slot.view);
+            if (result != VK_SUCCESS)
+                return result;
+
+            result = CreateExportSemaphore(&slot.semaphore);
+            if (result != VK_SUCCESS)
+                return result;
+        }
+
+        // The ring lives in an anonymous memfd, the consumer maps the descriptor it receives
+        m_RingFd = memfd_create("imp_frame_export", MFD_CLOEXEC);
+        if (m_RingFd == -1 || ftruncate(m_RingFd, sizeof(SharedRing)) == -1)
+        {
+            g_Log("Failed to create the frame export ring\n");
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        void* pRing = mmap(nullptr, sizeof(SharedRing), PROT_READ | PROT_WRITE, MAP_SHARED, m_RingFd, 0);
+        if (pRing == MAP_FAILED)
+            return VK_ERROR_MEMORY_MAP_FAILED;
+
+        m_pRing = new (pRing) SharedRing {};
+        m_pRing->magic = kMagic;
+        m_pRing->version = kVersion;
+        m_pRing->slotCount = params.slotCount;
+
+        m_ListenSocket = CreateListenSocket(params.socketPath);
+        if (m_ListenSocket == -1)
+            return VK_ERROR_INITIALIZATION_FAILED;
+
+        g_Log("Exporting frames on %s (%u slots of %ux%u)\n", params.socketPath.c_str(), params.slotCount, params.width, params.height);
+        return VK_SUCCESS;
+#endif
+    }
+
+    void FrameExporter::Shutdown(VkDevice device)
+    {
+#if defined(__linux__)
+        if (m_ClientSocket != -1)
+            close(m_ClientSocket);
+        if (m_ListenSocket != -1)
+        {
+            close(m_ListenSocket);
+            unlink(m_Params.socketPath.c_str());
+        }
+        if (m_pRing)
+            munmap(m_pRing, sizeof(SharedRing));
+        if (m_RingFd != -1)
+            close(m_RingFd);
+#endif
+        m_ClientSocket = -1;
+        m_ListenSocket = -1;
+        m_pRing = nullptr;
+        m_RingFd = -1;
+
+        for (const auto& slot : m_Slots)
+        {
+            vkt.vkDestroySemaphore(device, slot.semaphore, nullptr);
+            vkt.vkDestroyImageView(device, slot.view, nullptr);
+            vkt.vkDestroyImage(device, slot.image, nullptr);
+            vkt.vkFreeMemory(device, slot.memory, nullptr);
+        }
+        m_Slots.clear();
+    }
+
+    void FrameExporter::Poll(Engine& engine)
+    {
+#if defined(__linux__)
+        if (m_ClientSocket != -1)
+        {
+            // The consumer never sends anything, a readable socket means it hung up
+            char byte;
+            const ssize_t received = recv(m_ClientSocket, &byte, 1, MSG_DONTWAIT | MSG_PEEK);
+            if (received == 0 || (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK))
+                DisconnectConsumer(engine);
+            return;
+        }
+
+        if (m_ListenSocket == -1)
+            return;
+
+        const int client = accept4(m_ListenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client == -1)
+            return;
+
+        m_ClientSocket = client;
+        if (!SendHandshake())
+        {
+            g_Log("Failed to send the frame export handshake\n");
+            DisconnectConsumer(engine);
+            return;
+        }
+        g_Log("Frame export consumer connected\n");
+#endif
+    }
+
+    uint32_t FrameExporter::AcquireSlot()
+    {
+        if (!HasConsumer())
+            return ~0u;
+
+        for (uint32_t i = 0; i < m_Slots.size(); i++)
+        {
+            // Only the producer leaves Free, so checking is enough
+            if (m_pRing->slots[i].state.load(std::memory_order_acquire) == kSlotFree)
+                return i;
+        }
+        return ~0u;
+    }
+
+    void FrameExporter::Publish(uint32_t slot)
+    {
+        m_pRing->slots[slot].frameNumber.store(m_NextFrameNumber++, std::memory_order_relaxed);
+        m_pRing->slots[slot].state.store(kSlotReady, std::memory_order_release);
+        m_pRing->publishedFrames.fetch_add(1, std::memory_order_release);
+    }
+
+    VkResult FrameExporter::CreateExportSemaphore(VkSemaphore* pSemaphore) const
+    {
+        VkExportSemaphoreCreateInfo esci {};
+        esci.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+        esci.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+        VkSemaphoreCreateInfo sci {};
+        sci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        sci.pNext = &esci;
+
+        VkResult result = vkt.vkCreateSemaphore(m_Device, &sci, nullptr, pSemaphore);
+        if (result != VK_SUCCESS)
+            g_Log("Failed to create an exportable semaphore with result %d\n", result);
+        return result;
+    }
+
+    bool FrameExporter::SendHandshake()
+    {
+#if defined(__linux__)
+        Handshake handshake {};
+        handshake.magic = kMagic;
+        handshake.version = kVersion;
+        handshake.slotCount = static_cast<uint32_t>(m_Slots.size());
+        handshake.width = m_Params.width;
+        handshake.height = m_Params.height;
+        handshake.format = m_Params.format;
+        handshake.usage = kImageUsage;
+        handshake.tiling = VK_IMAGE_TILING_OPTIMAL;
+        memcpy(handshake.deviceUUID, m_DeviceUUID, VK_UUID_SIZE);
+        memcpy(handshake.driverUUID, m_DriverUUID, VK_UUID_SIZE);
+
+        // Ring first, then every memory, then every semaphore
+        std::vector<int> fds;
+        fds.push_back(m_RingFd);
+        bool exported = true;
+        for (uint32_t i = 0; i < m_Slots.size() && exported; i++)
+        {
+            handshake.memorySizes[i] = m_Slots[i].memorySize;
+
+            VkMemoryGetFdInfoKHR mgfi {};
+            mgfi.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
+            mgfi.memory = m_Slots[i].memory;
+            mgfi.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+            int fd = -1;
+            exported = vkt.vkGetMemoryFdKHR(m_Device, &mgfi, &fd) == VK_SUCCESS;
+            if (exported)
+                fds.push_back(fd);
+        }
+        for (uint32_t i = 0; i < m_Slots.size() && exported; i++)
+        {
+            VkSemaphoreGetFdInfoKHR sgfi {};
+            sgfi.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+            sgfi.semaphore = m_Slots[i].semaphore;
+            sgfi.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+
+            int fd = -1;
+            exported = vkt.vkGetSemaphoreFdKHR(m_Device, &sgfi, &fd) == VK_SUCCESS;
+            if (exported)
+                fds.push_back(fd);
+        }
+
+        const bool sent = exported && SendWithFds(m_ClientSocket, &handshake, sizeof(handshake), fds.data(), static_cast<uint32_t>(fds.size()));
+
+        // The consumer got its own duplicates, ours are no longer needed
+        for (size_t i = 1; i < fds.size(); i++)
+            close(fds[i]);
+        return sent;
+#else
+        return false;
+#endif
+    }
+
+    void FrameExporter::DisconnectConsumer(Engine& engine)
+    {
+#if defined(__linux__)
+        close(m_ClientSocket);
+#endif
+        m_ClientSocket = -1;
+
+        // Semaphores of slots the consumer didn't give back may stay signalled, replace them once their submits are done
+        const SubmitSync* lastSubmit = engine.GetSubmitSyncManager().GetLastSubmitSync();
+        for (uint32_t i = 0; i < m_Slots.size(); i++)
+        {
+            Slot& slot = m_Slots[i];
+            if (m_pRing->slots[i].state.load(std::memory_order_acquire) != kSlotFree)
+            {
+                VulkanResource resource {};
+                resource.type = VulkanResourceType::Semaphore;
+                resource.semaphore = slot.semaphore;
+                engine.GetSafeResourceDestroyer().EnqueueResourceForDestruction(resource, lastSubmit ? lastSubmit->submit : 0);
+
+                slot.semaphore = VK_NULL_HANDLE;
+                if (CreateExportSemaphore(&slot.semaphore) != VK_SUCCESS)
+                    g_Log("Failed to replace a frame export semaphore\n");
+            }
+        }
+
+        for (uint32_t i = 0; i < kMaxSlots; i++)
+            m_pRing->slots[i].state.store(kSlotFree, std::memory_order_release);
+        g_Log("Frame export consumer disconnected\n");
+    }
+}
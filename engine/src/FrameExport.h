@@ -0,0 +1,146 @@
+#pragma once
+#include "VulkanFunctionTable.h"
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace imp
+{
+    class Engine;
+
+    // Shared with the consumer process. The exporter listens on a unix socket, a consumer that connects
+    // gets a Handshake followed by the file descriptors: the shared ring, then one memory and one
+    // semaphore per slot. Images and semaphores are imported as VK_*_HANDLE_TYPE_OPAQUE_FD_BIT, so
+    // the consumer has to run on the device and driver given by the UUIDs.
+    namespace FrameExportProtocol
+    {
+        inline constexpr uint32_t kMagic = 0x58504D49; // "IMPX"
+        inline constexpr uint32_t kVersion = 1;
+        inline constexpr uint32_t kMaxSlots = 8;
+        // Layout the images are left in after a frame
+        inline constexpr VkImageLayout kImageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        // Free    - owned by the producer, it may render into the slot
+        // Ready   - its semaphore is or will be signalled once frameNumber is rendered
+        // Reading - taken by the consumer
+        // The consumer has to wait on the semaphore of every Ready slot it takes, even when skipping the
+        // frame, and may only set the slot back to Free once its own GPU work on the image is done.
+        enum SlotState : uint32_t
+        {
+            kSlotFree = 0,
+            kSlotReady,
+            kSlotReading
+        };
+
+        struct Slot
+        {
+            std::atomic<uint32_t> state;
+            uint32_t padding;
+            std::atomic<uint64_t> frameNumber;
+        };
+
+        struct SharedRing
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t slotCount;
+            uint32_t padding;
+            // Incremented after each Ready slot
+            std::atomic<uint64_t> publishedFrames;
+            Slot slots[kMaxSlots];
+        };
+        static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+            "The shared ring needs address free atomics");
+
+        struct Handshake
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t slotCount;
+            uint32_t width;
+            uint32_t height;
+            VkFormat format;
+            VkImageUsageFlags usage;
+            VkImageTiling tiling;
+            uint64_t memorySizes[kMaxSlots];
+            uint8_t deviceUUID[VK_UUID_SIZE];
+            uint8_t driverUUID[VK_UUID_SIZE];
+        };
+    }
+
+    struct FrameExportParams
+    {
+        std::string socketPath;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        VkFormat format = VK_FORMAT_B8G8R8A8_UNORM;
+        uint32_t slotCount = 3;
+    };
+
+    // Output images allocated as exportable memory and shared with another process without copies.
+    // The frame renders straight into an exported slot and its submit signals the slot's exported
+    // semaphore. Frames are only exported while a consumer is connected and has a slot free,
+    // otherwise AcquireSlot fails and the caller renders wherever it normally would.
+    class FrameExporter
+    {
+    public:
+        static constexpr std::array<const char*, 2> kRequiredDeviceExtensions = {
+            VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+            VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME
+        };
+
+        FrameExporter() = default;
+
+        FrameExporter(const FrameExporter&) = delete;
+        FrameExporter& operator=(const FrameExporter&) = delete;
+
+        VkResult Initialize(Engine& engine, const FrameExportParams& params);
+        void Shutdown(VkDevice device);
+
+        // Accepts a waiting consumer and notices when it goes away, call once per frame
+        void Poll(Engine& engine);
+        bool HasConsumer() const { return m_ClientSocket != -1; }
+
+        // ~0u when nobody is connected or the consumer still holds every slot
+        uint32_t AcquireSlot();
+        // Call after the submit that signals GetSemaphore(slot)
+        void Publish(uint32_t slot);
+
+        VkImage GetImage(uint32_t slot) const { return m_Slots[slot].image; }
+        VkImageView GetImageView(uint32_t slot) const { return m_Slots[slot].view; }
+        VkSemaphore GetSemaphore(uint32_t slot) const { return m_Slots[slot].semaphore; }
+        VkImageUsageFlags GetImageUsage() const { return kImageUsage; }
+
+    private:
+        static constexpr VkImageUsageFlags kImageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+            | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+        struct Slot
+        {
+            VkImage image = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            VkDeviceSize memorySize = 0;
+            VkSemaphore semaphore = VK_NULL_HANDLE;
+        };
+
+        VkResult CreateExportSemaphore(VkSemaphore* pSemaphore) const;
+        bool SendHandshake();
+        void DisconnectConsumer(Engine& engine);
+
+        FrameExportParams m_Params {};
+        VkDevice m_Device = VK_NULL_HANDLE;
+        uint8_t m_DeviceUUID[VK_UUID_SIZE] {};
+        uint8_t m_DriverUUID[VK_UUID_SIZE] {};
+
+        std::vector<Slot> m_Slots;
+        uint64_t m_NextFrameNumber = 0;
+
+        int m_ListenSocket = -1;
+        int m_ClientSocket = -1;
+        int m_RingFd = -1;
+        FrameExportProtocol::SharedRing* m_pRing = nullptr;
+    };
+}
@@ -0,0 +1,240 @@
+#include "FrameReadback.h"
+#include "Engine.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace imp
+{
+    static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static uint32_t FindMemoryType(const VkPhysicalDeviceMemoryProperties& props, uint32_t typeBits, VkMemoryPropertyFlags required)
+    {
+        for (uint32_t i = 0; i < props.memoryTypeCount; i++)
+            if ((typeBits & (1u << i)) && (props.memoryTypes[i].propertyFlags & required) == required)
+                return i;
+        return ~0u;
+    }
+
+    VkResult FrameReadbackRing::Initialize(Engine& engine, const FrameReadbackParams& params, FrameReadbackConsumer consumer)
+    {
+        m_Params = params;
+        m_Consumer = std::move(consumer);
+        m_Device = engine.GetWorkQueue().GetDevice();
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(engine.GetPhysicalDevice(), &props);
+        m_AtomSize = props.limits.nonCoherentAtomSize;
+
+        // Slots start on atom boundaries so each one can be invalidated on its own
+        m_FrameSize = VkDeviceSize(params.width) * params.height * params.bytesPerPixel;
+        const VkDeviceSize slotStride = AlignUp(m_FrameSize, std::max<VkDeviceSize>(m_AtomSize, 16));
+
+        VkBufferCreateInfo bci {};
+        bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bci.size = slotStride * params.slotCount;
+        bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VkResult result = vkt.vkCreateBuffer(m_Device, &bci, nullptr, &m_Buffer);
+        if (result != VK_SUCCESS)
+        {
+            g_Log("Failed to create the readback buffer with result %d\n", result);
+            return result;
+        }
+
+        VkMemoryRequirements reqs;
+        vkt.vkGetBufferMemoryRequirements(m_Device, m_Buffer, &reqs);
+
+        // Cached memory makes the consumer's reads fast, coherent memory is the fallback
+        const VkPhysicalDeviceMemoryProperties memoryProps = engine.GetMemoryProperties();
+        uint32_t memoryType = FindMemoryType(memoryProps, reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        if (memoryType == ~0u)
+            memoryType = FindMemoryType(memoryProps, reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        if (memoryType == ~0u)
+        {
+            g_Log("Failed to find host visible memory for the readback buffer\n");
+            return VK_ERROR_FEATURE_NOT_PRESENT;
+        }
+        m_Coherent = (memoryProps.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+        VkMemoryAllocateInfo mai {};
+        mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        mai.allocationSize = reqs.size;
+        mai.memoryTypeIndex = memoryType;
+
+        result = vkt.vkAllocateMemory(m_Device, &mai, nullptr, &m_Memory);
+        if (result != VK_SUCCESS)
+        {
+            g_Log("Failed to allocate readback memory with result %d\n", result);
+            return result;
+        }
+
+        result = vkt.vkBindBufferMemory(m_Device, m_Buffer, m_Memory, 0);
+        if (result != VK_SUCCESS)
+            return result;
+
+        void* pMapped = nullptr;
+        result = vkt.vkMapMemory(m_Device, m_Memory, 0, VK_WHOLE_SIZE, 0, &pMapped);
+        if (result != VK_SUCCESS)
+            return result;
+        m_pMapped = static_cast<uint8_t*>(pMapped);
+
+        static constexpr VkFenceCreateInfo fci { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0 };
+        m_Slots.resize(params.slotCount);
+        for (uint32_t i = 0; i < params.slotCount; i++)
+        {
+            m_Slots[i].offset = slotStride * i;
+            result = vkt.vkCreateFence(m_Device, &fci, nullptr, &m_Slots[i].fence);
+            if (result != VK_SUCCESS)
+                return result;
+            m_FreeSlots.push_back(params.slotCount - 1 - i);
+        }
+
+        m_Stop = false;
+        m_Worker = std::thread(&FrameReadbackRing::WorkerLoop, this);
+
+        g_Log("Frame readback ring: %u slots of %ux%u (%s memory)\n", params.slotCount, params.width, params.height,
+            m_Coherent ? "coherent" : "cached");
+        return VK_SUCCESS;
+    }
+
+    void FrameReadbackRing::Shutdown(VkDevice device)
+    {
+        if (m_Worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Stop = true;
+            }
+            m_WorkAvailable.notify_one();
+            m_Worker.join();
+        }
+
+        for (const auto& slot : m_Slots)
+            vkt.vkDestroyFence(device, slot.fence, nullptr);
+        m_Slots.clear();
+        m_FreeSlots.clear();
+
+        if (m_pMapped)
+            vkt.vkUnmapMemory(device, m_Memory);
+        m_pMapped = nullptr;
+        vkt.vkDestroyBuffer(device, m_Buffer, nullptr);
+        vkt.vkFreeMemory(device, m_Memory, nullptr);
+        m_Buffer = VK_NULL_HANDLE;
+        m_Memory = VK_NULL_HANDLE;
+    }
+
+    void FrameReadbackRing::Record(VkCommandBuffer cb, VkImage image)
+    {
+        uint32_t slotIndex = ~0u;
+        {
+            // Back pressure, the consumer is falling behind
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_SlotAvailable.wait(lock, [this] { return !m_FreeSlots.empty(); });
+            slotIndex = m_FreeSlots.back();
+            m_FreeSlots.pop_back();
+        }
+
+        // The worker is done with the slot, so its fence is no longer waited on
+        Slot& slot = m_Slots[slotIndex];
+        vkt.vkResetFences(m_Device, 1, &slot.fence);
+        slot.frameNumber = m_NextFrameNumber++;
+
+        VkBufferImageCopy region {};
+        region.bufferOffset = slot.offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { m_Params.width, m_Params.height, 1 };
+        vkt.vkCmdCopyImageToBuffer(cb, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_Buffer, 1, &region);
+
+        // Host reads wait on the fence, which only covers completion, so the writes need to be made available
+        VkBufferMemoryBarrier bmb {};
+        bmb.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bmb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bmb.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bmb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bmb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bmb.buffer = m_Buffer;
+        bmb.offset = slot.offset;
+        bmb.size = m_FrameSize;
+        vkt.vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bmb, 0, nullptr);
+
+        m_RecordedSlot = slotIndex;
+    }
+
+    VkResult FrameReadbackRing::Submit(VkQueue queue)
+    {
+        if (m_RecordedSlot == ~0u)
+            return VK_SUCCESS;
+
+        // An empty submit after the frame, its fence signals once all earlier work on the queue is done
+        VkResult result = vkt.vkQueueSubmit(queue, 0, nullptr, m_Slots[m_RecordedSlot].fence);
+        if (result != VK_SUCCESS)
+        {
+            g_Log("Failed to submit the readback fence with result %d\n", result);
+            return result;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_SubmittedSlots.push_back(m_RecordedSlot);
+        }
+        m_WorkAvailable.notify_one();
+        m_RecordedSlot = ~0u;
+        return VK_SUCCESS;
+    }
+
+    void FrameReadbackRing::WorkerLoop()
+    {
+        while (true)
+        {
+            uint32_t slotIndex = ~0u;
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_WorkAvailable.wait(lock, [this] { return m_Stop || !m_SubmittedSlots.empty(); });
+                // Drain everything that was submitted before stopping
+                if (m_SubmittedSlots.empty())
+                    return;
+                slotIndex = m_SubmittedSlots.front();
+                m_SubmittedSlots.pop_front();
+            }
+
+            const Slot& slot = m_Slots[slotIndex];
+            VkResult result = vkt.vkWaitForFences(m_Device, 1, &slot.fence, VK_TRUE, ~0ull);
+            if (result == VK_SUCCESS && !m_Coherent)
+            {
+                VkMappedMemoryRange range {};
+                range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+                range.memory = m_Memory;
+                range.offset = slot.offset;
+                range.size = AlignUp(m_FrameSize, m_AtomSize);
+                result = vkt.vkInvalidateMappedMemoryRanges(m_Device, 1, &range);
+            }
+
+            if (result == VK_SUCCESS)
+            {
+                ReadbackFrame frame {};
+                frame.frameNumber = slot.frameNumber;
+                frame.width = m_Params.width;
+                frame.height = m_Params.height;
+                frame.format = m_Params.format;
+                frame.pData = m_pMapped + slot.offset;
+                frame.size = m_FrameSize;
+                m_Consumer(frame);
+                m_ConsumedFrames++;
+            }
+            else
+                g_Log("Failed to read back frame %llu with result %d\n", static_cast<unsigned long long>(slot.frameNumber), result);
+
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_FreeSlots.push_back(slotIndex);
+            }
+            m_SlotAvailable.notify_one();
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "VulkanFunctionTable.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace imp
+{
+    class Engine;
+
+    struct FrameReadbackParams
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t bytesPerPixel = 4;
+        // Frames that can be in flight or waiting for the consumer at once
+        uint32_t slotCount = 3;
+    };
+
+    struct ReadbackFrame
+    {
+        uint64_t frameNumber;
+        uint32_t width;
+        uint32_t height;
+        VkFormat format;
+        // Tightly packed rows, only valid during the consumer call
+        const void* pData;
+        VkDeviceSize size;
+    };
+
+    typedef std::function<void(const ReadbackFrame&)> FrameReadbackConsumer;
+
+    // Copies rendered frames into host cached buffers and hands them to a consumer on a worker thread.
+    // Each slot gets its own fence, submitted right after the frame, so the worker only waits for the
+    // frame it reads and the render loop never waits on the GPU. The render loop blocks only when
+    // every slot is still waiting for the consumer.
+    class FrameReadbackRing
+    {
+    public:
+        FrameReadbackRing() = default;
+        ~FrameReadbackRing() = default;
+
+        FrameReadbackRing(const FrameReadbackRing&) = delete;
+        FrameReadbackRing& operator=(const FrameReadbackRing&) = delete;
+
+        VkResult Initialize(Engine& engine, const FrameReadbackParams& params, FrameReadbackConsumer consumer);
+        // Consumes every submitted frame before returning
+        void Shutdown(VkDevice device);
+
+        // Records the copy of the image, which has to be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+        void Record(VkCommandBuffer cb, VkImage image);
+        // Call after the command buffer with the copy was submitted
+        VkResult Submit(VkQueue queue);
+
+        uint64_t GetConsumedFrameCount() const { return m_ConsumedFrames; }
+
+    private:
+        struct Slot
+        {
+            VkFence fence = VK_NULL_HANDLE;
+            VkDeviceSize offset = 0;
+            uint64_t frameNumber = 0;
+        };
+
+        void WorkerLoop();
+
+        FrameReadbackParams m_Params {};
+        FrameReadbackConsumer m_Consumer;
+        VkDevice m_Device = VK_NULL_HANDLE;
+
+        VkBuffer m_Buffer = VK_NULL_HANDLE;
+        VkDeviceMemory m_Memory = VK_NULL_HANDLE;
+        uint8_t* m_pMapped = nullptr;
+        bool m_Coherent = false;
+        VkDeviceSize m_FrameSize = 0;
+        VkDeviceSize m_AtomSize = 1;
+
+        std::vector<Slot> m_Slots;
+        uint32_t m_RecordedSlot = ~0u;
+        uint64_t m_NextFrameNumber = 0;
+
+        std::mutex m_Mutex;
+        std::condition_variable m_WorkAvailable;
+        std::condition_variable m_SlotAvailable;
+        std::vector<uint32_t> m_FreeSlots;
+        std::deque<uint32_t> m_SubmittedSlots;
+        std::atomic<uint64_t> m_ConsumedFrames = 0;
+        bool m_Stop = false;
+        std::thread m_Worker;
+    };
+}
@@ -0,0 +1,360 @@
+#include "GeometryPool.h"
+#include "Engine.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace imp
+{
+    void RangeAllocator::Reset(VkDeviceSize capacity)
+    {
+        m_FreeByOffset.clear();
+        m_FreeBySize.clear();
+        m_Capacity = capacity;
+        m_Allocated = 0;
+        if (capacity)
+            InsertFree(0, capacity);
+    }
+
+    void RangeAllocator::Grow(VkDeviceSize capacity)
+    {
+        if (capacity <= m_Capacity)
+            return;
+        const VkDeviceSize oldCapacity = m_Capacity;
+        m_Capacity = capacity;
+        // Temporarily counted as allocated so Free merges it with a free range at the old end
+        m_Allocated += capacity - oldCapacity;
+        Free(oldCapacity, capacity - oldCapacity);
+    }
+
+    bool RangeAllocator::Allocate(VkDeviceSize size, VkDeviceSize& offset)
+    {
+        if (size == 0)
+        {
+            offset = 0;
+            return true;
+        }
+
+        // Smallest free range that fits, the rest of it stays free
+        const auto bestFit = m_FreeBySize.lower_bound(size);
+        if (bestFit == m_FreeBySize.end())
+            return false;
+
+        offset = bestFit->second;
+        const VkDeviceSize blockSize = bestFit->first;
+        EraseFree(m_FreeByOffset.find(offset));
+        if (blockSize > size)
+            InsertFree(offset + size, blockSize - size);
+        m_Allocated += size;
+        return true;
+    }
+
+    void RangeAllocator::Free(VkDeviceSize offset, VkDeviceSize size)
+    {
+        if (size == 0)
+            return;
+        m_Allocated -= size;
+
+        // Merge with the free neighbours on both sides
+        auto next = m_FreeByOffset.lower_bound(offset);
+        if (next != m_FreeByOffset.begin())
+        {
+            const auto previous = std::prev(next);
+            if (previous->first + previous->second == offset)
+            {
+                offset = previous->first;
+                size += previous->second;
+                EraseFree(previous);
+            }
+        }
+        if (next != m_FreeByOffset.end() && offset + size == next->first)
+        {
+            size += next->second;
+            EraseFree(next);
+        }
+        InsertFree(offset, size);
+    }
+
+    void RangeAllocator::InsertFree(VkDeviceSize offset, VkDeviceSize size)
+    {
+        m_FreeByOffset.emplace(offset, size);
+        m_FreeBySize.emplace(size, offset);
+    }
+
+    void RangeAllocator::EraseFree(std::map<VkDeviceSize, VkDeviceSize>::iterator block)
+    {
+        auto [first, last] = m_FreeBySize.equal_range(block->second);
+        for (; first != last; ++first)
+        {
+            if (first->second == block->first)
+            {
+                m_FreeBySize.erase(first);
+                break;
+            }
+        }
+        m_FreeByOffset.erase(block);
+    }
+
+    static uint32_t FindMemoryType(const VkPhysicalDeviceMemoryProperties& props, uint32_t typeBits, VkMemoryPropertyFlags required)
+    {
+        for (uint32_t i = 0; i < props.memoryTypeCount; i++)
+            if ((typeBits & (1u << i)) && (props.memoryTypes[i].propertyFlags & required) == required)
+                return i;
+        return ~0u;
+    }
+
+    static uint64_t GetRetirePoint(Engine& engine)
+    {
+        const SubmitSync* lastSubmit = engine.GetSubmitSyncManager().GetLastSubmitSync();
+        return lastSubmit ? lastSubmit->submit : engine.GetSubmitSyncManager().GetLastSyncedPoint();
+    }
+
+    static void DestroyPoolBuffer(VkDevice device, GeometryPool::PoolBuffer& buffer)
+    {
+        vkt.vkDestroyBuffer(device, buffer.buffer, nullptr);
+        vkt.vkFreeMemory(device, buffer.memory, nullptr);
+        buffer = {};
+    }
+
+    static void InsertMemoryBarrier(VkCommandBuffer cb, VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess,
+        VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess)
+    {
+        VkMemoryBarrier2 barrier {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+        barrier.srcStageMask = srcStages;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstStageMask = dstStages;
+        barrier.dstAccessMask = dstAccess;
+
+        VkDependencyInfoKHR dependencyInfo {};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+        dependencyInfo.memoryBarrierCount = 1;
+        dependencyInfo.pMemoryBarriers = &barrier;
+        vkt.vkCmdPipelineBarrier2KHR(cb, &dependencyInfo);
+    }
+
+    static VkDeviceSize AlignIndexSize(VkDeviceSize size)
+    {
+        return (size + kGeometryIndexAlignment - 1) & ~(kGeometryIndexAlignment - 1);
+    }
+
+    VkResult GeometryPool::Initialize(Engine& engine, const GeometryPoolParams& params)
+    {
+        m_Params = params;
+        m_Params.vertexStreamCount = std::min(params.vertexStreamCount, kMaxGeometryVertexStreams);
+        m_Params.initialIndexCapacity = AlignIndexSize(params.initialIndexCapacity);
+        m_Ranges = std::make_shared<Ranges>();
+        m_Ranges->vertices.Reset(m_Params.initialVertexCapacity);
+        m_Ranges->indices.Reset(m_Params.initialIndexCapacity);
+
+        for (uint32_t stream = 0; stream < m_Params.vertexStreamCount; stream++)
+        {
+            VkResult result = CreatePoolBuffer(engine, m_Params.initialVertexCapacity * m_Params.vertexStrides[stream],
+                m_Params.vertexUsages[stream], m_VertexBuffers[stream]);
+            if (result != VK_SUCCESS)
+                return result;
+        }
+        return CreatePoolBuffer(engine, m_Params.initialIndexCapacity, m_Params.indexUsage, m_IndexBuffer);
+    }
+
+    void GeometryPool::Shutdown(VkDevice device)
+    {
+        for (PoolBuffer& buffer : m_VertexBuffers)
+            DestroyPoolBuffer(device, buffer);
+        DestroyPoolBuffer(device, m_IndexBuffer);
+        m_Ranges.reset();
+    }
+
+    VkResult GeometryPool::CreatePoolBuffer(Engine& engine, VkDeviceSize size, VkBufferUsageFlags usage, PoolBuffer& buffer)
+    {
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+
+        VkBufferCreateInfo bci {};
+        bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        // Never empty, so every binding stays valid before anything is allocated
+        bci.size = std::max<VkDeviceSize>(size, 16);
+        // Transfers fill ranges and carry the contents over when the pool grows
+        bci.usage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VkResult result = vkt.vkCreateBuffer(device, &bci, nullptr, &buffer.buffer);
+        if (result != VK_SUCCESS)
+        {
+            g_Log("Failed to create a geometry pool buffer with result %d\n", result);
+            return result;
+        }
+
+        VkMemoryRequirements reqs;
+        vkt.vkGetBufferMemoryRequirements(device, buffer.buffer, &reqs);
+
+        VkMemoryAllocateInfo mai {};
+        mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        mai.allocationSize = reqs.size;
+        mai.memoryTypeIndex = FindMemoryType(engine.GetMemoryProperties(), reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (mai.memoryTypeIndex == ~0u)
+        {
+            g_Log("Failed to find device local memory for the geometry pool\n");
+            return VK_ERROR_FEATURE_NOT_PRESENT;
+        }
+
+        result = vkt.vkAllocateMemory(device, &mai, nullptr, &buffer.memory);
+        if (result != VK_SUCCESS)
+        {
+            g_Log("Failed to allocate geometry pool memory with result %d\n", result);
+            return result;
+        }
+
+        return vkt.vkBindBufferMemory(device, buffer.buffer, buffer.memory, 0);
+    }
+
+    VkResult GeometryPool::Grow(Engine& engine, VkDeviceSize vertexCapacity, VkDeviceSize indexCapacity)
+    {
+        const VkDeviceSize oldVertexCapacity = m_Ranges->vertices.GetCapacity();
+        const VkDeviceSize oldIndexCapacity = m_Ranges->indices.GetCapacity();
+
+        PoolBuffer vertexBuffers[kMaxGeometryVertexStreams] {};
+        PoolBuffer indexBuffer = m_IndexBuffer;
+        std::copy(std::begin(m_VertexBuffers), std::end(m_VertexBuffers), vertexBuffers);
+
+        // Out of memory leaves the pool as it was
+        const auto destroyNewBuffers = [&]()
+        {
+            VkDevice device = engine.GetWorkQueue().GetDevice();
+            for (uint32_t stream = 0; stream < kMaxGeometryVertexStreams; stream++)
+                if (vertexBuffers[stream].buffer != m_VertexBuffers[stream].buffer)
+                    DestroyPoolBuffer(device, vertexBuffers[stream]);
+            if (indexBuffer.buffer != m_IndexBuffer.buffer)
+                DestroyPoolBuffer(device, indexBuffer);
+        };
+
+        VkResult result = VK_SUCCESS;
+        for (uint32_t stream = 0; stream < m_Params.vertexStreamCount && vertexCapacity > oldVertexCapacity && result == VK_SUCCESS; stream++)
+        {
+            vertexBuffers[stream] = {};
+            result = CreatePoolBuffer(engine, vertexCapacity * m_Params.vertexStrides[stream], m_Params.vertexUsages[stream], vertexBuffers[stream]);
+        }
+        if (indexCapacity > oldIndexCapacity && result == VK_SUCCESS)
+        {
+            indexBuffer = {};
+            result = CreatePoolBuffer(engine, indexCapacity, m_Params.indexUsage, indexBuffer);
+        }
+        if (result != VK_SUCCESS)
+        {
+            destroyNewBuffers();
+            return result;
+        }
+
+        VkCommandBuffer cb = engine.AcquireCommandBuffer(CommandBufferType::Graphics);
+
+        // Uploads into the old buffers have to land before they are copied
+        InsertMemoryBarrier(cb, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+
+        VkBufferCopy region {};
+        for (uint32_t stream = 0; stream < m_Params.vertexStreamCount && vertexCapacity > oldVertexCapacity; stream++)
+        {
+            region.size = oldVertexCapacity * m_Params.vertexStrides[stream];
+            if (region.size)
+                vkt.vkCmdCopyBuffer(cb, m_VertexBuffers[stream].buffer, vertexBuffers[stream].buffer, 1, &region);
+        }
+        if (indexCapacity > oldIndexCapacity && oldIndexCapacity)
+        {
+            region.size = oldIndexCapacity;
+            vkt.vkCmdCopyBuffer(cb, m_IndexBuffer.buffer, indexBuffer.buffer, 1, &region);
+        }
+
+        // Everything submitted later sees the copied contents, later uploads are ordered after the copy
+        InsertMemoryBarrier(cb, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+
+        vkt.vkEndCommandBuffer(cb);
+        SubmitParams submitParams {};
+        submitParams.commandBufferCount = 1;
+        submitParams.pCommandBuffers = &cb;
+        submitParams.queue = engine.GetWorkQueue().GetGraphicsQueue();
+        const SubmitSync sync = engine.Submit(&submitParams, 1);
+
+        // Frames in flight and the copy still read the old buffers
+        SafeResourceDestroyer& destroyer = engine.GetSafeResourceDestroyer();
+        const auto retire = [&](PoolBuffer& oldBuffer, const PoolBuffer& newBuffer)
+        {
+            if (oldBuffer.buffer == newBuffer.buffer)
+                return;
+            VulkanResource res {};
+            res.type = VulkanResourceType::Buffer;
+            res.buffer = oldBuffer.buffer;
+            res.memory = oldBuffer.memory;
+            destroyer.EnqueueResourceForDestruction(res, sync.submit);
+            oldBuffer = newBuffer;
+        };
+        for (uint32_t stream = 0; stream < m_Params.vertexStreamCount; stream++)
+            retire(m_VertexBuffers[stream], vertexBuffers[stream]);
+        retire(m_IndexBuffer, indexBuffer);
+
+        m_Ranges->vertices.Grow(vertexCapacity);
+        m_Ranges->indices.Grow(indexCapacity);
+        m_Generation++;
+
+        g_Log("Geometry pool grew to %llu vertices and %llu index bytes\n",
+            static_cast<unsigned long long>(m_Ranges->vertices.GetCapacity()), static_cast<unsigned long long>(m_Ranges->indices.GetCapacity()));
+        return VK_SUCCESS;
+    }
+
+    VkResult GeometryPool::AllocateVertices(Engine& engine, uint32_t count, uint32_t& firstVertex)
+    {
+        VkDeviceSize offset = 0;
+        if (!m_Ranges->vertices.Allocate(count, offset))
+        {
+            const VkDeviceSize capacity = m_Ranges->vertices.GetCapacity();
+            VkResult result = Grow(engine, std::max(capacity * 2, capacity + count), m_Ranges->indices.GetCapacity());
+            if (result != VK_SUCCESS)
+                return result;
+            m_Ranges->vertices.Allocate(count, offset);
+        }
+        firstVertex = static_cast<uint32_t>(offset);
+        return VK_SUCCESS;
+    }
+
+    VkResult GeometryPool::AllocateIndices(Engine& engine, VkDeviceSize size, VkDeviceSize& offset)
+    {
+        size = AlignIndexSize(size);
+        if (!m_Ranges->indices.Allocate(size, offset))
+        {
+            const VkDeviceSize capacity = m_Ranges->indices.GetCapacity();
+            VkResult result = Grow(engine, m_Ranges->vertices.GetCapacity(), std::max(capacity * 2, capacity + size));
+            if (result != VK_SUCCESS)
+                return result;
+            m_Ranges->indices.Allocate(size, offset);
+        }
+        return VK_SUCCESS;
+    }
+
+    void GeometryPool::FreeVertices(Engine& engine, uint32_t firstVertex, uint32_t count)
+    {
+        std::shared_ptr<Ranges> ranges = m_Ranges;
+        engine.GetSafeResourceDestroyer().EnqueueRelease([ranges, firstVertex, count]() { ranges->vertices.Free(firstVertex, count); }, GetRetirePoint(engine));
+    }
+
+    void GeometryPool::FreeIndices(Engine& engine, VkDeviceSize offset, VkDeviceSize size)
+    {
+        std::shared_ptr<Ranges> ranges = m_Ranges;
+        size = AlignIndexSize(size);
+        engine.GetSafeResourceDestroyer().EnqueueRelease([ranges, offset, size]() { ranges->indices.Free(offset, size); }, GetRetirePoint(engine));
+    }
+
+    VkDeviceSize GeometryPool::GetMemoryUsage(bool allocatedOnly) const
+    {
+        if (!m_Ranges)
+            return 0;
+
+        VkDeviceSize vertexStride = 0;
+        for (uint32_t stream = 0; stream < m_Params.vertexStreamCount; stream++)
+            vertexStride += m_Params.vertexStrides[stream];
+
+        const RangeAllocator& vertices = m_Ranges->vertices;
+        const RangeAllocator& indices = m_Ranges->indices;
+        return allocatedOnly
+            ? vertices.GetAllocatedSize() * vertexStride + indices.GetAllocatedSize()
+            : vertices.GetCapacity() * vertexStride + indices.GetCapacity();
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "VulkanFunctionTable.h"
+
+#include <map>
+#include <memory>
+
+namespace imp
+{
+    class Engine;
+
+    // Best fit free list over [0, capacity) in abstract units, adjacent free ranges are merged on free
+    class RangeAllocator
+    {
+    public:
+        void Reset(VkDeviceSize capacity);
+        // Extends the capacity, the new space is free
+        void Grow(VkDeviceSize capacity);
+
+        bool Allocate(VkDeviceSize size, VkDeviceSize& offset);
+        void Free(VkDeviceSize offset, VkDeviceSize size);
+
+        VkDeviceSize GetCapacity() const { return m_Capacity; }
+        VkDeviceSize GetAllocatedSize() const { return m_Allocated; }
+
+    private:
+        void InsertFree(VkDeviceSize offset, VkDeviceSize size);
+        void EraseFree(std::map<VkDeviceSize, VkDeviceSize>::iterator block);
+
+        // Free ranges by offset and by size, for merging and for the best fit search
+        std::map<VkDeviceSize, VkDeviceSize> m_FreeByOffset;
+        std::multimap<VkDeviceSize, VkDeviceSize> m_FreeBySize;
+        VkDeviceSize m_Capacity = 0;
+        VkDeviceSize m_Allocated = 0;
+    };
+
+    inline constexpr uint32_t kMaxGeometryVertexStreams = 4;
+    // Index ranges start on this boundary so 16 and 32-bit indices can share the buffer
+    inline constexpr VkDeviceSize kGeometryIndexAlignment = 4;
+
+    struct GeometryPoolParams
+    {
+        // Vertex streams share one range allocator, vertex i of every stream belongs to the same vertex
+        uint32_t vertexStreamCount = 1;
+        VkDeviceSize vertexStrides[kMaxGeometryVertexStreams] = {};
+        VkBufferUsageFlags vertexUsages[kMaxGeometryVertexStreams] = {};
+        VkBufferUsageFlags indexUsage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+        // Buffers at least double when they run out
+        VkDeviceSize initialVertexCapacity = 1ull << 20;
+        VkDeviceSize initialIndexCapacity = 16ull << 20;
+    };
+
+    // Device local vertex and index buffers shared by all geometry, suballocated in ranges. Adding or removing
+    // geometry only touches its own range. A pool that runs out is replaced by a bigger copy, offsets stay valid
+    // but the buffer handles change, GetGeneration() tells when bindings have to be refreshed. Freed ranges and
+    // replaced buffers are retired through the SafeResourceDestroyer once the GPU is done with them.
+    class GeometryPool
+    {
+    public:
+        GeometryPool() = default;
+
+        GeometryPool(const GeometryPool&) = delete;
+        GeometryPool& operator=(const GeometryPool&) = delete;
+
+        VkResult Initialize(Engine& engine, const GeometryPoolParams& params);
+        // The device has to be idle
+        void Shutdown(VkDevice device);
+
+        // firstVertex is the same in every vertex stream
+        VkResult AllocateVertices(Engine& engine, uint32_t count, uint32_t& firstVertex);
+        // offset is in bytes, size is rounded up to kGeometryIndexAlignment
+        VkResult AllocateIndices(Engine& engine, VkDeviceSize size, VkDeviceSize& offset);
+        // The range is reused once everything submitted so far is done
+        void FreeVertices(Engine& engine, uint32_t firstVertex, uint32_t count);
+        void FreeIndices(Engine& engine, VkDeviceSize offset, VkDeviceSize size);
+
+        bool IsInitialized() const { return m_Ranges != nullptr; }
+        VkBuffer GetVertexBuffer(uint32_t stream) const { return m_VertexBuffers[stream].buffer; }
+        VkBuffer GetIndexBuffer() const { return m_IndexBuffer.buffer; }
+        uint64_t GetGeneration() const { return m_Generation; }
+        // Bytes allocated in all buffers, capacity included with allocatedOnly false
+        VkDeviceSize GetMemoryUsage(bool allocatedOnly) const;
+
+        struct PoolBuffer
+        {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+        };
+
+    private:
+        // Shared with the retire callbacks so ranges freed late still land somewhere valid
+        struct Ranges
+        {
+            RangeAllocator vertices;
+            RangeAllocator indices;
+        };
+
+        VkResult CreatePoolBuffer(Engine& engine, VkDeviceSize size, VkBufferUsageFlags usage, PoolBuffer& buffer);
+        // Copies the buffers into new ones of the given capacities and retires the old ones
+        VkResult Grow(Engine& engine, VkDeviceSize vertexCapacity, VkDeviceSize indexCapacity);
+
+        GeometryPoolParams m_Params {};
+        PoolBuffer m_VertexBuffers[kMaxGeometryVertexStreams] {};
+        PoolBuffer m_IndexBuffer {};
+        std::shared_ptr<Ranges> m_Ranges;
+        uint64_t m_Generation = 0;
+    };
+}
@@ -1,6 +1,9 @@
 #include "Layers.h"
+#include "Log.h"
 
 #include <unordered_set>
+#include <algorithm>
+#include <cstring>
 
 VkResult imp::GetInstanceLayers(std::vector<std::string>& layers)
 {
@@ -102,24 +105,17 @@ VkResult imp::CheckAllRequiredExtensionsSupported(VkPhysicalDevice device, const
     props.resize(extensionPropertyCount);
     result = vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionPropertyCount, props.data());
 
-    std::vector<const char*> allRequiredExtensions = requiredExtensions;
-    allRequiredExtensions.insert(allRequiredExtensions.end(), g_RequiredDeviceExtensions.begin(), g_RequiredDeviceExtensions.end());
-
-    int count = 0;
-    for (const auto& prop : props)
+    // Swapchain support is requested by the window, headless windows don't need it
+    for (const char* required : requiredExtensions)
     {
-        for (size_t i = 0; i < g_RequiredDeviceExtensions.size(); i++)
+        const auto found = std::find_if(props.begin(), props.end(),
+            [&](const VkExtensionProperties& prop) { return strcmp(prop.extensionName, required) == 0; });
+        if (found == props.end())
         {
-            if (strcmp(prop.extensionName, g_RequiredDeviceExtensions[i]) == 0)
-            {
-                count++;
-                break;
-            }
+            g_Log("Device extension %s is not supported.\n", required);
+            return VK_ERROR_EXTENSION_NOT_PRESENT;
         }
     }
 
-    if (count == g_RequiredDeviceExtensions.size())
-        return VK_SUCCESS;
-
-    return VK_ERROR_INITIALIZATION_FAILED;
+    return VK_SUCCESS;
 }
@@ -1,6 +1,7 @@
 #include "Platform/PlatformImpl.h"
 #include "Platform/Android/AndroidPlatform.h"
 #include "Platform/Android/WindowAndroid.h"
+#include "Platform/WindowHeadless.h"
 #include "Log.h"
 
 #include <cassert>
@@ -10,15 +11,13 @@ namespace imp
     bool PlatformImpl::Initialize(const PlatformInitParams& params)
     {
         g_Log = LogInfo;
-        m_Window = new WindowAndroid();
-        if (params.pWindowInitParams)
-            m_Window->Initialize(*params.pWindowInitParams);
+        const WindowInitParams defaultParams {};
+        const WindowInitParams& windowParams = params.pWindowInitParams ? *params.pWindowInitParams : defaultParams;
+        if (windowParams.type == WindowType::kHeadlessWindow)
+            m_Window = new WindowHeadless();
         else
-        {
-            const WindowInitParams defaultParams {};
-            m_Window->Initialize(defaultParams);
-        }
-        return true;
+            m_Window = new WindowAndroid();
+        return m_Window->Initialize(windowParams);
     }
 
     bool PlatformImpl::Shutdown(VkInstance instance, VkDevice device)
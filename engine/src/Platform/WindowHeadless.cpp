@@ -0,0 +1,58 @@
+#include "Platform/WindowHeadless.h"
+#include "Log.h"
+
+namespace imp
+{
+    bool WindowHeadless::Initialize(const WindowInitParams& params)
+    {
+        m_Width = params.width;
+        m_Height = params.height;
+        m_FrameLimit = params.headlessFrameCount;
+        return true;
+    }
+
+    VkResult WindowHeadless::InitializeSwapchain(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device)
+    {
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+        SwapchainInitParams params {};
+        params.format = kImageFormat;
+        params.imageExtent = { m_Width, m_Height };
+        params.imageCount = kImageCount;
+        // Transfer src so frames can be read back, dst so upscaled frames can be blitted in
+        params.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+        return m_Swapchain.InitializeOffscreen(device, memoryProperties, params);
+    }
+
+    void WindowHeadless::UpdateInfo(double frameTimeMs)
+    {
+        // There is no title to write to, report the average every so often instead
+        m_FrameCount++;
+        m_ReportTimeMs += frameTimeMs;
+        if (m_FrameCount % kReportInterval == 0)
+        {
+            const double averageMs = m_ReportTimeMs / kReportInterval;
+            g_Log("Headless frame %u - %.2f ms (%.0f FPS)\n", m_FrameCount, averageMs, 1000.0 / averageMs);
+            m_ReportTimeMs = 0.0;
+        }
+    }
+
+    bool WindowHeadless::ShouldClose() const
+    {
+        return m_FrameLimit != 0 && m_FrameCount >= m_FrameLimit;
+    }
+
+    const char* const* WindowHeadless::GetRequiredInstanceExtensions(uint32_t* count) const
+    {
+        *count = 0;
+        return nullptr;
+    }
+
+    const char* const* WindowHeadless::GetRequiredDeviceExtensions(uint32_t* count) const
+    {
+        *count = 0;
+        return nullptr;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Window.h"
+
+namespace imp
+{
+    // Window without a surface, frames are rendered into an engine owned image ring
+    // instead of a swapchain. Needs no instance or device extensions, so it also runs on
+    // CPU implementations and on machines without a display.
+    class WindowHeadless : public Window
+    {
+    public:
+        WindowHeadless() = default;
+        ~WindowHeadless() = default;
+
+        virtual bool Initialize(const WindowInitParams& params) override;
+
+        virtual VkResult InitializeSwapchain(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device) override;
+        virtual VkResult CreateWindowSurface(VkInstance instance) override { return VK_SUCCESS; }
+
+        virtual void UpdateInfo(double frameTimeMs) override;
+
+        virtual void MoveCamera(glm::mat4& transform, float delta) override {}
+
+        virtual bool ShouldClose() const override;
+
+        virtual uint32_t GetWidth() const override { return m_Width; }
+        virtual uint32_t GetHeight() const override { return m_Height; }
+
+        virtual const char* const* GetRequiredInstanceExtensions(uint32_t* count) const override;
+        virtual const char* const* GetRequiredDeviceExtensions(uint32_t* count) const override;
+
+        virtual VkSurfaceKHR GetWindowSurface() const override { return VK_NULL_HANDLE; }
+
+    private:
+        static constexpr uint32_t kImageCount = 2;
+        static constexpr VkFormat kImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+        static constexpr uint32_t kReportInterval = 100;
+
+        uint32_t m_Width = 0;
+        uint32_t m_Height = 0;
+        uint32_t m_FrameLimit = 0;
+        uint32_t m_FrameCount = 0;
+        double m_ReportTimeMs = 0.0;
+    };
+}
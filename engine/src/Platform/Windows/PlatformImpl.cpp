@@ -1,20 +1,19 @@
 #include "Platform/PlatformImpl.h"
 #include "Platform/Windows/WindowGLFW.h"
+#include "Platform/WindowHeadless.h"
 #include "Log.h"
 
 namespace imp
 {
     bool PlatformImpl::Initialize(const PlatformInitParams& params)
     {
-        m_Window = new WindowGLFW();
-        if (params.pWindowInitParams)
-            m_Window->Initialize(*params.pWindowInitParams);
+        const WindowInitParams defaultParams {};
+        const WindowInitParams& windowParams = params.pWindowInitParams ? *params.pWindowInitParams : defaultParams;
+        if (windowParams.type == WindowType::kHeadlessWindow)
+            m_Window = new WindowHeadless();
         else
-        {
-            const WindowInitParams defaultParams {};
-            m_Window->Initialize(defaultParams);
-        }
-        return true;
+            m_Window = new WindowGLFW();
+        return m_Window->Initialize(windowParams);
     }
 
     bool PlatformImpl::Shutdown(VkInstance instance, VkDevice device)
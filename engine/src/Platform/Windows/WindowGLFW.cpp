@@ -17,8 +17,17 @@ namespace imp
             return false;
 
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
         m_Window = glfwCreateWindow(params.width, params.height, "Imperial Engine 3", NULL, NULL);
+        if (!m_Window)
+            return false;
+
+        // The swapchain is recreated on the next acquire
+        glfwSetWindowUserPointer(m_Window, this);
+        glfwSetFramebufferSizeCallback(m_Window, [](GLFWwindow* window, int width, int height)
+        {
+            static_cast<WindowGLFW*>(glfwGetWindowUserPointer(window))->NotifyResized();
+        });
 
         return true;
     }
@@ -41,6 +50,11 @@ namespace imp
         glfwSetWindowTitle(m_Window, titleBuffer);
     }
     
+    void WindowGLFW::WaitEvents()
+    {
+        glfwWaitEvents();
+    }
+
     void WindowGLFW::MoveCamera(glm::mat4& transform, float delta)
     {
         static constexpr float translationSpeed = 10.0f;
@@ -144,17 +158,18 @@ namespace imp
         return glfwWindowShouldClose(m_Window);
     }
 
+    // Framebuffer size, in pixels like the swapchain and unlike the window size on high DPI displays
     uint32_t WindowGLFW::GetWidth() const
     {
         int width = 0;
-        glfwGetWindowSize(m_Window, &width, nullptr);
+        glfwGetFramebufferSize(m_Window, &width, nullptr);
         return static_cast<uint32_t>(width);
     }
 
     uint32_t WindowGLFW::GetHeight() const
     {
         int height = 0;
-        glfwGetWindowSize(m_Window, nullptr, &height);
+        glfwGetFramebufferSize(m_Window, nullptr, &height);
         return static_cast<uint32_t>(height);
     }
 
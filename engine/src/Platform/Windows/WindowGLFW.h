@@ -19,6 +19,7 @@ namespace imp
         virtual VkResult CreateWindowSurface(VkInstance instance) override;
         
         virtual void UpdateInfo(double frameTimeMs) override;
+        virtual void WaitEvents() override;
 
         virtual void MoveCamera(glm::mat4& transform, float delta) override;
 
@@ -0,0 +1,822 @@
+#include "RenderGraph.h"
+#include "Engine.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace imp
+{
+    struct UsageInfo
+    {
+        VkPipelineStageFlags2 stages;
+        VkAccessFlags2 readAccess;
+        VkAccessFlags2 writeAccess;
+        VkImageLayout readLayout;
+        VkImageLayout writeLayout;
+        VkImageUsageFlags readImageUsage;
+        VkImageUsageFlags writeImageUsage;
+        VkBufferUsageFlags readBufferUsage;
+        VkBufferUsageFlags writeBufferUsage;
+    };
+
+    static constexpr VkPipelineStageFlags2 kAllShaderStages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+
+    static constexpr VkAccessFlags2 kWriteAccessBits = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+        | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+    // Indexed by RenderGraphUsage
+    static constexpr UsageInfo kUsageInfos[] = {
+        // ColorAttachment
+        { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+          VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+          VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, 0, 0 },
+        // DepthStencilAttachment
+        { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+          VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+          VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 0, 0 },
+        // VertexShaderResource
+        { VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+          VK_ACCESS_2_SHADER_READ_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+          VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_USAGE_STORAGE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT },
+        // FragmentShaderResource
+        { VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+          VK_ACCESS_2_SHADER_READ_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+          VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_USAGE_STORAGE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT },
+        // ComputeShaderResource
+        { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+          VK_ACCESS_2_SHADER_READ_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+          VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_USAGE_STORAGE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT },
+        // UniformBuffer
+        { kAllShaderStages,
+          VK_ACCESS_2_UNIFORM_READ_BIT, 0,
+          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED,
+          0, 0, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 0 },
+        // VertexBuffer
+        { VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT,
+          VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT, 0,
+          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED,
+          0, 0, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 0 },
+        // IndexBuffer
+        { VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+          VK_ACCESS_2_INDEX_READ_BIT, 0,
+          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED,
+          0, 0, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 0 },
+        // IndirectBuffer
+        { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+          VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, 0,
+          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED,
+          0, 0, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, 0 },
+        // Transfer
+        { VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+          VK_ACCESS_2_TRANSFER_READ_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_BUFFER_USAGE_TRANSFER_DST_BIT },
+    };
+    static_assert(sizeof(kUsageInfos) / sizeof(kUsageInfos[0]) == static_cast<size_t>(RenderGraphUsage::Count));
+
+    static const UsageInfo& GetUsageInfo(RenderGraphUsage usage)
+    {
+        return kUsageInfos[static_cast<uint32_t>(usage)];
+    }
+
+    static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static bool LifetimesOverlap(uint32_t firstA, uint32_t lastA, uint32_t firstB, uint32_t lastB)
+    {
+        return firstA <= lastB && firstB <= lastA;
+    }
+
+    static bool ImageDescsEqual(const RenderGraphImageDesc& a, const RenderGraphImageDesc& b)
+    {
+        return a.width == b.width && a.height == b.height && a.format == b.format && a.usage == b.usage
+            && a.aspect == b.aspect && a.mipLevels == b.mipLevels && a.arrayLayers == b.arrayLayers;
+    }
+
+    static bool BufferDescsEqual(const RenderGraphBufferDesc& a, const RenderGraphBufferDesc& b)
+    {
+        return a.size == b.size && a.usage == b.usage;
+    }
+
+    static uint32_t FindMemoryType(const VkPhysicalDeviceMemoryProperties& props, uint32_t typeBits, VkMemoryPropertyFlags preferred)
+    {
+        for (uint32_t i = 0; i < props.memoryTypeCount; i++)
+            if ((typeBits & (1u << i)) && (props.memoryTypes[i].propertyFlags & preferred) == preferred)
+                return i;
+        for (uint32_t i = 0; i < props.memoryTypeCount; i++)
+            if (typeBits & (1u << i))
+                return i;
+        return ~0u;
+    }
+
+    void RenderGraphPass::Read(RenderGraphResource resource, RenderGraphUsage usage)
+    {
+        m_Uses.push_back({ resource, usage, false });
+    }
+
+    void RenderGraphPass::Write(RenderGraphResource resource, RenderGraphUsage usage)
+    {
+        m_Uses.push_back({ resource, usage, true });
+    }
+
+    void RenderGraph::Reset()
+    {
+        m_Passes.clear();
+        m_Resources.clear();
+    }
+
+    RenderGraphResource RenderGraph::CreateImage(const char* name, const RenderGraphImageDesc& desc)
+    {
+        Resource resource {};
+        resource.name = name;
+        resource.isImage = true;
+        resource.imageDesc = desc;
+        m_Resources.push_back(resource);
+        return static_cast<RenderGraphResource>(m_Resources.size() - 1);
+    }
+
+    RenderGraphResource RenderGraph::CreateBuffer(const char* name, const RenderGraphBufferDesc& desc)
+    {
+        Resource resource {};
+        resource.name = name;
+        resource.bufferDesc = desc;
+        m_Resources.push_back(resource);
+        return static_cast<RenderGraphResource>(m_Resources.size() - 1);
+    }
+
+    RenderGraphResource RenderGraph::ImportImage(const char* name, VkImage image, VkImageView view, const RenderGraphImageDesc& desc,
+        const RenderGraphResourceState* pInitialState, const RenderGraphResourceState* pFinalState)
+    {
+        Resource resource {};
+        resource.name = name;
+        resource.isImage = true;
+        resource.imported = true;
+        resource.imageDesc = desc;
+        resource.image = image;
+        resource.view = view;
+
+        if (pInitialState)
+        {
+            resource.state.layout = pInitialState->layout;
+            resource.state.writeStages = pInitialState->stages;
+            resource.state.writeAccess = pInitialState->access;
+        }
+        else
+        {
+            auto it = m_ImportedStates.find(reinterpret_cast<uint64_t>(image));
+            if (it != m_ImportedStates.end())
+                resource.state = it->second;
+        }
+
+        if (pFinalState)
+        {
+            resource.hasFinalState = true;
+            resource.finalState = *pFinalState;
+        }
+
+        m_Resources.push_back(resource);
+        return static_cast<RenderGraphResource>(m_Resources.size() - 1);
+    }
+
+    RenderGraphResource RenderGraph::ImportBuffer(const char* name, VkBuffer buffer, VkDeviceSize size,
+        const RenderGraphResourceState* pInitialState, const RenderGraphResourceState* pFinalState)
+    {
+        Resource resource {};
+        resource.name = name;
+        resource.imported = true;
+        resource.bufferDesc.size = size;
+        resource.buffer = buffer;
+
+        if (pInitialState)
+        {
+            resource.state.writeStages = pInitialState->stages;
+            resource.state.writeAccess = pInitialState->access;
+        }
+        else
+        {
+            auto it = m_ImportedStates.find(reinterpret_cast<uint64_t>(buffer));
+            if (it != m_ImportedStates.end())
+                resource.state = it->second;
+        }
+
+        if (pFinalState)
+        {
+            resource.hasFinalState = true;
+            resource.finalState = *pFinalState;
+        }
+
+        m_Resources.push_back(resource);
+        return static_cast<RenderGraphResource>(m_Resources.size() - 1);
+    }
+
+    RenderGraphPass& RenderGraph::AddPass(const char* name)
+    {
+        RenderGraphPass& pass = m_Passes.emplace_back();
+        pass.m_Name = name;
+        return pass;
+    }
+
+    void RenderGraph::CullPasses()
+    {
+        // Every write creates a new version of the resource and reads refer to the version
+        // current at declaration, so overwriting after the last read isn't kept alive by it
+        struct Version
+        {
+            uint32_t writer;
+            uint32_t readerCount;
+        };
+        std::vector<Version> versions;
+        std::vector<uint32_t> currentVersion(m_Resources.size(), ~0u);
+        std::vector<std::vector<uint32_t>> passReads(m_Passes.size());
+
+        for (uint32_t i = 0; i < m_Passes.size(); i++)
+        {
+            RenderGraphPass& pass = m_Passes[i];
+            pass.m_Culled = false;
+            pass.m_RefCount = 0;
+
+            for (const auto& use : pass.m_Uses)
+            {
+                const uint32_t version = currentVersion[use.resource];
+                if (use.write || version == ~0u || std::find(passReads[i].begin(), passReads[i].end(), version) != passReads[i].end())
+                    continue;
+                passReads[i].push_back(version);
+                versions[version].readerCount++;
+            }
+
+            for (const auto& use : pass.m_Uses)
+            {
+                if (!use.write || (currentVersion[use.resource] != ~0u && versions[currentVersion[use.resource]].writer == i))
+                    continue;
+                versions.push_back({ i, 0 });
+                currentVersion[use.resource] = static_cast<uint32_t>(versions.size() - 1);
+                pass.m_RefCount++;
+            }
+        }
+
+        // The last version of an imported resource is the graph's output
+        for (uint32_t i = 0; i < m_Resources.size(); i++)
+            if (m_Resources[i].imported && currentVersion[i] != ~0u)
+                versions[currentVersion[i]].readerCount++;
+
+        std::vector<uint32_t> unreferenced;
+        const auto cullPass = [&](uint32_t passIndex)
+        {
+            m_Passes[passIndex].m_Culled = true;
+            for (uint32_t version : passReads[passIndex])
+                if (--versions[version].readerCount == 0)
+                    unreferenced.push_back(version);
+        };
+
+        for (uint32_t i = 0; i < m_Passes.size(); i++)
+            if (m_Passes[i].m_RefCount == 0 && !m_Passes[i].m_HasSideEffects)
+                cullPass(i);
+
+        for (uint32_t i = 0; i < versions.size(); i++)
+            if (versions[i].readerCount == 0)
+                unreferenced.push_back(i);
+
+        while (!unreferenced.empty())
+        {
+            const uint32_t writerIndex = versions[unreferenced.back()].writer;
+            unreferenced.pop_back();
+
+            RenderGraphPass& writer = m_Passes[writerIndex];
+
+            if (writer.m_Culled || writer.m_HasSideEffects)
+                continue;
+            if (--writer.m_RefCount == 0)
+                cullPass(writerIndex);
+        }
+    }
+
+    void RenderGraph::ComputeLifetimes()
+    {
+        for (uint32_t i = 0; i < m_Passes.size(); i++)
+        {
+            if (m_Passes[i].m_Culled)
+                continue;
+
+            for (const auto& use : m_Passes[i].m_Uses)
+            {
+                Resource& resource = m_Resources[use.resource];
+                resource.firstPass = std::min(resource.firstPass, i);
+                resource.lastPass = std::max(resource.lastPass, i);
+
+                if (resource.imported)
+                    continue;
+
+                const UsageInfo& info = GetUsageInfo(use.usage);
+                if (resource.isImage)
+                    resource.imageDesc.usage |= use.write ? info.writeImageUsage : info.readImageUsage;
+                else
+                    resource.bufferDesc.usage |= use.write ? info.writeBufferUsage : info.readBufferUsage;
+            }
+        }
+    }
+
+    bool RenderGraph::PhysicalResourcesMatch() const
+    {
+        uint32_t physicalIndex = 0;
+        for (const auto& resource : m_Resources)
+        {
+            if (resource.imported || resource.firstPass == ~0u)
+                continue;
+            if (physicalIndex >= m_Physical.size())
+                return false;
+
+            const PhysicalResource& physical = m_Physical[physicalIndex++];
+            if (physical.isImage != resource.isImage || physical.firstPass != resource.firstPass || physical.lastPass != resource.lastPass)
+                return false;
+            if (resource.isImage ? !ImageDescsEqual(physical.imageDesc, resource.imageDesc) : !BufferDescsEqual(physical.bufferDesc, resource.bufferDesc))
+                return false;
+        }
+        return physicalIndex == m_Physical.size();
+    }
+
+    VkResult RenderGraph::CreatePhysicalResources(Engine& engine)
+    {
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+        const VkPhysicalDeviceMemoryProperties memoryProperties = engine.GetMemoryProperties();
+        m_Generation++;
+
+        std::vector<VkMemoryRequirements> requirements;
+        std::vector<uint32_t> memoryTypes;
+        for (const auto& resource : m_Resources)
+        {
+            if (resource.imported || resource.firstPass == ~0u)
+                continue;
+
+            PhysicalResource physical {};
+            physical.isImage = resource.isImage;
+            physical.imageDesc = resource.imageDesc;
+            physical.bufferDesc = resource.bufferDesc;
+            physical.firstPass = resource.firstPass;
+            physical.lastPass = resource.lastPass;
+
+            VkMemoryRequirements memoryRequirements {};
+            if (resource.isImage)
+            {
+                VkImageCreateInfo ici {};
+                ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+                ici.imageType = VK_IMAGE_TYPE_2D;
+                ici.extent = { resource.imageDesc.width, resource.imageDesc.height, 1 };
+                ici.mipLevels = resource.imageDesc.mipLevels;
+                ici.arrayLayers = resource.imageDesc.arrayLayers;
+                ici.format = resource.imageDesc.format;
+                ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+                ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                ici.usage = resource.imageDesc.usage;
+                ici.samples = VK_SAMPLE_COUNT_1_BIT;
+                ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+                VkResult result = vkt.vkCreateImage(device, &ici, nullptr, &physical.image);
+                if (result != VK_SUCCESS)
+                {
+                    g_Log("Failed to create render graph image \"%s\" with result %d\n", resource.name.c_str(), result);
+                    return result;
+                }
+                vkt.vkGetImageMemoryRequirements(device, physical.image, &memoryRequirements);
+            }
+            else
+            {
+                VkBufferCreateInfo bci {};
+                bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+                bci.size = resource.bufferDesc.size;
+                bci.usage = resource.bufferDesc.usage;
+                bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+                VkResult result = vkt.vkCreateBuffer(device, &bci, nullptr, &physical.buffer);
+                if (result != VK_SUCCESS)
+                {
+                    g_Log("Failed to create render graph buffer \"%s\" with result %d\n", resource.name.c_str(), result);
+                    return result;
+                }
+                vkt.vkGetBufferMemoryRequirements(device, physical.buffer, &memoryRequirements);
+            }
+
+            physical.size = memoryRequirements.size;
+            requirements.push_back(memoryRequirements);
+            memoryTypes.push_back(FindMemoryType(memoryProperties, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+            m_Physical.push_back(physical);
+        }
+
+        // Largest first, so every heap is sized by the first resource placed in it.
+        // Images and buffers get separate heaps to stay clear of bufferImageGranularity.
+        std::vector<uint32_t> order(m_Physical.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return m_Physical[a].size > m_Physical[b].size; });
+
+        std::vector<std::vector<uint32_t>> heapMembers;
+        for (uint32_t index : order)
+        {
+            PhysicalResource& physical = m_Physical[index];
+            const VkDeviceSize alignment = requirements[index].alignment;
+
+            for (uint32_t heapIndex = 0; heapIndex < m_Heaps.size() && physical.heap == ~0u; heapIndex++)
+            {
+                const Heap& heap = m_Heaps[heapIndex];
+                if (heap.memoryTypeIndex != memoryTypes[index] || heap.images != physical.isImage)
+                    continue;
+
+                // Candidates are the heap start and the end of every resource alive at the same time
+                std::vector<VkDeviceSize> candidates = { 0 };
+                for (uint32_t member : heapMembers[heapIndex])
+                {
+                    const PhysicalResource& other = m_Physical[member];
+                    if (LifetimesOverlap(physical.firstPass, physical.lastPass, other.firstPass, other.lastPass))
+                        candidates.push_back(AlignUp(other.offset + other.size, alignment));
+                }
+                std::sort(candidates.begin(), candidates.end());
+
+                for (VkDeviceSize offset : candidates)
+                {
+                    if (offset + physical.size > heap.size)
+                        break;
+
+                    bool fits = true;
+                    for (uint32_t member : heapMembers[heapIndex])
+                    {
+                        const PhysicalResource& other = m_Physical[member];
+                        const bool memoryOverlaps = offset < other.offset + other.size && other.offset < offset + physical.size;
+                        if (memoryOverlaps && LifetimesOverlap(physical.firstPass, physical.lastPass, other.firstPass, other.lastPass))
+                        {
+                            fits = false;
+                            break;
+                        }
+                    }
+
+                    if (fits)
+                    {
+                        physical.heap = heapIndex;
+                        physical.offset = offset;
+                        heapMembers[heapIndex].push_back(index);
+                        break;
+                    }
+                }
+            }
+
+            if (physical.heap == ~0u)
+            {
+                Heap heap {};
+                heap.memoryTypeIndex = memoryTypes[index];
+                heap.images = physical.isImage;
+                heap.size = physical.size;
+                m_Heaps.push_back(heap);
+                heapMembers.push_back({ index });
+                physical.heap = static_cast<uint32_t>(m_Heaps.size() - 1);
+                physical.offset = 0;
+            }
+        }
+
+        VkDeviceSize totalSize = 0;
+        VkDeviceSize unaliasedSize = 0;
+        for (auto& heap : m_Heaps)
+        {
+            VkMemoryAllocateInfo mai {};
+            mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            mai.allocationSize = heap.size;
+            mai.memoryTypeIndex = heap.memoryTypeIndex;
+
+            VkResult result = vkt.vkAllocateMemory(device, &mai, nullptr, &heap.memory);
+            if (result != VK_SUCCESS)
+            {
+                g_Log("Failed to allocate render graph memory with result %d\n", result);
+                return result;
+            }
+            totalSize += heap.size;
+        }
+
+        for (auto& physical : m_Physical)
+        {
+            const Heap& heap = m_Heaps[physical.heap];
+            unaliasedSize += physical.size;
+
+            VkResult result = VK_SUCCESS;
+            if (physical.isImage)
+            {
+                result = vkt.vkBindImageMemory(device, physical.image, heap.memory, physical.offset);
+                if (result != VK_SUCCESS)
+                    return result;
+
+                VkImageViewCreateInfo ivci {};
+                ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                ivci.image = physical.image;
+                ivci.viewType = physical.imageDesc.arrayLayers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+                ivci.format = physical.imageDesc.format;
+                ivci.subresourceRange.aspectMask = physical.imageDesc.aspect;
+                ivci.subresourceRange.levelCount = physical.imageDesc.mipLevels;
+                ivci.subresourceRange.layerCount = physical.imageDesc.arrayLayers;
+
+                result = vkt.vkCreateImageView(device, &ivci, nullptr, &physical.view);
+            }
+            else
+            {
+                result = vkt.vkBindBufferMemory(device, physical.buffer, heap.memory, physical.offset);
+            }
+
+            if (result != VK_SUCCESS)
+            {
+                g_Log("Failed to bind render graph resource with result %d\n", result);
+                return result;
+            }
+        }
+
+        g_Log("Render graph placed %u transient resources in %u heaps, %llu bytes instead of %llu\n",
+            static_cast<uint32_t>(m_Physical.size()), static_cast<uint32_t>(m_Heaps.size()),
+            static_cast<unsigned long long>(totalSize), static_cast<unsigned long long>(unaliasedSize));
+        return VK_SUCCESS;
+    }
+
+    void RenderGraph::RetirePhysicalResources(Engine& engine)
+    {
+        SafeResourceDestroyer& destroyer = engine.GetSafeResourceDestroyer();
+        const SubmitSync* lastSubmit = engine.GetSubmitSyncManager().GetLastSubmitSync();
+        const uint64_t point = lastSubmit ? lastSubmit->submit : 0;
+
+        for (const auto& physical : m_Physical)
+        {
+            VulkanResource resource {};
+            if (physical.isImage)
+            {
+                resource.type = VulkanResourceType::ImageView;
+                resource.imageView = physical.view;
+                destroyer.EnqueueResourceForDestruction(resource, point);
+                resource.type = VulkanResourceType::Image;
+                resource.image = physical.image;
+            }
+            else
+            {
+                resource.type = VulkanResourceType::Buffer;
+                resource.buffer = physical.buffer;
+            }
+            destroyer.EnqueueResourceForDestruction(resource, point);
+        }
+
+        for (const auto& heap : m_Heaps)
+        {
+            VulkanResource resource {};
+            resource.type = VulkanResourceType::Memory;
+            resource.memory = heap.memory;
+            destroyer.EnqueueResourceForDestruction(resource, point);
+        }
+
+        m_Physical.clear();
+        m_Heaps.clear();
+    }
+
+    VkResult RenderGraph::Compile(Engine& engine)
+    {
+        CullPasses();
+        ComputeLifetimes();
+
+        if (!PhysicalResourcesMatch())
+        {
+            RetirePhysicalResources(engine);
+            VkResult result = CreatePhysicalResources(engine);
+            if (result != VK_SUCCESS)
+                return result;
+        }
+
+        uint32_t physicalIndex = 0;
+        for (auto& resource : m_Resources)
+        {
+            if (resource.imported || resource.firstPass == ~0u)
+                continue;
+
+            const PhysicalResource& physical = m_Physical[physicalIndex];
+            resource.physical = physicalIndex++;
+            resource.image = physical.image;
+            resource.view = physical.view;
+            resource.buffer = physical.buffer;
+        }
+        return VK_SUCCESS;
+    }
+
+    void RenderGraph::Execute(VkCommandBuffer cb)
+    {
+        std::vector<VkImageMemoryBarrier2> imageBarriers;
+        std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+
+        const auto addBarrier = [&](const Resource& resource, VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess,
+            VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess, VkImageLayout oldLayout, VkImageLayout newLayout)
+        {
+            if (resource.isImage)
+            {
+                VkImageMemoryBarrier2 barrier {};
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+                barrier.srcStageMask = srcStages;
+                barrier.srcAccessMask = srcAccess;
+                barrier.dstStageMask = dstStages;
+                barrier.dstAccessMask = dstAccess;
+                barrier.oldLayout = oldLayout;
+                barrier.newLayout = newLayout;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.image = resource.image;
+                barrier.subresourceRange.aspectMask = resource.imageDesc.aspect;
+                barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+                barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+                imageBarriers.push_back(barrier);
+            }
+            else
+            {
+                VkBufferMemoryBarrier2 barrier {};
+                barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+                barrier.srcStageMask = srcStages;
+                barrier.srcAccessMask = srcAccess;
+                barrier.dstStageMask = dstStages;
+                barrier.dstAccessMask = dstAccess;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.buffer = resource.buffer;
+                barrier.size = VK_WHOLE_SIZE;
+                bufferBarriers.push_back(barrier);
+            }
+        };
+
+        // Only emits a barrier for hazards: layout changes, anything after a write and writes after reads.
+        // Reads that already see the last write are merged into the current state.
+        const auto transition = [&](Resource& resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout, bool write, bool discard)
+        {
+            TrackedState& state = resource.state;
+            const bool layoutChange = resource.isImage && state.layout != layout;
+
+            if (write || layoutChange || discard)
+            {
+                const VkPipelineStageFlags2 srcStages = state.writeStages | state.readStages;
+                if (srcStages || layoutChange || discard)
+                    addBarrier(resource, srcStages, state.writeAccess, stages, access, discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout, layout);
+
+                state.layout = layout;
+                state.writeStages = stages;
+                state.writeAccess = write ? access & kWriteAccessBits : 0;
+                state.readStages = 0;
+                state.visibleStages = write ? 0 : stages;
+                state.visibleAccess = write ? 0 : access;
+                return;
+            }
+
+            if (state.writeStages && ((stages & ~state.visibleStages) || (access & ~state.visibleAccess)))
+            {
+                addBarrier(resource, state.writeStages, state.writeAccess, stages, access, state.layout, state.layout);
+                state.visibleStages |= stages;
+                state.visibleAccess |= access;
+            }
+            state.readStages |= stages;
+        };
+
+        struct MergedUse
+        {
+            RenderGraphResource resource;
+            VkPipelineStageFlags2 stages;
+            VkAccessFlags2 access;
+            VkImageLayout layout;
+            bool write;
+        };
+        std::vector<MergedUse> mergedUses;
+
+        for (uint32_t passIndex = 0; passIndex < m_Passes.size(); passIndex++)
+        {
+            RenderGraphPass& pass = m_Passes[passIndex];
+            if (pass.m_Culled)
+                continue;
+
+            mergedUses.clear();
+            for (const auto& use : pass.m_Uses)
+            {
+                const UsageInfo& info = GetUsageInfo(use.usage);
+                auto it = std::find_if(mergedUses.begin(), mergedUses.end(), [&](const MergedUse& m) { return m.resource == use.resource; });
+                if (it == mergedUses.end())
+                {
+                    mergedUses.push_back({ use.resource, 0, 0, info.readLayout, false });
+                    it = mergedUses.end() - 1;
+                }
+                it->stages |= info.stages;
+                it->access |= use.write ? info.writeAccess : info.readAccess;
+                if (use.write)
+                {
+                    it->layout = info.writeLayout;
+                    it->write = true;
+                }
+            }
+
+            imageBarriers.clear();
+            bufferBarriers.clear();
+            for (const auto& use : mergedUses)
+            {
+                Resource& resource = m_Resources[use.resource];
+                const bool firstUse = !resource.imported && passIndex == resource.firstPass;
+                if (firstUse)
+                {
+                    // Previous contents are undefined, but whoever used the memory before has to finish
+                    const Heap& heap = m_Heaps[m_Physical[resource.physical].heap];
+                    resource.state.writeStages = heap.stages | heap.frameStages;
+                    resource.state.writeAccess = heap.writeAccess | heap.frameWriteAccess;
+                    resource.state.readStages = 0;
+                }
+
+                transition(resource, use.stages, use.access, use.layout, use.write, firstUse);
+
+                if (!resource.imported)
+                {
+                    Heap& heap = m_Heaps[m_Physical[resource.physical].heap];
+                    heap.frameStages |= use.stages;
+                    heap.frameWriteAccess |= use.access & kWriteAccessBits;
+                }
+            }
+
+            if (!imageBarriers.empty() || !bufferBarriers.empty())
+            {
+                VkDependencyInfoKHR dependencyInfo {};
+                dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+                dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+                dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+                dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+                dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+                vkt.vkCmdPipelineBarrier2KHR(cb, &dependencyInfo);
+            }
+
+            if (pass.m_Execute)
+                pass.m_Execute(cb);
+        }
+
+        // Hand imported resources over in their requested state and remember it for the next frame.
+        // Only this frame's imports are kept, a handle that stopped being imported may have been destroyed
+        // and its value reused by an unrelated resource.
+        imageBarriers.clear();
+        bufferBarriers.clear();
+        m_ImportedStates.clear();
+        for (auto& resource : m_Resources)
+        {
+            if (!resource.imported)
+                continue;
+
+            if (resource.hasFinalState)
+            {
+                const RenderGraphResourceState& finalState = resource.finalState;
+                transition(resource, finalState.stages, finalState.access, resource.isImage ? finalState.layout : VK_IMAGE_LAYOUT_UNDEFINED, false, false);
+            }
+
+            const uint64_t handle = resource.isImage ? reinterpret_cast<uint64_t>(resource.image) : reinterpret_cast<uint64_t>(resource.buffer);
+            m_ImportedStates[handle] = resource.state;
+        }
+
+        if (!imageBarriers.empty() || !bufferBarriers.empty())
+        {
+            VkDependencyInfoKHR dependencyInfo {};
+            dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+            dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+            dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+            dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+            dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+            vkt.vkCmdPipelineBarrier2KHR(cb, &dependencyInfo);
+        }
+
+        for (auto& heap : m_Heaps)
+        {
+            heap.stages = heap.frameStages;
+            heap.writeAccess = heap.frameWriteAccess;
+            heap.frameStages = 0;
+            heap.frameWriteAccess = 0;
+        }
+    }
+
+    void RenderGraph::ForgetImport(uint64_t handle)
+    {
+        m_ImportedStates.erase(handle);
+    }
+
+    void RenderGraph::Destroy(VkDevice device)
+    {
+        for (const auto& physical : m_Physical)
+        {
+            if (physical.isImage)
+            {
+                vkt.vkDestroyImageView(device, physical.view, nullptr);
+                vkt.vkDestroyImage(device, physical.image, nullptr);
+            }
+            else
+            {
+                vkt.vkDestroyBuffer(device, physical.buffer, nullptr);
+            }
+        }
+
+        for (const auto& heap : m_Heaps)
+            vkt.vkFreeMemory(device, heap.memory, nullptr);
+
+        m_Physical.clear();
+        m_Heaps.clear();
+        m_ImportedStates.clear();
+        Reset();
+    }
+}
@@ -0,0 +1,212 @@
+#pragma once
+#include "VulkanFunctionTable.h"
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace imp
+{
+    class Engine;
+    class RenderGraph;
+
+    typedef uint32_t RenderGraphResource;
+    inline constexpr RenderGraphResource kInvalidRenderGraphResource = ~0u;
+
+    // How a pass touches a resource. Together with whether it is a read or a write
+    // this decides the pipeline stage, access mask and image layout.
+    enum class RenderGraphUsage : uint32_t
+    {
+        ColorAttachment,
+        DepthStencilAttachment,
+        VertexShaderResource,
+        FragmentShaderResource,
+        ComputeShaderResource,
+        UniformBuffer,
+        VertexBuffer,
+        IndexBuffer,
+        IndirectBuffer,
+        Transfer,
+        Count
+    };
+
+    struct RenderGraphImageDesc
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        // Usage flags implied by the declared usages are added automatically
+        VkImageUsageFlags usage = 0;
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        uint32_t mipLevels = 1;
+        uint32_t arrayLayers = 1;
+    };
+
+    struct RenderGraphBufferDesc
+    {
+        VkDeviceSize size = 0;
+        VkBufferUsageFlags usage = 0;
+    };
+
+    struct RenderGraphResourceState
+    {
+        VkPipelineStageFlags2 stages;
+        VkAccessFlags2 access;
+        VkImageLayout layout;
+    };
+
+    class RenderGraphPass
+    {
+    public:
+        void Read(RenderGraphResource resource, RenderGraphUsage usage);
+        void Write(RenderGraphResource resource, RenderGraphUsage usage);
+
+        // Passes are culled when nothing reads their output, unless they have side effects
+        void SetSideEffects() { m_HasSideEffects = true; }
+        void SetExecute(std::function<void(VkCommandBuffer)> execute) { m_Execute = std::move(execute); }
+
+        const std::string& GetName() const { return m_Name; }
+
+    private:
+        friend class RenderGraph;
+
+        struct ResourceUse
+        {
+            RenderGraphResource resource;
+            RenderGraphUsage usage;
+            bool write;
+        };
+
+        std::string m_Name;
+        std::vector<ResourceUse> m_Uses;
+        std::function<void(VkCommandBuffer)> m_Execute;
+        uint32_t m_RefCount = 0;
+        bool m_HasSideEffects = false;
+        bool m_Culled = false;
+    };
+
+    // Rebuilt every frame: Reset, declare resources and passes, Compile, Execute.
+    // Transient resources only live within the frame and share memory when their lifetimes
+    // don't overlap. Physical resources are kept as long as the set of transients doesn't change.
+    class RenderGraph
+    {
+    public:
+        RenderGraph() = default;
+
+        void Reset();
+
+        RenderGraphResource CreateImage(const char* name, const RenderGraphImageDesc& desc);
+        RenderGraphResource CreateBuffer(const char* name, const RenderGraphBufferDesc& desc);
+
+        // Imported resources keep their state between frames as long as they are imported every frame.
+        // pInitialState overrides it, for example for swapchain images coming back from the presentation
+        // engine. pFinalState is applied at the end.
+        RenderGraphResource ImportImage(const char* name, VkImage image, VkImageView view, const RenderGraphImageDesc& desc,
+            const RenderGraphResourceState* pInitialState = nullptr, const RenderGraphResourceState* pFinalState = nullptr);
+        RenderGraphResource ImportBuffer(const char* name, VkBuffer buffer, VkDeviceSize size,
+            const RenderGraphResourceState* pInitialState = nullptr, const RenderGraphResourceState* pFinalState = nullptr);
+
+        // Drops the remembered state of an imported handle that is being destroyed within the frame,
+        // so a new resource that gets the same handle doesn't inherit it
+        void ForgetImportedImage(VkImage image) { ForgetImport(reinterpret_cast<uint64_t>(image)); }
+        void ForgetImportedBuffer(VkBuffer buffer) { ForgetImport(reinterpret_cast<uint64_t>(buffer)); }
+
+        RenderGraphPass& AddPass(const char* name);
+
+        VkResult Compile(Engine& engine);
+        void Execute(VkCommandBuffer cb);
+
+        void Destroy(VkDevice device);
+
+        VkImage GetImage(RenderGraphResource resource) const { return m_Resources[resource].image; }
+        VkImageView GetImageView(RenderGraphResource resource) const { return m_Resources[resource].view; }
+        VkBuffer GetBuffer(RenderGraphResource resource) const { return m_Resources[resource].buffer; }
+        const RenderGraphImageDesc& GetImageDesc(RenderGraphResource resource) const { return m_Resources[resource].imageDesc; }
+        // Changes whenever transient resources are recreated, anything built on their views has to be rebuilt
+        uint64_t GetGeneration() const { return m_Generation; }
+
+    private:
+        struct TrackedState
+        {
+            VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkPipelineStageFlags2 writeStages = 0;
+            VkAccessFlags2 writeAccess = 0;
+            // Reads since the last write, a following write has to wait for them
+            VkPipelineStageFlags2 readStages = 0;
+            // Stages and accesses that already see the last write
+            VkPipelineStageFlags2 visibleStages = 0;
+            VkAccessFlags2 visibleAccess = 0;
+        };
+
+        struct Resource
+        {
+            std::string name;
+            bool isImage = false;
+            bool imported = false;
+            RenderGraphImageDesc imageDesc {};
+            RenderGraphBufferDesc bufferDesc {};
+
+            VkImage image = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;
+            VkBuffer buffer = VK_NULL_HANDLE;
+
+            bool hasFinalState = false;
+            RenderGraphResourceState finalState {};
+            TrackedState state {};
+
+            uint32_t firstPass = ~0u;
+            uint32_t lastPass = 0;
+            uint32_t physical = ~0u;
+        };
+
+        struct PhysicalResource
+        {
+            bool isImage;
+            RenderGraphImageDesc imageDesc;
+            RenderGraphBufferDesc bufferDesc;
+            uint32_t firstPass;
+            uint32_t lastPass;
+
+            VkImage image = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;
+            VkBuffer buffer = VK_NULL_HANDLE;
+            uint32_t heap = ~0u;
+            VkDeviceSize offset = 0;
+            VkDeviceSize size = 0;
+        };
+
+        // One allocation shared by transients of the same memory type whose lifetimes don't overlap
+        struct Heap
+        {
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            uint32_t memoryTypeIndex = 0;
+            bool images = false;
+            VkDeviceSize size = 0;
+            // Everything the previous occupants did, the next first use has to wait for it.
+            // Split into the last frame and the frame being recorded.
+            VkPipelineStageFlags2 stages = 0;
+            VkAccessFlags2 writeAccess = 0;
+            VkPipelineStageFlags2 frameStages = 0;
+            VkAccessFlags2 frameWriteAccess = 0;
+        };
+
+        void ForgetImport(uint64_t handle);
+        void CullPasses();
+        void ComputeLifetimes();
+        bool PhysicalResourcesMatch() const;
+        VkResult CreatePhysicalResources(Engine& engine);
+        void RetirePhysicalResources(Engine& engine);
+
+        std::deque<RenderGraphPass> m_Passes;
+        std::vector<Resource> m_Resources;
+
+        std::vector<PhysicalResource> m_Physical;
+        std::vector<Heap> m_Heaps;
+
+        // Keyed by the imported VkImage or VkBuffer handle, holds only the last executed frame's imports
+        std::unordered_map<uint64_t, TrackedState> m_ImportedStates;
+        uint64_t m_Generation = 0;
+    };
+}
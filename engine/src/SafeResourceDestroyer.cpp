@@ -7,8 +7,19 @@ namespace imp
         m_Queue.push_back(std::make_pair(submitPoint, resource));
     }
 
+    void SafeResourceDestroyer::EnqueueRelease(std::function<void()> release, uint64_t submitPoint)
+    {
+        m_Releases.push_back(std::make_pair(submitPoint, std::move(release)));
+    }
+
     void SafeResourceDestroyer::ProcessQueue(VkDevice device, uint64_t completedPoint)
     {
+        while (!m_Releases.empty() && m_Releases.front().first <= completedPoint)
+        {
+            m_Releases.front().second();
+            m_Releases.pop_front();
+        }
+
         while (!m_Queue.empty())
         {
             auto& front = m_Queue.front();
@@ -27,6 +38,15 @@ namespace imp
             case VulkanResourceType::Semaphore:
                 vkt.vkDestroySemaphore(device, resource.semaphore, nullptr);
                 break;
+            case VulkanResourceType::ImageView:
+                vkt.vkDestroyImageView(device, resource.imageView, nullptr);
+                break;
+            case VulkanResourceType::Framebuffer:
+                vkt.vkDestroyFramebuffer(device, resource.framebuffer, nullptr);
+                break;
+            case VulkanResourceType::Swapchain:
+                vkt.vkDestroySwapchainKHR(device, resource.swapchain, nullptr);
+                break;
             default:
                 break;
             }
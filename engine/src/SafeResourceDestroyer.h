@@ -2,6 +2,7 @@
 #include "VulkanFunctionTable.h"
 
 #include <deque>
+#include <functional>
 
 namespace imp
 {
@@ -9,7 +10,11 @@ namespace imp
     {
         Buffer,
         Image,
-        Semaphore
+        Semaphore,
+        ImageView,
+        Framebuffer,
+        Memory,
+        Swapchain
     };
 
     struct VulkanResource
@@ -19,6 +24,9 @@ namespace imp
             VkBuffer buffer;
             VkImage image;
             VkSemaphore semaphore;
+            VkImageView imageView;
+            VkFramebuffer framebuffer;
+            VkSwapchainKHR swapchain;
         };
         VkDeviceMemory memory;
 
@@ -32,11 +40,14 @@ namespace imp
         ~SafeResourceDestroyer() = default;
 
         void EnqueueResourceForDestruction(VulkanResource& resource, uint64_t submitPoint);
+        // For memory that isn't a resource of its own, like ranges handed back to a suballocator
+        void EnqueueRelease(std::function<void()> release, uint64_t submitPoint);
 
         void ProcessQueue(VkDevice device, uint64_t completedPoint);
 
     private:
 
         std::deque<std::pair<uint64_t, VulkanResource>> m_Queue;
+        std::deque<std::pair<uint64_t, std::function<void()>>> m_Releases;
     };
 }
\ No newline at end of file
@@ -1,9 +1,66 @@
 #include "Swapchain.h"
 #include "Log.h"
+#include "SafeResourceDestroyer.h"
 
 namespace imp
 {
+    static VkResult CreateImageView(VkDevice device, VkImage image, VkFormat format, VkImageView* pView)
+    {
+        VkImageViewCreateInfo ivci {};
+        ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        ivci.components.a = VK_COMPONENT_SWIZZLE_A;
+        ivci.components.b = VK_COMPONENT_SWIZZLE_B;
+        ivci.components.r = VK_COMPONENT_SWIZZLE_R;
+        ivci.components.g = VK_COMPONENT_SWIZZLE_G;
+        ivci.format = format;
+        ivci.image = image;
+        ivci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        ivci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        ivci.subresourceRange.layerCount = 1;
+        ivci.subresourceRange.levelCount = 1;
+
+        return vkCreateImageView(device, &ivci, nullptr, pView);
+    }
+
     VkResult Swapchain::Initialize(VkDevice device, const SwapchainInitParams& params)
+    {
+        m_Params = params;
+        return Create(device, params, VK_NULL_HANDLE);
+    }
+
+    VkResult Swapchain::Recreate(VkDevice device, VkExtent2D extent, SafeResourceDestroyer& destroyer, uint64_t retirePoint)
+    {
+        const VkSwapchainKHR oldSwapchain = m_Swapchain;
+        const SwapchainImageViews oldViews = std::move(m_ImageViews);
+        m_Swapchain = VK_NULL_HANDLE;
+        m_ImageViews.clear();
+        m_Images.clear();
+
+        m_Params.imageExtent = extent;
+        // Chaining lets the presentation engine hand over without waiting for the old images
+        VkResult result = Create(device, m_Params, oldSwapchain);
+
+        // Retired either way, an old swapchain can't acquire anymore once passed as oldSwapchain
+        for (const auto& view : oldViews)
+        {
+            VulkanResource resource {};
+            resource.type = VulkanResourceType::ImageView;
+            resource.imageView = view;
+            destroyer.EnqueueResourceForDestruction(resource, retirePoint);
+        }
+
+        VulkanResource resource {};
+        resource.type = VulkanResourceType::Swapchain;
+        resource.swapchain = oldSwapchain;
+        destroyer.EnqueueResourceForDestruction(resource, retirePoint);
+
+        m_Generation++;
+        if (result == VK_SUCCESS)
+            g_Log("Recreated the Swapchain at %ux%u.\n", extent.width, extent.height);
+        return result;
+    }
+
+    VkResult Swapchain::Create(VkDevice device, const SwapchainInitParams& params, VkSwapchainKHR oldSwapchain)
     {
         VkSwapchainCreateInfoKHR sci {};
         sci.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -19,6 +76,7 @@ namespace imp
         sci.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         sci.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
         sci.clipped = VK_TRUE;
+        sci.oldSwapchain = oldSwapchain;
 
         VkResult result = vkCreateSwapchainKHR(device, &sci, nullptr, &m_Swapchain);
         if (result != VK_SUCCESS)
@@ -50,30 +108,111 @@ namespace imp
         m_SurfaceFormat = params.format;
 
         for (uint32_t i = 0; i < count; i++)
+            CreateImageView(device, m_Images[i], m_SurfaceFormat, &m_ImageViews[i]);
+
+        return result;
+    }
+
+    VkResult Swapchain::InitializeOffscreen(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, const SwapchainInitParams& params)
+    {
+        m_Params = params;
+        m_SurfaceFormat = params.format;
+        m_NextOffscreenImage = 0;
+        m_Images.resize(params.imageCount, VK_NULL_HANDLE);
+        m_ImageViews.resize(params.imageCount, VK_NULL_HANDLE);
+        m_ImageMemory.resize(params.imageCount, VK_NULL_HANDLE);
+
+        for (uint32_t i = 0; i < params.imageCount; i++)
         {
-            VkImageViewCreateInfo ivci {};
-            ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            ivci.components.a = VK_COMPONENT_SWIZZLE_A;
-            ivci.components.b = VK_COMPONENT_SWIZZLE_B;
-            ivci.components.r = VK_COMPONENT_SWIZZLE_R;
-            ivci.components.g = VK_COMPONENT_SWIZZLE_G;
-            ivci.format = m_SurfaceFormat;
-            ivci.image = m_Images[i];
-            ivci.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            ivci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            ivci.subresourceRange.layerCount = 1;
-            ivci.subresourceRange.levelCount = 1;
-
-            vkCreateImageView(device, &ivci, nullptr, &m_ImageViews[i]);
+            VkImageCreateInfo ici {};
+            ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            ici.imageType = VK_IMAGE_TYPE_2D;
+            ici.format = params.format;
+            ici.extent = { params.imageExtent.width, params.imageExtent.height, 1 };
+            ici.mipLevels = 1;
+            ici.arrayLayers = 1;
+            ici.samples = VK_SAMPLE_COUNT_1_BIT;
+            ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+            ici.usage = params.imageUsage;
+            ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            VkResult result = vkCreateImage(device, &ici, nullptr, &m_Images[i]);
+            if (result != VK_SUCCESS)
+            {
+                g_Log("Failed to create an offscreen Swapchain Image with result %d.\n", result);
+                return result;
+            }
+
+            VkMemoryRequirements reqs;
+            vkGetImageMemoryRequirements(device, m_Images[i], &reqs);
+
+            uint32_t memoryType = ~0u;
+            for (uint32_t j = 0; j < memoryProperties.memoryTypeCount; j++)
+            {
+                if ((reqs.memoryTypeBits & (1u << j)) && (memoryProperties.memoryTypes[j].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+                {
+                    memoryType = j;
+                    break;
+                }
+            }
+            // CPU implementations may not mark any type as device local
+            for (uint32_t j = 0; j < memoryProperties.memoryTypeCount && memoryType == ~0u; j++)
+            {
+                if (reqs.memoryTypeBits & (1u << j))
+                    memoryType = j;
+            }
+
+            VkMemoryAllocateInfo mai {};
+            mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            mai.allocationSize = reqs.size;
+            mai.memoryTypeIndex = memoryType;
+
+            result = vkAllocateMemory(device, &mai, nullptr, &m_ImageMemory[i]);
+            if (result != VK_SUCCESS)
+            {
+                g_Log("Failed to allocate offscreen Swapchain Image memory with result %d.\n", result);
+                return result;
+            }
+
+            result = vkBindImageMemory(device, m_Images[i], m_ImageMemory[i], 0);
+            if (result != VK_SUCCESS)
+                return result;
+
+            result = CreateImageView(device, m_Images[i], m_SurfaceFormat, &m_ImageViews[i]);
+            if (result != VK_SUCCESS)
+                return result;
         }
 
-        return result;
+        g_Log("Created %u offscreen Swapchain Images (%ux%u).\n", params.imageCount, params.imageExtent.width, params.imageExtent.height);
+        return VK_SUCCESS;
+    }
+
+    uint32_t Swapchain::AcquireNextOffscreenImage()
+    {
+        const uint32_t index = m_NextOffscreenImage;
+        m_NextOffscreenImage = (m_NextOffscreenImage + 1) % GetSwapchainImageCount();
+        return index;
     }
 
     void Swapchain::Destroy(VkDevice device)
     {
         for (const auto& iv : m_ImageViews)
             vkDestroyImageView(device, iv, nullptr);
+
+        // Offscreen images are owned by us, swapchain images go away with the swapchain
+        if (m_Swapchain == VK_NULL_HANDLE)
+        {
+            for (const auto& image : m_Images)
+                vkDestroyImage(device, image, nullptr);
+            for (const auto& memory : m_ImageMemory)
+                vkFreeMemory(device, memory, nullptr);
+        }
         vkDestroySwapchainKHR(device, m_Swapchain, nullptr);
+
+        m_Swapchain = VK_NULL_HANDLE;
+        m_Images.clear();
+        m_ImageViews.clear();
+        m_ImageMemory.clear();
     }
 }
\ No newline at end of file
@@ -5,8 +5,11 @@
 
 namespace imp
 {
+    class SafeResourceDestroyer;
+
     typedef std::vector<VkImage> SwapchainImages;
     typedef std::vector<VkImageView> SwapchainImageViews;
+    typedef std::vector<VkDeviceMemory> SwapchainImageMemory;
 
     struct SwapchainInitParams
     {
@@ -27,19 +30,41 @@ namespace imp
         Swapchain() = default;
 
         VkResult Initialize(VkDevice device, const SwapchainInitParams& params);
+        // New swapchain of the same surface chained to the current one. The old swapchain and its
+        // views are destroyed once retirePoint is synced, so frames in flight keep using them.
+        VkResult Recreate(VkDevice device, VkExtent2D extent, SafeResourceDestroyer& destroyer, uint64_t retirePoint);
+        // Engine owned image ring for headless windows, there is no surface or VkSwapchainKHR.
+        // Surface and present mode of the params are ignored.
+        VkResult InitializeOffscreen(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, const SwapchainInitParams& params);
         void Destroy(VkDevice device);
 
+        bool IsOffscreen() const { return m_Swapchain == VK_NULL_HANDLE && !m_Images.empty(); }
+        // Images are handed out in order, frame pacing keeps the reused image idle
+        uint32_t AcquireNextOffscreenImage();
+
         VkSwapchainKHR GetSwapchain() const { return m_Swapchain; }
         VkImage GetSwapchainImage(uint32_t index) const { return m_Images[index]; }
         VkImageView GetSwapchainImageView(uint32_t index) const { return m_ImageViews[index]; }
         uint32_t GetSwapchainImageCount() const { return m_Images.size(); }
         VkFormat GetSurfaceFormat() const { return m_SurfaceFormat; }
+        // Usage the images were created with, optional usages are left out when the surface doesn't support them
+        VkImageUsageFlags GetImageUsage() const { return m_Params.imageUsage; }
+        VkExtent2D GetExtent() const { return m_Params.imageExtent; }
+        // Changes whenever the images are recreated, anything built on their views has to be rebuilt
+        uint64_t GetGeneration() const { return m_Generation; }
 
         private:
 
+        VkResult Create(VkDevice device, const SwapchainInitParams& params, VkSwapchainKHR oldSwapchain);
+
+        SwapchainInitParams m_Params {};
+        uint64_t m_Generation = 0;
+
         VkSwapchainKHR m_Swapchain = VK_NULL_HANDLE;
         SwapchainImages m_Images {};
         SwapchainImageViews m_ImageViews {};
+        SwapchainImageMemory m_ImageMemory {};
+        uint32_t m_NextOffscreenImage = 0;
 
         VkFormat m_SurfaceFormat = VK_FORMAT_UNDEFINED;
     };
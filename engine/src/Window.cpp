@@ -1,5 +1,9 @@
 #include "Window.h"
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 namespace imp
 {
     uint32_t AdjustSwapchainImageCount(uint32_t count, const VkSurfaceCapabilitiesKHR& caps)
@@ -32,7 +36,8 @@ namespace imp
         vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, params.surface, &surfaceCaps);
 
         params.imageCount = AdjustSwapchainImageCount(2, surfaceCaps);
-        params.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        // Transfer dst so upscaled frames can be blitted in, where supported. Callers check GetImageUsage before blitting.
+        params.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (surfaceCaps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
         params.imageExtent = { GetWidth(), GetHeight() };
         params.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR ;
 
@@ -40,6 +45,30 @@ namespace imp
         return result;
     }
 
+    VkResult Window::RecreateSwapchain(VkPhysicalDevice physicalDevice, VkDevice device, SafeResourceDestroyer& destroyer, uint64_t retirePoint)
+    {
+        const VkSurfaceCapabilitiesKHR surfaceCaps = GetSurfaceCapabilities(physicalDevice);
+
+        // 0xFFFFFFFF means the surface takes whatever the swapchain has
+        VkExtent2D extent = surfaceCaps.currentExtent;
+        if (extent.width == ~0u)
+            extent = { GetWidth(), GetHeight() };
+        extent.width = std::clamp(extent.width, surfaceCaps.minImageExtent.width, surfaceCaps.maxImageExtent.width);
+        extent.height = std::clamp(extent.height, surfaceCaps.minImageExtent.height, surfaceCaps.maxImageExtent.height);
+
+        // Minimized, keep the old swapchain until there is something to present to
+        if (extent.width == 0 || extent.height == 0)
+            return VK_NOT_READY;
+
+        return m_Swapchain.Recreate(device, extent, destroyer, retirePoint);
+    }
+
+    void Window::WaitEvents()
+    {
+        // No event queue to block on, don't spin either
+        std::this_thread::sleep_for(std::chrono::milliseconds(16));
+    }
+
     bool Window::Shutdown(VkInstance instance, VkDevice device)
     {
         m_Swapchain.Destroy(device);
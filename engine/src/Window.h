@@ -19,6 +19,8 @@ namespace imp
         uint32_t height = 800;
         uint64_t windowHandle = 0;
         WindowType type = WindowType::kPlatformWindow;
+        // Headless windows close after this many frames, 0 keeps them open
+        uint32_t headlessFrameCount = 0;
     };
 
     class Window
@@ -34,9 +36,13 @@ namespace imp
         virtual bool Shutdown(VkInstance instance, VkDevice device);
 
         virtual VkResult InitializeSwapchain(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device);
+        // Follows the current surface extent, the old swapchain is retired through the destroyer
+        virtual VkResult RecreateSwapchain(VkPhysicalDevice physicalDevice, VkDevice device, SafeResourceDestroyer& destroyer, uint64_t retirePoint);
         virtual VkResult CreateWindowSurface(VkInstance instance) = 0;
 
         virtual void UpdateInfo(double frameTimeMs) = 0;
+        // Blocks until something happens to the window, for when there is nothing to render
+        virtual void WaitEvents();
 
         virtual void MoveCamera(glm::mat4& transform, float delta) = 0;
 
@@ -54,7 +60,13 @@ namespace imp
 
         VkSurfaceCapabilitiesKHR GetSurfaceCapabilities(VkPhysicalDevice device) const;
 
+        // True once after the window was resized
+        bool ConsumeResize() { const bool resized = m_Resized; m_Resized = false; return resized; }
+
     protected:
+        void NotifyResized() { m_Resized = true; }
+
+        bool m_Resized = false;
         Swapchain m_Swapchain {};
 
         double m_LastTime = 0.0;
@@ -0,0 +1,330 @@
+#include "AsyncFileReader.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef IMP_HAS_LIBURING
+#include <liburing.h>
+#endif
+
+// Large files are split so a single file doesn't serialize the reads behind it
+inline constexpr size_t kChunkSize = 4ull << 20;
+inline constexpr uint32_t kQueueDepth = 32;
+inline constexpr uint32_t kMaxReadThreads = 4;
+
+#ifdef _WIN32
+typedef HANDLE FileHandle;
+
+static bool OpenForRead(const std::filesystem::path& path, FileHandle& file)
+{
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    return file != INVALID_HANDLE_VALUE;
+}
+
+static void CloseFile(FileHandle file)
+{
+    CloseHandle(file);
+}
+
+// Positioned read, returns the bytes read or -1
+static int64_t ReadAt(FileHandle file, void* dst, size_t size, uint64_t offset)
+{
+    OVERLAPPED overlapped {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD bytesRead = 0;
+    if (!ReadFile(file, dst, static_cast<DWORD>(size), &bytesRead, &overlapped))
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    return bytesRead;
+}
+#else
+typedef int FileHandle;
+
+static bool OpenForRead(const std::filesystem::path& path, FileHandle& file)
+{
+    file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        return false;
+    posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+}
+
+static void CloseFile(FileHandle file)
+{
+    close(file);
+}
+
+static int64_t ReadAt(FileHandle file, void* dst, size_t size, uint64_t offset)
+{
+    ssize_t result;
+    do
+    {
+        result = pread(file, dst, size, static_cast<off_t>(offset));
+    } while (result < 0 && errno == EINTR);
+    return result;
+}
+#endif
+
+struct AsyncFileReader::Backend
+{
+    struct Chunk
+    {
+        FileHandle file;
+        uint8_t* dst;
+        uint64_t offset;
+        size_t size;
+    };
+
+    std::vector<FileHandle> files;
+
+    // Positioned-read threads, only started when io_uring isn't available
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::deque<Chunk> queue;
+    size_t outstanding = 0;
+    bool quit = false;
+    bool failed = false;
+
+#ifdef IMP_HAS_LIBURING
+    io_uring ring {};
+    bool ringReady = false;
+    // Chunks in flight in the ring, the slot index is the submission's user data
+    Chunk slots[kQueueDepth] {};
+    std::vector<uint32_t> freeSlots;
+
+    Backend()
+    {
+        // Fails on old kernels or where io_uring is blocked, the threads take over then
+        ringReady = io_uring_queue_init(kQueueDepth, &ring, 0) == 0;
+        for (uint32_t i = 0; i < kQueueDepth; i++)
+            freeSlots.push_back(kQueueDepth - 1 - i);
+    }
+
+    void SubmitToRing()
+    {
+        bool submitted = false;
+        while (!queue.empty() && !freeSlots.empty())
+        {
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            if (!sqe)
+                break;
+
+            const uint32_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            slots[slot] = queue.front();
+            queue.pop_front();
+
+            const Chunk& chunk = slots[slot];
+            io_uring_prep_read(sqe, chunk.file, chunk.dst, static_cast<unsigned>(chunk.size), chunk.offset);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(slot)));
+            submitted = true;
+        }
+        if (submitted)
+            io_uring_submit(&ring);
+    }
+
+    void CompleteFromRing(io_uring_cqe* cqe)
+    {
+        const uint32_t slot = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+        const int result = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        Chunk chunk = slots[slot];
+        freeSlots.push_back(slot);
+        if (result == -EINTR || result == -EAGAIN)
+        {
+            queue.push_front(chunk);
+            return;
+        }
+        if (result <= 0)
+        {
+            failed = true;
+            outstanding--;
+            return;
+        }
+
+        // Short reads continue where they stopped
+        if (static_cast<size_t>(result) < chunk.size)
+        {
+            chunk.dst += result;
+            chunk.offset += result;
+            chunk.size -= result;
+            queue.push_front(chunk);
+            return;
+        }
+        outstanding--;
+    }
+
+    // Reaps whatever already completed without blocking, keeps the ring full
+    void PollRing()
+    {
+        io_uring_cqe* cqe = nullptr;
+        while (io_uring_peek_cqe(&ring, &cqe) == 0 && cqe)
+            CompleteFromRing(cqe);
+        SubmitToRing();
+    }
+
+    void WaitRing()
+    {
+        SubmitToRing();
+        while (outstanding > 0)
+        {
+            io_uring_cqe* cqe = nullptr;
+            const int result = io_uring_wait_cqe(&ring, &cqe);
+            if (result == -EINTR)
+                continue;
+            if (result < 0)
+            {
+                failed = true;
+                queue.clear();
+                outstanding = 0;
+                return;
+            }
+            CompleteFromRing(cqe);
+            SubmitToRing();
+        }
+    }
+#else
+    static constexpr bool ringReady = false;
+
+    void PollRing() {}
+    void WaitRing() {}
+#endif
+
+    ~Backend()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+#ifdef IMP_HAS_LIBURING
+        if (ringReady)
+            io_uring_queue_exit(&ring);
+#endif
+    }
+
+    void ThreadLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wake.wait(lock, [&]() { return quit || !queue.empty(); });
+            if (quit)
+                return;
+
+            Chunk chunk = queue.front();
+            queue.pop_front();
+            lock.unlock();
+
+            bool ok = true;
+            while (chunk.size > 0)
+            {
+                const int64_t result = ReadAt(chunk.file, chunk.dst, chunk.size, chunk.offset);
+                if (result <= 0)
+                {
+                    ok = false;
+                    break;
+                }
+                chunk.dst += result;
+                chunk.offset += result;
+                chunk.size -= static_cast<size_t>(result);
+            }
+
+            lock.lock();
+            failed = failed || !ok;
+            if (--outstanding == 0)
+                done.notify_all();
+        }
+    }
+
+    // The queue is handed to the threads, started on first use
+    void WakeThreads()
+    {
+        if (threads.empty())
+        {
+            const uint32_t threadCount = std::clamp(std::thread::hardware_concurrency(), 1u, kMaxReadThreads);
+            for (uint32_t i = 0; i < threadCount; i++)
+                threads.emplace_back([this]() { ThreadLoop(); });
+        }
+        wake.notify_all();
+    }
+};
+
+AsyncFileReader::AsyncFileReader()
+    : m_Backend(std::make_unique<Backend>())
+{
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+    Wait();
+}
+
+bool AsyncFileReader::Read(const std::filesystem::path& path, void* dst, size_t size)
+{
+    FileHandle file;
+    if (!OpenForRead(path, file))
+        return false;
+
+    Backend& backend = *m_Backend;
+    backend.files.push_back(file);
+
+    std::unique_lock<std::mutex> lock(backend.mutex);
+    uint8_t* pDst = static_cast<uint8_t*>(dst);
+    for (uint64_t offset = 0; offset < size; offset += kChunkSize)
+    {
+        backend.queue.push_back({ file, pDst + offset, offset, std::min<size_t>(kChunkSize, size - offset) });
+        backend.outstanding++;
+    }
+
+    if (backend.ringReady)
+    {
+        backend.PollRing();
+        return true;
+    }
+
+    lock.unlock();
+    backend.WakeThreads();
+    return true;
+}
+
+bool AsyncFileReader::Wait()
+{
+    Backend& backend = *m_Backend;
+    if (backend.ringReady)
+        backend.WaitRing();
+
+    else
+    {
+        std::unique_lock<std::mutex> lock(backend.mutex);
+        backend.done.wait(lock, [&]() { return backend.outstanding == 0; });
+    }
+
+    for (FileHandle file : backend.files)
+        CloseFile(file);
+    backend.files.clear();
+
+    const bool ok = !backend.failed;
+    backend.failed = false;
+    return ok;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+// Overlapped reads of whole files into caller owned memory. Reads start as soon as they are
+// queued and are only guaranteed to be done after Wait, so multi-file scenes stream from disk
+// all at once instead of file by file. Uses io_uring when built with liburing and the kernel
+// allows it, a small pool of positioned-read threads otherwise.
+class AsyncFileReader
+{
+public:
+    AsyncFileReader();
+    // Waits for reads still in flight, dst memory must stay alive until then
+    ~AsyncFileReader();
+
+    AsyncFileReader(const AsyncFileReader&) = delete;
+    AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+    // Queues reading the first size bytes of the file into dst, false if the file can't be opened
+    bool Read(const std::filesystem::path& path, void* dst, size_t size);
+    // Blocks until every queued read is done, false if any of them failed
+    bool Wait();
+
+private:
+    struct Backend;
+    std::unique_ptr<Backend> m_Backend;
+};
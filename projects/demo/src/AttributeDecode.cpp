@@ -0,0 +1,290 @@
+#include "AttributeDecode.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ATTRIBUTE_DECODE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace AttributeDecode
+{
+    static size_t GetComponentSize(ComponentType type)
+    {
+        switch (type)
+        {
+        case ComponentType::Byte:
+        case ComponentType::UnsignedByte:
+            return 1;
+        case ComponentType::Short:
+        case ComponentType::UnsignedShort:
+            return 2;
+        default:
+            return 4;
+        }
+    }
+
+    static float GetNormalizeScale(ComponentType type)
+    {
+        switch (type)
+        {
+        case ComponentType::Byte:          return 1.0f / 127.0f;
+        case ComponentType::UnsignedByte:  return 1.0f / 255.0f;
+        case ComponentType::Short:         return 1.0f / 32767.0f;
+        case ComponentType::UnsignedShort: return 1.0f / 65535.0f;
+        default:                           return 1.0f;
+        }
+    }
+
+    static bool IsSigned(ComponentType type)
+    {
+        return type == ComponentType::Byte || type == ComponentType::Short;
+    }
+
+#if ATTRIBUTE_DECODE_SSE2
+    // Reads one element as four floats, components past componentCount are zero. Never reads past the element.
+    static inline __m128 LoadElement(const Stream& stream, size_t index)
+    {
+        if (!stream.data)
+            return _mm_setzero_ps();
+
+        const uint8_t* src = stream.data + index * stream.stride;
+        if (stream.type == ComponentType::Float)
+        {
+            switch (stream.componentCount)
+            {
+            case 1:
+                return _mm_load_ss(reinterpret_cast<const float*>(src));
+            case 2:
+                return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(src)));
+            case 3:
+                return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(src))),
+                    _mm_load_ss(reinterpret_cast<const float*>(src) + 2));
+            default:
+                return _mm_loadu_ps(reinterpret_cast<const float*>(src));
+            }
+        }
+
+        // At most 16 bytes, gathered into a zeroed register and widened to 32 bits
+        alignas(16) uint8_t bytes[16] = {};
+        std::memcpy(bytes, src, std::min<size_t>(stream.componentCount, 4) * GetComponentSize(stream.type));
+        __m128i packed = _mm_load_si128(reinterpret_cast<const __m128i*>(bytes));
+
+        __m128i wide;
+        switch (stream.type)
+        {
+        case ComponentType::UnsignedByte:
+            wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(packed, _mm_setzero_si128()), _mm_setzero_si128());
+            break;
+        case ComponentType::Byte:
+            packed = _mm_unpacklo_epi8(packed, packed);
+            wide = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 24);
+            break;
+        case ComponentType::UnsignedShort:
+            wide = _mm_unpacklo_epi16(packed, _mm_setzero_si128());
+            break;
+        case ComponentType::Short:
+            wide = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+            break;
+        default:
+            wide = packed;
+            break;
+        }
+
+        __m128 value = _mm_cvtepi32_ps(wide);
+        if (stream.normalized)
+        {
+            value = _mm_mul_ps(value, _mm_set1_ps(GetNormalizeScale(stream.type)));
+            // The most negative signed value would land just under -1
+            if (IsSigned(stream.type))
+                value = _mm_max_ps(value, _mm_set1_ps(-1.0f));
+        }
+        return value;
+    }
+
+    void DecodeVertices(const VertexStreams& streams, size_t first, size_t count, VU::Vertex* dst, glm::vec3* positions,
+        glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        static_assert(offsetof(VU::Vertex, normals) == 12 && offsetof(VU::Vertex, uvs) == 24);
+
+        __m128 vMin = _mm_setr_ps(boundsMin.x, boundsMin.y, boundsMin.z, 0.0f);
+        __m128 vMax = _mm_setr_ps(boundsMax.x, boundsMax.y, boundsMax.z, 0.0f);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const __m128 p = LoadElement(streams.position, first + i);
+            const __m128 n = LoadElement(streams.normal, first + i);
+            const __m128 t = LoadElement(streams.texCoord, first + i);
+
+            // (p.x, p.y, p.z, n.x) and (n.y, n.z, t.x, t.y), exactly one Vertex
+            const __m128 pzzNxx = _mm_shuffle_ps(p, n, _MM_SHUFFLE(0, 0, 2, 2));
+            const __m128 lo = _mm_shuffle_ps(p, pzzNxx, _MM_SHUFFLE(2, 0, 1, 0));
+            const __m128 hi = _mm_shuffle_ps(n, t, _MM_SHUFFLE(1, 0, 2, 1));
+
+            float* out = &dst[i].position.x;
+            _mm_storeu_ps(out, lo);
+            _mm_storeu_ps(out + 4, hi);
+
+            if (positions)
+            {
+                float* position = &positions[i].x;
+                _mm_storel_pi(reinterpret_cast<__m64*>(position), p);
+                _mm_store_ss(position + 2, _mm_movehl_ps(p, p));
+            }
+
+            vMin = _mm_min_ps(vMin, p);
+            vMax = _mm_max_ps(vMax, p);
+        }
+
+        alignas(16) float bounds[8];
+        _mm_store_ps(bounds, vMin);
+        _mm_store_ps(bounds + 4, vMax);
+        boundsMin = glm::vec3(bounds[0], bounds[1], bounds[2]);
+        boundsMax = glm::vec3(bounds[4], bounds[5], bounds[6]);
+    }
+#else
+    static inline float ReadComponent(const uint8_t* src, ComponentType type, bool normalized)
+    {
+        float value;
+        switch (type)
+        {
+        case ComponentType::Byte:          { int8_t v; std::memcpy(&v, src, 1); value = v; break; }
+        case ComponentType::UnsignedByte:  { uint8_t v; std::memcpy(&v, src, 1); value = v; break; }
+        case ComponentType::Short:         { int16_t v; std::memcpy(&v, src, 2); value = v; break; }
+        case ComponentType::UnsignedShort: { uint16_t v; std::memcpy(&v, src, 2); value = v; break; }
+        case ComponentType::UnsignedInt:   { uint32_t v; std::memcpy(&v, src, 4); value = static_cast<float>(v); break; }
+        default:                           { std::memcpy(&value, src, 4); return value; }
+        }
+
+        if (normalized)
+            value = std::max(value * GetNormalizeScale(type), IsSigned(type) ? -1.0f : 0.0f);
+        return value;
+    }
+
+    static inline void LoadElement(const Stream& stream, size_t index, float* dst, uint32_t dstComponents)
+    {
+        const uint8_t* src = stream.data ? stream.data + index * stream.stride : nullptr;
+        const size_t componentSize = GetComponentSize(stream.type);
+        for (uint32_t c = 0; c < dstComponents; c++)
+            dst[c] = src && c < stream.componentCount ? ReadComponent(src + c * componentSize, stream.type, stream.normalized) : 0.0f;
+    }
+
+    void DecodeVertices(const VertexStreams& streams, size_t first, size_t count, VU::Vertex* dst, glm::vec3* positions,
+        glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            VU::Vertex vertex;
+            LoadElement(streams.position, first + i, &vertex.position.x, 3);
+            LoadElement(streams.normal, first + i, &vertex.normals.x, 3);
+            LoadElement(streams.texCoord, first + i, &vertex.uvs.x, 2);
+            dst[i] = vertex;
+
+            if (positions)
+                positions[i] = vertex.position;
+
+            boundsMin = glm::min(boundsMin, vertex.position);
+            boundsMax = glm::max(boundsMax, vertex.position);
+        }
+    }
+#endif
+
+    template<typename Src, typename Dst>
+    static void ConvertIndices(const uint8_t* src, size_t stride, size_t count, Dst* dst)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            Src value;
+            std::memcpy(&value, src + i * stride, sizeof(Src));
+            dst[i] = static_cast<Dst>(value);
+        }
+    }
+
+    void DecodeIndices(const Stream& stream, size_t count, uint32_t* dst)
+    {
+        const size_t componentSize = GetComponentSize(stream.type);
+        size_t i = 0;
+        if (stream.stride == componentSize && stream.type == ComponentType::UnsignedInt)
+        {
+            std::memcpy(dst, stream.data, count * sizeof(uint32_t));
+            return;
+        }
+
+#if ATTRIBUTE_DECODE_SSE2
+        if (stream.stride == componentSize && stream.type == ComponentType::UnsignedShort)
+        {
+            for (; i + 8 <= count; i += 8)
+            {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stream.data + i * 2));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(v, _mm_setzero_si128()));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(v, _mm_setzero_si128()));
+            }
+        }
+        else if (stream.stride == componentSize && stream.type == ComponentType::UnsignedByte)
+        {
+            for (; i + 16 <= count; i += 16)
+            {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stream.data + i));
+                const __m128i lo = _mm_unpacklo_epi8(v, _mm_setzero_si128());
+                const __m128i hi = _mm_unpackhi_epi8(v, _mm_setzero_si128());
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(lo, _mm_setzero_si128()));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(lo, _mm_setzero_si128()));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpacklo_epi16(hi, _mm_setzero_si128()));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 12), _mm_unpackhi_epi16(hi, _mm_setzero_si128()));
+            }
+        }
+#endif
+
+        const uint8_t* src = stream.data + i * stream.stride;
+        switch (stream.type)
+        {
+        case ComponentType::UnsignedByte:  ConvertIndices<uint8_t>(src, stream.stride, count - i, dst + i); break;
+        case ComponentType::UnsignedShort: ConvertIndices<uint16_t>(src, stream.stride, count - i, dst + i); break;
+        default:                           ConvertIndices<uint32_t>(src, stream.stride, count - i, dst + i); break;
+        }
+    }
+
+    void DecodeIndices(const Stream& stream, size_t count, uint16_t* dst)
+    {
+        const size_t componentSize = GetComponentSize(stream.type);
+        size_t i = 0;
+        if (stream.stride == componentSize && stream.type == ComponentType::UnsignedShort)
+        {
+            std::memcpy(dst, stream.data, count * sizeof(uint16_t));
+            return;
+        }
+
+#if ATTRIBUTE_DECODE_SSE2
+        if (stream.stride == componentSize && stream.type == ComponentType::UnsignedInt)
+        {
+            // SSE2 only has a signed 32 -> 16 pack, so bias into the signed range and back
+            const __m128i bias32 = _mm_set1_epi32(32768);
+            const __m128i bias16 = _mm_set1_epi16(-32768);
+            for (; i + 8 <= count; i += 8)
+            {
+                const __m128i a = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(stream.data + i * 4)), bias32);
+                const __m128i b = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(stream.data + i * 4 + 16)), bias32);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi16(_mm_packs_epi32(a, b), bias16));
+            }
+        }
+        else if (stream.stride == componentSize && stream.type == ComponentType::UnsignedByte)
+        {
+            for (; i + 16 <= count; i += 16)
+            {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stream.data + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+            }
+        }
+#endif
+
+        const uint8_t* src = stream.data + i * stream.stride;
+        switch (stream.type)
+        {
+        case ComponentType::UnsignedByte:  ConvertIndices<uint8_t>(src, stream.stride, count - i, dst + i); break;
+        case ComponentType::UnsignedShort: ConvertIndices<uint16_t>(src, stream.stride, count - i, dst + i); break;
+        default:                           ConvertIndices<uint32_t>(src, stream.stride, count - i, dst + i); break;
+        }
+    }
+}
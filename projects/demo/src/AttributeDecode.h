@@ -0,0 +1,49 @@
+#pragma once
+#include "vkutilities.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Conversion of glTF accessor data into the engine's vertex and index layouts. The kernels write
+// every destination byte exactly once and in order, so they can target mapped (write-combined)
+// staging memory directly. SSE2 is used when available, other targets take the scalar path.
+namespace AttributeDecode
+{
+    // Values match the glTF componentType enum
+    enum class ComponentType : uint32_t
+    {
+        Byte            = 5120,
+        UnsignedByte    = 5121,
+        Short           = 5122,
+        UnsignedShort   = 5123,
+        UnsignedInt     = 5125,
+        Float           = 5126
+    };
+
+    struct Stream
+    {
+        // nullptr reads as zeros
+        const uint8_t* data     = nullptr;
+        size_t stride           = 0;
+        ComponentType type      = ComponentType::Float;
+        uint32_t componentCount = 0;
+        // Integer components map to [0, 1] or [-1, 1]
+        bool normalized         = false;
+    };
+
+    struct VertexStreams
+    {
+        Stream position;
+        Stream normal;
+        Stream texCoord;
+    };
+
+    // Interleaves vertices [first, first + count) into dst. positions, if not null, gets a tightly packed
+    // copy of the positions. boundsMin and boundsMax are grown by every decoded position.
+    void DecodeVertices(const VertexStreams& streams, size_t first, size_t count, VU::Vertex* dst, glm::vec3* positions,
+        glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+    // Index streams may be 8, 16 or 32-bit. Narrowing to 16 bits is only valid for meshes with less than 65536 vertices.
+    void DecodeIndices(const Stream& stream, size_t count, uint32_t* dst);
+    void DecodeIndices(const Stream& stream, size_t count, uint16_t* dst);
+}
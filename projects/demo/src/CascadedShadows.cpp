@@ -0,0 +1,682 @@
+#include "CascadedShadows.h"
+#include "RenderQueue.h"
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace Shadows
+{
+    static VkResult CreateDepthRenderPass(VkDevice device, VkAttachmentLoadOp loadOp, VkRenderPass& renderPass)
+    {
+        // Layout transitions are done by the render graph
+        VkAttachmentDescription attachmentDesc {};
+        attachmentDesc.format = kShadowFormat;
+        attachmentDesc.samples = VK_SAMPLE_COUNT_1_BIT;
+        attachmentDesc.loadOp = loadOp;
+        attachmentDesc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachmentDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachmentDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachmentDesc.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        attachmentDesc.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference attachmentRef {};
+        attachmentRef.attachment = 0;
+        attachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpassDesc {};
+        subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpassDesc.pDepthStencilAttachment = &attachmentRef;
+
+        VkRenderPassCreateInfo rpci {};
+        rpci.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        rpci.attachmentCount = 1;
+        rpci.pAttachments = &attachmentDesc;
+        rpci.subpassCount = 1;
+        rpci.pSubpasses = &subpassDesc;
+
+        return vkCreateRenderPass(device, &rpci, nullptr, &renderPass);
+    }
+
+    static VkResult CreateAtlas(imp::Engine& engine, VU::Image& image, VkImageView& view)
+    {
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+        VkResult result = VU::CreateImage(engine.GetPhysicalDevice(), device, kAtlasSize, kAtlasSize, kShadowFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image);
+        if (result != VK_SUCCESS)
+            return result;
+
+        return VU::CreateImageView(device, image.image, kShadowFormat, VK_IMAGE_ASPECT_DEPTH_BIT, view);
+    }
+
+    static VkRect2D GetCascadeRect(uint32_t cascade)
+    {
+        VkRect2D rect {};
+        rect.offset.x = static_cast<int32_t>((cascade & 1) * kCascadeResolution);
+        rect.offset.y = static_cast<int32_t>((cascade >> 1) * kCascadeResolution);
+        rect.extent = { kCascadeResolution, kCascadeResolution };
+        return rect;
+    }
+
+    VkResult CascadedShadowMaps::Initialize(imp::Engine& engine, VkShaderModule vertModule, const SceneLoader::Scene& scene, uint32_t framesInFlight, VkDescriptorSet lightingSet)
+    {
+        VkPhysicalDevice pDevice = engine.GetPhysicalDevice();
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+
+        VkResult result = CreateAtlas(engine, m_StaticAtlas, m_StaticAtlasView);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = CreateAtlas(engine, m_DynamicAtlas, m_DynamicAtlasView);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = VU::CreateBuffer(pDevice, device, sizeof(glm::mat4) * kMaxShadowInstances,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_InstanceBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = VU::CreateBuffer(pDevice, device, sizeof(ShadowUniforms),
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_UniformBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        // One slot per frame in flight, each holds the uniforms followed by the instance transforms
+        m_StagingSlotSize = (sizeof(ShadowUniforms) + sizeof(glm::mat4) * kMaxShadowInstances + 255) & ~VkDeviceSize(255);
+        m_StagingSlotCount = std::max(framesInFlight, 1u);
+        result = VU::CreateBuffer(pDevice, device, m_StagingSlotSize * m_StagingSlotCount,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_StagingBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        void* pStaging = nullptr;
+        result = vkMapMemory(device, m_StagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &pStaging);
+        if (result != VK_SUCCESS)
+            return result;
+        m_pStaging = static_cast<uint8_t*>(pStaging);
+
+        // Hardware 2x2 PCF
+        VkSamplerCreateInfo sci {};
+        sci.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        sci.magFilter = VK_FILTER_LINEAR;
+        sci.minFilter = VK_FILTER_LINEAR;
+        sci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        sci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sci.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sci.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sci.compareEnable = VK_TRUE;
+        sci.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+        result = vkCreateSampler(device, &sci, nullptr, &m_Sampler);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = CreateDepthRenderPass(device, VK_ATTACHMENT_LOAD_OP_LOAD, m_StaticRenderPass);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = CreateDepthRenderPass(device, VK_ATTACHMENT_LOAD_OP_CLEAR, m_DynamicRenderPass);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = VU::CreateFramebuffer(device, m_StaticRenderPass, 1, &m_StaticAtlasView, kAtlasSize, kAtlasSize, m_StaticFramebuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = VU::CreateFramebuffer(device, m_DynamicRenderPass, 1, &m_DynamicAtlasView, kAtlasSize, kAtlasSize, m_DynamicFramebuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkDescriptorSetLayoutBinding binding {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+        VkDescriptorSetLayoutCreateInfo dslci {};
+        dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        dslci.bindingCount = 1;
+        dslci.pBindings = &binding;
+
+        result = vkCreateDescriptorSetLayout(device, &dslci, nullptr, &m_DescriptorSetLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkDescriptorSetAllocateInfo dsai {};
+        dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        dsai.descriptorPool = engine.GetDescriptorPool();
+        dsai.descriptorSetCount = 1;
+        dsai.pSetLayouts = &m_DescriptorSetLayout;
+
+        result = vkAllocateDescriptorSets(device, &dsai, &m_DescriptorSet);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkDescriptorBufferInfo instanceInfo {};
+        instanceInfo.buffer = m_InstanceBuffer.buffer;
+        instanceInfo.range = VK_WHOLE_SIZE;
+
+        VkDescriptorBufferInfo uniformInfo {};
+        uniformInfo.buffer = m_UniformBuffer.buffer;
+        uniformInfo.range = VK_WHOLE_SIZE;
+
+        std::array<VkDescriptorImageInfo, 2> atlasInfos {};
+        atlasInfos[0].sampler = m_Sampler;
+        atlasInfos[0].imageView = m_StaticAtlasView;
+        atlasInfos[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        atlasInfos[1] = atlasInfos[0];
+        atlasInfos[1].imageView = m_DynamicAtlasView;
+
+        // Set 0 of the shadow pipeline, then bindings 4 to 6 of the lighting set
+        std::array<VkWriteDescriptorSet, 4> writes {};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].dstSet = m_DescriptorSet;
+        writes[0].dstBinding = 0;
+        writes[0].descriptorCount = 1;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[0].pBufferInfo = &instanceInfo;
+        writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[1].dstSet = lightingSet;
+        writes[1].dstBinding = 4;
+        writes[1].descriptorCount = 1;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        writes[1].pBufferInfo = &uniformInfo;
+        writes[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[2].dstSet = lightingSet;
+        writes[2].dstBinding = 5;
+        writes[2].descriptorCount = 1;
+        writes[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[2].pImageInfo = &atlasInfos[0];
+        writes[3] = writes[2];
+        writes[3].dstBinding = 6;
+        writes[3].pImageInfo = &atlasInfos[1];
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+        VkPushConstantRange pushConstantRange {};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.size = sizeof(glm::mat4);
+
+        VkPipelineLayoutCreateInfo plci {};
+        plci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        plci.setLayoutCount = 1;
+        plci.pSetLayouts = &m_DescriptorSetLayout;
+        plci.pushConstantRangeCount = 1;
+        plci.pPushConstantRanges = &pushConstantRange;
+
+        result = vkCreatePipelineLayout(device, &plci, nullptr, &m_PipelineLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkPipelineShaderStageCreateInfo stage {};
+        stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        stage.module = vertModule;
+        stage.pName = "main";
+
+        VkVertexInputBindingDescription vertexBinding {};
+        vertexBinding.binding = 0;
+        vertexBinding.stride = sizeof(glm::vec3);
+        vertexBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        VkVertexInputAttributeDescription vertexAttribute {};
+        vertexAttribute.location = 0;
+        vertexAttribute.binding = 0;
+        vertexAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+
+        VkPipelineVertexInputStateCreateInfo pvisi {};
+        pvisi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        pvisi.vertexBindingDescriptionCount = 1;
+        pvisi.pVertexBindingDescriptions = &vertexBinding;
+        pvisi.vertexAttributeDescriptionCount = 1;
+        pvisi.pVertexAttributeDescriptions = &vertexAttribute;
+
+        VkPipelineInputAssemblyStateCreateInfo piasi {};
+        piasi.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        piasi.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        VkPipelineViewportStateCreateInfo pvsi {};
+        pvsi.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        pvsi.viewportCount = 1;
+        pvsi.scissorCount = 1;
+
+        // No culling, thin and open meshes still have to cast
+        VkPipelineRasterizationStateCreateInfo prsi {};
+        prsi.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        prsi.polygonMode = VK_POLYGON_MODE_FILL;
+        prsi.cullMode = VK_CULL_MODE_NONE;
+        prsi.frontFace = VK_FRONT_FACE_CLOCKWISE;
+        prsi.depthBiasEnable = VK_TRUE;
+        prsi.depthBiasConstantFactor = 2.0f;
+        prsi.depthBiasSlopeFactor = 2.5f;
+        prsi.lineWidth = 1.0f;
+
+        VkPipelineMultisampleStateCreateInfo pmsi {};
+        pmsi.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        pmsi.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineDepthStencilStateCreateInfo pdsci {};
+        pdsci.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        pdsci.depthTestEnable = VK_TRUE;
+        pdsci.depthWriteEnable = VK_TRUE;
+        pdsci.depthCompareOp = VK_COMPARE_OP_LESS;
+
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+        VkPipelineDynamicStateCreateInfo pdysci {};
+        pdysci.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        pdysci.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        pdysci.pDynamicStates = dynamicStates.data();
+
+        // Depth only, no fragment shader
+        VkGraphicsPipelineCreateInfo gpci {};
+        gpci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        gpci.stageCount = 1;
+        gpci.pStages = &stage;
+        gpci.pVertexInputState = &pvisi;
+        gpci.pInputAssemblyState = &piasi;
+        gpci.pViewportState = &pvsi;
+        gpci.pRasterizationState = &prsi;
+        gpci.pMultisampleState = &pmsi;
+        gpci.pDepthStencilState = &pdsci;
+        gpci.pDynamicState = &pdysci;
+        gpci.layout = m_PipelineLayout;
+        gpci.renderPass = m_StaticRenderPass;
+
+        result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &gpci, nullptr, &m_Pipeline);
+        if (result != VK_SUCCESS)
+            return result;
+
+        UpdateSceneBounds(scene);
+        return VK_SUCCESS;
+    }
+
+    void CascadedShadowMaps::Destroy(VkDevice device)
+    {
+        vkDestroyPipeline(device, m_Pipeline, nullptr);
+        vkDestroyPipelineLayout(device, m_PipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, m_DescriptorSetLayout, nullptr);
+        vkDestroyFramebuffer(device, m_StaticFramebuffer, nullptr);
+        vkDestroyFramebuffer(device, m_DynamicFramebuffer, nullptr);
+        vkDestroyRenderPass(device, m_StaticRenderPass, nullptr);
+        vkDestroyRenderPass(device, m_DynamicRenderPass, nullptr);
+        vkDestroySampler(device, m_Sampler, nullptr);
+
+        vkDestroyImageView(device, m_StaticAtlasView, nullptr);
+        vkDestroyImageView(device, m_DynamicAtlasView, nullptr);
+        for (VU::Image* pImage : { &m_StaticAtlas, &m_DynamicAtlas })
+        {
+            vkDestroyImage(device, pImage->image, nullptr);
+            vkFreeMemory(device, pImage->memory, nullptr);
+            *pImage = {};
+        }
+
+        if (m_pStaging)
+            vkUnmapMemory(device, m_StagingBuffer.memory);
+        m_pStaging = nullptr;
+
+        for (VU::Buffer* pBuffer : { &m_InstanceBuffer, &m_UniformBuffer, &m_StagingBuffer })
+        {
+            vkDestroyBuffer(device, pBuffer->buffer, nullptr);
+            vkFreeMemory(device, pBuffer->memory, nullptr);
+            *pBuffer = {};
+        }
+    }
+
+    void CascadedShadowMaps::InvalidateStatic(const SceneLoader::Scene& scene, const std::vector<uint32_t>& changedMeshes)
+    {
+        // Nothing cached yet, Update fits the bounds and draws every cascade anyway
+        if (!m_SceneBoundsValid || changedMeshes.empty())
+            return;
+
+        std::vector<bool> changed(scene.meshes.size(), false);
+        for (uint32_t m : changedMeshes)
+            changed[m] = true;
+
+        glm::vec3 changedMin(std::numeric_limits<float>::max());
+        glm::vec3 changedMax(std::numeric_limits<float>::lowest());
+        for (const auto& entity : scene.entities)
+        {
+            if (!changed[entity.meshId])
+                continue;
+
+            const SceneLoader::Mesh& mesh = scene.meshes[entity.meshId];
+            const glm::mat4& transform = scene.transforms[entity.transformId];
+            glm::vec3 worldMin(std::numeric_limits<float>::max());
+            glm::vec3 worldMax(std::numeric_limits<float>::lowest());
+            glm::vec2 lightMin(std::numeric_limits<float>::max());
+            glm::vec2 lightMax(std::numeric_limits<float>::lowest());
+            for (uint32_t corner = 0; corner < 8; corner++)
+            {
+                const glm::vec3 local((corner & 1) ? mesh.boundsMax.x : mesh.boundsMin.x,
+                                      (corner & 2) ? mesh.boundsMax.y : mesh.boundsMin.y,
+                                      (corner & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+                const glm::vec4 world = transform * glm::vec4(local, 1.0f);
+                const glm::vec2 light = glm::vec2(m_LightView * world);
+                worldMin = glm::min(worldMin, glm::vec3(world));
+                worldMax = glm::max(worldMax, glm::vec3(world));
+                lightMin = glm::min(lightMin, light);
+                lightMax = glm::max(lightMax, light);
+            }
+            changedMin = glm::min(changedMin, worldMin);
+            changedMax = glm::max(changedMax, worldMax);
+
+            // Dynamic entities are redrawn every frame, they only matter for the bounds
+            if (entity.isDynamic)
+                continue;
+
+            for (uint32_t c = 0; c < kCascadeCount; c++)
+            {
+                const Cascade& cascade = m_Cascades[c];
+                const glm::vec2 squareMin = glm::vec2(cascade.lightSpaceCenter) - cascade.paddedRadius;
+                const glm::vec2 squareMax = glm::vec2(cascade.lightSpaceCenter) + cascade.paddedRadius;
+                if (lightMin.x <= squareMax.x && lightMax.x >= squareMin.x && lightMin.y <= squareMax.y && lightMax.y >= squareMin.y)
+                    m_StaticValid[c] = false;
+            }
+        }
+
+        // Casters outside the bounds would fall out of the light depth range
+        if (glm::any(glm::lessThan(changedMin, m_SceneBoundsMin)) || glm::any(glm::greaterThan(changedMax, m_SceneBoundsMax)))
+        {
+            m_SceneBoundsMin = glm::min(m_SceneBoundsMin, changedMin);
+            m_SceneBoundsMax = glm::max(m_SceneBoundsMax, changedMax);
+            m_StaticValid.fill(false);
+        }
+    }
+
+    void CascadedShadowMaps::UpdateSceneBounds(const SceneLoader::Scene& scene)
+    {
+        m_SceneBoundsMin = glm::vec3(std::numeric_limits<float>::max());
+        m_SceneBoundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+        for (const auto& entity : scene.entities)
+        {
+            const SceneLoader::Mesh& mesh = scene.meshes[entity.meshId];
+            const glm::mat4& transform = scene.transforms[entity.transformId];
+            for (uint32_t corner = 0; corner < 8; corner++)
+            {
+                const glm::vec3 local((corner & 1) ? mesh.boundsMax.x : mesh.boundsMin.x,
+                                      (corner & 2) ? mesh.boundsMax.y : mesh.boundsMin.y,
+                                      (corner & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+                const glm::vec3 world = glm::vec3(transform * glm::vec4(local, 1.0f));
+                m_SceneBoundsMin = glm::min(m_SceneBoundsMin, world);
+                m_SceneBoundsMax = glm::max(m_SceneBoundsMax, world);
+            }
+        }
+
+        if (scene.entities.empty())
+        {
+            m_SceneBoundsMin = glm::vec3(-1.0f);
+            m_SceneBoundsMax = glm::vec3(1.0f);
+        }
+
+        // Dynamic entities may wander a little outside of where they were loaded
+        const glm::vec3 margin = (m_SceneBoundsMax - m_SceneBoundsMin) * 0.1f + glm::vec3(1.0f);
+        m_SceneBoundsMin -= margin;
+        m_SceneBoundsMax += margin;
+        m_SceneBoundsValid = true;
+    }
+
+    void CascadedShadowMaps::Update(const SceneLoader::Scene& scene, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane)
+    {
+        if (!m_SceneBoundsValid)
+            UpdateSceneBounds(scene);
+
+        const glm::vec3 sunDirection = glm::normalize(scene.sunDirection);
+        if (sunDirection != m_CachedSunDirection)
+        {
+            const glm::vec3 up = std::abs(sunDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            m_LightView = glm::lookAtRH(glm::vec3(0.0f), sunDirection, up);
+            m_CachedSunDirection = sunDirection;
+            m_StaticValid.fill(false);
+        }
+
+        // Light space depth range from the whole scene, so casters behind the view still land in the map
+        float minZ = std::numeric_limits<float>::max();
+        float maxZ = std::numeric_limits<float>::lowest();
+        for (uint32_t corner = 0; corner < 8; corner++)
+        {
+            const glm::vec3 world((corner & 1) ? m_SceneBoundsMax.x : m_SceneBoundsMin.x,
+                                  (corner & 2) ? m_SceneBoundsMax.y : m_SceneBoundsMin.y,
+                                  (corner & 4) ? m_SceneBoundsMax.z : m_SceneBoundsMin.z);
+            const float z = (m_LightView * glm::vec4(world, 1.0f)).z;
+            minZ = std::min(minZ, z);
+            maxZ = std::max(maxZ, z);
+        }
+
+        const glm::mat4 cameraTransform = glm::inverse(view);
+        const glm::mat4 inverseProjection = glm::inverse(projection);
+        const float shadowFar = std::min(farPlane, kShadowDistance);
+
+        m_StaticCascadeMask = 0;
+        float splitNear = nearPlane;
+        for (uint32_t c = 0; c < kCascadeCount; c++)
+        {
+            const float t = float(c + 1) / float(kCascadeCount);
+            const float logSplit = nearPlane * std::pow(shadowFar / nearPlane, t);
+            const float uniformSplit = nearPlane + (shadowFar - nearPlane) * t;
+            const float splitFar = kSplitLambda * logSplit + (1.0f - kSplitLambda) * uniformSplit;
+
+            // Bounding sphere of the slice, its radius does not change with camera rotation
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (uint32_t corner = 0; corner < 8; corner++)
+            {
+                const glm::vec4 ndc((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, 1.0f, 1.0f);
+                glm::vec4 ray = inverseProjection * ndc;
+                const glm::vec3 dir = glm::vec3(ray) / ray.w;
+                const float depth = (corner & 4) ? splitFar : splitNear;
+                corners[corner] = glm::vec3(cameraTransform * glm::vec4(dir * (depth / -dir.z), 1.0f));
+                center += corners[corner];
+            }
+            center /= 8.0f;
+
+            float radius = 0.0f;
+            for (const auto& corner : corners)
+                radius = std::max(radius, glm::length(corner - center));
+            // Rounded so float noise doesn't invalidate the cache
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            Cascade& cascade = m_Cascades[c];
+            const glm::vec3 lightSpaceCenter = glm::vec3(m_LightView * glm::vec4(center, 1.0f));
+            if (radius != cascade.radius)
+            {
+                cascade.radius = radius;
+                cascade.paddedRadius = radius * kCascadePadding;
+                m_StaticValid[c] = false;
+            }
+
+            // Re-center once the view sphere would leave the padded square
+            const glm::vec2 offset = glm::abs(glm::vec2(lightSpaceCenter) - glm::vec2(cascade.lightSpaceCenter));
+            if (!m_StaticValid[c] || std::max(offset.x, offset.y) > cascade.paddedRadius - cascade.radius)
+            {
+                // Snapped to whole texels, so re-centering never shifts the rasterization grid
+                const float texelSize = 2.0f * cascade.paddedRadius / float(kCascadeResolution);
+                cascade.lightSpaceCenter = glm::vec3(glm::round(glm::vec2(lightSpaceCenter) / texelSize) * texelSize, 0.0f);
+                m_StaticValid[c] = false;
+            }
+
+            const float r = cascade.paddedRadius;
+            const glm::vec2 s = glm::vec2(cascade.lightSpaceCenter);
+            const glm::mat4 lightProjection = glm::orthoRH_ZO(s.x - r, s.x + r, s.y - r, s.y + r, -maxZ - 1.0f, -minZ + 1.0f);
+
+            m_Uniforms.cascadeViewProj[c] = lightProjection * m_LightView;
+            m_Uniforms.cascadeSplits[c] = splitFar;
+            m_Uniforms.cascadeTexelSizes[c] = 2.0f * r / float(kCascadeResolution);
+
+            if (!m_StaticValid[c])
+                m_StaticCascadeMask |= 1u << c;
+
+            splitNear = splitFar;
+        }
+
+        m_Uniforms.sunDirection = glm::vec4(-sunDirection, 0.0f);
+        m_Uniforms.sunColor = glm::vec4(scene.sunColor, 0.0f);
+
+        m_Instances.clear();
+        m_StaticDraws.clear();
+        m_DynamicDraws.clear();
+        for (uint32_t c = 0; c < kCascadeCount; c++)
+        {
+            if (m_StaticCascadeMask & (1u << c))
+                BuildDraws(scene, c, false, m_StaticDraws);
+            BuildDraws(scene, c, true, m_DynamicDraws);
+        }
+    }
+
+    void CascadedShadowMaps::BuildDraws(const SceneLoader::Scene& scene, uint32_t cascade, bool dynamic, std::vector<ShadowDraw>& draws)
+    {
+        const RenderQueue::Frustum frustum = RenderQueue::ExtractFrustum(m_Uniforms.cascadeViewProj[cascade]);
+
+        m_VisibleEntities.clear();
+        for (uint32_t e = 0; e < scene.entities.size(); e++)
+        {
+            const SceneLoader::Entity& entity = scene.entities[e];
+            if (entity.isDynamic != dynamic)
+                continue;
+
+            const SceneLoader::Mesh& mesh = scene.meshes[entity.meshId];
+            if (RenderQueue::IsBoxVisible(frustum, scene.transforms[entity.transformId], mesh.boundsMin, mesh.boundsMax))
+                m_VisibleEntities.push_back(e);
+        }
+
+        // Same mesh next to each other, so runs become instanced draws
+        std::sort(m_VisibleEntities.begin(), m_VisibleEntities.end(), [&](uint32_t a, uint32_t b)
+        {
+            return scene.entities[a].meshId < scene.entities[b].meshId;
+        });
+
+        for (const uint32_t e : m_VisibleEntities)
+        {
+            if (m_Instances.size() >= kMaxShadowInstances)
+                break;
+
+            const SceneLoader::Entity& entity = scene.entities[e];
+            const uint32_t instance = static_cast<uint32_t>(m_Instances.size());
+            m_Instances.push_back(scene.transforms[entity.transformId]);
+
+            if (!draws.empty() && draws.back().cascade == cascade && draws.back().meshId == entity.meshId)
+                draws.back().instanceCount++;
+            else
+                draws.push_back({ cascade, entity.meshId, instance, 1 });
+        }
+    }
+
+    void CascadedShadowMaps::Upload(VkCommandBuffer cb, uint32_t frameIndex)
+    {
+        const VkDeviceSize slotOffset = m_StagingSlotSize * (frameIndex % m_StagingSlotCount);
+        uint8_t* pSlot = m_pStaging + slotOffset;
+
+        memcpy(pSlot, &m_Uniforms, sizeof(ShadowUniforms));
+        memcpy(pSlot + sizeof(ShadowUniforms), m_Instances.data(), sizeof(glm::mat4) * m_Instances.size());
+
+        // Synchronized by the render graph pass that records this
+        VkBufferCopy copyRegion {};
+        copyRegion.srcOffset = slotOffset;
+        copyRegion.size = sizeof(ShadowUniforms);
+        vkCmdCopyBuffer(cb, m_StagingBuffer.buffer, m_UniformBuffer.buffer, 1, &copyRegion);
+
+        if (m_Instances.empty())
+            return;
+
+        copyRegion.srcOffset = slotOffset + sizeof(ShadowUniforms);
+        copyRegion.size = sizeof(glm::mat4) * m_Instances.size();
+        vkCmdCopyBuffer(cb, m_StagingBuffer.buffer, m_InstanceBuffer.buffer, 1, &copyRegion);
+    }
+
+    void CascadedShadowMaps::RecordDraws(VkCommandBuffer cb, const SceneLoader::Scene& scene, const std::vector<ShadowDraw>& draws) const
+    {
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_Pipeline);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout, 0, 1, &m_DescriptorSet, 0, nullptr);
+
+        const VkDeviceSize offset = 0;
+        const VkBuffer positionBuffer = scene.pGeometryPool->GetVertexBuffer(kPositionStream);
+        const VkBuffer indexBuffer = scene.pGeometryPool->GetIndexBuffer();
+        vkCmdBindVertexBuffers(cb, 0, 1, &positionBuffer, &offset);
+
+        uint32_t boundCascade = ~0u;
+        VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+        for (const auto& draw : draws)
+        {
+            if (draw.cascade != boundCascade)
+            {
+                const VkRect2D rect = GetCascadeRect(draw.cascade);
+
+                VkViewport viewport {};
+                viewport.x = static_cast<float>(rect.offset.x);
+                viewport.y = static_cast<float>(rect.offset.y);
+                viewport.width = static_cast<float>(rect.extent.width);
+                viewport.height = static_cast<float>(rect.extent.height);
+                viewport.maxDepth = 1.0f;
+
+                vkCmdSetViewport(cb, 0, 1, &viewport);
+                vkCmdSetScissor(cb, 0, 1, &rect);
+                vkCmdPushConstants(cb, m_PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &m_Uniforms.cascadeViewProj[draw.cascade]);
+                boundCascade = draw.cascade;
+            }
+
+            const SceneLoader::Mesh& mesh = scene.meshes[draw.meshId];
+            if (mesh.indexType != boundIndexType)
+            {
+                vkCmdBindIndexBuffer(cb, indexBuffer, 0, mesh.indexType);
+                boundIndexType = mesh.indexType;
+            }
+            vkCmdDrawIndexed(cb, mesh.indexCount, draw.instanceCount, mesh.indexOffset, mesh.vertexOffset, draw.firstInstance);
+        }
+    }
+
+    void CascadedShadowMaps::RenderStatic(VkCommandBuffer cb, const SceneLoader::Scene& scene)
+    {
+        VkRenderPassBeginInfo rpbi {};
+        rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        rpbi.renderPass = m_StaticRenderPass;
+        rpbi.framebuffer = m_StaticFramebuffer;
+        rpbi.renderArea.extent = { kAtlasSize, kAtlasSize };
+
+        vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+
+        // Only the invalid tiles are cleared, the rest of the atlas is kept
+        for (uint32_t c = 0; c < kCascadeCount; c++)
+        {
+            if (!(m_StaticCascadeMask & (1u << c)))
+                continue;
+
+            VkClearAttachment clear {};
+            clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+            clear.clearValue.depthStencil.depth = 1.0f;
+
+            VkClearRect clearRect {};
+            clearRect.rect = GetCascadeRect(c);
+            clearRect.layerCount = 1;
+
+            vkCmdClearAttachments(cb, 1, &clear, 1, &clearRect);
+            m_StaticValid[c] = true;
+        }
+
+        RecordDraws(cb, scene, m_StaticDraws);
+        vkCmdEndRenderPass(cb);
+
+        m_StaticCascadeMask = 0;
+    }
+
+    void CascadedShadowMaps::RenderDynamic(VkCommandBuffer cb, const SceneLoader::Scene& scene)
+    {
+        VkClearValue clearValue {};
+        clearValue.depthStencil.depth = 1.0f;
+
+        VkRenderPassBeginInfo rpbi {};
+        rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        rpbi.renderPass = m_DynamicRenderPass;
+        rpbi.framebuffer = m_DynamicFramebuffer;
+        rpbi.renderArea.extent = { kAtlasSize, kAtlasSize };
+        rpbi.clearValueCount = 1;
+        rpbi.pClearValues = &clearValue;
+
+        vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+        RecordDraws(cb, scene, m_DynamicDraws);
+        vkCmdEndRenderPass(cb);
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "SceneLoader.h"
+
+#include <array>
+#include <vector>
+
+namespace Shadows
+{
+    inline constexpr uint32_t kCascadeCount = 4;
+    // Cascades are 2x2 tiles of one atlas
+    inline constexpr uint32_t kCascadeResolution = 2048;
+    inline constexpr uint32_t kAtlasSize = kCascadeResolution * 2;
+    inline constexpr VkFormat kShadowFormat = VK_FORMAT_D16_UNORM;
+    // Cascades cover more than the view needs, so the cached static depth stays valid
+    // until the camera leaves the padding
+    inline constexpr float kCascadePadding = 1.25f;
+    inline constexpr float kShadowDistance = 150.0f;
+    // Blend between logarithmic and uniform cascade splits
+    inline constexpr float kSplitLambda = 0.75f;
+    inline constexpr uint32_t kMaxShadowInstances = 65536;
+
+    // Mirrors ShadowUniforms in shadows.glsl
+    struct ShadowUniforms
+    {
+        glm::mat4 cascadeViewProj[kCascadeCount];
+        // Far view depth of each cascade
+        glm::vec4 cascadeSplits;
+        // World size of one shadow texel, for the normal offset
+        glm::vec4 cascadeTexelSizes;
+        // xyz towards the sun
+        glm::vec4 sunDirection;
+        glm::vec4 sunColor;
+    };
+
+    // Directional light cascades rendered from the position-only stream. Static entities go into
+    // a cached atlas that is only redrawn per cascade when it gets re-centered, the sun moves or
+    // InvalidateStatic is called. Dynamic entities are drawn every frame into a second atlas with
+    // the same cascade matrices, the shaders take the minimum of both.
+    class CascadedShadowMaps
+    {
+    public:
+        CascadedShadowMaps() = default;
+
+        // Writes the shadow bindings of the lighting descriptor set
+        VkResult Initialize(imp::Engine& engine, VkShaderModule vertModule, const SceneLoader::Scene& scene, uint32_t framesInFlight, VkDescriptorSet lightingSet);
+        void Destroy(VkDevice device);
+
+        // Static geometry changed, every cascade is redrawn next frame
+        void InvalidateStatic() { m_StaticValid.fill(false); m_SceneBoundsValid = false; }
+        // Meshes were added or removed, only the cascades their entities overlap are redrawn. The scene bounds are
+        // kept and only grown, which redraws every cascade since their depth range changes.
+        void InvalidateStatic(const SceneLoader::Scene& scene, const std::vector<uint32_t>& changedMeshes);
+
+        // Fits the cascades to the view and builds the shadow draw lists
+        void Update(const SceneLoader::Scene& scene, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane);
+
+        void Upload(VkCommandBuffer cb, uint32_t frameIndex);
+        bool HasStaticWork() const { return m_StaticCascadeMask != 0; }
+        void RenderStatic(VkCommandBuffer cb, const SceneLoader::Scene& scene);
+        void RenderDynamic(VkCommandBuffer cb, const SceneLoader::Scene& scene);
+
+        VkImage GetStaticAtlas() const { return m_StaticAtlas.image; }
+        VkImageView GetStaticAtlasView() const { return m_StaticAtlasView; }
+        VkImage GetDynamicAtlas() const { return m_DynamicAtlas.image; }
+        VkImageView GetDynamicAtlasView() const { return m_DynamicAtlasView; }
+        VkBuffer GetInstanceBuffer() const { return m_InstanceBuffer.buffer; }
+        VkBuffer GetUniformBuffer() const { return m_UniformBuffer.buffer; }
+
+    private:
+        struct ShadowDraw
+        {
+            uint32_t cascade;
+            uint32_t meshId;
+            uint32_t firstInstance;
+            uint32_t instanceCount;
+        };
+
+        struct Cascade
+        {
+            glm::vec3 lightSpaceCenter = glm::vec3(0.0f);
+            float radius = 0.0f;
+            float paddedRadius = 0.0f;
+        };
+
+        void UpdateSceneBounds(const SceneLoader::Scene& scene);
+        void BuildDraws(const SceneLoader::Scene& scene, uint32_t cascade, bool dynamic, std::vector<ShadowDraw>& draws);
+        void RecordDraws(VkCommandBuffer cb, const SceneLoader::Scene& scene, const std::vector<ShadowDraw>& draws) const;
+
+        Cascade m_Cascades[kCascadeCount] {};
+        std::array<bool, kCascadeCount> m_StaticValid {};
+        uint32_t m_StaticCascadeMask = 0;
+        glm::vec3 m_CachedSunDirection = glm::vec3(0.0f);
+        glm::mat4 m_LightView = glm::mat4(1.0f);
+
+        bool m_SceneBoundsValid = false;
+        glm::vec3 m_SceneBoundsMin = glm::vec3(0.0f);
+        glm::vec3 m_SceneBoundsMax = glm::vec3(0.0f);
+
+        ShadowUniforms m_Uniforms {};
+        std::vector<glm::mat4> m_Instances;
+        std::vector<ShadowDraw> m_StaticDraws;
+        std::vector<ShadowDraw> m_DynamicDraws;
+        std::vector<uint32_t> m_VisibleEntities;
+
+        VU::Image m_StaticAtlas {};
+        VU::Image m_DynamicAtlas {};
+        VkImageView m_StaticAtlasView = VK_NULL_HANDLE;
+        VkImageView m_DynamicAtlasView = VK_NULL_HANDLE;
+        VkSampler m_Sampler = VK_NULL_HANDLE;
+
+        VU::Buffer m_InstanceBuffer {};
+        VU::Buffer m_UniformBuffer {};
+        VU::Buffer m_StagingBuffer {};
+        uint8_t* m_pStaging = nullptr;
+        VkDeviceSize m_StagingSlotSize = 0;
+        uint32_t m_StagingSlotCount = 0;
+
+        VkRenderPass m_StaticRenderPass = VK_NULL_HANDLE;
+        VkRenderPass m_DynamicRenderPass = VK_NULL_HANDLE;
+        VkFramebuffer m_StaticFramebuffer = VK_NULL_HANDLE;
+        VkFramebuffer m_DynamicFramebuffer = VK_NULL_HANDLE;
+        VkDescriptorSetLayout m_DescriptorSetLayout = VK_NULL_HANDLE;
+        VkDescriptorSet m_DescriptorSet = VK_NULL_HANDLE;
+        VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
+        VkPipeline m_Pipeline = VK_NULL_HANDLE;
+    };
+}
@@ -0,0 +1,314 @@
+#include "ClusteredLighting.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+
+namespace ClusteredLighting
+{
+    float GetLightRange(const SceneLoader::Light& light)
+    {
+        if (light.range > 0.0f)
+            return light.range;
+
+        // Inverse square falloff reaches the cutoff at sqrt(intensity / cutoff)
+        const float peak = std::max({ light.color.r, light.color.g, light.color.b }) * light.intensity;
+        return std::sqrt(std::max(peak, 0.0f) / kLightCutoff);
+    }
+
+    GpuLight MakeGpuLight(const SceneLoader::Light& light)
+    {
+        GpuLight gpuLight {};
+        gpuLight.position = light.position;
+        gpuLight.range = GetLightRange(light);
+        gpuLight.color = light.color * light.intensity;
+        gpuLight.direction = light.direction;
+        gpuLight.type = static_cast<uint32_t>(light.type);
+
+        if (light.type == SceneLoader::LightType::Spot)
+        {
+            // Falloff from the glTF KHR_lights_punctual spec
+            const float cosInner = std::cos(light.innerConeAngle);
+            const float cosOuter = std::cos(light.outerConeAngle);
+            gpuLight.spotScale = 1.0f / std::max(cosInner - cosOuter, 0.001f);
+            gpuLight.spotOffset = -cosOuter * gpuLight.spotScale;
+            gpuLight.cosOuterCone = cosOuter;
+            gpuLight.sinOuterCone = std::sin(light.outerConeAngle);
+        }
+        else
+        {
+            gpuLight.spotScale = 0.0f;
+            gpuLight.spotOffset = 1.0f;
+            gpuLight.cosOuterCone = -1.0f;
+            gpuLight.sinOuterCone = 0.0f;
+        }
+
+        return gpuLight;
+    }
+
+    glm::vec3 AddRandomLights(SceneLoader::Scene& scene, uint32_t count, uint32_t seed)
+    {
+        glm::vec3 boundsMin(std::numeric_limits<float>::max());
+        glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+        for (const auto& entity : scene.entities)
+        {
+            const SceneLoader::Mesh& mesh = scene.meshes[entity.meshId];
+            const glm::mat4& transform = scene.transforms[entity.transformId];
+            for (uint32_t corner = 0; corner < 8; corner++)
+            {
+                const glm::vec3 local((corner & 1) ? mesh.boundsMax.x : mesh.boundsMin.x,
+                                      (corner & 2) ? mesh.boundsMax.y : mesh.boundsMin.y,
+                                      (corner & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+                const glm::vec3 world = glm::vec3(transform * glm::vec4(local, 1.0f));
+                boundsMin = glm::min(boundsMin, world);
+                boundsMax = glm::max(boundsMax, world);
+            }
+        }
+
+        if (scene.entities.empty())
+        {
+            boundsMin = glm::vec3(-10.0f);
+            boundsMax = glm::vec3(10.0f);
+        }
+
+        // Sized so a few dozen lights overlap any point of the scene
+        const glm::vec3 extent = boundsMax - boundsMin;
+        const float baseRange = std::max(std::cbrt(extent.x * extent.y * extent.z / float(std::max(count, 1u))) * 2.0f, 1.0f);
+
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        scene.lights.reserve(scene.lights.size() + count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            SceneLoader::Light light {};
+            light.type = (i & 3) == 3 ? SceneLoader::LightType::Spot : SceneLoader::LightType::Point;
+            light.position = boundsMin + extent * glm::vec3(unit(rng), unit(rng), unit(rng));
+            light.direction = glm::normalize(glm::vec3(unit(rng) - 0.5f, -1.0f, unit(rng) - 0.5f));
+            light.color = glm::vec3(0.2f) + 0.8f * glm::vec3(unit(rng), unit(rng), unit(rng));
+            light.range = baseRange * (0.5f + unit(rng));
+            // Reaches the cutoff roughly at the range
+            light.intensity = light.range * light.range * kLightCutoff;
+            light.innerConeAngle = 0.3f;
+            light.outerConeAngle = 0.6f;
+            scene.lights.push_back(light);
+        }
+
+        return (boundsMin + boundsMax) * 0.5f;
+    }
+
+    void AnimateLights(const std::vector<SceneLoader::Light>& baseLights, size_t firstAnimated, const glm::vec3& center, float time, std::vector<SceneLoader::Light>& lights)
+    {
+        lights = baseLights;
+        for (size_t i = firstAnimated; i < lights.size(); i++)
+        {
+            // Alternate direction and vary speed so the lights don't move as one rigid body
+            const float speed = (0.1f + 0.05f * float(i % 7)) * ((i & 1) ? 1.0f : -1.0f);
+            const float angle = time * speed;
+            const float c = std::cos(angle);
+            const float s = std::sin(angle);
+
+            const glm::vec3 offset = baseLights[i].position - center;
+            lights[i].position = center + glm::vec3(offset.x * c - offset.z * s, offset.y, offset.x * s + offset.z * c);
+
+            const glm::vec3 dir = baseLights[i].direction;
+            lights[i].direction = glm::vec3(dir.x * c - dir.z * s, dir.y, dir.x * s + dir.z * c);
+        }
+    }
+
+    VkResult LightCuller::Initialize(imp::Engine& engine, VkShaderModule computeModule, uint32_t framesInFlight)
+    {
+        VkPhysicalDevice pDevice = engine.GetPhysicalDevice();
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+
+        VkResult result = VU::CreateBuffer(pDevice, device, sizeof(GpuLight) * kMaxLights,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_LightBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = VU::CreateBuffer(pDevice, device, sizeof(ClusterUniforms),
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_UniformBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = VU::CreateBuffer(pDevice, device, sizeof(uint32_t) * kClusterCount,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_ClusterBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = VU::CreateBuffer(pDevice, device, sizeof(uint32_t) * kClusterCount * kMaxLightsPerCluster,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_LightIndexBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        // One slot per frame in flight, each holds the uniforms followed by the lights
+        m_StagingSlotSize = (sizeof(ClusterUniforms) + sizeof(GpuLight) * kMaxLights + 255) & ~VkDeviceSize(255);
+        m_StagingSlotCount = std::max(framesInFlight, 1u);
+        result = VU::CreateBuffer(pDevice, device, m_StagingSlotSize * m_StagingSlotCount,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_StagingBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        void* pStaging = nullptr;
+        result = vkMapMemory(device, m_StagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &pStaging);
+        if (result != VK_SUCCESS)
+            return result;
+        m_pStaging = static_cast<uint8_t*>(pStaging);
+
+        // 4 to 6 are the sun shadow uniforms and atlases, written by CascadedShadowMaps
+        std::array<VkDescriptorSetLayoutBinding, 7> bindings {};
+        for (uint32_t i = 0; i < bindings.size(); i++)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        for (uint32_t i = 4; i < bindings.size(); i++)
+            bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorSetLayoutCreateInfo dslci {};
+        dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        dslci.bindingCount = static_cast<uint32_t>(bindings.size());
+        dslci.pBindings = bindings.data();
+
+        result = vkCreateDescriptorSetLayout(device, &dslci, nullptr, &m_DescriptorSetLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkDescriptorSetAllocateInfo dsai {};
+        dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        dsai.descriptorPool = engine.GetDescriptorPool();
+        dsai.descriptorSetCount = 1;
+        dsai.pSetLayouts = &m_DescriptorSetLayout;
+
+        result = vkAllocateDescriptorSets(device, &dsai, &m_DescriptorSet);
+        if (result != VK_SUCCESS)
+            return result;
+
+        std::array<VkDescriptorBufferInfo, 4> bi {};
+        bi[0].buffer = m_LightBuffer.buffer;
+        bi[0].range = VK_WHOLE_SIZE;
+        bi[1].buffer = m_ClusterBuffer.buffer;
+        bi[1].range = VK_WHOLE_SIZE;
+        bi[2].buffer = m_LightIndexBuffer.buffer;
+        bi[2].range = VK_WHOLE_SIZE;
+        bi[3].buffer = m_UniformBuffer.buffer;
+        bi[3].range = VK_WHOLE_SIZE;
+
+        std::array<VkWriteDescriptorSet, 2> writes {};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].dstSet = m_DescriptorSet;
+        writes[0].dstBinding = 0;
+        writes[0].descriptorCount = 3;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[0].pBufferInfo = bi.data();
+        writes[1] = writes[0];
+        writes[1].dstBinding = 3;
+        writes[1].descriptorCount = 1;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        writes[1].pBufferInfo = &bi[3];
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+        VkPipelineLayoutCreateInfo plci {};
+        plci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        plci.setLayoutCount = 1;
+        plci.pSetLayouts = &m_DescriptorSetLayout;
+
+        result = vkCreatePipelineLayout(device, &plci, nullptr, &m_PipelineLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkComputePipelineCreateInfo cpci {};
+        cpci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        cpci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        cpci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        cpci.stage.module = computeModule;
+        cpci.stage.pName = "main";
+        cpci.layout = m_PipelineLayout;
+
+        return vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &cpci, nullptr, &m_Pipeline);
+    }
+
+    void LightCuller::Destroy(VkDevice device)
+    {
+        vkDestroyPipeline(device, m_Pipeline, nullptr);
+        vkDestroyPipelineLayout(device, m_PipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, m_DescriptorSetLayout, nullptr);
+
+        if (m_pStaging)
+            vkUnmapMemory(device, m_StagingBuffer.memory);
+        m_pStaging = nullptr;
+
+        for (VU::Buffer* pBuffer : { &m_LightBuffer, &m_UniformBuffer, &m_ClusterBuffer, &m_LightIndexBuffer, &m_StagingBuffer })
+        {
+            vkDestroyBuffer(device, pBuffer->buffer, nullptr);
+            vkFreeMemory(device, pBuffer->memory, nullptr);
+            *pBuffer = {};
+        }
+    }
+
+    void LightCuller::Update(const std::vector<SceneLoader::Light>& lights, const glm::mat4& view, const glm::mat4& projection,
+        float nearPlane, float farPlane, uint32_t width, uint32_t height)
+    {
+        if (lights.size() > kMaxLights)
+        {
+            static bool warned = false;
+            if (!warned)
+                printf("[Lighting] Warning: %zu lights, only the first %u are used.\n", lights.size(), kMaxLights);
+            warned = true;
+        }
+
+        const size_t lightCount = std::min<size_t>(lights.size(), kMaxLights);
+        m_Lights.resize(lightCount);
+        for (size_t i = 0; i < lightCount; i++)
+            m_Lights[i] = MakeGpuLight(lights[i]);
+
+        // Exponential slices keep clusters roughly cubic in view space
+        const float logDepthRange = std::log(farPlane / nearPlane);
+
+        m_Uniforms.view = view;
+        m_Uniforms.inverseProjection = glm::inverse(projection);
+        m_Uniforms.gridSize = glm::uvec4(kClusterCountX, kClusterCountY, kClusterCountZ, static_cast<uint32_t>(lightCount));
+        m_Uniforms.screenSize = glm::vec4(float(width), float(height), 0.0f, 0.0f);
+        m_Uniforms.depthSlicing = glm::vec4(float(kClusterCountZ) / logDepthRange, -float(kClusterCountZ) * std::log(nearPlane) / logDepthRange, nearPlane, farPlane);
+    }
+
+    void LightCuller::Upload(VkCommandBuffer cb, uint32_t frameIndex)
+    {
+        const VkDeviceSize slotOffset = m_StagingSlotSize * (frameIndex % m_StagingSlotCount);
+        uint8_t* pSlot = m_pStaging + slotOffset;
+
+        memcpy(pSlot, &m_Uniforms, sizeof(ClusterUniforms));
+        memcpy(pSlot + sizeof(ClusterUniforms), m_Lights.data(), sizeof(GpuLight) * m_Lights.size());
+
+        // Synchronized by the render graph pass that records this
+        VkBufferCopy copyRegion {};
+        copyRegion.srcOffset = slotOffset;
+        copyRegion.size = sizeof(ClusterUniforms);
+        vkCmdCopyBuffer(cb, m_StagingBuffer.buffer, m_UniformBuffer.buffer, 1, &copyRegion);
+
+        if (m_Lights.empty())
+            return;
+
+        copyRegion.srcOffset = slotOffset + sizeof(ClusterUniforms);
+        copyRegion.size = sizeof(GpuLight) * m_Lights.size();
+        vkCmdCopyBuffer(cb, m_StagingBuffer.buffer, m_LightBuffer.buffer, 1, &copyRegion);
+    }
+
+    void LightCuller::Dispatch(VkCommandBuffer cb) const
+    {
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, 1, &m_DescriptorSet, 0, nullptr);
+        vkCmdDispatch(cb, (kClusterCount + kWorkgroupSize - 1) / kWorkgroupSize, 1, 1);
+    }
+}
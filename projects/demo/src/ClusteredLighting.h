@@ -0,0 +1,104 @@
+#pragma once
+#include "SceneLoader.h"
+
+#include <vector>
+
+namespace ClusteredLighting
+{
+    // View frustum split into 16x9 screen tiles and 24 exponential depth slices
+    inline constexpr uint32_t kClusterCountX = 16;
+    inline constexpr uint32_t kClusterCountY = 9;
+    inline constexpr uint32_t kClusterCountZ = 24;
+    inline constexpr uint32_t kClusterCount = kClusterCountX * kClusterCountY * kClusterCountZ;
+    // Must match kMaxLightsPerCluster in clustered_lighting.glsl
+    inline constexpr uint32_t kMaxLightsPerCluster = 128;
+    inline constexpr uint32_t kMaxLights = 4096;
+    // Must match local_size_x in cluster_lights.comp
+    inline constexpr uint32_t kWorkgroupSize = 64;
+    // Lights without a range reach until their intensity falls below this
+    inline constexpr float kLightCutoff = 0.01f;
+
+    // Mirrors Light in clustered_lighting.glsl
+    struct GpuLight
+    {
+        glm::vec3 position;
+        float range;
+        // Premultiplied by intensity
+        glm::vec3 color;
+        // Spot cone falloff is saturate(cos * scale + offset), 0 and 1 for point lights
+        float spotScale;
+        glm::vec3 direction;
+        float spotOffset;
+        float cosOuterCone;
+        float sinOuterCone;
+        uint32_t type;
+        uint32_t padding;
+    };
+    static_assert(sizeof(GpuLight) == 64);
+
+    // Mirrors ClusterUniforms in clustered_lighting.glsl
+    struct ClusterUniforms
+    {
+        glm::mat4 view;
+        glm::mat4 inverseProjection;
+        // xyz cluster count, w light count
+        glm::uvec4 gridSize;
+        // width, height
+        glm::vec4 screenSize;
+        // slice = log(viewDepth) * x + y
+        glm::vec4 depthSlicing;
+    };
+
+    float GetLightRange(const SceneLoader::Light& light);
+    GpuLight MakeGpuLight(const SceneLoader::Light& light);
+
+    // Scatters point and spot lights inside the scene bounds, for stress testing. Returns the bounds center.
+    glm::vec3 AddRandomLights(SceneLoader::Scene& scene, uint32_t count, uint32_t seed);
+    // Orbits lights from firstAnimated on around the vertical axis through center
+    void AnimateLights(const std::vector<SceneLoader::Light>& baseLights, size_t firstAnimated, const glm::vec3& center, float time, std::vector<SceneLoader::Light>& lights);
+
+    // Bins lights into a froxel grid on the GPU. The light list of each cluster is
+    // written to a fixed slot of kMaxLightsPerCluster indices, so no counters need clearing.
+    class LightCuller
+    {
+    public:
+        LightCuller() = default;
+
+        VkResult Initialize(imp::Engine& engine, VkShaderModule computeModule, uint32_t framesInFlight);
+        void Destroy(VkDevice device);
+
+        void Update(const std::vector<SceneLoader::Light>& lights, const glm::mat4& view, const glm::mat4& projection,
+            float nearPlane, float farPlane, uint32_t width, uint32_t height);
+
+        // Copies the lights and uniforms of Update through the staging slot of frameIndex,
+        // the slot must not be in use by the GPU anymore
+        void Upload(VkCommandBuffer cb, uint32_t frameIndex);
+        void Dispatch(VkCommandBuffer cb) const;
+
+        VkDescriptorSetLayout GetDescriptorSetLayout() const { return m_DescriptorSetLayout; }
+        VkDescriptorSet GetDescriptorSet() const { return m_DescriptorSet; }
+        VkBuffer GetLightBuffer() const { return m_LightBuffer.buffer; }
+        VkBuffer GetUniformBuffer() const { return m_UniformBuffer.buffer; }
+        VkBuffer GetClusterBuffer() const { return m_ClusterBuffer.buffer; }
+        VkBuffer GetLightIndexBuffer() const { return m_LightIndexBuffer.buffer; }
+        uint32_t GetLightCount() const { return m_Uniforms.gridSize.w; }
+
+    private:
+        VU::Buffer m_LightBuffer {};
+        VU::Buffer m_UniformBuffer {};
+        VU::Buffer m_ClusterBuffer {};
+        VU::Buffer m_LightIndexBuffer {};
+        VU::Buffer m_StagingBuffer {};
+        uint8_t* m_pStaging = nullptr;
+        VkDeviceSize m_StagingSlotSize = 0;
+        uint32_t m_StagingSlotCount = 0;
+
+        VkDescriptorSetLayout m_DescriptorSetLayout = VK_NULL_HANDLE;
+        VkDescriptorSet m_DescriptorSet = VK_NULL_HANDLE;
+        VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
+        VkPipeline m_Pipeline = VK_NULL_HANDLE;
+
+        std::vector<GpuLight> m_Lights;
+        ClusterUniforms m_Uniforms {};
+    };
+}
@@ -0,0 +1,126 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace DynamicResolution
+{
+    // Aim a little under the target so small spikes still fit
+    inline constexpr float kHeadroom = 0.9f;
+    // Smoothing of the measured time, rising times are followed much faster than falling ones
+    inline constexpr float kRiseSmoothing = 0.5f;
+    inline constexpr float kFallSmoothing = 0.05f;
+    inline constexpr float kMaxScaleUpStep = 0.05f;
+    // Frames still in flight were recorded at the old scale, their times are ignored for a while
+    inline constexpr uint32_t kScaleDownDelayFrames = 4;
+    inline constexpr uint32_t kScaleUpDelayFrames = 30;
+
+    VkResult GpuTimer::Initialize(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t framesInFlight)
+    {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(physicalDevice, &props);
+        if (!props.limits.timestampComputeAndGraphics)
+        {
+            printf("[DynamicResolution] Timestamps are not supported, keeping the resolution fixed\n");
+            return VK_SUCCESS;
+        }
+        m_TimestampPeriodNs = props.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo qpci {};
+        qpci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        qpci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        qpci.queryCount = framesInFlight * 2;
+
+        m_Pending.assign(framesInFlight, false);
+        return vkCreateQueryPool(device, &qpci, nullptr, &m_QueryPool);
+    }
+
+    void GpuTimer::Destroy(VkDevice device)
+    {
+        vkDestroyQueryPool(device, m_QueryPool, nullptr);
+        m_QueryPool = VK_NULL_HANDLE;
+    }
+
+    void GpuTimer::Begin(VkCommandBuffer cb, uint32_t frameIndex)
+    {
+        if (!IsSupported())
+            return;
+
+        vkCmdResetQueryPool(cb, m_QueryPool, frameIndex * 2, 2);
+        vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_QueryPool, frameIndex * 2);
+    }
+
+    void GpuTimer::End(VkCommandBuffer cb, uint32_t frameIndex)
+    {
+        if (!IsSupported())
+            return;
+
+        vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_QueryPool, frameIndex * 2 + 1);
+        m_Pending[frameIndex] = true;
+    }
+
+    float GpuTimer::Resolve(VkDevice device, uint32_t frameIndex)
+    {
+        if (!IsSupported() || !m_Pending[frameIndex])
+            return -1.0f;
+
+        // The frame was already waited on, so this never stalls
+        uint64_t timestamps[2] = {};
+        const VkResult result = vkGetQueryPoolResults(device, m_QueryPool, frameIndex * 2, 2, sizeof(timestamps), timestamps,
+            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        m_Pending[frameIndex] = false;
+        if (result != VK_SUCCESS || timestamps[1] < timestamps[0])
+            return -1.0f;
+
+        return static_cast<float>(double(timestamps[1] - timestamps[0]) * m_TimestampPeriodNs / 1e6);
+    }
+
+    Controller::Controller(const ControllerParams& params)
+        : m_Params(params)
+        , m_Scale(params.maxScale)
+    {
+    }
+
+    float Controller::Update(float gpuFrameMs)
+    {
+        if (gpuFrameMs <= 0.0f)
+            return m_Scale;
+
+        if (m_SmoothedMs <= 0.0f)
+            m_SmoothedMs = gpuFrameMs;
+        else
+            m_SmoothedMs += (gpuFrameMs - m_SmoothedMs) * (gpuFrameMs > m_SmoothedMs ? kRiseSmoothing : kFallSmoothing);
+
+        m_FramesSinceChange++;
+
+        const float budgetMs = m_Params.targetFrameMs * kHeadroom;
+        const float desired = std::clamp(m_Scale * std::sqrt(budgetMs / m_SmoothedMs), m_Params.minScale, m_Params.maxScale);
+
+        if (m_SmoothedMs > m_Params.targetFrameMs && desired < m_Scale && m_FramesSinceChange >= kScaleDownDelayFrames)
+        {
+            m_Scale = desired;
+            m_FramesSinceChange = 0;
+            // Start over from the budget so the old extent's time doesn't push the scale down again
+            m_SmoothedMs = budgetMs;
+        }
+        else if (desired > m_Scale && m_FramesSinceChange >= kScaleUpDelayFrames)
+        {
+            m_Scale = std::min(desired, m_Scale + kMaxScaleUpStep);
+            m_FramesSinceChange = 0;
+        }
+
+        return m_Scale;
+    }
+
+    VkExtent2D Controller::GetRenderExtent(uint32_t width, uint32_t height) const
+    {
+        const auto scaleAxis = [&](uint32_t size)
+        {
+            uint32_t scaled = static_cast<uint32_t>(float(size) * m_Scale + 0.5f);
+            scaled = (scaled + kExtentGranularity / 2) / kExtentGranularity * kExtentGranularity;
+            return std::clamp(scaled, std::min(kExtentGranularity, size), size);
+        };
+        return { scaleAxis(width), scaleAxis(height) };
+    }
+}
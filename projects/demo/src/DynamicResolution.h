@@ -0,0 +1,67 @@
+#pragma once
+#include "vkutilities.h"
+
+#include <vector>
+
+namespace DynamicResolution
+{
+    // Render extents are rounded to this, so small scale changes don't touch every frame
+    inline constexpr uint32_t kExtentGranularity = 8;
+
+    struct ControllerParams
+    {
+        // GPU time to hold, in milliseconds
+        float targetFrameMs = 16.0f;
+        // Bounds of the per-axis render scale
+        float minScale = 0.5f;
+        float maxScale = 1.0f;
+    };
+
+    // Frame timestamps, one query pair per frame in flight. A slot is read back
+    // once the frame pacing has waited for the frame that wrote it.
+    class GpuTimer
+    {
+    public:
+        GpuTimer() = default;
+
+        VkResult Initialize(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t framesInFlight);
+        void Destroy(VkDevice device);
+
+        // False when the queue can't write timestamps, the controller then holds its scale
+        bool IsSupported() const { return m_QueryPool != VK_NULL_HANDLE; }
+
+        void Begin(VkCommandBuffer cb, uint32_t frameIndex);
+        void End(VkCommandBuffer cb, uint32_t frameIndex);
+
+        // GPU time of the last frame recorded in this slot, negative if there is none yet
+        float Resolve(VkDevice device, uint32_t frameIndex);
+
+    private:
+        VkQueryPool m_QueryPool = VK_NULL_HANDLE;
+        float m_TimestampPeriodNs = 1.0f;
+        std::vector<bool> m_Pending;
+    };
+
+    // Scales the internal render extent so the GPU frame time stays under the target.
+    // GPU time is assumed to follow the pixel count, so the scale moves by the square root
+    // of the time ratio. Load spikes are followed within a frame or two, recovery is slow
+    // so the resolution doesn't oscillate.
+    class Controller
+    {
+    public:
+        Controller() = default;
+        explicit Controller(const ControllerParams& params);
+
+        // Feed the GPU time of a finished frame, returns the new scale
+        float Update(float gpuFrameMs);
+
+        float GetScale() const { return m_Scale; }
+        VkExtent2D GetRenderExtent(uint32_t width, uint32_t height) const;
+
+    private:
+        ControllerParams m_Params {};
+        float m_Scale = 1.0f;
+        float m_SmoothedMs = 0.0f;
+        uint32_t m_FramesSinceChange = 0;
+    };
+}
@@ -0,0 +1,141 @@
+#include "GeometryRegistry.h"
+
+#include <algorithm>
+#include <cstring>
+
+inline constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+inline constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+inline constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+
+static uint64_t Rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t Avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static void ProcessBlock(uint64_t* lanes, const uint8_t* block)
+{
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        uint64_t word;
+        std::memcpy(&word, block + lane * 8, sizeof(word));
+        lanes[lane] = Rotl(lanes[lane] + word * kPrime2, 31) * kPrime1;
+    }
+}
+
+GeometryHasher::GeometryHasher()
+    : m_Lanes{ kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1 }
+{
+}
+
+void GeometryHasher::Update(const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    m_TotalSize += size;
+
+    if (m_BlockSize > 0)
+    {
+        const size_t fill = std::min(size, sizeof(m_Block) - m_BlockSize);
+        std::memcpy(m_Block + m_BlockSize, bytes, fill);
+        m_BlockSize += fill;
+        bytes += fill;
+        size -= fill;
+        if (m_BlockSize < sizeof(m_Block))
+            return;
+        ProcessBlock(m_Lanes, m_Block);
+        m_BlockSize = 0;
+    }
+
+    for (; size >= sizeof(m_Block); bytes += sizeof(m_Block), size -= sizeof(m_Block))
+        ProcessBlock(m_Lanes, bytes);
+
+    std::memcpy(m_Block, bytes, size);
+    m_BlockSize = size;
+}
+
+GeometryKey GeometryHasher::Finish() const
+{
+    // Both halves see every lane, in a different order and with different multipliers
+    uint64_t low = m_TotalSize * kPrime1;
+    uint64_t high = m_TotalSize * kPrime3 + kPrime2;
+    for (uint32_t lane = 0; lane < 4; lane++)
+    {
+        low = (low ^ Avalanche(m_Lanes[lane])) * kPrime1;
+        high = (high ^ Avalanche(m_Lanes[3 - lane] + kPrime3)) * kPrime2;
+    }
+    for (size_t i = 0; i < m_BlockSize; i++)
+    {
+        low = (low ^ m_Block[i]) * 0x100000001B3ull;
+        high = Rotl(high ^ m_Block[i], 11) * kPrime1;
+    }
+
+    GeometryKey key;
+    key.low = Avalanche(low);
+    key.high = Avalanche(high ^ key.low);
+    return key;
+}
+
+const GeometryRegistry::Entry* GeometryRegistry::Find(const GeometryKey& key) const
+{
+    const auto it = m_Entries.find(key);
+    return it != m_Entries.end() ? &it->second : nullptr;
+}
+
+uint32_t GeometryRegistry::AddRange(const SceneLoader::GeometryAllocation& allocation)
+{
+    uint32_t range = static_cast<uint32_t>(m_Ranges.size());
+    if (!m_FreeRanges.empty())
+    {
+        range = m_FreeRanges.back();
+        m_FreeRanges.pop_back();
+    }
+    else
+    {
+        m_Ranges.emplace_back();
+    }
+
+    m_Ranges[range].allocation = allocation;
+    m_Ranges[range].refCount = 1;
+    return range;
+}
+
+void GeometryRegistry::Add(const GeometryKey& key, uint32_t range, const SceneLoader::Mesh& mesh)
+{
+    if (m_Entries.try_emplace(key, Entry{ range, mesh }).second)
+        m_Ranges[range].keys.push_back(key);
+}
+
+void GeometryRegistry::AddReference(uint32_t range)
+{
+    m_Ranges[range].refCount++;
+}
+
+bool GeometryRegistry::Release(uint32_t range, SceneLoader::GeometryAllocation& allocation)
+{
+    Range& entry = m_Ranges[range];
+    if (--entry.refCount != 0)
+        return false;
+
+    for (const GeometryKey& key : entry.keys)
+        m_Entries.erase(key);
+    allocation = entry.allocation;
+    entry = {};
+    m_FreeRanges.push_back(range);
+    return true;
+}
+
+void GeometryRegistry::Clear()
+{
+    m_Entries.clear();
+    m_Ranges.clear();
+    m_FreeRanges.clear();
+}
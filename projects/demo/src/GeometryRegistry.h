@@ -0,0 +1,80 @@
+#pragma once
+#include "SceneLoader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Content addressed geometry. Meshes are keyed by a 128-bit hash of their source data and of the load settings
+// that change what ends up in the pool, so byte-identical primitives are stored once per load and, through a
+// registry kept next to the pool, once across every scene loaded into that pool.
+struct GeometryKey
+{
+    uint64_t low            = 0;
+    uint64_t high           = 0;
+
+    bool operator==(const GeometryKey&) const = default;
+};
+
+// Streaming hash over four 64-bit lanes, small and unaligned updates are buffered into 32 byte blocks.
+// Not cryptographic, 128 bits only make accidental collisions between meshes practically impossible.
+class GeometryHasher
+{
+public:
+    GeometryHasher();
+
+    void Update(const void* data, size_t size);
+    GeometryKey Finish() const;
+
+private:
+    uint64_t m_Lanes[4];
+    uint8_t m_Block[32];
+    size_t m_BlockSize = 0;
+    uint64_t m_TotalSize = 0;
+};
+
+// The key is already well mixed
+struct GeometryKeyHash
+{
+    size_t operator()(const GeometryKey& key) const { return static_cast<size_t>(key.low); }
+};
+
+// Geometry already in a pool, for scenes loaded later to share. Scenes register the ranges they allocate and
+// the meshes stored in them. A range is referenced by its owner and by every scene sharing one of its meshes,
+// once the last reference is dropped its meshes are forgotten and the owner of the registry frees it.
+class GeometryRegistry
+{
+public:
+    struct Entry
+    {
+        uint32_t range;
+        // Offsets point into the pool's buffers
+        SceneLoader::Mesh mesh;
+    };
+
+    const Entry* Find(const GeometryKey& key) const;
+
+    // The caller holds the first reference of the new range
+    uint32_t AddRange(const SceneLoader::GeometryAllocation& allocation);
+    // Keeps the first mesh registered with a key
+    void Add(const GeometryKey& key, uint32_t range, const SceneLoader::Mesh& mesh);
+    void AddReference(uint32_t range);
+    // True when that was the last reference, the range's allocation has to go back to the pool then
+    bool Release(uint32_t range, SceneLoader::GeometryAllocation& allocation);
+    void Clear();
+
+    size_t GetSize() const { return m_Entries.size(); }
+
+private:
+    struct Range
+    {
+        SceneLoader::GeometryAllocation allocation;
+        uint32_t refCount = 0;
+        std::vector<GeometryKey> keys;
+    };
+
+    std::unordered_map<GeometryKey, Entry, GeometryKeyHash> m_Entries;
+    std::vector<Range> m_Ranges;
+    std::vector<uint32_t> m_FreeRanges;
+};
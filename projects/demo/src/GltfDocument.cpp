@@ -0,0 +1,1116 @@
+#include "GltfDocument.h"
+#include "AsyncFileReader.h"
+#include "MeshoptDecode.h"
+#include "Parallel.h"
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace Gltf
+{
+    inline constexpr uint32_t kGlbMagic = 0x46546C67; // "glTF"
+    inline constexpr uint32_t kGlbChunkJson = 0x4E4F534A;
+    inline constexpr uint32_t kGlbChunkBin = 0x004E4942;
+
+    // Forward only reader over the JSON text. Values are consumed in document order by the caller,
+    // objects and arrays hand every member or element to a callback. The first error stops it.
+    class JsonReader
+    {
+    public:
+        JsonReader(const char* begin, const char* end)
+            : m_Begin(begin), m_Pos(begin), m_End(end)
+        {
+        }
+
+        bool HasFailed() const { return m_Error != nullptr; }
+        const char* GetError() const { return m_Error; }
+        size_t GetErrorOffset() const { return m_ErrorOffset; }
+
+        // onMember(key) has to consume the member's value
+        template<typename Func>
+        void ReadObject(Func&& onMember)
+        {
+            if (!Expect('{'))
+                return;
+            if (Peek() == '}')
+            {
+                m_Pos++;
+                return;
+            }
+
+            for (;;)
+            {
+                const std::string_view key = ReadString();
+                if (!Expect(':'))
+                    return;
+                onMember(key);
+
+                const char c = Peek();
+                if (c != ',' && c != '}')
+                    return Fail("Expected ',' or '}'");
+                m_Pos++;
+                if (c == '}')
+                    return;
+            }
+        }
+
+        // onElement() has to consume the element
+        template<typename Func>
+        void ReadArray(Func&& onElement)
+        {
+            if (!Expect('['))
+                return;
+            if (Peek() == ']')
+            {
+                m_Pos++;
+                return;
+            }
+
+            for (;;)
+            {
+                onElement();
+
+                const char c = Peek();
+                if (c != ',' && c != ']')
+                    return Fail("Expected ',' or ']'");
+                m_Pos++;
+                if (c == ']')
+                    return;
+            }
+        }
+
+        // Raw contents between the quotes, escapes are skipped over but not decoded
+        std::string_view ReadString()
+        {
+            if (!Expect('"'))
+                return {};
+
+            const char* start = m_Pos;
+            for (;;)
+            {
+                const char* quote = static_cast<const char*>(memchr(m_Pos, '"', m_End - m_Pos));
+                if (!quote)
+                {
+                    Fail("Unterminated string");
+                    return {};
+                }
+
+                // An odd number of backslashes in front escapes the quote
+                const char* escape = quote;
+                while (escape > start && escape[-1] == '\\')
+                    escape--;
+                m_Pos = quote + 1;
+                if (((quote - escape) & 1) == 0)
+                    return std::string_view(start, quote - start);
+            }
+        }
+
+        double ReadNumber()
+        {
+            Peek();
+            double value = 0.0;
+            const auto [ptr, ec] = std::from_chars(m_Pos, m_End, value);
+            if (ec != std::errc())
+            {
+                Fail("Expected a number");
+                return 0.0;
+            }
+            m_Pos = ptr;
+            return value;
+        }
+
+        // Indices, counts and offsets. Integers written with a fraction or exponent are accepted.
+        int64_t ReadInteger()
+        {
+            Peek();
+            int64_t value = 0;
+            const auto [ptr, ec] = std::from_chars(m_Pos, m_End, value);
+            if (ec == std::errc() && (ptr == m_End || (*ptr != '.' && *ptr != 'e' && *ptr != 'E')))
+            {
+                m_Pos = ptr;
+                return value;
+            }
+            return static_cast<int64_t>(ReadNumber());
+        }
+
+        int32_t ReadIndex()
+        {
+            const int64_t value = ReadInteger();
+            if (value < 0 || value > INT32_MAX)
+            {
+                Fail("Index out of range");
+                return kNone;
+            }
+            return static_cast<int32_t>(value);
+        }
+
+        size_t ReadSize()
+        {
+            const int64_t value = ReadInteger();
+            if (value < 0)
+            {
+                Fail("Negative size");
+                return 0;
+            }
+            return static_cast<size_t>(value);
+        }
+
+        bool ReadBool()
+        {
+            if (Match("true"))
+                return true;
+            if (!Match("false"))
+                Fail("Expected a boolean");
+            return false;
+        }
+
+        // Reads up to capacity numbers into dst, returns how many the array had
+        template<typename T>
+        size_t ReadNumbers(T* dst, size_t capacity)
+        {
+            size_t count = 0;
+            ReadArray([&]()
+            {
+                const double value = ReadNumber();
+                if (count < capacity)
+                    dst[count] = static_cast<T>(value);
+                count++;
+            });
+            return count;
+        }
+
+        void Skip()
+        {
+            switch (Peek())
+            {
+            case '"':
+                ReadString();
+                return;
+            case '{':
+            case '[':
+                SkipContainer();
+                return;
+            default:
+                // Numbers, true, false and null
+                while (m_Pos < m_End && *m_Pos != ',' && *m_Pos != '}' && *m_Pos != ']' && !IsWhitespace(*m_Pos))
+                    m_Pos++;
+                return;
+            }
+        }
+
+        void Fail(const char* error)
+        {
+            if (!m_Error)
+            {
+                m_Error = error;
+                m_ErrorOffset = m_Pos - m_Begin;
+            }
+            // Everything after the first error reads as the end of the input
+            m_Pos = m_End;
+        }
+
+    private:
+        static bool IsWhitespace(char c)
+        {
+            return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+        }
+
+        char Peek()
+        {
+            while (m_Pos < m_End && IsWhitespace(*m_Pos))
+                m_Pos++;
+            return m_Pos < m_End ? *m_Pos : '\0';
+        }
+
+        bool Expect(char c)
+        {
+            if (Peek() != c)
+            {
+                Fail(c == '"' ? "Expected a string" : c == '{' ? "Expected an object" : c == '[' ? "Expected an array" : "Expected ':'");
+                return false;
+            }
+            m_Pos++;
+            return true;
+        }
+
+        bool Match(std::string_view literal)
+        {
+            Peek();
+            if (size_t(m_End - m_Pos) < literal.size() || std::memcmp(m_Pos, literal.data(), literal.size()) != 0)
+                return false;
+            m_Pos += literal.size();
+            return true;
+        }
+
+        // Only brackets outside of strings count
+        void SkipContainer()
+        {
+            uint32_t depth = 0;
+            while (m_Pos < m_End)
+            {
+                const char c = *m_Pos;
+                if (c == '"')
+                {
+                    ReadString();
+                    continue;
+                }
+
+                m_Pos++;
+                if (c == '{' || c == '[')
+                    depth++;
+                else if ((c == '}' || c == ']') && --depth == 0)
+                    return;
+            }
+            Fail("Unterminated object or array");
+        }
+
+        const char* m_Begin;
+        const char* m_Pos;
+        const char* m_End;
+        const char* m_Error = nullptr;
+        size_t m_ErrorOffset = 0;
+    };
+
+    uint32_t GetComponentSize(uint32_t componentType)
+    {
+        switch (componentType)
+        {
+        case 5120: // BYTE
+        case 5121: // UNSIGNED_BYTE
+            return 1;
+        case 5122: // SHORT
+        case 5123: // UNSIGNED_SHORT
+            return 2;
+        case 5125: // UNSIGNED_INT
+        case 5126: // FLOAT
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+    static uint32_t GetComponentCount(std::string_view type)
+    {
+        if (type == "SCALAR")
+            return 1;
+        if (type == "VEC2")
+            return 2;
+        if (type == "VEC3")
+            return 3;
+        if (type == "VEC4" || type == "MAT2")
+            return 4;
+        if (type == "MAT3")
+            return 9;
+        if (type == "MAT4")
+            return 16;
+        return 0;
+    }
+
+    // Where the bytes of a buffer come from, resolved after parsing
+    struct BufferSource
+    {
+        std::string_view uri;
+        size_t byteLength = 0;
+        // EXT_meshopt_compression placeholder, only compressed views reference it and it's never read
+        bool fallback = false;
+    };
+
+    // EXT_meshopt_compression buffer view, decoded into memory owned by the document after the buffers are read
+    struct CompressedView
+    {
+        uint32_t view = 0;
+        uint32_t buffer = 0;
+        size_t byteOffset = 0;
+        size_t byteLength = 0;
+        uint32_t byteStride = 0;
+        size_t count = 0;
+        MeshoptDecode::Mode mode = MeshoptDecode::Mode::Attributes;
+        MeshoptDecode::Filter filter = MeshoptDecode::Filter::None;
+    };
+
+    static void ParseNode(JsonReader& json, Document& document)
+    {
+        Node& node = document.nodes.emplace_back();
+        node.firstChild = static_cast<uint32_t>(document.nodeChildren.size());
+
+        float matrix[16];
+        float translation[3] = { 0.0f, 0.0f, 0.0f };
+        float rotation[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        float scale[3] = { 1.0f, 1.0f, 1.0f };
+        bool hasMatrix = false;
+        bool hasTRS = false;
+
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "children")
+                json.ReadArray([&]() { document.nodeChildren.push_back(static_cast<uint32_t>(json.ReadIndex())); });
+            else if (key == "mesh")
+                node.mesh = json.ReadIndex();
+            else if (key == "name")
+                node.name = json.ReadString();
+            else if (key == "matrix")
+                hasMatrix = json.ReadNumbers(matrix, 16) == 16;
+            else if (key == "translation")
+                hasTRS |= json.ReadNumbers(translation, 3) == 3;
+            else if (key == "rotation")
+                hasTRS |= json.ReadNumbers(rotation, 4) == 4;
+            else if (key == "scale")
+                hasTRS |= json.ReadNumbers(scale, 3) == 3;
+            else if (key == "extensions")
+            {
+                json.ReadObject([&](std::string_view extension)
+                {
+                    if (extension != "KHR_lights_punctual")
+                        return json.Skip();
+                    json.ReadObject([&](std::string_view member)
+                    {
+                        if (member == "light")
+                            node.light = json.ReadIndex();
+                        else
+                            json.Skip();
+                    });
+                });
+            }
+            else
+                json.Skip();
+        });
+
+        node.childCount = static_cast<uint32_t>(document.nodeChildren.size()) - node.firstChild;
+        // A matrix wins over TRS, T * R * S otherwise. Quaternions are stored x, y, z, w.
+        if (hasMatrix)
+            std::memcpy(&node.localTransform, matrix, sizeof(matrix));
+        else if (hasTRS)
+        {
+            const glm::quat q(rotation[3], rotation[0], rotation[1], rotation[2]);
+            node.localTransform = glm::translate(glm::mat4(1.0f), glm::vec3(translation[0], translation[1], translation[2]))
+                * glm::mat4_cast(q) * glm::scale(glm::mat4(1.0f), glm::vec3(scale[0], scale[1], scale[2]));
+        }
+    }
+
+    static void ParsePrimitive(JsonReader& json, Document& document)
+    {
+        Primitive& primitive = document.primitives.emplace_back();
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "attributes")
+            {
+                json.ReadObject([&](std::string_view name)
+                {
+                    const int32_t accessor = json.ReadIndex();
+                    if (name == "POSITION")
+                        primitive.attributes[kAttributePosition] = accessor;
+                    else if (name == "NORMAL")
+                        primitive.attributes[kAttributeNormal] = accessor;
+                    else if (name == "TEXCOORD_0")
+                        primitive.attributes[kAttributeTexCoord0] = accessor;
+                });
+            }
+            else if (key == "indices")
+                primitive.indices = json.ReadIndex();
+            else if (key == "material")
+                primitive.material = json.ReadIndex();
+            else
+                json.Skip();
+        });
+    }
+
+    static void ParseMesh(JsonReader& json, Document& document)
+    {
+        Mesh& mesh = document.meshes.emplace_back();
+        mesh.firstPrimitive = static_cast<uint32_t>(document.primitives.size());
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "primitives")
+                json.ReadArray([&]() { ParsePrimitive(json, document); });
+            else
+                json.Skip();
+        });
+        mesh.primitiveCount = static_cast<uint32_t>(document.primitives.size()) - mesh.firstPrimitive;
+    }
+
+    static void ParseAccessor(JsonReader& json, Document& document)
+    {
+        Accessor& accessor = document.accessors.emplace_back();
+        size_t minCount = 0;
+        size_t maxCount = 0;
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "bufferView")
+                accessor.bufferView = json.ReadIndex();
+            else if (key == "byteOffset")
+                accessor.byteOffset = json.ReadSize();
+            else if (key == "count")
+                accessor.count = json.ReadSize();
+            else if (key == "componentType")
+                accessor.componentType = static_cast<uint32_t>(json.ReadInteger());
+            else if (key == "type")
+                accessor.componentCount = GetComponentCount(json.ReadString());
+            else if (key == "normalized")
+                accessor.normalized = json.ReadBool();
+            else if (key == "min")
+                minCount = json.ReadNumbers(&accessor.min.x, 3);
+            else if (key == "max")
+                maxCount = json.ReadNumbers(&accessor.max.x, 3);
+            else
+                json.Skip();
+        });
+        accessor.hasBounds = minCount == 3 && maxCount == 3;
+    }
+
+    static void ParseMeshoptCompression(JsonReader& json, CompressedView& compressed)
+    {
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "buffer")
+                compressed.buffer = static_cast<uint32_t>(json.ReadIndex());
+            else if (key == "byteOffset")
+                compressed.byteOffset = json.ReadSize();
+            else if (key == "byteLength")
+                compressed.byteLength = json.ReadSize();
+            else if (key == "byteStride")
+                compressed.byteStride = static_cast<uint32_t>(json.ReadSize());
+            else if (key == "count")
+                compressed.count = json.ReadSize();
+            else if (key == "mode")
+            {
+                const std::string_view mode = json.ReadString();
+                if (mode == "ATTRIBUTES")
+                    compressed.mode = MeshoptDecode::Mode::Attributes;
+                else if (mode == "TRIANGLES")
+                    compressed.mode = MeshoptDecode::Mode::Triangles;
+                else if (mode == "INDICES")
+                    compressed.mode = MeshoptDecode::Mode::Indices;
+                else
+                    json.Fail("Unknown meshopt compression mode");
+            }
+            else if (key == "filter")
+            {
+                const std::string_view filter = json.ReadString();
+                if (filter == "NONE")
+                    compressed.filter = MeshoptDecode::Filter::None;
+                else if (filter == "OCTAHEDRAL")
+                    compressed.filter = MeshoptDecode::Filter::Octahedral;
+                else if (filter == "QUATERNION")
+                    compressed.filter = MeshoptDecode::Filter::Quaternion;
+                else if (filter == "EXPONENTIAL")
+                    compressed.filter = MeshoptDecode::Filter::Exponential;
+                else
+                    json.Fail("Unknown meshopt compression filter");
+            }
+            else
+                json.Skip();
+        });
+    }
+
+    static void ParseBufferView(JsonReader& json, Document& document, std::vector<CompressedView>& compressedViews)
+    {
+        const uint32_t index = static_cast<uint32_t>(document.bufferViews.size());
+        BufferView& view = document.bufferViews.emplace_back();
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "buffer")
+                view.buffer = static_cast<uint32_t>(json.ReadIndex());
+            else if (key == "byteOffset")
+                view.byteOffset = json.ReadSize();
+            else if (key == "byteLength")
+                view.byteLength = json.ReadSize();
+            else if (key == "byteStride")
+                view.byteStride = static_cast<uint32_t>(json.ReadSize());
+            else if (key == "extensions")
+            {
+                json.ReadObject([&](std::string_view extension)
+                {
+                    if (extension != "EXT_meshopt_compression")
+                        return json.Skip();
+                    CompressedView& compressed = compressedViews.emplace_back();
+                    compressed.view = index;
+                    ParseMeshoptCompression(json, compressed);
+                });
+            }
+            else
+                json.Skip();
+        });
+    }
+
+    static void ParseBuffer(JsonReader& json, std::vector<BufferSource>& sources)
+    {
+        BufferSource& source = sources.emplace_back();
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "uri")
+                source.uri = json.ReadString();
+            else if (key == "byteLength")
+                source.byteLength = json.ReadSize();
+            else if (key == "extensions")
+            {
+                json.ReadObject([&](std::string_view extension)
+                {
+                    if (extension != "EXT_meshopt_compression")
+                        return json.Skip();
+                    json.ReadObject([&](std::string_view member)
+                    {
+                        if (member == "fallback")
+                            source.fallback = json.ReadBool();
+                        else
+                            json.Skip();
+                    });
+                });
+            }
+            else
+                json.Skip();
+        });
+    }
+
+    static void ParseLight(JsonReader& json, Document& document)
+    {
+        Light& light = document.lights.emplace_back();
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "type")
+                light.type = json.ReadString();
+            else if (key == "color")
+                light.hasColor = json.ReadNumbers(&light.color.x, 3) == 3;
+            else if (key == "intensity")
+                light.intensity = static_cast<float>(json.ReadNumber());
+            else if (key == "range")
+                light.range = static_cast<float>(json.ReadNumber());
+            else if (key == "spot")
+            {
+                json.ReadObject([&](std::string_view member)
+                {
+                    if (member == "innerConeAngle")
+                        light.innerConeAngle = static_cast<float>(json.ReadNumber());
+                    else if (member == "outerConeAngle")
+                        light.outerConeAngle = static_cast<float>(json.ReadNumber());
+                    else
+                        json.Skip();
+                });
+            }
+            else
+                json.Skip();
+        });
+    }
+
+    static void ParseScene(JsonReader& json, Document& document)
+    {
+        Scene& scene = document.scenes.emplace_back();
+        scene.firstNode = static_cast<uint32_t>(document.sceneNodes.size());
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "nodes")
+                json.ReadArray([&]() { document.sceneNodes.push_back(static_cast<uint32_t>(json.ReadIndex())); });
+            else
+                json.Skip();
+        });
+        scene.nodeCount = static_cast<uint32_t>(document.sceneNodes.size()) - scene.firstNode;
+    }
+
+    static void ParseRoot(JsonReader& json, Document& document, std::vector<BufferSource>& bufferSources,
+        std::vector<CompressedView>& compressedViews)
+    {
+        bool hasVersion = false;
+        json.ReadObject([&](std::string_view key)
+        {
+            if (key == "nodes")
+                json.ReadArray([&]() { ParseNode(json, document); });
+            else if (key == "meshes")
+                json.ReadArray([&]() { ParseMesh(json, document); });
+            else if (key == "accessors")
+                json.ReadArray([&]() { ParseAccessor(json, document); });
+            else if (key == "bufferViews")
+                json.ReadArray([&]() { ParseBufferView(json, document, compressedViews); });
+            else if (key == "buffers")
+                json.ReadArray([&]() { ParseBuffer(json, bufferSources); });
+            else if (key == "scenes")
+                json.ReadArray([&]() { ParseScene(json, document); });
+            else if (key == "asset")
+            {
+                json.ReadObject([&](std::string_view member)
+                {
+                    if (member != "version")
+                        return json.Skip();
+                    const std::string_view version = json.ReadString();
+                    if (version.substr(0, 2) != "2.")
+                        json.Fail("Only glTF 2.x is supported");
+                    hasVersion = true;
+                });
+            }
+            else if (key == "extensions")
+            {
+                json.ReadObject([&](std::string_view extension)
+                {
+                    if (extension != "KHR_lights_punctual")
+                        return json.Skip();
+                    json.ReadObject([&](std::string_view member)
+                    {
+                        if (member == "lights")
+                            json.ReadArray([&]() { ParseLight(json, document); });
+                        else
+                            json.Skip();
+                    });
+                });
+            }
+            else
+                json.Skip();
+        });
+
+        if (!hasVersion)
+            json.Fail("Missing asset version");
+    }
+
+    static int DecodeBase64Char(char c)
+    {
+        if (c >= 'A' && c <= 'Z')
+            return c - 'A';
+        if (c >= 'a' && c <= 'z')
+            return c - 'a' + 26;
+        if (c >= '0' && c <= '9')
+            return c - '0' + 52;
+        if (c == '+')
+            return 62;
+        if (c == '/')
+            return 63;
+        return -1;
+    }
+
+    // Stops at the first character that isn't base64, returns the number of bytes written
+    static size_t DecodeBase64(std::string_view text, uint8_t* dst, size_t capacity)
+    {
+        size_t written = 0;
+        uint32_t bits = 0;
+        uint32_t bitCount = 0;
+        for (char c : text)
+        {
+            const int value = DecodeBase64Char(c);
+            if (value < 0)
+                break;
+
+            bits = (bits << 6) | static_cast<uint32_t>(value);
+            bitCount += 6;
+            if (bitCount >= 8)
+            {
+                bitCount -= 8;
+                if (written == capacity)
+                    break;
+                dst[written++] = static_cast<uint8_t>(bits >> bitCount);
+            }
+        }
+        return written;
+    }
+
+    static int DecodeHexDigit(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    static void AppendUtf8(std::string& dst, uint32_t codePoint)
+    {
+        if (codePoint < 0x80)
+            dst.push_back(static_cast<char>(codePoint));
+        else if (codePoint < 0x800)
+        {
+            dst.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+            dst.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else
+        {
+            dst.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+            dst.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            dst.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+    }
+
+    // JSON escapes first, then percent encoding. Only used for file URIs, which are short.
+    static std::string DecodeUri(std::string_view raw)
+    {
+        std::string unescaped;
+        unescaped.reserve(raw.size());
+        for (size_t i = 0; i < raw.size(); i++)
+        {
+            if (raw[i] != '\\' || i + 1 == raw.size())
+            {
+                unescaped.push_back(raw[i]);
+                continue;
+            }
+
+            const char c = raw[++i];
+            switch (c)
+            {
+            case 'b': unescaped.push_back('\b'); break;
+            case 'f': unescaped.push_back('\f'); break;
+            case 'n': unescaped.push_back('\n'); break;
+            case 'r': unescaped.push_back('\r'); break;
+            case 't': unescaped.push_back('\t'); break;
+            case 'u':
+            {
+                uint32_t codePoint = 0;
+                for (size_t digit = 0; digit < 4 && i + 1 < raw.size(); digit++)
+                    codePoint = codePoint * 16 + static_cast<uint32_t>(std::max(DecodeHexDigit(raw[++i]), 0));
+                AppendUtf8(unescaped, codePoint);
+                break;
+            }
+            default: unescaped.push_back(c); break;
+            }
+        }
+
+        std::string decoded;
+        decoded.reserve(unescaped.size());
+        for (size_t i = 0; i < unescaped.size(); i++)
+        {
+            const int high = unescaped[i] == '%' && i + 2 < unescaped.size() ? DecodeHexDigit(unescaped[i + 1]) : -1;
+            const int low = high >= 0 ? DecodeHexDigit(unescaped[i + 2]) : -1;
+            if (low >= 0)
+            {
+                decoded.push_back(static_cast<char>(high * 16 + low));
+                i += 2;
+            }
+            else
+                decoded.push_back(unescaped[i]);
+        }
+        return decoded;
+    }
+
+    static std::filesystem::path GetBufferPath(const std::filesystem::path& path, std::string_view rawUri)
+    {
+        const std::string uri = DecodeUri(rawUri);
+        return path.parent_path() / std::u8string_view(reinterpret_cast<const char8_t*>(uri.data()), uri.size());
+    }
+
+    static bool IsExternalBuffer(const BufferSource& source)
+    {
+        return !source.fallback && !source.uri.empty() && source.uri.substr(0, 5) != "data:";
+    }
+
+    // Embedded data URIs are decoded, the BIN chunk of a .glb is used in place and external files are read
+    // concurrently. External files may be larger than byteLength, only byteLength bytes are read.
+    static bool LoadBuffers(const std::filesystem::path& path, const std::vector<BufferSource>& sources,
+        const uint8_t* binChunk, size_t binChunkSize, Document& document)
+    {
+        AsyncFileReader reader;
+        bool ok = true;
+        document.buffers.resize(sources.size());
+        for (size_t i = 0; i < sources.size() && ok; i++)
+        {
+            const BufferSource& source = sources[i];
+            Buffer& buffer = document.buffers[i];
+            buffer.size = source.byteLength;
+
+            // Nothing references a fallback buffer once its compressed views are decoded
+            if (source.fallback)
+                continue;
+
+            if (source.uri.empty())
+            {
+                // Only the first buffer of a .glb may leave out the uri
+                if (i != 0 || !binChunk || binChunkSize < source.byteLength)
+                {
+                    printf("[Asset Importer] Error: Buffer %zu of %s has no data.\n", i, path.string().c_str());
+                    ok = false;
+                }
+                buffer.data = binChunk;
+                continue;
+            }
+
+            auto& storage = document.bufferStorage.emplace_back(std::make_unique_for_overwrite<uint8_t[]>(source.byteLength));
+            buffer.data = storage.get();
+
+            if (source.uri.substr(0, 5) == "data:")
+            {
+                const size_t base64 = source.uri.find(";base64,");
+                if (base64 == std::string_view::npos
+                    || DecodeBase64(source.uri.substr(base64 + 8), storage.get(), source.byteLength) != source.byteLength)
+                {
+                    printf("[Asset Importer] Error: Buffer %zu of %s has an invalid data URI.\n", i, path.string().c_str());
+                    ok = false;
+                }
+                continue;
+            }
+
+            const std::filesystem::path bufferPath = GetBufferPath(path, source.uri);
+            std::error_code ec;
+            const uintmax_t fileSize = std::filesystem::file_size(bufferPath, ec);
+            if (ec || fileSize < source.byteLength || !reader.Read(bufferPath, storage.get(), source.byteLength))
+            {
+                printf("[Asset Importer] Error: Could not read %s, buffer %zu of %s.\n", bufferPath.string().c_str(), i, path.string().c_str());
+                ok = false;
+            }
+        }
+
+        if (!reader.Wait() && ok)
+        {
+            printf("[Asset Importer] Error: Failed to read the buffers of %s.\n", path.string().c_str());
+            ok = false;
+        }
+        return ok;
+    }
+
+    // Compressed views are decoded in parallel into one block appended as a new buffer and the views are pointed
+    // at their decoded bytes, so accessors read them like any other view. Decoding stays on the CPU, the loaders
+    // convert, optimize and bound the decoded attributes before anything is staged, so the upload is the decoded
+    // size of the vertex format and not the compressed one.
+    static bool DecompressBufferViews(const std::filesystem::path& path, const std::vector<CompressedView>& compressedViews,
+        Document& document)
+    {
+        if (compressedViews.empty())
+            return true;
+
+        const auto decodeStart = std::chrono::steady_clock::now();
+        std::vector<size_t> offsets(compressedViews.size());
+        size_t decodedSize = 0;
+        for (size_t i = 0; i < compressedViews.size(); i++)
+        {
+            const CompressedView& compressed = compressedViews[i];
+            const char* error = nullptr;
+            if (compressed.view >= document.bufferViews.size() || compressed.buffer >= document.buffers.size())
+                error = "references a missing buffer";
+            else if (!document.buffers[compressed.buffer].data)
+                error = "references a buffer without data";
+            else if (compressed.byteOffset > document.buffers[compressed.buffer].size
+                || compressed.byteLength > document.buffers[compressed.buffer].size - compressed.byteOffset)
+                error = "exceeds its buffer";
+            else if (compressed.byteStride == 0 || compressed.count > (SIZE_MAX / 2) / compressed.byteStride)
+                error = "has an invalid stride or count";
+            // The codecs can't get below 2 bits per 16 bytes, anything claiming more is corrupt
+            else if (compressed.count * compressed.byteStride / 64 > compressed.byteLength)
+                error = "decodes to more data than it can hold";
+            if (error)
+            {
+                printf("[Asset Importer] Error: Compressed buffer view %u of %s %s.\n", compressed.view, path.string().c_str(), error);
+                return false;
+            }
+
+            offsets[i] = decodedSize;
+            // Keeps every view 4 byte aligned for the float and index reads
+            decodedSize += (size_t(compressed.count) * compressed.byteStride + 3) & ~size_t(3);
+        }
+
+        auto& storage = document.bufferStorage.emplace_back(std::make_unique_for_overwrite<uint8_t[]>(decodedSize));
+        const uint32_t decodedBuffer = static_cast<uint32_t>(document.buffers.size());
+        document.buffers.push_back({ storage.get(), decodedSize });
+
+        // Biggest streams first so a large one doesn't end up alone on the last thread
+        std::vector<uint32_t> order(compressedViews.size());
+        for (uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return compressedViews[a].byteLength > compressedViews[b].byteLength; });
+
+        std::atomic<size_t> failedView = SIZE_MAX;
+        Parallel::For(order.size(), [&](size_t i)
+        {
+            const CompressedView& compressed = compressedViews[order[i]];
+            const uint8_t* src = document.buffers[compressed.buffer].data + compressed.byteOffset;
+            if (!MeshoptDecode::Decode(compressed.mode, compressed.filter, storage.get() + offsets[order[i]], compressed.count,
+                compressed.byteStride, src, compressed.byteLength))
+                failedView = compressed.view;
+        });
+        if (failedView != SIZE_MAX)
+        {
+            printf("[Asset Importer] Error: Compressed buffer view %zu of %s could not be decoded.\n", failedView.load(), path.string().c_str());
+            return false;
+        }
+
+        for (size_t i = 0; i < compressedViews.size(); i++)
+        {
+            const CompressedView& compressed = compressedViews[i];
+            BufferView& view = document.bufferViews[compressed.view];
+            view.buffer = decodedBuffer;
+            view.byteOffset = offsets[i];
+            view.byteLength = size_t(compressed.count) * compressed.byteStride;
+        }
+
+        const double decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decodeStart).count();
+        printf("[Asset Importer] Decoded %zu meshopt compressed buffer views (%.2f MB) in %.2f ms.\n",
+            compressedViews.size(), double(decodedSize) / (1024.0 * 1024.0), decodeMs);
+        return true;
+    }
+
+    // Every index the loader follows is checked once here, so it can use the document without checks
+    static const char* Validate(const Document& document)
+    {
+        for (const BufferView& view : document.bufferViews)
+        {
+            if (view.buffer >= document.buffers.size())
+                return "Buffer view references a missing buffer";
+            const Buffer& buffer = document.buffers[view.buffer];
+            if (!buffer.data && view.byteLength > 0)
+                return "Buffer view references a buffer without data";
+            if (view.byteOffset > buffer.size || view.byteLength > buffer.size - view.byteOffset)
+                return "Buffer view exceeds its buffer";
+        }
+
+        for (const Accessor& accessor : document.accessors)
+        {
+            const uint32_t componentSize = GetComponentSize(accessor.componentType);
+            if (componentSize == 0 || accessor.componentCount == 0)
+                return "Accessor has an invalid type or component type";
+            // Sparse-only accessors without a buffer view read as zeros
+            if (accessor.bufferView == kNone || accessor.count == 0)
+                continue;
+            if (static_cast<size_t>(accessor.bufferView) >= document.bufferViews.size())
+                return "Accessor references a missing buffer view";
+
+            const BufferView& view = document.bufferViews[accessor.bufferView];
+            const size_t elementSize = size_t(componentSize) * accessor.componentCount;
+            const size_t stride = std::max(GetByteStride(accessor, view), elementSize);
+            if (accessor.byteOffset > view.byteLength)
+                return "Accessor exceeds its buffer view";
+            const size_t available = view.byteLength - accessor.byteOffset;
+            if (elementSize > available || accessor.count - 1 > (available - elementSize) / stride)
+                return "Accessor exceeds its buffer view";
+        }
+
+        const auto isAccessor = [&](int32_t index) { return index == kNone || static_cast<size_t>(index) < document.accessors.size(); };
+        for (const Primitive& primitive : document.primitives)
+        {
+            for (int32_t attribute : primitive.attributes)
+                if (!isAccessor(attribute))
+                    return "Primitive references a missing accessor";
+            if (!isAccessor(primitive.indices))
+                return "Primitive references a missing accessor";
+        }
+
+        for (const Node& node : document.nodes)
+        {
+            if (node.mesh != kNone && static_cast<size_t>(node.mesh) >= document.meshes.size())
+                return "Node references a missing mesh";
+            if (node.light != kNone && static_cast<size_t>(node.light) >= document.lights.size())
+                return "Node references a missing light";
+        }
+
+        for (uint32_t node : document.nodeChildren)
+            if (node >= document.nodes.size())
+                return "Node references a missing child";
+        for (uint32_t node : document.sceneNodes)
+            if (node >= document.nodes.size())
+                return "Scene references a missing node";
+        return nullptr;
+    }
+
+    // Finds the JSON and the optional BIN chunk, a .gltf is all JSON
+    static bool SplitChunks(const std::filesystem::path& path, const uint8_t* data, size_t size,
+        const char*& json, size_t& jsonSize, const uint8_t*& binChunk, size_t& binChunkSize)
+    {
+        json = reinterpret_cast<const char*>(data);
+        jsonSize = size;
+        binChunk = nullptr;
+        binChunkSize = 0;
+
+        if (path.extension() != ".glb")
+            return true;
+
+        // 12 byte header, then the JSON chunk and an optional BIN chunk, each with an 8 byte chunk header
+        uint32_t header[5] = {};
+        if (size >= sizeof(header))
+            std::memcpy(header, data, sizeof(header));
+        if (size < sizeof(header) || header[0] != kGlbMagic || header[1] != 2 || header[2] > size || header[2] < sizeof(header)
+            || header[4] != kGlbChunkJson || header[3] > header[2] - sizeof(header))
+        {
+            printf("[Asset Importer] Error: %s is not a valid glTF 2.0 binary.\n", path.string().c_str());
+            return false;
+        }
+
+        json = reinterpret_cast<const char*>(data + sizeof(header));
+        jsonSize = header[3];
+
+        // Chunks are 4 byte aligned
+        const size_t binHeader = sizeof(header) + ((size_t(header[3]) + 3) & ~size_t(3));
+        uint32_t chunk[2] = {};
+        if (binHeader + sizeof(chunk) <= header[2])
+        {
+            std::memcpy(chunk, data + binHeader, sizeof(chunk));
+            if (chunk[1] == kGlbChunkBin && chunk[0] <= header[2] - binHeader - sizeof(chunk))
+            {
+                binChunk = data + binHeader + sizeof(chunk);
+                binChunkSize = chunk[0];
+            }
+        }
+        return true;
+    }
+
+    bool Load(const std::filesystem::path& path, Document& document)
+    {
+        const auto parseStart = std::chrono::steady_clock::now();
+        if (!document.file.Open(path) || document.file.GetSize() == 0)
+            return false;
+
+        const char* json = nullptr;
+        size_t jsonSize = 0;
+        const uint8_t* binChunk = nullptr;
+        size_t binChunkSize = 0;
+        if (!SplitChunks(path, document.file.GetData(), document.file.GetSize(), json, jsonSize, binChunk, binChunkSize))
+            return false;
+
+        std::vector<BufferSource> bufferSources;
+        std::vector<CompressedView> compressedViews;
+        JsonReader reader(json, json + jsonSize);
+        ParseRoot(reader, document, bufferSources, compressedViews);
+        if (reader.HasFailed())
+        {
+            printf("[Asset Importer] Error: %s at byte %zu of %s.\n", reader.GetError(), reader.GetErrorOffset(), path.string().c_str());
+            return false;
+        }
+
+        const double parseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - parseStart).count();
+        printf("[Asset Importer] Parsed %.2f MB of JSON in %.2f ms: %zu nodes, %zu primitives, %zu accessors.\n",
+            double(jsonSize) / (1024.0 * 1024.0), parseMs, document.nodes.size(), document.primitives.size(), document.accessors.size());
+
+        if (!LoadBuffers(path, bufferSources, binChunk, binChunkSize, document)
+            || !DecompressBufferViews(path, compressedViews, document))
+            return false;
+
+        if (const char* error = Validate(document))
+        {
+            printf("[Asset Importer] Error: %s in %s.\n", error, path.string().c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool GetExternalBufferPaths(const std::filesystem::path& path, const uint8_t* data, size_t size, std::vector<std::filesystem::path>& paths)
+    {
+        const char* json = nullptr;
+        size_t jsonSize = 0;
+        const uint8_t* binChunk = nullptr;
+        size_t binChunkSize = 0;
+        if (!SplitChunks(path, data, size, json, jsonSize, binChunk, binChunkSize))
+            return false;
+
+        std::vector<BufferSource> bufferSources;
+        JsonReader reader(json, json + jsonSize);
+        reader.ReadObject([&](std::string_view key)
+        {
+            if (key == "buffers")
+                reader.ReadArray([&]() { ParseBuffer(reader, bufferSources); });
+            else
+                reader.Skip();
+        });
+        if (reader.HasFailed())
+            return false;
+
+        for (const BufferSource& source : bufferSources)
+            if (IsExternalBuffer(source))
+                paths.push_back(GetBufferPath(path, source.uri));
+        return true;
+    }
+
+    void ReleaseBuffers(Document& document)
+    {
+        document.buffers.clear();
+        document.bufferStorage.clear();
+        document.file.Close();
+    }
+}
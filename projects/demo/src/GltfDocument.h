@@ -0,0 +1,144 @@
+#pragma once
+#include "MappedFile.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// glTF 2.0 reader for the scene loader. The JSON is parsed in a single pass straight into flat
+// arrays, no DOM is built and only what the loader consumes is kept: the node hierarchy, meshes,
+// accessors and punctual lights. The buffer of a .glb is used in place from the mapped file,
+// external .bin files are read concurrently into memory owned by the document. EXT_meshopt_compression
+// buffer views are decoded on load, so the loader only ever sees raw accessors.
+namespace Gltf
+{
+    inline constexpr int32_t kNone = -1;
+
+    // Attribute slots of a primitive, attributes the loader doesn't decode aren't kept
+    enum Attribute : uint32_t
+    {
+        kAttributePosition,
+        kAttributeNormal,
+        kAttributeTexCoord0,
+        kAttributeCount
+    };
+
+    // Values match the glTF componentType enum
+    inline constexpr uint32_t kComponentTypeFloat = 5126;
+
+    struct Buffer
+    {
+        const uint8_t* data     = nullptr;
+        size_t size             = 0;
+    };
+
+    struct BufferView
+    {
+        uint32_t buffer         = 0;
+        size_t byteOffset       = 0;
+        size_t byteLength       = 0;
+        // 0 means tightly packed
+        uint32_t byteStride     = 0;
+    };
+
+    struct Accessor
+    {
+        int32_t bufferView      = kNone;
+        size_t byteOffset       = 0;
+        size_t count            = 0;
+        uint32_t componentType  = 0;
+        uint32_t componentCount = 0;
+        bool normalized         = false;
+        // Set when min and max both have exactly three values
+        bool hasBounds          = false;
+        glm::vec3 min           = glm::vec3(0.0f);
+        glm::vec3 max           = glm::vec3(0.0f);
+    };
+
+    struct Primitive
+    {
+        int32_t attributes[kAttributeCount] = { kNone, kNone, kNone };
+        int32_t indices         = kNone;
+        int32_t material        = kNone;
+    };
+
+    struct Mesh
+    {
+        // Range in Document::primitives
+        uint32_t firstPrimitive = 0;
+        uint32_t primitiveCount = 0;
+    };
+
+    struct Node
+    {
+        glm::mat4 localTransform = glm::mat4(1.0f);
+        // Raw JSON string contents, escape sequences aren't decoded
+        std::string_view name;
+        int32_t mesh            = kNone;
+        // KHR_lights_punctual
+        int32_t light           = kNone;
+        // Range in Document::nodeChildren
+        uint32_t firstChild     = 0;
+        uint32_t childCount     = 0;
+    };
+
+    struct Scene
+    {
+        // Range in Document::sceneNodes
+        uint32_t firstNode      = 0;
+        uint32_t nodeCount      = 0;
+    };
+
+    // KHR_lights_punctual
+    struct Light
+    {
+        std::string_view type;
+        bool hasColor           = false;
+        glm::vec3 color         = glm::vec3(1.0f);
+        float intensity         = 1.0f;
+        float range             = 0.0f;
+        float innerConeAngle    = 0.0f;
+        float outerConeAngle    = 0.7853981634f;
+    };
+
+    struct Document
+    {
+        std::vector<Buffer> buffers;
+        std::vector<BufferView> bufferViews;
+        std::vector<Accessor> accessors;
+        std::vector<Primitive> primitives;
+        std::vector<Mesh> meshes;
+        std::vector<Node> nodes;
+        std::vector<uint32_t> nodeChildren;
+        std::vector<Scene> scenes;
+        std::vector<uint32_t> sceneNodes;
+        std::vector<Light> lights;
+
+        // Backing memory of the buffers and names
+        MappedFile file;
+        std::vector<std::unique_ptr<uint8_t[]>> bufferStorage;
+    };
+
+    // Parses a .gltf or .glb and reads all of its buffers. Every index in the document is validated and
+    // every accessor lies inside its buffer. Prints the reason and returns false for malformed files.
+    bool Load(const std::filesystem::path& path, Document& document);
+
+    // Files of the buffers a .gltf or .glb references by uri, from only the buffers array of the JSON.
+    // data and size are the mapped file. False if the JSON can't be read.
+    bool GetExternalBufferPaths(const std::filesystem::path& path, const uint8_t* data, size_t size, std::vector<std::filesystem::path>& paths);
+
+    // Frees the file and buffer memory, buffer data and names are invalid afterwards
+    void ReleaseBuffers(Document& document);
+
+    uint32_t GetComponentSize(uint32_t componentType);
+
+    inline size_t GetByteStride(const Accessor& accessor, const BufferView& view)
+    {
+        return view.byteStride ? view.byteStride : size_t(GetComponentSize(accessor.componentType)) * accessor.componentCount;
+    }
+}
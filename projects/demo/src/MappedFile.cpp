@@ -0,0 +1,111 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+    Close();
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    m_FileHandle = file;
+    m_Size = static_cast<size_t>(size.QuadPart);
+    m_IsOpen = true;
+    // Zero sized files can't be mapped
+    if (m_Size == 0)
+        return true;
+
+    m_MappingHandle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_MappingHandle)
+        m_pData = static_cast<const uint8_t*>(MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0));
+
+    if (!m_pData)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_pData)
+        UnmapViewOfFile(m_pData);
+    if (m_MappingHandle)
+        CloseHandle(m_MappingHandle);
+    if (m_FileHandle)
+        CloseHandle(m_FileHandle);
+
+    m_pData = nullptr;
+    m_MappingHandle = nullptr;
+    m_FileHandle = nullptr;
+    m_Size = 0;
+    m_IsOpen = false;
+}
+#else
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+    Close();
+
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    m_Size = static_cast<size_t>(st.st_size);
+    if (m_Size > 0)
+    {
+        void* data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            m_Size = 0;
+            return false;
+        }
+        // Mostly streamed front to back
+        madvise(data, m_Size, MADV_SEQUENTIAL);
+        m_pData = static_cast<const uint8_t*>(data);
+    }
+
+    // The mapping keeps the file alive
+    close(fd);
+    m_IsOpen = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_pData)
+        munmap(const_cast<uint8_t*>(m_pData), m_Size);
+
+    m_pData = nullptr;
+    m_Size = 0;
+    m_IsOpen = false;
+}
+#endif
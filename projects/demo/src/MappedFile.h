@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Read-only memory mapping of a whole file. Pages are faulted in on first touch,
+// so only the parts that are actually read cost I/O.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::filesystem::path& path);
+    void Close();
+
+    bool IsOpen() const { return m_IsOpen; }
+    // nullptr for empty files
+    const uint8_t* GetData() const { return m_pData; }
+    size_t GetSize() const { return m_Size; }
+
+private:
+    const uint8_t* m_pData = nullptr;
+    size_t m_Size = 0;
+    bool m_IsOpen = false;
+#ifdef _WIN32
+    void* m_FileHandle = nullptr;
+    void* m_MappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,434 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace MeshOptimizer
+{
+    static constexpr uint32_t kInvalidIndex = ~0u;
+
+    static uint64_t HashVertex(const uint8_t* data, size_t size)
+    {
+        // FNV-1a over 32-bit words with a murmur finalizer, vertices are always 4 byte multiples
+        uint64_t h = 0xcbf29ce484222325ull;
+        size_t i = 0;
+        for (; i + 4 <= size; i += 4)
+        {
+            uint32_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            h = (h ^ word) * 0x100000001b3ull;
+        }
+        for (; i < size; i++)
+            h = (h ^ data[i]) * 0x100000001b3ull;
+
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    size_t WeldVertices(void* vertices, size_t vertexCount, size_t vertexStride, uint32_t* indices, size_t indexCount)
+    {
+        uint8_t* bytes = static_cast<uint8_t*>(vertices);
+
+        size_t capacity = 1;
+        while (capacity < vertexCount * 2)
+            capacity *= 2;
+        const size_t mask = capacity - 1;
+
+        std::vector<uint32_t> table(capacity, kInvalidIndex);
+        std::vector<uint32_t> remap(vertexCount);
+
+        size_t uniqueCount = 0;
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            const uint8_t* vertex = bytes + v * vertexStride;
+            size_t slot = HashVertex(vertex, vertexStride) & mask;
+
+            while (true)
+            {
+                const uint32_t unique = table[slot];
+                if (unique == kInvalidIndex)
+                {
+                    // uniqueCount <= v, so the destination was already consumed
+                    if (uniqueCount != v)
+                        std::memmove(bytes + uniqueCount * vertexStride, vertex, vertexStride);
+                    table[slot] = static_cast<uint32_t>(uniqueCount);
+                    remap[v] = static_cast<uint32_t>(uniqueCount++);
+                    break;
+                }
+
+                if (std::memcmp(bytes + unique * vertexStride, vertex, vertexStride) == 0)
+                {
+                    remap[v] = unique;
+                    break;
+                }
+
+                slot = (slot + 1) & mask;
+            }
+        }
+
+        for (size_t i = 0; i < indexCount; i++)
+            indices[i] = remap[indices[i]];
+
+        return uniqueCount;
+    }
+
+    // Forsyth, "Linear-Speed Vertex Cache Optimisation"
+    static constexpr uint32_t kForsythCacheSize = 32;
+
+    static float ScoreVertex(int32_t cachePosition, uint32_t remainingValence)
+    {
+        static constexpr float kCacheDecayPower = 1.5f;
+        static constexpr float kLastTriangleScore = 0.75f;
+        static constexpr float kValenceBoostScale = 2.0f;
+        static constexpr float kValenceBoostPower = 0.5f;
+
+        if (remainingValence == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // The vertices of the last triangle get a fixed score so the next one doesn't just reuse them
+            if (cachePosition < 3)
+                score = kLastTriangleScore;
+            else
+                score = std::pow(1.0f - float(cachePosition - 3) / float(kForsythCacheSize - 3), kCacheDecayPower);
+        }
+
+        // Boost vertices with few remaining triangles so they get finished off
+        score += kValenceBoostScale * std::pow(float(remainingValence), -kValenceBoostPower);
+        return score;
+    }
+
+    void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+    {
+        const size_t triangleCount = indexCount / 3;
+        if (triangleCount < 2)
+            return;
+
+        // Vertex -> triangle adjacency, the first valence[v] entries of each list are the live triangles
+        std::vector<uint32_t> valence(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            valence[indices[i]]++;
+
+        std::vector<uint32_t> offsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] = offsets[v] + valence[v];
+
+        std::vector<uint32_t> adjacency(triangleCount * 3);
+        {
+            std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < triangleCount * 3; i++)
+                adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        std::vector<int32_t> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+            vertexScore[v] = ScoreVertex(-1, valence[v]);
+
+        std::vector<float> triangleScore(triangleCount);
+        std::vector<uint8_t> emitted(triangleCount, 0);
+        for (size_t t = 0; t < triangleCount; t++)
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+        std::vector<uint32_t> output;
+        output.reserve(triangleCount * 3);
+
+        uint32_t cache[kForsythCacheSize + 3];
+        size_t cacheCount = 0;
+        size_t scanCursor = 0;
+
+        int64_t best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+        for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+        {
+            // Nothing in the cache has triangles left, continue with the next triangle in input order
+            if (best < 0)
+            {
+                while (emitted[scanCursor])
+                    scanCursor++;
+                best = static_cast<int64_t>(scanCursor);
+            }
+
+            const uint32_t* tri = &indices[best * 3];
+            emitted[best] = 1;
+            output.insert(output.end(), tri, tri + 3);
+
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                const uint32_t v = tri[k];
+                uint32_t* list = &adjacency[offsets[v]];
+                for (uint32_t i = 0; i < valence[v]; i++)
+                {
+                    if (list[i] == best)
+                    {
+                        std::swap(list[i], list[valence[v] - 1]);
+                        valence[v]--;
+                        break;
+                    }
+                }
+            }
+
+            // Triangle vertices go to the front, everything else gets pushed back
+            uint32_t newCache[kForsythCacheSize + 3];
+            size_t newCacheCount = 0;
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                if (std::find(newCache, newCache + newCacheCount, tri[k]) == newCache + newCacheCount)
+                    newCache[newCacheCount++] = tri[k];
+            }
+            for (size_t i = 0; i < cacheCount; i++)
+            {
+                if (std::find(tri, tri + 3, cache[i]) == tri + 3)
+                    newCache[newCacheCount++] = cache[i];
+            }
+
+            for (size_t i = 0; i < newCacheCount; i++)
+            {
+                const uint32_t v = newCache[i];
+                cachePosition[v] = i < kForsythCacheSize ? static_cast<int32_t>(i) : -1;
+
+                const float score = ScoreVertex(cachePosition[v], valence[v]);
+                const float delta = score - vertexScore[v];
+                vertexScore[v] = score;
+
+                const uint32_t* list = &adjacency[offsets[v]];
+                for (uint32_t j = 0; j < valence[v]; j++)
+                    triangleScore[list[j]] += delta;
+            }
+
+            cacheCount = std::min<size_t>(newCacheCount, kForsythCacheSize);
+            std::copy(newCache, newCache + cacheCount, cache);
+
+            best = -1;
+            float bestScore = -1.0f;
+            for (size_t i = 0; i < cacheCount; i++)
+            {
+                const uint32_t v = cache[i];
+                const uint32_t* list = &adjacency[offsets[v]];
+                for (uint32_t j = 0; j < valence[v]; j++)
+                {
+                    if (triangleScore[list[j]] > bestScore)
+                    {
+                        bestScore = triangleScore[list[j]];
+                        best = list[j];
+                    }
+                }
+            }
+        }
+
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    // FIFO cache simulation shared by the overdraw optimizer and ACMR analysis
+    struct FifoCache
+    {
+        std::vector<uint32_t> timestamps;
+        uint32_t time;
+        uint32_t size;
+
+        FifoCache(size_t vertexCount, uint32_t cacheSize)
+            : timestamps(vertexCount, 0), time(cacheSize + 1), size(cacheSize) {}
+
+        uint32_t Update(const uint32_t* tri)
+        {
+            uint32_t misses = 0;
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                if (time - timestamps[tri[k]] > size)
+                {
+                    timestamps[tri[k]] = time++;
+                    misses++;
+                }
+            }
+            return misses;
+        }
+
+        void Flush() { time += size + 1; }
+    };
+
+    // Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+    void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride, float threshold)
+    {
+        static constexpr uint32_t kCacheSize = 16;
+
+        const size_t triangleCount = indexCount / 3;
+        if (triangleCount < 2)
+            return;
+
+        // Hard boundaries: triangles that miss the cache on all three vertices
+        std::vector<uint32_t> hardClusters;
+        {
+            FifoCache cache(vertexCount, kCacheSize);
+            for (size_t t = 0; t < triangleCount; t++)
+            {
+                if (cache.Update(&indices[t * 3]) == 3 || t == 0)
+                    hardClusters.push_back(static_cast<uint32_t>(t));
+            }
+        }
+
+        // Soft boundaries: split hard clusters wherever the running ACMR already beats the cluster's ACMR by the threshold
+        std::vector<uint32_t> clusters;
+        {
+            FifoCache cache(vertexCount, kCacheSize);
+            for (size_t c = 0; c < hardClusters.size(); c++)
+            {
+                const size_t start = hardClusters[c];
+                const size_t end = c + 1 < hardClusters.size() ? hardClusters[c + 1] : triangleCount;
+
+                cache.Flush();
+                uint32_t clusterMisses = 0;
+                for (size_t t = start; t < end; t++)
+                    clusterMisses += cache.Update(&indices[t * 3]);
+                const float clusterThreshold = threshold * float(clusterMisses) / float(end - start);
+
+                clusters.push_back(static_cast<uint32_t>(start));
+                cache.Flush();
+
+                uint32_t runningMisses = 0;
+                uint32_t runningTriangles = 0;
+                for (size_t t = start; t < end; t++)
+                {
+                    runningMisses += cache.Update(&indices[t * 3]);
+                    runningTriangles++;
+
+                    if (t + 1 < end && float(runningMisses) / float(runningTriangles) <= clusterThreshold)
+                    {
+                        clusters.push_back(static_cast<uint32_t>(t + 1));
+                        cache.Flush();
+                        runningMisses = 0;
+                        runningTriangles = 0;
+                    }
+                }
+            }
+        }
+
+        const auto GetPosition = [&](uint32_t v)
+        {
+            const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + v * positionStride);
+            return std::array<float, 3> { p[0], p[1], p[2] };
+        };
+
+        struct ClusterInfo
+        {
+            float centroid[3];
+            float normal[3];
+            float area;
+        };
+        std::vector<ClusterInfo> infos(clusters.size());
+
+        float meshCentroid[3] = {};
+        float meshArea = 0.0f;
+        for (size_t c = 0; c < clusters.size(); c++)
+        {
+            const size_t start = clusters[c];
+            const size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+            ClusterInfo& info = infos[c];
+            info = {};
+            for (size_t t = start; t < end; t++)
+            {
+                const auto a = GetPosition(indices[t * 3]);
+                const auto b = GetPosition(indices[t * 3 + 1]);
+                const auto d = GetPosition(indices[t * 3 + 2]);
+
+                const float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                const float e1[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+                const float n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+                const float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+                for (int k = 0; k < 3; k++)
+                {
+                    info.centroid[k] += (a[k] + b[k] + d[k]) / 3.0f * area;
+                    info.normal[k] += n[k];
+                }
+                info.area += area;
+            }
+
+            for (int k = 0; k < 3; k++)
+                meshCentroid[k] += info.centroid[k];
+            meshArea += info.area;
+
+            const float inverseArea = info.area == 0.0f ? 0.0f : 1.0f / info.area;
+            const float normalLength = std::sqrt(info.normal[0] * info.normal[0] + info.normal[1] * info.normal[1] + info.normal[2] * info.normal[2]);
+            const float inverseLength = normalLength == 0.0f ? 0.0f : 1.0f / normalLength;
+            for (int k = 0; k < 3; k++)
+            {
+                info.centroid[k] *= inverseArea;
+                info.normal[k] *= inverseLength;
+            }
+        }
+
+        const float inverseMeshArea = meshArea == 0.0f ? 0.0f : 1.0f / meshArea;
+        for (int k = 0; k < 3; k++)
+            meshCentroid[k] *= inverseMeshArea;
+
+        // Clusters facing away from the mesh center are likely to occlude the rest, draw them first
+        std::vector<float> sortKeys(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++)
+        {
+            const ClusterInfo& info = infos[c];
+            sortKeys[c] = (info.centroid[0] - meshCentroid[0]) * info.normal[0]
+                        + (info.centroid[1] - meshCentroid[1]) * info.normal[1]
+                        + (info.centroid[2] - meshCentroid[2]) * info.normal[2];
+        }
+
+        std::vector<uint32_t> order(clusters.size());
+        for (size_t c = 0; c < order.size(); c++)
+            order[c] = static_cast<uint32_t>(c);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+        std::vector<uint32_t> output;
+        output.reserve(triangleCount * 3);
+        for (uint32_t c : order)
+        {
+            const size_t start = clusters[c];
+            const size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            output.insert(output.end(), indices + start * 3, indices + end * 3);
+        }
+
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    size_t OptimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexStride, uint32_t* indices, size_t indexCount)
+    {
+        std::vector<uint32_t> remap(vertexCount, kInvalidIndex);
+        uint32_t next = 0;
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            uint32_t& r = remap[indices[i]];
+            if (r == kInvalidIndex)
+                r = next++;
+            indices[i] = r;
+        }
+
+        uint8_t* bytes = static_cast<uint8_t*>(vertices);
+        const std::vector<uint8_t> copy(bytes, bytes + vertexCount * vertexStride);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            if (remap[v] != kInvalidIndex)
+                std::memcpy(bytes + remap[v] * vertexStride, copy.data() + v * vertexStride, vertexStride);
+        }
+
+        return next;
+    }
+
+    float ComputeACMR(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+    {
+        const size_t triangleCount = indexCount / 3;
+        if (triangleCount == 0)
+            return 0.0f;
+
+        FifoCache cache(vertexCount, cacheSize);
+        size_t misses = 0;
+        for (size_t t = 0; t < triangleCount; t++)
+            misses += cache.Update(&indices[t * 3]);
+
+        return float(misses) / float(triangleCount);
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Load-time triangle mesh optimizations. Everything works in place on raw vertex and
+// index ranges so it can run on request vectors as well as on mapped staging memory.
+namespace MeshOptimizer
+{
+    // Merges bit-identical vertices. Vertices are compacted in place and indices remapped.
+    // Returns the new vertex count.
+    size_t WeldVertices(void* vertices, size_t vertexCount, size_t vertexStride, uint32_t* indices, size_t indexCount);
+
+    // Reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm).
+    void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+    // Splits a cache-optimized index list into clusters and sorts them so outward facing clusters
+    // are drawn first, which reduces overdraw. threshold (>= 1) bounds how much the cache efficiency
+    // may degrade by splitting clusters further.
+    void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride, float threshold);
+
+    // Reorders vertices in the order they are first referenced so vertex fetch walks memory linearly.
+    // Unreferenced vertices are dropped. Returns the new vertex count.
+    size_t OptimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexStride, uint32_t* indices, size_t indexCount);
+
+    // Average cache miss ratio (transformed vertices per triangle) for a FIFO cache of cacheSize entries.
+    float ComputeACMR(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16);
+}
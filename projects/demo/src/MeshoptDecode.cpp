@@ -0,0 +1,432 @@
+#include "MeshoptDecode.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace MeshoptDecode
+{
+    inline constexpr uint8_t kVertexHeader = 0xA0;
+    inline constexpr uint8_t kIndexHeader = 0xE0;
+    inline constexpr uint8_t kSequenceHeader = 0xD0;
+
+    // Vertex blocks hold up to 256 elements and at most 8 KB of decoded data, bytes are coded in groups of 16
+    inline constexpr size_t kVertexBlockSizeBytes = 8192;
+    inline constexpr size_t kVertexBlockMaxSize = 256;
+    inline constexpr size_t kByteGroupSize = 16;
+    // Largest group encoding: 8 bytes of 4 bit values and an escape byte for each of them
+    inline constexpr size_t kByteGroupDecodeLimit = 24;
+    inline constexpr size_t kTailMinSize = 32;
+
+    static size_t GetVertexBlockSize(size_t byteStride)
+    {
+        const size_t size = (kVertexBlockSizeBytes / byteStride) & ~(kByteGroupSize - 1);
+        return size < kVertexBlockMaxSize ? size : kVertexBlockMaxSize;
+    }
+
+    static uint8_t Unzigzag8(uint8_t v)
+    {
+        return static_cast<uint8_t>(-(v & 1) ^ (v >> 1));
+    }
+
+    // Values are packed most significant bits first, the all ones value escapes to a full byte stored after the packed bits
+    template<uint32_t Bits>
+    static const uint8_t* DecodePackedGroup(const uint8_t* data, uint8_t* dst)
+    {
+        constexpr uint32_t kEscape = (1u << Bits) - 1;
+        constexpr size_t kPackedSize = kByteGroupSize * Bits / 8;
+        const uint8_t* escapes = data + kPackedSize;
+        for (size_t i = 0; i < kByteGroupSize; i++)
+        {
+            const uint32_t shift = 8 - Bits - (i * Bits) % 8;
+            const uint32_t value = (data[i * Bits / 8] >> shift) & kEscape;
+            dst[i] = value == kEscape ? *escapes++ : static_cast<uint8_t>(value);
+        }
+        return escapes;
+    }
+
+    // One byte of every element of a block: 2 bit group modes, then the groups
+    static const uint8_t* DecodeBytes(const uint8_t* data, const uint8_t* end, uint8_t* dst, size_t count)
+    {
+        const size_t groupCount = count / kByteGroupSize;
+        const size_t headerSize = (groupCount + 3) / 4;
+        if (size_t(end - data) < headerSize)
+            return nullptr;
+
+        const uint8_t* header = data;
+        data += headerSize;
+        for (size_t group = 0; group < groupCount; group++)
+        {
+            if (size_t(end - data) < kByteGroupDecodeLimit)
+                return nullptr;
+
+            uint8_t* groupDst = dst + group * kByteGroupSize;
+            switch ((header[group / 4] >> ((group % 4) * 2)) & 3)
+            {
+            case 0:
+                std::memset(groupDst, 0, kByteGroupSize);
+                break;
+            case 1:
+                data = DecodePackedGroup<2>(data, groupDst);
+                break;
+            case 2:
+                data = DecodePackedGroup<4>(data, groupDst);
+                break;
+            default:
+                std::memcpy(groupDst, data, kByteGroupSize);
+                data += kByteGroupSize;
+                break;
+            }
+        }
+        return data;
+    }
+
+    // Bytes are stored per byte position as deltas to the previous element, the first element of the
+    // stream is a delta to the baseline element in the tail
+    static const uint8_t* DecodeVertexBlock(const uint8_t* data, const uint8_t* end, uint8_t* dst, size_t count,
+        size_t byteStride, uint8_t* lastElement)
+    {
+        uint8_t deltas[kVertexBlockMaxSize];
+        const size_t alignedCount = (count + kByteGroupSize - 1) & ~(kByteGroupSize - 1);
+        for (size_t k = 0; k < byteStride; k++)
+        {
+            data = DecodeBytes(data, end, deltas, alignedCount);
+            if (!data)
+                return nullptr;
+
+            uint8_t previous = lastElement[k];
+            uint8_t* out = dst + k;
+            for (size_t i = 0; i < count; i++)
+            {
+                previous = static_cast<uint8_t>(previous + Unzigzag8(deltas[i]));
+                *out = previous;
+                out += byteStride;
+            }
+        }
+
+        std::memcpy(lastElement, dst + (count - 1) * byteStride, byteStride);
+        return data;
+    }
+
+    bool DecodeVertexBuffer(uint8_t* dst, size_t count, size_t byteStride, const uint8_t* src, size_t srcSize)
+    {
+        if (byteStride == 0 || byteStride > 256 || byteStride % 4 != 0)
+            return false;
+        if (srcSize < 1 + byteStride || src[0] != kVertexHeader)
+            return false;
+
+        const uint8_t* data = src + 1;
+        const uint8_t* end = src + srcSize;
+
+        uint8_t lastElement[256];
+        std::memcpy(lastElement, end - byteStride, byteStride);
+
+        const size_t blockSize = GetVertexBlockSize(byteStride);
+        for (size_t first = 0; first < count; first += blockSize)
+        {
+            const size_t blockCount = count - first < blockSize ? count - first : blockSize;
+            data = DecodeVertexBlock(data, end, dst + first * byteStride, blockCount, byteStride, lastElement);
+            if (!data)
+                return false;
+        }
+
+        // Everything but the tail has to be consumed
+        const size_t tailSize = byteStride < kTailMinSize ? kTailMinSize : byteStride;
+        return size_t(end - data) == tailSize;
+    }
+
+    static uint32_t DecodeVByte(const uint8_t*& data)
+    {
+        const uint8_t lead = *data++;
+        if (lead < 128)
+            return lead;
+
+        uint32_t result = lead & 127;
+        uint32_t shift = 7;
+        for (int i = 0; i < 4; i++)
+        {
+            const uint8_t group = *data++;
+            result |= uint32_t(group & 127) << shift;
+            shift += 7;
+            if (group < 128)
+                break;
+        }
+        return result;
+    }
+
+    // Zigzag delta to the last explicitly coded index
+    static uint32_t DecodeIndex(const uint8_t*& data, uint32_t last)
+    {
+        const uint32_t v = DecodeVByte(data);
+        return last + ((v >> 1) ^ (0u - (v & 1)));
+    }
+
+    static void WriteIndex(uint8_t* dst, size_t indexSize, size_t i, uint32_t index)
+    {
+        if (indexSize == 2)
+        {
+            const uint16_t narrow = static_cast<uint16_t>(index);
+            std::memcpy(dst + i * 2, &narrow, 2);
+        }
+        else
+            std::memcpy(dst + i * 4, &index, 4);
+    }
+
+    bool DecodeIndexBuffer(uint8_t* dst, size_t count, size_t indexSize, const uint8_t* src, size_t srcSize)
+    {
+        if (count % 3 != 0 || (indexSize != 2 && indexSize != 4))
+            return false;
+        // Header, a code byte per triangle and the 16 byte auxiliary code table at the end
+        if (srcSize < 1 + count / 3 + 16 || (src[0] & 0xF0) != kIndexHeader)
+            return false;
+        const uint32_t version = src[0] & 0x0F;
+        if (version > 1)
+            return false;
+
+        // Recently seen edges and vertices, reads wrap around the 16 entries
+        uint32_t edges[16][2];
+        uint32_t vertices[16];
+        std::memset(edges, -1, sizeof(edges));
+        std::memset(vertices, -1, sizeof(vertices));
+        size_t edgeOffset = 0;
+        size_t vertexOffset = 0;
+
+        const auto pushVertex = [&](uint32_t v, bool push = true)
+        {
+            vertices[vertexOffset] = v;
+            vertexOffset = (vertexOffset + push) & 15;
+        };
+        const auto pushEdge = [&](uint32_t a, uint32_t b)
+        {
+            edges[edgeOffset][0] = a;
+            edges[edgeOffset][1] = b;
+            edgeOffset = (edgeOffset + 1) & 15;
+        };
+
+        uint32_t next = 0;
+        uint32_t last = 0;
+        // Version 1 codes +-1 deltas to the last index as 13 and 14
+        const uint32_t fecMax = version >= 1 ? 13 : 15;
+
+        const uint8_t* code = src + 1;
+        const uint8_t* data = code + count / 3;
+        const uint8_t* dataSafeEnd = src + srcSize - 16;
+        const uint8_t* auxTable = dataSafeEnd;
+
+        for (size_t i = 0; i < count; i += 3)
+        {
+            // A triangle reads at most 16 data bytes, which the code table guarantees are there
+            if (data > dataSafeEnd)
+                return false;
+
+            const uint8_t codeTri = *code++;
+            if (codeTri < 0xF0)
+            {
+                // Edge from the fifo and a new, cached or explicitly coded third vertex
+                const uint32_t fe = codeTri >> 4;
+                const uint32_t a = edges[(edgeOffset - 1 - fe) & 15][0];
+                const uint32_t b = edges[(edgeOffset - 1 - fe) & 15][1];
+                const uint32_t fec = codeTri & 15;
+
+                uint32_t c;
+                if (fec < fecMax)
+                {
+                    c = fec == 0 ? next++ : vertices[(vertexOffset - 1 - fec) & 15];
+                    pushVertex(c, fec == 0);
+                }
+                else
+                {
+                    last = c = fec != 15 ? last + (fec == 13 ? -1 : 1) : DecodeIndex(data, last);
+                    pushVertex(c);
+                }
+
+                WriteIndex(dst, indexSize, i + 0, a);
+                WriteIndex(dst, indexSize, i + 1, b);
+                WriteIndex(dst, indexSize, i + 2, c);
+                pushEdge(c, b);
+                pushEdge(a, c);
+            }
+            else if (codeTri < 0xFE)
+            {
+                // Three vertices from the table, a is always new
+                const uint8_t codeAux = auxTable[codeTri & 15];
+                const uint32_t feb = codeAux >> 4;
+                const uint32_t fec = codeAux & 15;
+
+                const uint32_t a = next++;
+                const uint32_t b = feb == 0 ? next++ : vertices[(vertexOffset - feb) & 15];
+                const uint32_t c = fec == 0 ? next++ : vertices[(vertexOffset - fec) & 15];
+
+                WriteIndex(dst, indexSize, i + 0, a);
+                WriteIndex(dst, indexSize, i + 1, b);
+                WriteIndex(dst, indexSize, i + 2, c);
+                pushVertex(a);
+                pushVertex(b, feb == 0);
+                pushVertex(c, fec == 0);
+                pushEdge(b, a);
+                pushEdge(c, b);
+                pushEdge(a, c);
+            }
+            else
+            {
+                // Full auxiliary byte, 15 means an explicitly coded index and a zero byte restarts next
+                const uint8_t codeAux = *data++;
+                const uint32_t fea = codeTri == 0xFE ? 0 : 15;
+                const uint32_t feb = codeAux >> 4;
+                const uint32_t fec = codeAux & 15;
+                if (codeAux == 0)
+                    next = 0;
+
+                uint32_t a = fea == 0 ? next++ : 0;
+                uint32_t b = feb == 0 ? next++ : vertices[(vertexOffset - feb) & 15];
+                uint32_t c = fec == 0 ? next++ : vertices[(vertexOffset - fec) & 15];
+                if (fea == 15)
+                    last = a = DecodeIndex(data, last);
+                if (feb == 15)
+                    last = b = DecodeIndex(data, last);
+                if (fec == 15)
+                    last = c = DecodeIndex(data, last);
+
+                WriteIndex(dst, indexSize, i + 0, a);
+                WriteIndex(dst, indexSize, i + 1, b);
+                WriteIndex(dst, indexSize, i + 2, c);
+                pushVertex(a);
+                pushVertex(b, feb == 0 || feb == 15);
+                pushVertex(c, fec == 0 || fec == 15);
+                pushEdge(b, a);
+                pushEdge(c, b);
+                pushEdge(a, c);
+            }
+        }
+
+        return data == dataSafeEnd;
+    }
+
+    bool DecodeIndexSequence(uint8_t* dst, size_t count, size_t indexSize, const uint8_t* src, size_t srcSize)
+    {
+        if (indexSize != 2 && indexSize != 4)
+            return false;
+        // Header, at least a byte per index and 4 bytes of padding
+        if (srcSize < 1 + count + 4 || (src[0] & 0xF0) != kSequenceHeader || (src[0] & 0x0F) > 1)
+            return false;
+
+        const uint8_t* data = src + 1;
+        const uint8_t* dataSafeEnd = src + srcSize - 4;
+
+        // Two baselines, the low bit of each value picks the one its delta is relative to
+        uint32_t last[2] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            if (data >= dataSafeEnd)
+                return false;
+
+            uint32_t v = DecodeVByte(data);
+            const uint32_t baseline = v & 1;
+            v >>= 1;
+            const uint32_t index = last[baseline] + ((v >> 1) ^ (0u - (v & 1)));
+            last[baseline] = index;
+            WriteIndex(dst, indexSize, i, index);
+        }
+
+        return data == dataSafeEnd;
+    }
+
+    static int RoundToInt(float v)
+    {
+        return int(v + (v >= 0.0f ? 0.5f : -0.5f));
+    }
+
+    // Snorm x and y of an octahedral map with z stored as 1, w is left as is
+    template<typename T>
+    static void DecodeOctahedral(uint8_t* data, size_t count)
+    {
+        const float one = float((1 << (sizeof(T) * 8 - 1)) - 1);
+        for (size_t i = 0; i < count; i++)
+        {
+            T v[4];
+            std::memcpy(v, data + i * sizeof(v), sizeof(v));
+
+            float x = float(v[0]);
+            float y = float(v[1]);
+            const float z = float(v[2]) - std::fabs(x) - std::fabs(y);
+
+            // Fold the lower hemisphere back
+            const float t = z < 0.0f ? z : 0.0f;
+            x += x >= 0.0f ? t : -t;
+            y += y >= 0.0f ? t : -t;
+
+            const float scale = one / std::sqrt(x * x + y * y + z * z);
+            v[0] = T(RoundToInt(x * scale));
+            v[1] = T(RoundToInt(y * scale));
+            v[2] = T(RoundToInt(z * scale));
+            std::memcpy(data + i * sizeof(v), v, sizeof(v));
+        }
+    }
+
+    // Three snorm16 components and the index of the dropped, largest one in the low bits of the fourth
+    static void DecodeQuaternion(uint8_t* data, size_t count)
+    {
+        const float scale = 1.0f / std::sqrt(2.0f);
+        for (size_t i = 0; i < count; i++)
+        {
+            int16_t v[4];
+            std::memcpy(v, data + i * sizeof(v), sizeof(v));
+
+            const float s = scale / float(v[3] | 3);
+            const float x = float(v[0]) * s;
+            const float y = float(v[1]) * s;
+            const float z = float(v[2]) * s;
+            const float ww = 1.0f - x * x - y * y - z * z;
+            const float w = std::sqrt(ww >= 0.0f ? ww : 0.0f);
+
+            const uint32_t dropped = v[3] & 3;
+            int16_t out[4];
+            out[(dropped + 1) & 3] = int16_t(RoundToInt(x * 32767.0f));
+            out[(dropped + 2) & 3] = int16_t(RoundToInt(y * 32767.0f));
+            out[(dropped + 3) & 3] = int16_t(RoundToInt(z * 32767.0f));
+            out[dropped] = int16_t(RoundToInt(w * 32767.0f));
+            std::memcpy(data + i * sizeof(out), out, sizeof(out));
+        }
+    }
+
+    // 24 bit signed mantissa and 8 bit signed exponent to float
+    static void DecodeExponential(uint8_t* data, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t v;
+            std::memcpy(&v, data + i * 4, 4);
+            const int32_t mantissa = int32_t(v << 8) >> 8;
+            const int32_t exponent = int32_t(v) >> 24;
+            const float value = std::ldexp(float(mantissa), exponent);
+            std::memcpy(data + i * 4, &value, 4);
+        }
+    }
+
+    bool ApplyFilter(Filter filter, uint8_t* data, size_t count, size_t byteStride)
+    {
+        switch (filter)
+        {
+        case Filter::None:
+            return true;
+        case Filter::Octahedral:
+            if (byteStride == 4)
+                DecodeOctahedral<int8_t>(data, count);
+            else if (byteStride == 8)
+                DecodeOctahedral<int16_t>(data, count);
+            else
+                return false;
+            return true;
+        case Filter::Quaternion:
+            if (byteStride != 8)
+                return false;
+            DecodeQuaternion(data, count);
+            return true;
+        case Filter::Exponential:
+            if (byteStride % 4 != 0)
+                return false;
+            DecodeExponential(data, count * byteStride / 4);
+            return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Decoders for the EXT_meshopt_compression bitstreams (vertex codec version 0, index codecs version 0 and 1).
+// Every decoder checks the stream against the expected element count and size and returns false instead of
+// reading past src + srcSize, a corrupt stream leaves dst partially written.
+namespace MeshoptDecode
+{
+    enum class Mode : uint32_t
+    {
+        Attributes,
+        Triangles,
+        Indices
+    };
+
+    enum class Filter : uint32_t
+    {
+        None,
+        Octahedral,
+        Quaternion,
+        Exponential
+    };
+
+    // count elements of byteStride bytes, byteStride is a multiple of 4 and at most 256
+    bool DecodeVertexBuffer(uint8_t* dst, size_t count, size_t byteStride, const uint8_t* src, size_t srcSize);
+    // count is a multiple of 3, indexSize is 2 or 4
+    bool DecodeIndexBuffer(uint8_t* dst, size_t count, size_t indexSize, const uint8_t* src, size_t srcSize);
+    bool DecodeIndexSequence(uint8_t* dst, size_t count, size_t indexSize, const uint8_t* src, size_t srcSize);
+
+    // Applied in place after DecodeVertexBuffer, false if the stride doesn't fit the filter
+    bool ApplyFilter(Filter filter, uint8_t* data, size_t count, size_t byteStride);
+
+    inline bool Decode(Mode mode, Filter filter, uint8_t* dst, size_t count, size_t byteStride, const uint8_t* src, size_t srcSize)
+    {
+        switch (mode)
+        {
+        case Mode::Attributes:
+            return DecodeVertexBuffer(dst, count, byteStride, src, srcSize) && ApplyFilter(filter, dst, count, byteStride);
+        case Mode::Triangles:
+            return DecodeIndexBuffer(dst, count, byteStride, src, srcSize);
+        default:
+            return DecodeIndexSequence(dst, count, byteStride, src, srcSize);
+        }
+    }
+}
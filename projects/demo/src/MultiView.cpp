@@ -0,0 +1,173 @@
+#include "MultiView.h"
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+namespace MultiView
+{
+    void MakeRigViews(const glm::mat4& view, uint32_t viewCount, glm::mat4* pViews)
+    {
+        // Rotating in view space turns the camera around its own position
+        for (uint32_t i = 0; i < viewCount; i++)
+        {
+            const float yaw = glm::two_pi<float>() * float(i) / float(viewCount);
+            pViews[i] = glm::rotate(glm::mat4(1.0f), yaw, glm::vec3(0.0f, 1.0f, 0.0f)) * view;
+        }
+    }
+
+    VkResult ViewSet::Initialize(imp::Engine& engine, uint32_t viewCount, uint32_t maxInstances, uint32_t framesInFlight)
+    {
+        VkPhysicalDevice pDevice = engine.GetPhysicalDevice();
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+
+        VkPhysicalDeviceMultiviewProperties multiviewProps {};
+        multiviewProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 props {};
+        props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props.pNext = &multiviewProps;
+        vkGetPhysicalDeviceProperties2(pDevice, &props);
+
+        if (viewCount == 0 || viewCount > std::min(kMaxViews, multiviewProps.maxMultiviewViewCount))
+        {
+            printf("[MultiView] %u views requested, the device supports up to %u\n", viewCount, std::min(kMaxViews, multiviewProps.maxMultiviewViewCount));
+            return VK_ERROR_FEATURE_NOT_PRESENT;
+        }
+
+        m_ViewCount = viewCount;
+        m_MaxInstances = std::max(maxInstances, 1u);
+
+        VkResult result = VU::CreateBuffer(pDevice, device, sizeof(ViewUniforms),
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_UniformBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = VU::CreateBuffer(pDevice, device, sizeof(uint32_t) * m_MaxInstances,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_ViewMaskBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        // One slot per frame in flight, each holds the uniforms followed by the view masks
+        m_StagingSlotSize = (sizeof(ViewUniforms) + sizeof(uint32_t) * m_MaxInstances + 255) & ~VkDeviceSize(255);
+        m_StagingSlotCount = std::max(framesInFlight, 1u);
+        result = VU::CreateBuffer(pDevice, device, m_StagingSlotSize * m_StagingSlotCount,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_StagingBuffer);
+        if (result != VK_SUCCESS)
+            return result;
+
+        void* pStaging = nullptr;
+        result = vkMapMemory(device, m_StagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &pStaging);
+        if (result != VK_SUCCESS)
+            return result;
+        m_pStaging = static_cast<uint8_t*>(pStaging);
+
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings {};
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorCount = 1;
+        bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+        VkDescriptorSetLayoutCreateInfo dslci {};
+        dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        dslci.bindingCount = static_cast<uint32_t>(bindings.size());
+        dslci.pBindings = bindings.data();
+
+        result = vkCreateDescriptorSetLayout(device, &dslci, nullptr, &m_DescriptorSetLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkDescriptorSetAllocateInfo dsai {};
+        dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        dsai.descriptorPool = engine.GetDescriptorPool();
+        dsai.descriptorSetCount = 1;
+        dsai.pSetLayouts = &m_DescriptorSetLayout;
+
+        result = vkAllocateDescriptorSets(device, &dsai, &m_DescriptorSet);
+        if (result != VK_SUCCESS)
+            return result;
+
+        std::array<VkDescriptorBufferInfo, 2> bufferInfos {};
+        bufferInfos[0].buffer = m_UniformBuffer.buffer;
+        bufferInfos[0].range = VK_WHOLE_SIZE;
+        bufferInfos[1].buffer = m_ViewMaskBuffer.buffer;
+        bufferInfos[1].range = VK_WHOLE_SIZE;
+
+        std::array<VkWriteDescriptorSet, 2> writes {};
+        for (uint32_t i = 0; i < writes.size(); i++)
+        {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = m_DescriptorSet;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = bindings[i].descriptorType;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        return VK_SUCCESS;
+    }
+
+    void ViewSet::Destroy(VkDevice device)
+    {
+        vkDestroyDescriptorSetLayout(device, m_DescriptorSetLayout, nullptr);
+
+        if (m_pStaging)
+            vkUnmapMemory(device, m_StagingBuffer.memory);
+        m_pStaging = nullptr;
+
+        for (VU::Buffer* pBuffer : { &m_UniformBuffer, &m_ViewMaskBuffer, &m_StagingBuffer })
+        {
+            vkDestroyBuffer(device, pBuffer->buffer, nullptr);
+            vkFreeMemory(device, pBuffer->memory, nullptr);
+            *pBuffer = {};
+        }
+    }
+
+    void ViewSet::Update(const glm::mat4* pViews, const glm::mat4& projection, const glm::vec3& lightPos)
+    {
+        for (uint32_t i = 0; i < m_ViewCount; i++)
+        {
+            m_Uniforms.viewProj[i] = projection * pViews[i];
+            m_Uniforms.cameraPos[i] = glm::vec4(glm::vec3(glm::inverse(pViews[i])[3]), 1.0f);
+        }
+        m_Uniforms.lightPos = glm::vec4(lightPos, 1.0f);
+    }
+
+    void ViewSet::SetInstanceViewMasks(const std::vector<uint32_t>& instanceViewMasks)
+    {
+        if (instanceViewMasks.size() > m_MaxInstances)
+            printf("[MultiView] %zu instances, only the first %u get view masks\n", instanceViewMasks.size(), m_MaxInstances);
+        m_ViewMasks.assign(instanceViewMasks.begin(), instanceViewMasks.begin() + std::min<size_t>(instanceViewMasks.size(), m_MaxInstances));
+    }
+
+    void ViewSet::Upload(VkCommandBuffer cb, uint32_t frameIndex)
+    {
+        const VkDeviceSize slotOffset = m_StagingSlotSize * (frameIndex % m_StagingSlotCount);
+        uint8_t* pSlot = m_pStaging + slotOffset;
+
+        memcpy(pSlot, &m_Uniforms, sizeof(ViewUniforms));
+        memcpy(pSlot + sizeof(ViewUniforms), m_ViewMasks.data(), sizeof(uint32_t) * m_ViewMasks.size());
+
+        // Synchronized by the render graph pass that records this
+        VkBufferCopy copyRegion {};
+        copyRegion.srcOffset = slotOffset;
+        copyRegion.size = sizeof(ViewUniforms);
+        vkCmdCopyBuffer(cb, m_StagingBuffer.buffer, m_UniformBuffer.buffer, 1, &copyRegion);
+
+        if (m_ViewMasks.empty())
+            return;
+
+        copyRegion.srcOffset = slotOffset + sizeof(ViewUniforms);
+        copyRegion.size = sizeof(uint32_t) * m_ViewMasks.size();
+        vkCmdCopyBuffer(cb, m_StagingBuffer.buffer, m_ViewMaskBuffer.buffer, 1, &copyRegion);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "SceneLoader.h"
+
+#include <vector>
+
+namespace MultiView
+{
+    // Must match kMaxViews in multiview.vert, view masks are 32-bit
+    inline constexpr uint32_t kMaxViews = 8;
+    inline constexpr VkFormat kColorFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+    // Mirrors ViewUniforms in multiview.vert
+    struct ViewUniforms
+    {
+        glm::mat4 viewProj[kMaxViews];
+        glm::vec4 cameraPos[kMaxViews];
+        glm::vec4 lightPos;
+    };
+
+    // Views of a sensor rig on the camera, evenly spread in yaw with view 0 looking forward
+    void MakeRigViews(const glm::mat4& view, uint32_t viewCount, glm::mat4* pViews);
+
+    // Per-view cameras plus a view mask per instance, in the draw data order. Instances
+    // are culled per view in the vertex shader with the mask, so one instanced draw still
+    // serves every view while each view only rasterizes what it can see.
+    class ViewSet
+    {
+    public:
+        ViewSet() = default;
+
+        VkResult Initialize(imp::Engine& engine, uint32_t viewCount, uint32_t maxInstances, uint32_t framesInFlight);
+        void Destroy(VkDevice device);
+
+        void Update(const glm::mat4* pViews, const glm::mat4& projection, const glm::vec3& lightPos);
+        // In draw data order, from RenderQueue::Queue::Emit
+        void SetInstanceViewMasks(const std::vector<uint32_t>& instanceViewMasks);
+
+        // Copies the uniforms and masks of Update through the staging slot of frameIndex,
+        // the slot must not be in use by the GPU anymore
+        void Upload(VkCommandBuffer cb, uint32_t frameIndex);
+
+        const glm::mat4* GetViewProjs() const { return m_Uniforms.viewProj; }
+        uint32_t GetViewCount() const { return m_ViewCount; }
+        VkDescriptorSetLayout GetDescriptorSetLayout() const { return m_DescriptorSetLayout; }
+        VkDescriptorSet GetDescriptorSet() const { return m_DescriptorSet; }
+        VkBuffer GetUniformBuffer() const { return m_UniformBuffer.buffer; }
+        VkBuffer GetViewMaskBuffer() const { return m_ViewMaskBuffer.buffer; }
+
+    private:
+        uint32_t m_ViewCount = 0;
+        uint32_t m_MaxInstances = 0;
+
+        VU::Buffer m_UniformBuffer {};
+        VU::Buffer m_ViewMaskBuffer {};
+        VU::Buffer m_StagingBuffer {};
+        uint8_t* m_pStaging = nullptr;
+        VkDeviceSize m_StagingSlotSize = 0;
+        uint32_t m_StagingSlotCount = 0;
+
+        VkDescriptorSetLayout m_DescriptorSetLayout = VK_NULL_HANDLE;
+        VkDescriptorSet m_DescriptorSet = VK_NULL_HANDLE;
+
+        ViewUniforms m_Uniforms {};
+        std::vector<uint32_t> m_ViewMasks;
+    };
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Parallel
+{
+    inline uint32_t GetWorkerCount()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Calls func(i) for every i in [0, count) on up to GetWorkerCount() threads, the caller included.
+    // Items are handed out one at a time so uneven work (e.g. meshes of very different sizes) balances itself.
+    template<typename Func>
+    void For(size_t count, Func&& func)
+    {
+        const size_t workerCount = std::min<size_t>(GetWorkerCount(), count);
+        if (workerCount <= 1)
+        {
+            for (size_t i = 0; i < count; i++)
+                func(i);
+            return;
+        }
+
+        std::atomic_size_t next = 0;
+        const auto worker = [&]()
+        {
+            for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+                func(i);
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(workerCount - 1);
+        for (size_t i = 0; i < workerCount - 1; i++)
+            threads.emplace_back(worker);
+
+        worker();
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    // Persistent threads for per-frame work where spawning threads every call is too expensive.
+    // Run() executes every task concurrently on its own thread, so tasks may synchronize with each other.
+    class WorkerPool
+    {
+    public:
+        explicit WorkerPool(uint32_t threadCount = GetWorkerCount())
+        {
+            for (uint32_t i = 1; i < threadCount; i++)
+                m_Threads.emplace_back([this, i]() { WorkerLoop(i); });
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Quit = true;
+            }
+            m_Wake.notify_all();
+            for (auto& thread : m_Threads)
+                thread.join();
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_Threads.size()) + 1; }
+
+        // Runs task(i) for i in [0, taskCount), clamped to GetThreadCount(). The caller runs task 0. Not reentrant.
+        void Run(uint32_t taskCount, const std::function<void(uint32_t)>& task)
+        {
+            taskCount = std::min(taskCount, GetThreadCount());
+            if (taskCount <= 1)
+            {
+                task(0);
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Task = &task;
+                m_TaskCount = taskCount;
+                m_Pending = taskCount - 1;
+                m_Generation++;
+            }
+            m_Wake.notify_all();
+
+            task(0);
+
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Done.wait(lock, [this]() { return m_Pending == 0; });
+            m_Task = nullptr;
+        }
+
+    private:
+        void WorkerLoop(uint32_t index)
+        {
+            uint64_t seenGeneration = 0;
+            while (true)
+            {
+                const std::function<void(uint32_t)>* task = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(m_Mutex);
+                    m_Wake.wait(lock, [&]() { return m_Quit || m_Generation != seenGeneration; });
+                    if (m_Quit)
+                        return;
+                    seenGeneration = m_Generation;
+                    if (index < m_TaskCount)
+                        task = m_Task;
+                }
+
+                if (task == nullptr)
+                    continue;
+
+                (*task)(index);
+
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                if (--m_Pending == 0)
+                    m_Done.notify_one();
+            }
+        }
+
+        std::vector<std::thread> m_Threads;
+        std::mutex m_Mutex;
+        std::condition_variable m_Wake;
+        std::condition_variable m_Done;
+        const std::function<void(uint32_t)>* m_Task = nullptr;
+        uint64_t m_Generation = 0;
+        uint32_t m_TaskCount = 0;
+        uint32_t m_Pending = 0;
+        bool m_Quit = false;
+    };
+}
@@ -0,0 +1,114 @@
+#include "RadixSort.h"
+#include "Parallel.h"
+
+#include <barrier>
+#include <utility>
+#include <vector>
+
+namespace RadixSort
+{
+    static constexpr uint32_t kDigitBits = 11;
+    static constexpr uint32_t kBucketCount = 1u << kDigitBits;
+    static constexpr uint32_t kPassCount = (64 + kDigitBits - 1) / kDigitBits;
+
+    static inline uint32_t GetDigit(uint64_t key, uint32_t pass)
+    {
+        return static_cast<uint32_t>(key >> (pass * kDigitBits)) & (kBucketCount - 1);
+    }
+
+    bool Sort(uint64_t* keys, uint32_t* values, uint64_t* tempKeys, uint32_t* tempValues, size_t count, Parallel::WorkerPool* pool)
+    {
+        if (count < 2)
+            return false;
+
+        const uint32_t threadCount = pool && count >= kParallelThreshold ? pool->GetThreadCount() : 1;
+        const size_t chunkSize = (count + threadCount - 1) / threadCount;
+
+        // [thread][pass][bucket] for the skip test, then [thread][bucket] per pass for the scatter offsets
+        std::vector<uint32_t> fullHistograms(size_t(threadCount) * kPassCount * kBucketCount, 0);
+        std::vector<uint32_t> passHistograms(size_t(threadCount) * kBucketCount, 0);
+        bool skipPass[kPassCount] = {};
+        bool swapped = false;
+
+        std::barrier sync(threadCount);
+
+        const auto task = [&](uint32_t t)
+        {
+            const size_t begin = std::min(count, t * chunkSize);
+            const size_t end = std::min(count, begin + chunkSize);
+
+            // All digit histograms in one read to find the passes that would not move anything
+            uint32_t* full = &fullHistograms[size_t(t) * kPassCount * kBucketCount];
+            for (size_t i = begin; i < end; i++)
+            {
+                for (uint32_t pass = 0; pass < kPassCount; pass++)
+                    full[pass * kBucketCount + GetDigit(keys[i], pass)]++;
+            }
+            sync.arrive_and_wait();
+
+            if (t == 0)
+            {
+                for (uint32_t pass = 0; pass < kPassCount; pass++)
+                {
+                    const uint32_t digit = GetDigit(keys[0], pass);
+                    size_t total = 0;
+                    for (uint32_t thread = 0; thread < threadCount; thread++)
+                        total += fullHistograms[(size_t(thread) * kPassCount + pass) * kBucketCount + digit];
+                    skipPass[pass] = total == count;
+                }
+            }
+            sync.arrive_and_wait();
+
+            uint64_t* srcKeys = keys;
+            uint32_t* srcValues = values;
+            uint64_t* dstKeys = tempKeys;
+            uint32_t* dstValues = tempValues;
+
+            std::vector<uint32_t> offsets(kBucketCount);
+            for (uint32_t pass = 0; pass < kPassCount; pass++)
+            {
+                if (skipPass[pass])
+                    continue;
+
+                uint32_t* histogram = &passHistograms[size_t(t) * kBucketCount];
+                std::fill(histogram, histogram + kBucketCount, 0);
+                for (size_t i = begin; i < end; i++)
+                    histogram[GetDigit(srcKeys[i], pass)]++;
+                sync.arrive_and_wait();
+
+                // Elements of bucket b from thread t go after all smaller buckets and after bucket b of earlier threads
+                uint32_t running = 0;
+                for (uint32_t bucket = 0; bucket < kBucketCount; bucket++)
+                {
+                    for (uint32_t thread = 0; thread < threadCount; thread++)
+                    {
+                        if (thread == t)
+                            offsets[bucket] = running;
+                        running += passHistograms[size_t(thread) * kBucketCount + bucket];
+                    }
+                }
+
+                for (size_t i = begin; i < end; i++)
+                {
+                    const uint32_t dst = offsets[GetDigit(srcKeys[i], pass)]++;
+                    dstKeys[dst] = srcKeys[i];
+                    dstValues[dst] = srcValues[i];
+                }
+                // Nobody may rewrite the histograms or read the destination before every scatter is done
+                sync.arrive_and_wait();
+
+                std::swap(srcKeys, dstKeys);
+                std::swap(srcValues, dstValues);
+                if (t == 0)
+                    swapped = !swapped;
+            }
+        };
+
+        if (threadCount > 1)
+            pool->Run(threadCount, task);
+        else
+            task(0);
+
+        return swapped;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace Parallel
+{
+    class WorkerPool;
+}
+
+namespace RadixSort
+{
+    // Stable LSD radix sort of 64-bit keys with a 32-bit payload, 11 bits per pass.
+    // Digits that are identical for every key are skipped. Inputs of at least
+    // kParallelThreshold keys are split across the pool's threads.
+    // Returns true if the sorted result ended up in tempKeys/tempValues instead of keys/values.
+    bool Sort(uint64_t* keys, uint32_t* values, uint64_t* tempKeys, uint32_t* tempValues, size_t count, Parallel::WorkerPool* pool = nullptr);
+
+    inline constexpr size_t kParallelThreshold = 16384;
+}
@@ -0,0 +1,188 @@
+#include "RenderQueue.h"
+#include "RadixSort.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace RenderQueue
+{
+    static constexpr uint32_t kDepthBits = 26;
+    static constexpr uint32_t kFineDepthBits = 20;
+    static constexpr uint32_t kMeshBits = 22;
+
+    uint64_t MakeSortKey(Pass pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float viewDepth, float nearPlane, float farPlane)
+    {
+        // Logarithmic so nearby geometry, where early-Z matters most, gets most of the precision
+        const float clampedDepth = std::clamp(viewDepth, nearPlane, farPlane);
+        const float t = std::log(clampedDepth / nearPlane) / std::log(farPlane / nearPlane);
+        const uint64_t depth = static_cast<uint64_t>(t * float((1u << kDepthBits) - 1));
+
+        const uint64_t coarseDepth = depth >> kFineDepthBits;
+        const uint64_t fineDepth = depth & ((1u << kFineDepthBits) - 1);
+
+        return (uint64_t(static_cast<uint32_t>(pass) & 0x3) << 62)
+             | (uint64_t(pipeline & 0x3f) << 56)
+             | (uint64_t(material & 0xff) << 48)
+             | (coarseDepth << 42)
+             | (uint64_t(mesh & ((1u << kMeshBits) - 1)) << kFineDepthBits)
+             | fineDepth;
+    }
+
+    Frustum ExtractFrustum(const glm::mat4& viewProj)
+    {
+        const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+        const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+        const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+        const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+        // Vulkan clip space, 0 <= z <= w
+        Frustum frustum;
+        frustum.planes[0] = row3 + row0;
+        frustum.planes[1] = row3 - row0;
+        frustum.planes[2] = row3 + row1;
+        frustum.planes[3] = row3 - row1;
+        frustum.planes[4] = row2;
+        frustum.planes[5] = row3 - row2;
+        return frustum;
+    }
+
+    bool IsBoxVisible(const Frustum& frustum, const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+    {
+        const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        const glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+
+        const glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+        const glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+        const glm::vec3 worldExtent = absolute * extent;
+
+        for (const auto& plane : frustum.planes)
+        {
+            const glm::vec3 normal = glm::vec3(plane);
+            if (glm::dot(normal, worldCenter) + plane.w + glm::dot(glm::abs(normal), worldExtent) < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    void Queue::Build(const SceneLoader::Scene& scene, const glm::mat4& viewProj, float nearPlane, float farPlane, uint32_t pipeline, Parallel::WorkerPool* pool)
+    {
+        BuildMultiView(scene, &viewProj, 1, nearPlane, farPlane, pipeline, pool);
+    }
+
+    void Queue::BuildMultiView(const SceneLoader::Scene& scene, const glm::mat4* pViewProjs, uint32_t viewCount, float nearPlane, float farPlane,
+        uint32_t pipeline, Parallel::WorkerPool* pool)
+    {
+        const size_t entityCount = scene.entities.size();
+        m_Keys.resize(entityCount);
+        m_Entities.resize(entityCount);
+        m_TempKeys.resize(entityCount);
+        m_TempEntities.resize(entityCount);
+        m_ViewMasks.resize(entityCount);
+
+        viewCount = std::min(viewCount, 32u);
+        Frustum frustums[32];
+        for (uint32_t view = 0; view < viewCount; view++)
+            frustums[view] = ExtractFrustum(pViewProjs[view]);
+
+        const uint32_t chunkCount = pool && entityCount >= RadixSort::kParallelThreshold ? pool->GetThreadCount() : 1;
+        const size_t chunkSize = (entityCount + chunkCount - 1) / std::max(chunkCount, 1u);
+        m_ChunkVisibleCounts.assign(chunkCount, 0);
+
+        // Every chunk writes its visible entities to the front of its own range
+        const auto cull = [&](uint32_t chunk)
+        {
+            const size_t begin = std::min(entityCount, chunk * chunkSize);
+            const size_t end = std::min(entityCount, begin + chunkSize);
+
+            size_t visible = begin;
+            for (size_t i = begin; i < end; i++)
+            {
+                const SceneLoader::Entity& entity = scene.entities[i];
+                const SceneLoader::Mesh& mesh = scene.meshes[entity.meshId];
+                if (mesh.indexCount == 0)
+                    continue;
+
+                const glm::mat4& transform = scene.transforms[entity.transformId];
+                const glm::vec4 center = transform * glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f);
+
+                uint32_t viewMask = 0;
+                float viewDepth = farPlane;
+                for (uint32_t view = 0; view < viewCount; view++)
+                {
+                    if (!IsBoxVisible(frustums[view], transform, mesh.boundsMin, mesh.boundsMax))
+                        continue;
+
+                    // Clip space w is the view space depth for a perspective projection
+                    viewMask |= 1u << view;
+                    viewDepth = std::min(viewDepth, (pViewProjs[view] * center).w);
+                }
+                if (!viewMask)
+                    continue;
+
+                m_ViewMasks[entity.id] = viewMask;
+                m_Keys[visible] = MakeSortKey(Pass::Opaque, pipeline, entity.materialId, entity.meshId, viewDepth, nearPlane, farPlane);
+                m_Entities[visible] = entity.id;
+                visible++;
+            }
+            m_ChunkVisibleCounts[chunk] = visible - begin;
+        };
+
+        if (chunkCount > 1)
+            pool->Run(chunkCount, cull);
+        else
+            cull(0);
+
+        m_VisibleCount = m_ChunkVisibleCounts.empty() ? 0 : m_ChunkVisibleCounts[0];
+        for (uint32_t chunk = 1; chunk < chunkCount; chunk++)
+        {
+            const size_t begin = chunk * chunkSize;
+            const size_t count = m_ChunkVisibleCounts[chunk];
+            std::memmove(&m_Keys[m_VisibleCount], &m_Keys[begin], count * sizeof(uint64_t));
+            std::memmove(&m_Entities[m_VisibleCount], &m_Entities[begin], count * sizeof(uint32_t));
+            m_VisibleCount += count;
+        }
+
+        m_SortedInTemp = RadixSort::Sort(m_Keys.data(), m_Entities.data(), m_TempKeys.data(), m_TempEntities.data(), m_VisibleCount, pool);
+    }
+
+    void Queue::Emit(const SceneLoader::Scene& scene, std::vector<VU::DrawData>& drawDatas, std::vector<SceneLoader::InstancedDraw>& draws,
+        std::vector<uint32_t>* pViewMasks) const
+    {
+        const uint64_t* keys = GetSortedKeys();
+        const uint32_t* entities = GetSortedEntities();
+
+        drawDatas.resize(m_VisibleCount);
+        draws.clear();
+
+        if (pViewMasks)
+        {
+            pViewMasks->resize(m_VisibleCount);
+            for (size_t i = 0; i < m_VisibleCount; i++)
+                (*pViewMasks)[i] = m_ViewMasks[entities[i]];
+        }
+
+        uint64_t runKey = ~0ull;
+        for (size_t i = 0; i < m_VisibleCount; i++)
+        {
+            const SceneLoader::Entity& entity = scene.entities[entities[i]];
+            drawDatas[i] = VU::MakeDrawData(scene.transforms[entity.transformId], scene.meshes[entity.meshId], entity.materialId);
+
+            // Everything above the fine depth matches, so the state and mesh are the same
+            const uint64_t key = keys[i] >> kFineDepthBits;
+            if (key == runKey && draws.back().meshId == entity.meshId)
+            {
+                draws.back().instanceCount++;
+                continue;
+            }
+
+            SceneLoader::InstancedDraw draw {};
+            draw.meshId = entity.meshId;
+            draw.firstInstance = static_cast<uint32_t>(i);
+            draw.instanceCount = 1;
+            draws.push_back(draw);
+            runKey = key;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "SceneLoader.h"
+
+#include <vector>
+
+namespace Parallel
+{
+    class WorkerPool;
+}
+
+namespace RenderQueue
+{
+    enum class Pass : uint32_t
+    {
+        Opaque = 0
+    };
+
+    // [63:62] pass | [61:56] pipeline | [55:48] material | [47:42] coarse depth | [41:20] mesh | [19:0] fine depth
+    // The coarse depth slice sits above the mesh so opaque draws go roughly front to back,
+    // while instances of one mesh inside a slice stay adjacent and merge into one instanced draw.
+    uint64_t MakeSortKey(Pass pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float viewDepth, float nearPlane, float farPlane);
+
+    struct Frustum
+    {
+        glm::vec4 planes[6];
+    };
+
+    Frustum ExtractFrustum(const glm::mat4& viewProj);
+    bool IsBoxVisible(const Frustum& frustum, const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+    class Queue
+    {
+    public:
+        Queue() = default;
+
+        // Culls every entity against the frustum and sorts the visible ones by key.
+        void Build(const SceneLoader::Scene& scene, const glm::mat4& viewProj, float nearPlane, float farPlane, uint32_t pipeline, Parallel::WorkerPool* pool);
+
+        // Culls against up to 32 views at once. Entities seen by any view are kept with one bit per
+        // view in their mask, and are sorted by the depth in the nearest view that sees them.
+        void BuildMultiView(const SceneLoader::Scene& scene, const glm::mat4* pViewProjs, uint32_t viewCount, float nearPlane, float farPlane,
+            uint32_t pipeline, Parallel::WorkerPool* pool);
+
+        // Writes DrawData in key order and merges runs of the same mesh into instanced draws.
+        // Optionally writes the view mask of every instance in the same order.
+        void Emit(const SceneLoader::Scene& scene, std::vector<VU::DrawData>& drawDatas, std::vector<SceneLoader::InstancedDraw>& draws,
+            std::vector<uint32_t>* pViewMasks = nullptr) const;
+
+        size_t GetVisibleCount() const { return m_VisibleCount; }
+
+    private:
+        const uint64_t* GetSortedKeys() const { return m_SortedInTemp ? m_TempKeys.data() : m_Keys.data(); }
+        const uint32_t* GetSortedEntities() const { return m_SortedInTemp ? m_TempEntities.data() : m_Entities.data(); }
+
+        std::vector<uint64_t> m_Keys;
+        std::vector<uint32_t> m_Entities;
+        std::vector<uint64_t> m_TempKeys;
+        std::vector<uint32_t> m_TempEntities;
+        // Indexed by entity ID
+        std::vector<uint32_t> m_ViewMasks;
+        std::vector<size_t> m_ChunkVisibleCounts;
+        size_t m_VisibleCount = 0;
+        bool m_SortedInTemp = false;
+    };
+}
@@ -0,0 +1,407 @@
+#include "SceneCache.h"
+#include "GltfDocument.h"
+
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace SceneCache
+{
+    struct Section
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // Header flags
+    inline constexpr uint32_t kSunLoaded = 1 << 0;
+    inline constexpr uint32_t kCameraLoaded = 1 << 1;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint32_t vertexFormat;
+        uint32_t flags;
+        glm::vec3 sunDirection;
+        glm::vec3 sunColor;
+        SceneLoader::Camera camera;
+
+        Section vertices;
+        Section positions;
+        Section indices;
+        Section meshes;
+        Section entities;
+        Section transforms;
+        Section lights;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Header>);
+    static_assert(std::is_trivially_copyable_v<SceneLoader::Mesh> && std::is_trivially_copyable_v<SceneLoader::Entity>
+        && std::is_trivially_copyable_v<SceneLoader::Light>, "Scene data is baked with memcpy");
+
+    static uint64_t Rotl(uint64_t v, int shift)
+    {
+        return (v << shift) | (v >> (64 - shift));
+    }
+
+    static uint64_t Avalanche(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // Four independent lanes over 8 byte words so hashing a large .glb runs at memory speed
+    static uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t seed)
+    {
+        constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+        constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+
+        uint64_t lanes[4] = { seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1 };
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            for (uint32_t lane = 0; lane < 4; lane++)
+            {
+                uint64_t word;
+                std::memcpy(&word, data + i + lane * 8, sizeof(word));
+                lanes[lane] = Rotl(lanes[lane] + word * kPrime2, 31) * kPrime1;
+            }
+        }
+
+        uint64_t h = size * kPrime1;
+        for (uint64_t lane : lanes)
+            h = (h ^ Avalanche(lane)) * kPrime1;
+        for (; i < size; i++)
+            h = (h ^ data[i]) * 0x100000001B3ull;
+        return Avalanche(h);
+    }
+
+    // Size and modification time of a file the content hash was computed from
+    struct FileStamp
+    {
+        uint64_t size;
+        int64_t writeTime;
+
+        bool operator==(const FileStamp&) const = default;
+    };
+
+    struct StampHeader
+    {
+        uint32_t magic;
+        uint32_t fileCount;
+        uint64_t contentHash;
+    };
+
+    static bool GetFileStamp(const std::filesystem::path& path, FileStamp& stamp)
+    {
+        std::error_code ec;
+        stamp.size = std::filesystem::file_size(path, ec);
+        if (ec)
+            return false;
+        stamp.writeTime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    // One stamp per source path, next to the baked scenes
+    static std::filesystem::path GetStampPath(const std::filesystem::path& directory, const std::filesystem::path& source)
+    {
+        std::error_code ec;
+        const std::string absolute = std::filesystem::absolute(source, ec).string();
+        const uint64_t pathHash = HashBytes(reinterpret_cast<const uint8_t*>(absolute.data()), absolute.size(), 0);
+
+        char hashString[17];
+        snprintf(hashString, sizeof(hashString), "%016llx", static_cast<unsigned long long>(pathHash));
+        return directory / (source.stem().string() + "-" + hashString + kStampExtension);
+    }
+
+    // The stored content hash, if none of the files it was computed from changed size or modification time
+    static bool ReadStamp(const std::filesystem::path& stampPath, uint64_t& contentHash)
+    {
+        MappedFile file;
+        if (!file.Open(stampPath) || file.GetSize() < sizeof(StampHeader))
+            return false;
+
+        StampHeader header;
+        std::memcpy(&header, file.GetData(), sizeof(header));
+        if (header.magic != kStampMagic || header.fileCount == 0)
+            return false;
+
+        // Per file: the stamp, the path length and the path
+        size_t offset = sizeof(header);
+        for (uint32_t i = 0; i < header.fileCount; i++)
+        {
+            FileStamp stored;
+            uint32_t pathLength = 0;
+            if (file.GetSize() - offset < sizeof(stored) + sizeof(pathLength))
+                return false;
+            std::memcpy(&stored, file.GetData() + offset, sizeof(stored));
+            std::memcpy(&pathLength, file.GetData() + offset + sizeof(stored), sizeof(pathLength));
+            offset += sizeof(stored) + sizeof(pathLength);
+            if (file.GetSize() - offset < pathLength)
+                return false;
+
+            const char* path = reinterpret_cast<const char*>(file.GetData() + offset);
+            offset += pathLength;
+
+            FileStamp current;
+            if (!GetFileStamp(std::u8string_view(reinterpret_cast<const char8_t*>(path), pathLength), current) || current != stored)
+                return false;
+        }
+
+        contentHash = header.contentHash;
+        return true;
+    }
+
+    static void WriteStamp(const std::filesystem::path& stampPath, const std::vector<std::filesystem::path>& paths, uint64_t contentHash)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(stampPath.parent_path(), ec);
+
+        std::filesystem::path tempPath = stampPath;
+        tempPath += ".tmp";
+        FILE* file = fopen(tempPath.string().c_str(), "wb");
+        if (!file)
+            return;
+
+        const StampHeader header = { kStampMagic, static_cast<uint32_t>(paths.size()), contentHash };
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        for (const std::filesystem::path& path : paths)
+        {
+            FileStamp stamp;
+            const std::u8string name = std::filesystem::absolute(path, ec).u8string();
+            const uint32_t pathLength = static_cast<uint32_t>(name.size());
+            ok = ok && GetFileStamp(path, stamp);
+            ok = ok && fwrite(&stamp, sizeof(stamp), 1, file) == 1;
+            ok = ok && fwrite(&pathLength, sizeof(pathLength), 1, file) == 1;
+            ok = ok && (pathLength == 0 || fwrite(name.data(), pathLength, 1, file) == 1);
+        }
+        ok = fclose(file) == 0 && ok;
+
+        if (ok)
+            std::filesystem::rename(tempPath, stampPath, ec);
+        if (!ok || ec)
+            std::filesystem::remove(tempPath, ec);
+    }
+
+    // Hashes the source and every external buffer it references, paths gets all of them, the source first
+    static bool HashContents(const std::filesystem::path& source, uint64_t& contentHash, std::vector<std::filesystem::path>& paths)
+    {
+        MappedFile file;
+        if (!file.Open(source))
+            return false;
+
+        // External buffers hold the geometry of a .gltf, editing one has to miss the cache like editing the file
+        paths.push_back(source);
+        if (!Gltf::GetExternalBufferPaths(source, file.GetData(), file.GetSize(), paths))
+            return false;
+
+        contentHash = HashBytes(file.GetData(), file.GetSize(), 0);
+        for (size_t i = 1; i < paths.size(); i++)
+        {
+            MappedFile buffer;
+            if (!buffer.Open(paths[i]))
+                return false;
+            contentHash = HashBytes(buffer.GetData(), buffer.GetSize(), contentHash);
+        }
+        return true;
+    }
+
+    uint64_t ComputeKey(const std::filesystem::path& source, const SceneLoader::LoadParams& params)
+    {
+        // Loader settings that end up in the baked data
+        const uint32_t settings[] = {
+            kVersion,
+            static_cast<uint32_t>(params.vertexFormat),
+            params.allow16BitIndices,
+            params.optimizeMeshes,
+            params.deduplicateGeometry,
+            params.staticBatching,
+            std::bit_cast<uint32_t>(params.staticBatchCellSize),
+            params.staticBatchMaxVertices
+        };
+
+        uint64_t contentHash = 0;
+        const std::filesystem::path stampPath = GetStampPath(params.cacheDirectory, source);
+        if (!ReadStamp(stampPath, contentHash))
+        {
+            std::vector<std::filesystem::path> paths;
+            if (!HashContents(source, contentHash, paths))
+                return 0;
+            WriteStamp(stampPath, paths, contentHash);
+        }
+
+        const uint64_t key = HashBytes(reinterpret_cast<const uint8_t*>(settings), sizeof(settings), contentHash);
+        return key ? key : 1;
+    }
+
+    std::filesystem::path GetCachePath(const std::filesystem::path& directory, const std::filesystem::path& source, uint64_t key)
+    {
+        char keyString[17];
+        snprintf(keyString, sizeof(keyString), "%016llx", static_cast<unsigned long long>(key));
+        return directory / (source.stem().string() + "-" + keyString + kExtension);
+    }
+
+    static uint64_t AlignSection(uint64_t offset)
+    {
+        return (offset + kSectionAlignment - 1) & ~(kSectionAlignment - 1);
+    }
+
+    bool Write(const std::filesystem::path& path, uint64_t key, const SceneLoader::Scene& scene, const Geometry& geometry)
+    {
+        Header header {};
+        header.magic = kMagic;
+        header.version = kVersion;
+        header.key = key;
+        header.vertexFormat = static_cast<uint32_t>(scene.vertexFormat);
+        header.flags = (scene.sunWasLoaded ? kSunLoaded : 0) | (scene.cameraWasLoaded ? kCameraLoaded : 0);
+        header.sunDirection = scene.sunDirection;
+        header.sunColor = scene.sunColor;
+        header.camera = scene.camera;
+
+        struct Blob
+        {
+            Section* section;
+            const void* data;
+            size_t size;
+        };
+        const Blob blobs[] = {
+            { &header.vertices, geometry.vertices, geometry.vertexBytes },
+            { &header.positions, geometry.positions, geometry.positionBytes },
+            { &header.indices, geometry.indices, geometry.indexBytes },
+            { &header.meshes, scene.meshes.data(), scene.meshes.size() * sizeof(SceneLoader::Mesh) },
+            { &header.entities, scene.entities.data(), scene.entities.size() * sizeof(SceneLoader::Entity) },
+            { &header.transforms, scene.transforms.data(), scene.transforms.size() * sizeof(glm::mat4x4) },
+            { &header.lights, scene.lights.data(), scene.lights.size() * sizeof(SceneLoader::Light) },
+        };
+
+        uint64_t offset = sizeof(Header);
+        for (const Blob& blob : blobs)
+        {
+            offset = AlignSection(offset);
+            blob.section->offset = offset;
+            blob.section->size = blob.size;
+            offset += blob.size;
+        }
+
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+
+        std::filesystem::path tempPath = path;
+        tempPath += ".tmp";
+        FILE* file = fopen(tempPath.string().c_str(), "wb");
+        if (!file)
+        {
+            printf("[Scene Cache] Error: Could not create %s\n", tempPath.string().c_str());
+            return false;
+        }
+
+        static constexpr uint8_t kPadding[kSectionAlignment] = {};
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        uint64_t written = sizeof(Header);
+        for (const Blob& blob : blobs)
+        {
+            const uint64_t padding = blob.section->offset - written;
+            ok = ok && (padding == 0 || fwrite(kPadding, padding, 1, file) == 1);
+            ok = ok && (blob.size == 0 || fwrite(blob.data, blob.size, 1, file) == 1);
+            written = blob.section->offset + blob.size;
+        }
+        ok = fclose(file) == 0 && ok;
+
+        if (ok)
+            std::filesystem::rename(tempPath, path, ec);
+        if (!ok || ec)
+        {
+            printf("[Scene Cache] Error: Failed to write %s\n", path.string().c_str());
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+
+        printf("[Scene Cache] Baked %s, %.2f MB.\n", path.filename().string().c_str(), double(written) / (1024.0 * 1024.0));
+        return true;
+    }
+
+    static const Header& GetHeader(const MappedFile& file)
+    {
+        return *reinterpret_cast<const Header*>(file.GetData());
+    }
+
+    template<typename T>
+    static void ReadSection(const MappedFile& file, const Section& section, std::vector<T>& dst)
+    {
+        const T* src = reinterpret_cast<const T*>(file.GetData() + section.offset);
+        dst.assign(src, src + section.size / sizeof(T));
+    }
+
+    bool Reader::Open(const std::filesystem::path& path, uint64_t key)
+    {
+        if (!m_File.Open(path))
+            return false;
+
+        const size_t fileSize = m_File.GetSize();
+        if (fileSize < sizeof(Header))
+        {
+            m_File.Close();
+            return false;
+        }
+
+        const Header& header = GetHeader(m_File);
+        bool valid = header.magic == kMagic && header.version == kVersion && header.key == key;
+
+        const auto checkSection = [&](const Section& section, size_t elementSize)
+        {
+            return section.offset % kSectionAlignment == 0 && section.offset <= fileSize
+                && section.size <= fileSize - section.offset && section.size % elementSize == 0;
+        };
+        valid = valid && checkSection(header.vertices, 1) && checkSection(header.positions, sizeof(glm::vec3))
+            && checkSection(header.indices, 1) && checkSection(header.meshes, sizeof(SceneLoader::Mesh))
+            && checkSection(header.entities, sizeof(SceneLoader::Entity)) && checkSection(header.transforms, sizeof(glm::mat4x4))
+            && checkSection(header.lights, sizeof(SceneLoader::Light));
+
+        if (!valid)
+        {
+            printf("[Scene Cache] Warning: %s is stale or corrupt, rebaking.\n", path.filename().string().c_str());
+            m_File.Close();
+        }
+        return valid;
+    }
+
+    void Reader::ReadScene(SceneLoader::Scene& scene) const
+    {
+        const Header& header = GetHeader(m_File);
+        scene.vertexFormat = static_cast<VU::VertexFormat>(header.vertexFormat);
+        scene.sunWasLoaded = (header.flags & kSunLoaded) != 0;
+        scene.cameraWasLoaded = (header.flags & kCameraLoaded) != 0;
+        scene.sunDirection = header.sunDirection;
+        scene.sunColor = header.sunColor;
+        scene.camera = header.camera;
+
+        ReadSection(m_File, header.meshes, scene.meshes);
+        ReadSection(m_File, header.entities, scene.entities);
+        ReadSection(m_File, header.transforms, scene.transforms);
+        ReadSection(m_File, header.lights, scene.lights);
+    }
+
+    Geometry Reader::GetGeometry() const
+    {
+        const Header& header = GetHeader(m_File);
+        const uint8_t* data = m_File.GetData();
+
+        Geometry geometry;
+        geometry.vertices = data + header.vertices.offset;
+        geometry.vertexBytes = header.vertices.size;
+        geometry.positions = data + header.positions.offset;
+        geometry.positionBytes = header.positions.size;
+        geometry.indices = data + header.indices.offset;
+        geometry.indexBytes = header.indices.size;
+        return geometry;
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "SceneLoader.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <filesystem>
+
+// Baked scenes: the GPU-ready vertex, position and index blobs plus everything LoadScene
+// produces on the CPU side. Written after the first load of a source file and mapped on
+// later loads, so warm loads skip glTF parsing, conversion and mesh optimization entirely.
+namespace SceneCache
+{
+    inline constexpr uint32_t kMagic = 0x53504D49; // "IMPS"
+    inline constexpr uint32_t kVersion = 1;
+    // Every section starts on this boundary, enough for any upload or copy alignment
+    inline constexpr uint64_t kSectionAlignment = 256;
+    inline constexpr const char* kExtension = ".impscene";
+    // Remembers the content hash of a source by the sizes and modification times of its files
+    inline constexpr uint32_t kStampMagic = 0x54534D49; // "IMST"
+    inline constexpr const char* kStampExtension = ".impstamp";
+
+    struct Geometry
+    {
+        const void* vertices    = nullptr;
+        size_t vertexBytes      = 0;
+        const void* positions   = nullptr;
+        size_t positionBytes    = 0;
+        const void* indices     = nullptr;
+        size_t indexBytes       = 0;
+    };
+
+    // Hash of the source file contents, of the external buffers it references and of every load parameter
+    // that changes the baked result. 0 if the source or one of its buffers can't be read. The contents are only
+    // hashed again when the size or modification time of one of those files changed since the last call.
+    uint64_t ComputeKey(const std::filesystem::path& source, const SceneLoader::LoadParams& params);
+    std::filesystem::path GetCachePath(const std::filesystem::path& directory, const std::filesystem::path& source, uint64_t key);
+
+    // Writes to a temporary file first, so a crash never leaves a truncated cache behind
+    bool Write(const std::filesystem::path& path, uint64_t key, const SceneLoader::Scene& scene, const Geometry& geometry);
+
+    // A mapped baked scene, the geometry pointers stay valid while the reader is open
+    class Reader
+    {
+    public:
+        // Fails if the file is missing, corrupt, from another version or baked with another key
+        bool Open(const std::filesystem::path& path, uint64_t key);
+
+        // Everything but the GPU buffers and the instanced draws
+        void ReadScene(SceneLoader::Scene& scene) const;
+        Geometry GetGeometry() const;
+
+    private:
+        MappedFile m_File;
+    };
+}
@@ -1,157 +1,897 @@
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#define TINYGLTF_IMPLEMENTATION
 #include "SceneLoader.h"
 #include "Engine.h"
+#include "VertexCompression.h"
+#include "AttributeDecode.h"
+#include "SceneCache.h"
+#include "MeshOptimizer.h"
+#include "Parallel.h"
+#include "GltfDocument.h"
+#include "GeometryRegistry.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <cstdio>
+#include <cstring>
 #include <string>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 namespace SceneLoader
 {
     static inline std::atomic_uint32_t temporaryMeshCounter = 0;
 
-    static bool ParseGLTF(const std::filesystem::path& path, std::vector<MeshCreationRequest>& reqs, Scene& scene)
+    // A primitive of a glTF mesh whose geometry becomes one MeshCreationRequest
+    struct PrimitiveSource
     {
-        if (!std::filesystem::exists(path))
-            return false;
+        AttributeDecode::VertexStreams vertices;
+        // No data means the primitive isn't indexed
+        AttributeDecode::Stream indices;
+        size_t vertexCount = 0;
+        size_t indexCount = 0;
+        // From the accessor's min and max, otherwise computed while decoding
+        bool hasBounds = false;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+
+    // The document has to outlive the sources, they point into its buffers
+    struct ParsedGLTF
+    {
+        Gltf::Document document;
+        std::vector<PrimitiveSource> sources;
+    };
+
+    static AttributeDecode::Stream GetAccessorStream(const Gltf::Document& document, int32_t accessorIndex)
+    {
+        AttributeDecode::Stream stream;
+        if (accessorIndex == Gltf::kNone)
+            return stream;
+
+        const Gltf::Accessor& accessor = document.accessors[accessorIndex];
+        if (accessor.bufferView == Gltf::kNone)
+            return stream;
+
+        const Gltf::BufferView& view = document.bufferViews[accessor.bufferView];
+        stream.data = document.buffers[view.buffer].data + view.byteOffset + accessor.byteOffset;
+        stream.stride = Gltf::GetByteStride(accessor, view);
+        stream.type = static_cast<AttributeDecode::ComponentType>(accessor.componentType);
+        stream.componentCount = accessor.componentCount;
+        stream.normalized = accessor.normalized;
+        return stream;
+    }
+
+    static void LoadNodeLight(const Gltf::Light& gltfLight, const glm::mat4x4& transform, Scene& scene)
+    {
+        if (gltfLight.type == "directional")
+        {
+            if (!scene.sunWasLoaded)
+            {
+                scene.sunDirection = glm::normalize(glm::vec3(transform * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f)));
+                if (gltfLight.hasColor)
+                    scene.sunColor = gltfLight.color;
+                scene.sunColor *= gltfLight.intensity;
+                scene.sunWasLoaded = true;
+            }
+        }
+        else if (gltfLight.type == "point" || gltfLight.type == "spot")
+        {
+            Light light {};
+            light.type = gltfLight.type == "spot" ? LightType::Spot : LightType::Point;
+            light.position = glm::vec3(transform[3]);
+            // Lights point down their local -Z
+            light.direction = glm::normalize(glm::vec3(transform * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f)));
+            if (gltfLight.hasColor)
+                light.color = gltfLight.color;
+            light.intensity = gltfLight.intensity;
+            light.range = gltfLight.range;
+            light.innerConeAngle = gltfLight.innerConeAngle;
+            light.outerConeAngle = gltfLight.outerConeAngle;
+            scene.lights.push_back(light);
+        }
+        else
+            printf("[Scene Loader] Warning: Light type '%.*s' is not supported.\n", static_cast<int>(gltfLight.type.size()), gltfLight.type.data());
+    }
+
+    // Phase one: walks the node hierarchy, emits entities, lights and the camera with world transforms
+    // and creates one request per unique primitive. Geometry is only located and sized here and decoded later.
+    static void FlattenNodes(const Gltf::Document& document, std::vector<MeshCreationRequest>& reqs, std::vector<PrimitiveSource>& sources, Scene& scene)
+    {
+        // Request ID of the first primitive of every loaded mesh, IDs of the following primitives are consecutive
+        std::vector<uint32_t> meshFirstId(document.meshes.size(), kInvalidId);
+
+        struct PendingNode
+        {
+            uint32_t node;
+            glm::mat4x4 parentTransform;
+        };
+        std::vector<PendingNode> stack;
+        const Gltf::Scene& root = document.scenes.front();
+        for (uint32_t i = root.nodeCount; i-- > 0;)
+            stack.push_back({ document.sceneNodes[root.firstNode + i], glm::mat4x4(1.0f) });
+
+        while (!stack.empty())
+        {
+            const PendingNode pending = stack.back();
+            stack.pop_back();
+
+            const Gltf::Node& node = document.nodes[pending.node];
+            const glm::mat4x4 transform = pending.parentTransform * node.localTransform;
+            const bool isDynamic = node.name.find("Dynamic") != std::string_view::npos;
+
+            for (uint32_t i = node.childCount; i-- > 0;)
+                stack.push_back({ document.nodeChildren[node.firstChild + i], transform });
+
+            if (node.name.find("Camera") != std::string_view::npos && scene.cameraWasLoaded == false)
+            {
+                scene.camera.Model = transform;
+                scene.cameraWasLoaded = true;
+            }
+
+            if (node.light != Gltf::kNone)
+                LoadNodeLight(document.lights[node.light], transform, scene);
+
+            if (node.mesh == Gltf::kNone)
+                continue;
 
+            const Gltf::Mesh& mesh = document.meshes[node.mesh];
+
+            // This is so we don't load geometry for linked/duplicate meshes.
+            const bool isNewMesh = meshFirstId[node.mesh] == kInvalidId;
+            if (isNewMesh)
+                meshFirstId[node.mesh] = temporaryMeshCounter.fetch_add(mesh.primitiveCount);
+
+            for (uint32_t primIndex = 0; primIndex < mesh.primitiveCount; primIndex++)
+            {
+                const Gltf::Primitive& prim = document.primitives[mesh.firstPrimitive + primIndex];
+                uint32_t materialId = prim.material >= 0 ? prim.material : kDefaultMaterialIndex;
+                if (materialId >= kMaxMaterialIndex) // last one is reserved for default
+                {
+                    if (isNewMesh)
+                        printf("[Scene Loader] Error: Trying to assign material with ID '%u' when max is '%u'. Will assign default material.\n", prim.material, kMaxMaterialIndex);
+                    materialId = kDefaultMaterialIndex;
+                }
+
+                const uint32_t meshId = meshFirstId[node.mesh] + primIndex;
+                if (isNewMesh)
+                {
+                    PrimitiveSource& source = sources.emplace_back();
+                    const int32_t position = prim.attributes[Gltf::kAttributePosition];
+                    source.vertices.position = GetAccessorStream(document, position);
+                    source.vertices.normal = GetAccessorStream(document, prim.attributes[Gltf::kAttributeNormal]);
+                    source.vertices.texCoord = GetAccessorStream(document, prim.attributes[Gltf::kAttributeTexCoord0]);
+                    if (source.vertices.position.data)
+                    {
+                        const Gltf::Accessor& accessor = document.accessors[position];
+                        source.vertexCount = accessor.count;
+                        source.hasBounds = accessor.componentType == Gltf::kComponentTypeFloat && accessor.hasBounds;
+                        if (source.hasBounds)
+                        {
+                            source.boundsMin = accessor.min;
+                            source.boundsMax = accessor.max;
+                        }
+                    }
+
+                    source.indices = GetAccessorStream(document, prim.indices);
+                    source.indexCount = prim.indices != Gltf::kNone ? document.accessors[prim.indices].count : source.vertexCount;
+                    if (source.indices.data && source.indices.type != AttributeDecode::ComponentType::UnsignedInt
+                        && source.indices.type != AttributeDecode::ComponentType::UnsignedShort
+                        && source.indices.type != AttributeDecode::ComponentType::UnsignedByte)
+                    {
+                        printf("[Scene Loader] Error: Index component type %i not supported!\n", static_cast<int>(source.indices.type));
+                        source.indexCount = 0;
+                    }
+
+                    MeshCreationRequest& req = reqs.emplace_back();
+                    req.id = meshId;
+                    req.materialId = materialId;
+                }
+
+                scene.transforms.push_back(transform);
+
+                Entity entity;
+                entity.id = static_cast<uint32_t>(scene.entities.size());
+                entity.meshId = meshId;
+                entity.transformId = static_cast<uint32_t>(scene.transforms.size() - 1);
+                entity.materialId = materialId;
+                entity.isDynamic = isDynamic;
+                scene.entities.push_back(entity);
+            }
+        }
+    }
+
+    template<typename IndexType>
+    static void DecodePrimitiveIndices(const PrimitiveSource& source, size_t first, size_t count, IndexType* dst)
+    {
+        if (source.indices.data)
+        {
+            AttributeDecode::Stream stream = source.indices;
+            stream.data += first * stream.stride;
+            AttributeDecode::DecodeIndices(stream, count, dst);
+        }
+        else
+            for (size_t index = 0; index < count; index++)
+                dst[index] = static_cast<IndexType>(first + index);
+    }
+
+    // Phase two when the geometry is still processed on the CPU, every primitive writes only its own request
+    static void DecodePrimitives(const ParsedGLTF& gltf, std::vector<MeshCreationRequest>& reqs)
+    {
+        Parallel::For(gltf.sources.size(), [&](size_t i)
+        {
+            const PrimitiveSource& source = gltf.sources[i];
+            MeshCreationRequest& req = reqs[i];
+            req.vertices.resize(source.vertexCount);
+            req.indices.resize(source.indexCount);
+
+            // Mesh bounds are computed once optimization and batching are done
+            glm::vec3 boundsMin(0.0f);
+            glm::vec3 boundsMax(0.0f);
+            AttributeDecode::DecodeVertices(source.vertices, 0, source.vertexCount, req.vertices.data(), nullptr, boundsMin, boundsMax);
+            DecodePrimitiveIndices(source, 0, source.indexCount, req.indices.data());
+        });
+    }
+
+    // Vertices a thread converts on the stack before compressing them into staging memory
+    inline constexpr size_t kCompressChunkVertices = 256;
+
+    // Decodes vertices [first, first + count) of a primitive in the given format, plus the position-only copy
+    static void DecodeVertexRange(const PrimitiveSource& source, VU::VertexFormat format, size_t first, size_t count,
+        void* vertices, glm::vec3* positions, glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        if (format == VU::VertexFormat::Compact)
+        {
+            VU::CompactVertex* compactVertices = static_cast<VU::CompactVertex*>(vertices);
+            VU::Vertex chunk[kCompressChunkVertices];
+            for (size_t offset = 0; offset < count; offset += kCompressChunkVertices)
+            {
+                const size_t chunkCount = std::min(kCompressChunkVertices, count - offset);
+                AttributeDecode::DecodeVertices(source.vertices, first + offset, chunkCount, chunk, positions + offset, boundsMin, boundsMax);
+                VU::CompressVertices(chunk, chunkCount, compactVertices + offset);
+            }
+        }
+        else
+            AttributeDecode::DecodeVertices(source.vertices, first, count, static_cast<VU::Vertex*>(vertices), positions, boundsMin, boundsMax);
+    }
+
+    // Phase two straight into mapped staging memory, used when nothing touches the geometry before upload
+    static void DecodePrimitiveToStaging(const PrimitiveSource& source, VU::VertexFormat format, Mesh& mesh,
+        void* vertexData, glm::vec3* positionData, void* indexData)
+    {
+        void* vertices = static_cast<uint8_t*>(vertexData) + mesh.vertexOffset * VU::GetVertexSize(format);
+        DecodeVertexRange(source, format, 0, source.vertexCount, vertices, positionData + mesh.vertexOffset, mesh.boundsMin, mesh.boundsMax);
+
+        if (mesh.indexType == VK_INDEX_TYPE_UINT16)
+            DecodePrimitiveIndices(source, 0, source.indexCount, static_cast<uint16_t*>(indexData) + mesh.indexOffset);
+        else
+            DecodePrimitiveIndices(source, 0, source.indexCount, static_cast<uint32_t*>(indexData) + mesh.indexOffset);
+    }
+
+    // Whole elements only, so the stride and whatever else is interleaved with the stream don't change the key
+    static void HashStream(GeometryHasher& hasher, const AttributeDecode::Stream& stream, size_t count)
+    {
+        const uint32_t format[] = { static_cast<uint32_t>(stream.type), stream.componentCount, stream.normalized, stream.data != nullptr };
+        hasher.Update(format, sizeof(format));
+        if (!stream.data || count == 0)
+            return;
+
+        const size_t elementSize = size_t(Gltf::GetComponentSize(static_cast<uint32_t>(stream.type))) * stream.componentCount;
+        if (stream.stride == elementSize)
+            hasher.Update(stream.data, elementSize * count);
+        else
+            for (size_t i = 0; i < count; i++)
+                hasher.Update(stream.data + i * stream.stride, elementSize);
+    }
+
+    // Hashes everything the primitive is decoded from and the settings that change what it becomes in the pool,
+    // equal keys end up as equal meshes
+    static GeometryKey HashPrimitiveSource(const PrimitiveSource& source, const LoadParams& params)
+    {
+        GeometryHasher hasher;
+        const uint32_t settings[] = { static_cast<uint32_t>(params.vertexFormat), params.allow16BitIndices, params.optimizeMeshes };
+        hasher.Update(settings, sizeof(settings));
+        const uint64_t counts[] = { source.vertexCount, source.indexCount };
+        hasher.Update(counts, sizeof(counts));
+        HashStream(hasher, source.vertices.position, source.vertexCount);
+        HashStream(hasher, source.vertices.normal, source.vertexCount);
+        HashStream(hasher, source.vertices.texCoord, source.vertexCount);
+        HashStream(hasher, source.indices, source.indexCount);
+        return hasher.Finish();
+    }
+
+    // Geometry of a request that an earlier scene already uploaded
+    struct SharedMesh
+    {
+        uint32_t requestId;
+        uint32_t range;
+        Mesh mesh;
+    };
+
+    // Keeps the first request of every distinct geometry and points the entities of the duplicates at it. Requests found
+    // in the registry are dropped as well and come back as shared meshes, the keys of the kept ones are returned by id.
+    // Runs before anything is decoded, so duplicates are neither decoded, optimized nor uploaded.
+    static void DeduplicateGeometry(const LoadParams& params, const GeometryRegistry* pRegistry, std::vector<MeshCreationRequest>& reqs,
+        std::vector<PrimitiveSource>& sources, Scene& scene, std::unordered_map<uint32_t, GeometryKey>& keysById, std::vector<SharedMesh>& shared)
+    {
+        std::vector<GeometryKey> keys(reqs.size());
+        Parallel::For(reqs.size(), [&](size_t i) { keys[i] = HashPrimitiveSource(sources[i], params); });
+
+        std::unordered_map<GeometryKey, uint32_t, GeometryKeyHash> firstIds;
+        std::unordered_map<uint32_t, uint32_t> canonicalIds;
+        size_t duplicateVertices = 0;
+        size_t duplicateIndices = 0;
+        size_t sharedVertices = 0;
+        size_t sharedIndices = 0;
+        size_t writeIndex = 0;
+        for (size_t i = 0; i < reqs.size(); i++)
+        {
+            const auto [first, added] = firstIds.try_emplace(keys[i], reqs[i].id);
+            if (!added)
+            {
+                canonicalIds[reqs[i].id] = first->second;
+                duplicateVertices += sources[i].vertexCount;
+                duplicateIndices += sources[i].indexCount;
+                continue;
+            }
+
+            if (const GeometryRegistry::Entry* pEntry = pRegistry ? pRegistry->Find(keys[i]) : nullptr)
+            {
+                shared.push_back({ reqs[i].id, pEntry->range, pEntry->mesh });
+                sharedVertices += sources[i].vertexCount;
+                sharedIndices += sources[i].indexCount;
+                continue;
+            }
+
+            keysById[reqs[i].id] = keys[i];
+            if (writeIndex != i)
+            {
+                reqs[writeIndex] = std::move(reqs[i]);
+                sources[writeIndex] = sources[i];
+            }
+            writeIndex++;
+        }
+
+        if (writeIndex == reqs.size())
+            return;
+
+        const size_t primitiveCount = reqs.size();
+        reqs.resize(writeIndex);
+        sources.resize(writeIndex);
+        for (auto& entity : scene.entities)
+        {
+            const auto it = canonicalIds.find(entity.meshId);
+            if (it != canonicalIds.end())
+                entity.meshId = it->second;
+        }
+
+        printf("[Scene Loader] Geometry deduplication: %zu primitives -> %zu meshes, skipped %zu vertices and %zu indices.\n",
+            primitiveCount, reqs.size() + shared.size(), duplicateVertices, duplicateIndices);
+        if (!shared.empty())
+            printf("[Scene Loader] %zu meshes shared with scenes already loaded, skipped %zu vertices and %zu indices.\n",
+                shared.size(), sharedVertices, sharedIndices);
+    }
+
+    // Indices in a chunk of this many are checked at a time
+    inline constexpr size_t kIndexCheckChunk = 1024;
+
+    // Accessor ranges are validated by the parser, the values aren't. Every later stage indexes vertex arrays with
+    // them, so primitives referencing a vertex they don't have lose their geometry and are never drawn.
+    static void RejectInvalidIndices(std::vector<PrimitiveSource>& sources)
+    {
+        std::atomic<uint32_t> rejected = 0;
+        Parallel::For(sources.size(), [&](size_t i)
+        {
+            PrimitiveSource& source = sources[i];
+            if (!source.indices.data)
+                return;
+
+            uint32_t chunk[kIndexCheckChunk];
+            for (size_t first = 0; first < source.indexCount; first += kIndexCheckChunk)
+            {
+                const size_t count = std::min(kIndexCheckChunk, source.indexCount - first);
+                DecodePrimitiveIndices(source, first, count, chunk);
+                if (*std::max_element(chunk, chunk + count) >= source.vertexCount)
+                {
+                    source.vertexCount = 0;
+                    source.indexCount = 0;
+                    rejected++;
+                    return;
+                }
+            }
+        });
+
+        if (rejected)
+            printf("[Scene Loader] Skipped %u primitives with indices past their vertex count.\n", rejected.load());
+    }
+
+    // Phase one only, the geometry stays in the document's buffers until it is decoded
+    static bool ParseGLTF(const std::filesystem::path& path, ParsedGLTF& gltf, std::vector<MeshCreationRequest>& reqs, Scene& scene)
+    {
         if (path.extension() != ".gltf" && path.extension() != ".glb")
             return false;
 
-        tinygltf::TinyGLTF loader;
-        tinygltf::Model model;
-		std::string err;
-		std::string warn;
+        if (!Gltf::Load(path, gltf.document) || gltf.document.scenes.empty())
+            return false;
 
-        if(path.extension().string() == ".gltf")
-			loader.LoadASCIIFromFile(&model, &err, &warn, path.string());
-		else
-			loader.LoadBinaryFromFile(&model, &err, &warn, path.string());
+        FlattenNodes(gltf.document, reqs, gltf.sources, scene);
+        RejectInvalidIndices(gltf.sources);
+        return true;
+    }
 
-		if (err.size()) printf("[Asset Importer] Error: %s\n", err.c_str());
-		if (warn.size()) printf("[Asset Importer] Warning: %s\n", warn.c_str());
+    // Allowed ACMR degradation when splitting clusters for overdraw
+    static constexpr float kOverdrawThreshold = 1.05f;
 
-		std::unordered_map<uint32_t, uint32_t> meshIdMap;
+    static void OptimizeMeshes(std::vector<MeshCreationRequest>& reqs)
+    {
+        struct MeshStats
+        {
+            float acmrBefore = 0.0f;
+            float acmrAfter = 0.0f;
+            size_t verticesBefore = 0;
+            size_t verticesAfter = 0;
+        };
+        std::vector<MeshStats> stats(reqs.size());
+
+        Parallel::For(reqs.size(), [&](size_t i)
+        {
+            MeshCreationRequest& req = reqs[i];
+            if (req.indices.empty() || req.vertices.empty())
+                return;
+
+            uint32_t* indices = req.indices.data();
+            const size_t indexCount = req.indices.size();
+            MeshStats& meshStats = stats[i];
+            meshStats.verticesBefore = req.vertices.size();
+            meshStats.acmrBefore = MeshOptimizer::ComputeACMR(indices, indexCount, req.vertices.size());
 
-        for (const auto& nodeIdx : model.scenes.front().nodes)
+            size_t vertexCount = MeshOptimizer::WeldVertices(req.vertices.data(), req.vertices.size(), sizeof(VU::Vertex), indices, indexCount);
+            MeshOptimizer::OptimizeVertexCache(indices, indexCount, vertexCount);
+            MeshOptimizer::OptimizeOverdraw(indices, indexCount, &req.vertices.front().position.x, vertexCount, sizeof(VU::Vertex), kOverdrawThreshold);
+            vertexCount = MeshOptimizer::OptimizeVertexFetch(req.vertices.data(), vertexCount, sizeof(VU::Vertex), indices, indexCount);
+            req.vertices.resize(vertexCount);
+
+            meshStats.verticesAfter = vertexCount;
+            meshStats.acmrAfter = MeshOptimizer::ComputeACMR(indices, indexCount, vertexCount);
+        });
+
+        // Triangle weighted so big meshes dominate, like they do on the GPU
+        double trianglesTotal = 0.0;
+        double missesBefore = 0.0;
+        double missesAfter = 0.0;
+        size_t verticesBefore = 0;
+        size_t verticesAfter = 0;
+        for (size_t i = 0; i < reqs.size(); i++)
         {
-            const auto& node = model.nodes[nodeIdx];
-            LoadGLTFNode(node, model, meshIdMap, reqs, scene);
+            const double triangleCount = reqs[i].indices.size() / 3;
+            trianglesTotal += triangleCount;
+            missesBefore += stats[i].acmrBefore * triangleCount;
+            missesAfter += stats[i].acmrAfter * triangleCount;
+            verticesBefore += stats[i].verticesBefore;
+            verticesAfter += stats[i].verticesAfter;
         }
 
-        return true;
+        if (trianglesTotal > 0.0)
+            printf("[Scene Loader] Optimized meshes: ACMR %.3f -> %.3f, vertices %zu -> %zu\n",
+                missesBefore / trianglesTotal, missesAfter / trianglesTotal, verticesBefore, verticesAfter);
     }
 
+    void BuildInstancedDraws(Scene& scene)
+    {
+        // Counting sort of the entities by mesh, every mesh becomes one instanced draw
+        std::vector<uint32_t> instanceCounts(scene.meshes.size(), 0);
+        for (const auto& entity : scene.entities)
+            instanceCounts[entity.meshId]++;
+
+        std::vector<uint32_t> firstInstances(scene.meshes.size(), 0);
+        scene.draws.clear();
+        uint32_t instanceCount = 0;
+        for (uint32_t meshId = 0; meshId < scene.meshes.size(); meshId++)
+        {
+            firstInstances[meshId] = instanceCount;
+            instanceCount += instanceCounts[meshId];
+            // Meshes without geometry, or not streamed in yet, keep their instance range but get no draw
+            if (instanceCounts[meshId] == 0 || scene.meshes[meshId].indexCount == 0)
+                continue;
+
+            InstancedDraw draw {};
+            draw.meshId = meshId;
+            draw.firstInstance = firstInstances[meshId];
+            draw.instanceCount = instanceCounts[meshId];
+            scene.draws.push_back(draw);
+        }
+
+        scene.instanceEntities.resize(scene.entities.size());
+        for (const auto& entity : scene.entities)
+            scene.instanceEntities[firstInstances[entity.meshId]++] = entity.id;
+
+        printf("[Scene Loader] %zu entities drawn with %zu instanced draws.\n", scene.entities.size(), scene.draws.size());
+    }
 
+    // Merged meshes stay below this so they can still use 16-bit indices
+    static constexpr size_t kMaxBatchVertexCount = 65536;
 
-    bool LoadScene(const std::filesystem::path& path, imp::Engine& engine, Scene& scene)
+    static void BatchStaticMeshes(const LoadParams& params, std::vector<MeshCreationRequest>& reqs, Scene& scene)
     {
-        std::vector<MeshCreationRequest> reqs;
-        if (!ParseGLTF(path, reqs, scene))
-            return false;
+        std::unordered_map<uint32_t, uint32_t> reqIndexById;
+        std::vector<uint32_t> references(reqs.size(), 0);
+        for (uint32_t i = 0; i < reqs.size(); i++)
+            reqIndexById[reqs[i].id] = i;
+        for (const auto& entity : scene.entities)
+        {
+            const auto it = reqIndexById.find(entity.meshId);
+            if (it != reqIndexById.end())
+                references[it->second]++;
+        }
 
-        VkPhysicalDevice pDevice = engine.GetPhysicalDevice();
-        VkDevice device = engine.GetWorkQueue().GetDevice();
+        // Key is (material, cell x, cell y, cell z), ordered so the output is deterministic
+        typedef std::tuple<uint32_t, int32_t, int32_t, int32_t> BatchKey;
+        std::map<BatchKey, std::vector<uint32_t>> batches;
 
-        VkDeviceSize vertexBufferSize = 0;
-        VkDeviceSize indexBufferSize = 0;
-        for (const auto& req : reqs)
+        for (uint32_t e = 0; e < scene.entities.size(); e++)
+        {
+            const Entity& entity = scene.entities[e];
+            // Meshes shared with other scenes are already in the pool
+            const auto reqIndex = reqIndexById.find(entity.meshId);
+            if (reqIndex == reqIndexById.end())
+                continue;
+            const MeshCreationRequest& req = reqs[reqIndex->second];
+
+            // Shared meshes are better off instanced, moving ones can't be baked into a cell
+            if (entity.isDynamic || references[reqIndex->second] != 1 || req.indices.empty() || req.vertices.size() > params.staticBatchMaxVertices)
+                continue;
+
+            const glm::mat4& transform = scene.transforms[entity.transformId];
+            glm::vec3 center(0.0f);
+            for (const auto& vertex : req.vertices)
+                center += glm::vec3(transform * glm::vec4(vertex.position, 1.0f));
+            center /= static_cast<float>(req.vertices.size());
+
+            const glm::ivec3 cell = glm::ivec3(glm::floor(center / params.staticBatchCellSize));
+            batches[BatchKey(entity.materialId, cell.x, cell.y, cell.z)].push_back(e);
+        }
+
+        std::vector<uint8_t> removedEntities(scene.entities.size(), 0);
+        std::vector<uint8_t> removedReqs(reqs.size(), 0);
+        std::vector<MeshCreationRequest> batchedReqs;
+        std::vector<Entity> batchedEntities;
+
+        for (const auto& [key, entityIndices] : batches)
+        {
+            if (entityIndices.size() < 2)
+                continue;
+
+            const auto [materialId, cx, cy, cz] = key;
+            // Cell local positions keep precision for half-float vertices
+            const glm::vec3 cellOrigin = glm::vec3(cx, cy, cz) * params.staticBatchCellSize;
+
+            MeshCreationRequest* batch = nullptr;
+            for (const uint32_t e : entityIndices)
+            {
+                const Entity& entity = scene.entities[e];
+                // Only entities whose mesh was found above made it into a batch
+                const uint32_t reqIndex = reqIndexById.at(entity.meshId);
+                const MeshCreationRequest& req = reqs[reqIndex];
+
+                if (batch == nullptr || batch->vertices.size() + req.vertices.size() > kMaxBatchVertexCount)
+                {
+                    batchedReqs.emplace_back();
+                    batch = &batchedReqs.back();
+                    batch->id = temporaryMeshCounter.fetch_add(1);
+                    batch->materialId = materialId;
+
+                    scene.transforms.push_back(glm::translate(glm::mat4(1.0f), cellOrigin));
+
+                    Entity batchEntity;
+                    batchEntity.meshId = batch->id;
+                    batchEntity.transformId = static_cast<uint32_t>(scene.transforms.size() - 1);
+                    batchEntity.materialId = materialId;
+                    batchedEntities.push_back(batchEntity);
+                }
+
+                const glm::mat4& transform = scene.transforms[entity.transformId];
+                const glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(transform));
+
+                const uint32_t baseVertex = static_cast<uint32_t>(batch->vertices.size());
+                for (VU::Vertex vertex : req.vertices)
+                {
+                    vertex.position = glm::vec3(transform * glm::vec4(vertex.position, 1.0f)) - cellOrigin;
+                    vertex.normals = glm::normalize(normalMatrix * vertex.normals);
+                    batch->vertices.push_back(vertex);
+                }
+                for (const uint32_t index : req.indices)
+                    batch->indices.push_back(baseVertex + index);
+
+                removedEntities[e] = 1;
+                removedReqs[reqIndex] = 1;
+            }
+        }
+
+        if (batchedReqs.empty())
+            return;
+
+        const size_t entityCountBefore = scene.entities.size();
+
+        size_t writeIndex = 0;
+        for (size_t i = 0; i < reqs.size(); i++)
+        {
+            if (!removedReqs[i])
+                reqs[writeIndex++] = std::move(reqs[i]);
+        }
+        reqs.resize(writeIndex);
+        for (auto& req : batchedReqs)
+            reqs.push_back(std::move(req));
+
+        // Transforms of the removed entities are left unreferenced
+        std::vector<Entity> entities;
+        entities.reserve(scene.entities.size());
+        for (size_t e = 0; e < scene.entities.size(); e++)
+        {
+            if (!removedEntities[e])
+                entities.push_back(scene.entities[e]);
+        }
+        entities.insert(entities.end(), batchedEntities.begin(), batchedEntities.end());
+        for (uint32_t e = 0; e < entities.size(); e++)
+            entities[e].id = e;
+        scene.entities = std::move(entities);
+
+        printf("[Scene Loader] Static batching: %zu entities -> %zu entities in %zu batches.\n",
+            entityCountBefore, scene.entities.size(), batchedEntities.size());
+    }
+
+    static bool CanUse16BitIndices(const LoadParams& params, size_t vertexCount)
+    {
+        return params.allow16BitIndices && vertexCount <= std::numeric_limits<uint16_t>::max() + 1ull;
+    }
+
+    // Gives every request its range of the shared vertex and index buffers and remaps the entities to mesh indices.
+    // Counts come from the sources when the geometry hasn't been decoded into the requests. Shared meshes follow
+    // the laid out ones and keep their place in the pool.
+    static void LayoutMeshes(const LoadParams& params, const std::vector<MeshCreationRequest>& reqs, const std::vector<PrimitiveSource>* pSources,
+        const std::vector<SharedMesh>& shared, Scene& scene, VkDeviceSize& vertexBufferSize, VkDeviceSize& indexBufferSize)
+    {
+        scene.vertexFormat = params.vertexFormat;
+        const VkDeviceSize vertexSize = VU::GetVertexSize(params.vertexFormat);
+
+        std::unordered_map<uint32_t, uint32_t> meshIndexById;
+        meshIndexById.reserve(reqs.size());
+
+        vertexBufferSize = 0;
+        indexBufferSize = 0;
+        for (size_t i = 0; i < reqs.size(); i++)
         {
+            const auto& req = reqs[i];
+            meshIndexById[req.id] = static_cast<uint32_t>(scene.meshes.size());
+
+            const size_t vertexCount = pSources ? (*pSources)[i].vertexCount : req.vertices.size();
+            const size_t indexCount = pSources ? (*pSources)[i].indexCount : req.indices.size();
+
             Mesh mesh {};
             mesh.id = scene.meshes.size();
-            mesh.vertexOffset = static_cast<uint32_t>(vertexBufferSize / sizeof(VU::Vertex));
-            mesh.indexOffset = static_cast<uint32_t>(indexBufferSize / sizeof(uint32_t));
-            mesh.vertexCount = static_cast<uint32_t>(req.vertices.size());
-            mesh.indexCount = static_cast<uint32_t>(req.indices.size());
+            mesh.indexType = CanUse16BitIndices(params, vertexCount) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+            const VkDeviceSize indexSize = mesh.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+            // Keep every range 4 byte aligned so 32-bit meshes can follow 16-bit ones
+            indexBufferSize = (indexBufferSize + 3) & ~VkDeviceSize(3);
+
+            mesh.vertexOffset = static_cast<uint32_t>(vertexBufferSize / vertexSize);
+            mesh.indexOffset = static_cast<uint32_t>(indexBufferSize / indexSize);
+            mesh.vertexCount = static_cast<uint32_t>(vertexCount);
+            mesh.indexCount = static_cast<uint32_t>(indexCount);
+            // Without accessor bounds, undecoded meshes get theirs while decoding
+            mesh.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+            mesh.boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+            if (pSources && (*pSources)[i].hasBounds)
+            {
+                mesh.boundsMin = (*pSources)[i].boundsMin;
+                mesh.boundsMax = (*pSources)[i].boundsMax;
+            }
+            for (const auto& vertex : req.vertices)
+            {
+                mesh.boundsMin = glm::min(mesh.boundsMin, vertex.position);
+                mesh.boundsMax = glm::max(mesh.boundsMax, vertex.position);
+            }
             scene.meshes.push_back(mesh);
 
-            vertexBufferSize += sizeof(VU::Vertex) * req.vertices.size();
-            indexBufferSize += sizeof(uint32_t) * req.indices.size();
+            vertexBufferSize += vertexSize * vertexCount;
+            indexBufferSize += indexSize * indexCount;
+        }
+        indexBufferSize = (indexBufferSize + 3) & ~VkDeviceSize(3);
+
+        for (const SharedMesh& sharedMesh : shared)
+        {
+            meshIndexById[sharedMesh.requestId] = static_cast<uint32_t>(scene.meshes.size());
+            Mesh& mesh = scene.meshes.emplace_back(sharedMesh.mesh);
+            mesh.id = static_cast<uint32_t>(scene.meshes.size() - 1);
+        }
+
+        // Entities reference the temporary IDs handed out while parsing, one without a request has nothing to draw
+        size_t entityCount = 0;
+        for (const auto& entity : scene.entities)
+        {
+            const auto meshIndex = meshIndexById.find(entity.meshId);
+            if (meshIndex == meshIndexById.end())
+                continue;
+
+            Entity& kept = scene.entities[entityCount];
+            kept = entity;
+            kept.id = static_cast<uint32_t>(entityCount++);
+            kept.meshId = meshIndex->second;
         }
+        if (entityCount != scene.entities.size())
+            printf("[Scene Loader] Dropped %zu entities referencing unknown meshes.\n", scene.entities.size() - entityCount);
+        scene.entities.resize(entityCount);
+    }
+
+    struct StagingBuffers
+    {
+        VU::Buffer vertices;
+        VU::Buffer positions;
+        VU::Buffer indices;
+        VkDeviceSize vertexBytes = 0;
+        VkDeviceSize positionBytes = 0;
+        VkDeviceSize indexBytes = 0;
+        void* vertexData = nullptr;
+        void* positionData = nullptr;
+        void* indexData = nullptr;
+    };
+
+    // Creates the host visible staging buffers and leaves them mapped
+    static VkResult CreateStagingBuffers(imp::Engine& engine, StagingBuffers& staging)
+    {
+        VkPhysicalDevice pDevice = engine.GetPhysicalDevice();
+        VkDevice device = engine.GetWorkQueue().GetDevice();
 
-        // Create vertex staging buffer
-        VU::Buffer vertexStagingBuffer;
         VkResult result = CreateBuffer(pDevice, device,
-                                        vertexBufferSize,
+                                        staging.vertexBytes,
                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                        vertexStagingBuffer);
+                                        staging.vertices);
         if (result != VK_SUCCESS)
             return result;
 
-        // Map and copy vertex data
-        void* vertexData;
-        vkMapMemory(device, vertexStagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &vertexData);
-        for (const auto& req : reqs)
-        {
-            memcpy(vertexData, req.vertices.data(), sizeof(VU::Vertex) * req.vertices.size());
-            vertexData = static_cast<uint8_t*>(vertexData) + sizeof(VU::Vertex) * req.vertices.size();
-        }
-        vkUnmapMemory(device, vertexStagingBuffer.memory);
-
-        // Create index buffer
-        VU::Buffer indexStagingBuffer;
         result = CreateBuffer(pDevice, device,
-                                indexBufferSize,
-                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                        indexStagingBuffer);
+                                staging.positionBytes,
+                                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                staging.positions);
+        if (result != VK_SUCCESS)
+            return result;
 
+        result = CreateBuffer(pDevice, device,
+                                staging.indexBytes,
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                staging.indices);
         if (result != VK_SUCCESS)
             return result;
 
-        // Map and copy index data
-        void* indexData;
-        vkMapMemory(device, indexStagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &indexData);
-        for (const auto& req : reqs)
-        {
-            memcpy(indexData, req.indices.data(), sizeof(uint32_t) * req.indices.size());
-            indexData = static_cast<uint8_t*>(indexData) + sizeof(uint32_t) * req.indices.size();
-        }
-        vkUnmapMemory(device, indexStagingBuffer.memory);
+        vkMapMemory(device, staging.vertices.memory, 0, VK_WHOLE_SIZE, 0, &staging.vertexData);
+        vkMapMemory(device, staging.positions.memory, 0, VK_WHOLE_SIZE, 0, &staging.positionData);
+        vkMapMemory(device, staging.indices.memory, 0, VK_WHOLE_SIZE, 0, &staging.indexData);
+        return VK_SUCCESS;
+    }
 
-        // Create device local vertex buffer
-        result = CreateBuffer(pDevice, device,
-                                vertexBufferSize,
-                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                scene.vertexBuffer);
+    VkResult InitializeGeometryPool(imp::Engine& engine, VU::VertexFormat vertexFormat, imp::GeometryPool& geometryPool)
+    {
+        imp::GeometryPoolParams params {};
+        params.vertexStreamCount = 2;
+        params.vertexStrides[kVertexStream] = VU::GetVertexSize(vertexFormat);
+        params.vertexUsages[kVertexStream] = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        params.vertexStrides[kPositionStream] = sizeof(glm::vec3);
+        params.vertexUsages[kPositionStream] = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        params.indexUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+        return geometryPool.Initialize(engine, params);
+    }
 
+    // Takes ranges of the pool for the first meshCount meshes, the laid out ones, and moves their offsets from 0 based
+    // into the pool's buffers
+    static VkResult AllocateSceneGeometry(imp::Engine& engine, imp::GeometryPool& geometryPool, VkDeviceSize vertexBytes, VkDeviceSize indexBytes,
+        size_t meshCount, Scene& scene)
+    {
+        GeometryAllocation allocation {};
+        allocation.vertexCount = static_cast<uint32_t>(vertexBytes / VU::GetVertexSize(scene.vertexFormat));
+        allocation.indexBytes = indexBytes;
+
+        VkResult result = geometryPool.AllocateVertices(engine, allocation.vertexCount, allocation.firstVertex);
         if (result != VK_SUCCESS)
             return result;
 
-        // Create device local index buffer
-        result = CreateBuffer(pDevice, device,
-                                indexBufferSize,
-                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                scene.indexBuffer);
-
+        result = geometryPool.AllocateIndices(engine, allocation.indexBytes, allocation.indexOffset);
         if (result != VK_SUCCESS)
+        {
+            geometryPool.FreeVertices(engine, allocation.firstVertex, allocation.vertexCount);
             return result;
+        }
 
-         VkCommandBuffer cb = engine.AcquireCommandBuffer(imp::CommandBufferType::Graphics);
+        // Index ranges are 4 byte aligned, so the offset is a whole number of elements of either type
+        for (size_t m = 0; m < meshCount; m++)
+        {
+            Mesh& mesh = scene.meshes[m];
+            const VkDeviceSize indexSize = mesh.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+            mesh.vertexOffset += allocation.firstVertex;
+            mesh.indexOffset += static_cast<uint32_t>(allocation.indexOffset / indexSize);
+        }
 
-        // Copy vertex data to device local buffer
-        VkBufferCopy copyRegion {};
-        copyRegion.size = vertexBufferSize;
-        vkCmdCopyBuffer(cb, vertexStagingBuffer.buffer, scene.vertexBuffer.buffer, 1, &copyRegion);
+        scene.pGeometryPool = &geometryPool;
+        scene.geometry = allocation;
+        return VK_SUCCESS;
+    }
 
-        // Copy index data to device local buffer
-        copyRegion.size = indexBufferSize;
-        vkCmdCopyBuffer(cb, indexStagingBuffer.buffer, scene.indexBuffer.buffer, 1, &copyRegion);
+    void ReleaseGeometry(imp::Engine& engine, Scene& scene)
+    {
+        if (!scene.pGeometryPool)
+            return;
+
+        if (scene.pGeometryRegistry)
+        {
+            for (uint32_t range : scene.geometryRanges)
+            {
+                GeometryAllocation allocation {};
+                if (!scene.pGeometryRegistry->Release(range, allocation))
+                    continue;
+                scene.pGeometryPool->FreeVertices(engine, allocation.firstVertex, allocation.vertexCount);
+                scene.pGeometryPool->FreeIndices(engine, allocation.indexOffset, allocation.indexBytes);
+            }
+        }
+        else
+        {
+            scene.pGeometryPool->FreeVertices(engine, scene.geometry.firstVertex, scene.geometry.vertexCount);
+            scene.pGeometryPool->FreeIndices(engine, scene.geometry.indexOffset, scene.geometry.indexBytes);
+        }
+
+        scene.pGeometryPool = nullptr;
+        scene.geometry = {};
+        scene.pGeometryRegistry = nullptr;
+        scene.geometryRanges.clear();
+    }
+
+    // Hands the scene's own range to the registry, offers its meshes for sharing and takes a reference on every range
+    // its shared meshes live in
+    static void RegisterGeometry(GeometryRegistry& registry, const std::vector<MeshCreationRequest>& reqs,
+        const std::unordered_map<uint32_t, GeometryKey>& keysById, const std::vector<SharedMesh>& shared, Scene& scene)
+    {
+        const uint32_t range = registry.AddRange(scene.geometry);
+        scene.pGeometryRegistry = &registry;
+        scene.geometryRanges = { range };
 
+        for (size_t i = 0; i < reqs.size(); i++)
+        {
+            const auto key = keysById.find(reqs[i].id);
+            if (key != keysById.end())
+                registry.Add(key->second, range, scene.meshes[i]);
+        }
+
+        for (const SharedMesh& sharedMesh : shared)
+        {
+            if (std::find(scene.geometryRanges.begin(), scene.geometryRanges.end(), sharedMesh.range) != scene.geometryRanges.end())
+                continue;
+            registry.AddReference(sharedMesh.range);
+            scene.geometryRanges.push_back(sharedMesh.range);
+        }
+    }
+
+    // Makes the geometry copies recorded in cb visible to every later draw and submits them
+    static imp::SubmitSync SubmitUploadCommands(imp::Engine& engine, VkCommandBuffer cb)
+    {
         // Add memory barrier to ensure copies are visible before reads
         VU::InsertPipelineBarrier2(cb,
             VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+            VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
             VK_ACCESS_2_TRANSFER_WRITE_BIT,
-            VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT);
+            VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
 
         // Submit copy commands
         vkEndCommandBuffer(cb);
@@ -159,188 +899,804 @@ namespace SceneLoader
         submitParams.commandBufferCount = 1;
         submitParams.pCommandBuffers = &cb;
         submitParams.queue = engine.GetWorkQueue().GetGraphicsQueue();
-        imp::SubmitSync sync = engine.Submit(&submitParams, 1);
+        return engine.Submit(&submitParams, 1);
+    }
+
+    // Unmaps the staging buffers, copies them into the scene's ranges of the pool and retires them once the copy is done
+    static VkResult UploadStagingBuffers(imp::Engine& engine, imp::GeometryPool& geometryPool, StagingBuffers& staging, size_t meshCount, Scene& scene)
+    {
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+
+        vkUnmapMemory(device, staging.vertices.memory);
+        vkUnmapMemory(device, staging.positions.memory);
+        vkUnmapMemory(device, staging.indices.memory);
+
+        // May grow the pool, which records its own copy before the uploads below
+        VkResult result = AllocateSceneGeometry(engine, geometryPool, staging.vertexBytes, staging.indexBytes, meshCount, scene);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkCommandBuffer cb = engine.AcquireCommandBuffer(imp::CommandBufferType::Graphics);
+
+        // Copy vertex data to device local buffer
+        VkBufferCopy copyRegion {};
+        copyRegion.dstOffset = scene.geometry.firstVertex * VU::GetVertexSize(scene.vertexFormat);
+        copyRegion.size = staging.vertexBytes;
+        if (copyRegion.size)
+            vkCmdCopyBuffer(cb, staging.vertices.buffer, geometryPool.GetVertexBuffer(kVertexStream), 1, &copyRegion);
+
+        // Copy index data to device local buffer
+        copyRegion.dstOffset = scene.geometry.indexOffset;
+        copyRegion.size = staging.indexBytes;
+        if (copyRegion.size)
+            vkCmdCopyBuffer(cb, staging.indices.buffer, geometryPool.GetIndexBuffer(), 1, &copyRegion);
+
+        copyRegion.dstOffset = scene.geometry.firstVertex * sizeof(glm::vec3);
+        copyRegion.size = staging.positionBytes;
+        if (copyRegion.size)
+            vkCmdCopyBuffer(cb, staging.positions.buffer, geometryPool.GetVertexBuffer(kPositionStream), 1, &copyRegion);
+
+        const imp::SubmitSync sync = SubmitUploadCommands(engine, cb);
 
         // Enqueue staging buffers for deferred destruction
         imp::SafeResourceDestroyer& destroyer = engine.GetSafeResourceDestroyer();
         imp::VulkanResource res {};
-        res.buffer = vertexStagingBuffer.buffer;
-        res.memory = vertexStagingBuffer.memory;
+        res.buffer = staging.vertices.buffer;
+        res.memory = staging.vertices.memory;
         res.type = imp::VulkanResourceType::Buffer;
         destroyer.EnqueueResourceForDestruction(res, sync.submit);
-        res.buffer = indexStagingBuffer.buffer;
-        res.memory = indexStagingBuffer.memory;
+        res.buffer = staging.indices.buffer;
+        res.memory = staging.indices.memory;
+        destroyer.EnqueueResourceForDestruction(res, sync.submit);
+        res.buffer = staging.positions.buffer;
+        res.memory = staging.positions.memory;
         destroyer.EnqueueResourceForDestruction(res, sync.submit);
 
+        return VK_SUCCESS;
+    }
+
+    // A cache hit commits to the baked data, errors past this point fail the load. loadStart is taken before the key
+    // is computed, which is part of every warm load.
+    static bool LoadCachedScene(const SceneCache::Reader& reader, imp::Engine& engine, imp::GeometryPool& geometryPool, GeometryRegistry& geometryRegistry,
+        std::chrono::steady_clock::time_point loadStart, Scene& scene)
+    {
+        const SceneCache::Geometry geometry = reader.GetGeometry();
+
+        StagingBuffers staging;
+        staging.vertexBytes = geometry.vertexBytes;
+        staging.positionBytes = geometry.positionBytes;
+        staging.indexBytes = geometry.indexBytes;
+        if (CreateStagingBuffers(engine, staging) != VK_SUCCESS)
+            return false;
+
+        std::memcpy(staging.vertexData, geometry.vertices, geometry.vertexBytes);
+        std::memcpy(staging.positionData, geometry.positions, geometry.positionBytes);
+        std::memcpy(staging.indexData, geometry.indices, geometry.indexBytes);
+
+        reader.ReadScene(scene);
+        BuildInstancedDraws(scene);
+
+        const double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+        printf("[Scene Loader] Loaded %zu meshes from the scene cache in %.2f ms.\n", scene.meshes.size(), loadMs);
+        if (UploadStagingBuffers(engine, geometryPool, staging, scene.meshes.size(), scene) != VK_SUCCESS)
+            return false;
+
+        RegisterGeometry(geometryRegistry, {}, {}, {}, scene);
         return true;
     }
 
-    void LoadGLTFNode(const tinygltf::Node& node, const tinygltf::Model& model, std::unordered_map<uint32_t, uint32_t>& meshIdMap
-        , std::vector<MeshCreationRequest>& reqs, Scene& scene)
+    bool LoadScene(const std::filesystem::path& path, imp::Engine& engine, imp::GeometryPool& geometryPool, GeometryRegistry& geometryRegistry,
+        const LoadParams& params, Scene& scene)
     {
-        auto transform = glm::mat4x4(1.0f);
+        uint64_t cacheKey = 0;
+        std::filesystem::path cachePath;
+        if (!params.cacheDirectory.empty())
+        {
+            const auto loadStart = std::chrono::steady_clock::now();
+            cacheKey = SceneCache::ComputeKey(path, params);
+            if (cacheKey)
+            {
+                cachePath = SceneCache::GetCachePath(params.cacheDirectory, path, cacheKey);
+                SceneCache::Reader reader;
+                if (reader.Open(cachePath, cacheKey))
+                    return LoadCachedScene(reader, engine, geometryPool, geometryRegistry, loadStart, scene);
+            }
+        }
+
+        std::vector<MeshCreationRequest> reqs;
+        ParsedGLTF gltf;
+        if (!ParseGLTF(path, gltf, reqs, scene))
+            return false;
 
-		if (node.matrix.size())
-			transform = glm::make_mat4x4(node.matrix.data());
-		else
-		{
-			if (node.scale.size())
-				transform = glm::scale(transform, glm::vec3(glm::make_vec3(node.scale.data())));
+        // A scene written to the cache can't point into other scenes' geometry
+        std::unordered_map<uint32_t, GeometryKey> keysById;
+        std::vector<SharedMesh> shared;
+        if (params.deduplicateGeometry)
+            DeduplicateGeometry(params, cacheKey ? nullptr : &geometryRegistry, reqs, gltf.sources, scene, keysById, shared);
 
-			if (node.rotation.size())
-				transform *= glm::mat4((glm::quat)glm::make_quat(node.rotation.data()));
+        // Without CPU side processing the accessors are converted once, straight into the staging buffers
+        const bool decodeToStaging = !params.optimizeMeshes && !params.staticBatching;
+        const auto decodeStart = std::chrono::steady_clock::now();
+        if (!decodeToStaging)
+        {
+            DecodePrimitives(gltf, reqs);
+            Gltf::ReleaseBuffers(gltf.document);
+        }
 
-			if (node.translation.size())
-				transform = glm::translate(transform, glm::vec3(glm::make_vec3(node.translation.data())));
-		}
+        if (params.optimizeMeshes)
+            OptimizeMeshes(reqs);
 
-        if (std::string(node.name).find("Camera") != std::string::npos &&
-            scene.cameraWasLoaded == false)
+        if (params.staticBatching)
+            BatchStaticMeshes(params, reqs, scene);
+
+        VkDeviceSize vertexBufferSize = 0;
+        VkDeviceSize indexBufferSize = 0;
+        LayoutMeshes(params, reqs, decodeToStaging ? &gltf.sources : nullptr, shared, scene, vertexBufferSize, indexBufferSize);
+        BuildInstancedDraws(scene);
+
+        StagingBuffers staging;
+        staging.vertexBytes = vertexBufferSize;
+        // Position-only copy for shadow and other depth-only passes
+        staging.positionBytes = sizeof(glm::vec3) * (vertexBufferSize / VU::GetVertexSize(params.vertexFormat));
+        staging.indexBytes = indexBufferSize;
+        if (CreateStagingBuffers(engine, staging) != VK_SUCCESS)
+            return false;
+
+        if (decodeToStaging)
         {
-            scene.camera.Model = transform;
-            scene.cameraWasLoaded = true;
+            // Meshes own disjoint ranges of every staging buffer
+            Parallel::For(reqs.size(), [&](size_t i)
+            {
+                DecodePrimitiveToStaging(gltf.sources[i], params.vertexFormat, scene.meshes[i],
+                    staging.vertexData, static_cast<glm::vec3*>(staging.positionData), staging.indexData);
+            });
         }
+        else
+        {
+            // Copy vertex data, compressing on the way if requested
+            uint8_t* pVertices = static_cast<uint8_t*>(staging.vertexData);
+            glm::vec3* pPositions = static_cast<glm::vec3*>(staging.positionData);
+            for (size_t i = 0; i < reqs.size(); i++)
+            {
+                const auto& req = reqs[i];
+                const Mesh& mesh = scene.meshes[i];
+                if (params.vertexFormat == VU::VertexFormat::Compact)
+                    VU::CompressVertices(req.vertices.data(), req.vertices.size(), reinterpret_cast<VU::CompactVertex*>(pVertices));
+                else
+                    memcpy(pVertices, req.vertices.data(), sizeof(VU::Vertex) * req.vertices.size());
+                pVertices += VU::GetVertexSize(params.vertexFormat) * req.vertices.size();
 
-        for (const auto child : node.children)
-            LoadGLTFNode(model.nodes[child], model, meshIdMap, reqs, scene);
+                for (const auto& vertex : req.vertices)
+                    *pPositions++ = vertex.position;
 
-        // This is so we don't load geometry for linked/duplicate meshes.
-        if (meshIdMap.find(node.mesh) != meshIdMap.end())
+                if (mesh.indexType == VK_INDEX_TYPE_UINT16)
+                    VU::NarrowIndices(req.indices.data(), req.indices.size(), static_cast<uint16_t*>(staging.indexData) + mesh.indexOffset);
+                else
+                    memcpy(static_cast<uint32_t*>(staging.indexData) + mesh.indexOffset, req.indices.data(), sizeof(uint32_t) * req.indices.size());
+            }
+        }
+
+        const double decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decodeStart).count();
+        printf("[Scene Loader] Geometry of %zu meshes processed and staged in %.2f ms%s.\n", reqs.size(), decodeMs,
+            decodeToStaging ? ", straight to staging memory" : "");
+
+        if (cacheKey)
+        {
+            // Reads the blobs back from the staging mapping, only on the first load of a source
+            SceneCache::Geometry geometry;
+            geometry.vertices = staging.vertexData;
+            geometry.vertexBytes = staging.vertexBytes;
+            geometry.positions = staging.positionData;
+            geometry.positionBytes = staging.positionBytes;
+            geometry.indices = staging.indexData;
+            geometry.indexBytes = staging.indexBytes;
+            SceneCache::Write(cachePath, cacheKey, scene, geometry);
+        }
+
+        if (UploadStagingBuffers(engine, geometryPool, staging, reqs.size(), scene) != VK_SUCCESS)
+            return false;
+
+        RegisterGeometry(geometryRegistry, reqs, keysById, shared, scene);
+        return true;
+    }
+
+    // Pieces take at most this fraction of the staging ring, so decoding and uploading overlap
+    inline constexpr VkDeviceSize kStreamingPieceFraction = 4;
+    inline constexpr VkDeviceSize kMinStagingBudget = 1ull << 20;
+    inline constexpr VkDeviceSize kStagingAlignment = 16;
+
+    static VkDeviceSize AlignStaging(VkDeviceSize size)
+    {
+        return (size + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+    }
+
+    struct SceneStreamer::State
+    {
+        // A decoded piece waiting in the staging ring
+        struct StagedPiece
+        {
+            uint32_t mesh;
+            // Including the end of the ring skipped when the piece wrapped to the front
+            VkDeviceSize ringBytes;
+            // Index pieces have one copy, vertex pieces one into each vertex stream. Resolved to the pool's
+            // buffers at submit time, they change when the pool grows.
+            bool indices;
+            VkBufferCopy copies[2];
+        };
+
+        struct Upload
+        {
+            uint64_t submit;
+            std::vector<StagedPiece> pieces;
+        };
+
+        // Entities binned by position on the ground plane, the bounds cover all of them in world space
+        struct Cell
+        {
+            glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+            glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+            std::vector<uint32_t> meshes;
+        };
+
+        enum class Residency : uint8_t
         {
-            const auto& mesh = model.meshes[node.mesh];
+            Unloaded,
+            // Has its ranges, waiting for or being decoded by the worker or uploading
+            Queued,
+            Resident
+        };
 
-            int primIndex = 0;
-            for (const auto& prim : mesh.primitives)
+        ParsedGLTF gltf;
+        VU::VertexFormat vertexFormat = VU::VertexFormat::Full;
+        size_t verticesPerPiece = 1;
+        size_t indicesPerPiece = 1;
+        // Buffer ranges of every mesh, written by the main thread before the mesh is requested
+        std::vector<Mesh> layout;
+
+        // Written by the worker, read by the main thread once the mesh's last piece was handed over
+        std::vector<glm::vec3> decodedBoundsMin;
+        std::vector<glm::vec3> decodedBoundsMax;
+
+        VU::Buffer staging;
+        uint8_t* pStaging = nullptr;
+        VkDeviceSize capacity = 0;
+        // Worker only, the ring is filled and freed in the same order
+        VkDeviceSize head = 0;
+
+        std::mutex mutex;
+        // New requests, freed ring space or quit
+        std::condition_variable wake;
+        VkDeviceSize ringUsed = 0;
+        // Meshes for the worker to decode, the nearest at the back
+        std::vector<uint32_t> requests;
+        std::vector<StagedPiece> staged;
+        bool quit = false;
+        std::thread worker;
+
+        // Main thread only
+        imp::GeometryPool* pGeometryPool = nullptr;
+        StreamingParams params;
+        bool partitioned = false;
+        std::vector<Cell> cells;
+        // Meshes of dynamic entities, they leave their cell so they are always loaded
+        std::vector<uint32_t> pinnedMeshes;
+        std::vector<Residency> residency;
+        std::vector<uint32_t> pendingPieces;
+        // Update in which the mesh was last within the load radius, for the LRU eviction
+        std::vector<uint64_t> lastWanted;
+        std::vector<float> distances;
+        uint64_t updateIndex = 0;
+        VkDeviceSize residentBytes = 0;
+        size_t queuedMeshes = 0;
+        std::deque<Upload> uploads;
+        uint64_t lastUploadSubmit = 0;
+        std::chrono::steady_clock::time_point start;
+
+        VkDeviceSize GetIndexSize(uint32_t m) const
+        {
+            return layout[m].indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        }
+
+        // Pool memory of a mesh, what counts against the geometry budget
+        VkDeviceSize GetMeshBytes(uint32_t m) const
+        {
+            const VkDeviceSize indexBytes = layout[m].indexCount * GetIndexSize(m);
+            return layout[m].vertexCount * (VU::GetVertexSize(vertexFormat) + sizeof(glm::vec3))
+                + ((indexBytes + imp::kGeometryIndexAlignment - 1) & ~(imp::kGeometryIndexAlignment - 1));
+        }
+
+        uint32_t GetPieceCount(uint32_t m) const
+        {
+            const PrimitiveSource& source = gltf.sources[m];
+            return static_cast<uint32_t>((source.vertexCount + verticesPerPiece - 1) / verticesPerPiece
+                + (source.indexCount + indicesPerPiece - 1) / indicesPerPiece);
+        }
+
+        bool AllocateMesh(imp::Engine& engine, uint32_t m)
+        {
+            Mesh& mesh = layout[m];
+            uint32_t firstVertex = 0;
+            VkDeviceSize indexOffset = 0;
+            if (pGeometryPool->AllocateVertices(engine, mesh.vertexCount, firstVertex) != VK_SUCCESS)
+                return false;
+            if (pGeometryPool->AllocateIndices(engine, mesh.indexCount * GetIndexSize(m), indexOffset) != VK_SUCCESS)
             {
-                MeshCreationRequest req;
-                // Adds primIndex so it maps to the temporary mesh IDs generated below. 
-                req.id = meshIdMap[node.mesh] + primIndex;
-                req.materialId = model.meshes[node.mesh].primitives.front().material;
-                reqs.push_back(req);
+                pGeometryPool->FreeVertices(engine, firstVertex, mesh.vertexCount);
+                return false;
+            }
+            mesh.vertexOffset = firstVertex;
+            mesh.indexOffset = static_cast<uint32_t>(indexOffset / GetIndexSize(m));
+            return true;
+        }
 
-                scene.transforms.push_back(transform);
+        void FreeMesh(imp::Engine& engine, uint32_t m)
+        {
+            const Mesh& mesh = layout[m];
+            pGeometryPool->FreeVertices(engine, mesh.vertexOffset, mesh.vertexCount);
+            pGeometryPool->FreeIndices(engine, mesh.indexOffset * GetIndexSize(m), mesh.indexCount * GetIndexSize(m));
+            residentBytes -= GetMeshBytes(m);
+            residency[m] = Residency::Unloaded;
+        }
 
-                Entity entity;
-                entity.id = static_cast<uint32_t>(scene.entities.size());
-                entity.meshId = req.id;
-                entity.transformId = static_cast<uint32_t>(scene.transforms.size() - 1);
-                entity.materialId = req.materialId;
-                scene.entities.push_back(entity);
+        // Puts entities into cells by their world space bounds center
+        void BuildCells(const Scene& scene)
+        {
+            std::unordered_map<uint64_t, uint32_t> cellIndices;
+            for (const Entity& entity : scene.entities)
+            {
+                if (layout[entity.meshId].indexCount == 0)
+                    continue;
+                if (entity.isDynamic)
+                {
+                    pinnedMeshes.push_back(entity.meshId);
+                    continue;
+                }
+
+                const glm::mat4x4& transform = scene.transforms[entity.transformId];
+                const Mesh& mesh = layout[entity.meshId];
+                glm::vec3 boundsMin = glm::vec3(transform[3]);
+                glm::vec3 boundsMax = boundsMin;
+                if (mesh.boundsMin.x <= mesh.boundsMax.x)
+                {
+                    // Transformed box of the object space bounds
+                    const glm::vec3 center = glm::vec3(transform * glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f));
+                    const glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+                    const glm::vec3 extent = absolute * ((mesh.boundsMax - mesh.boundsMin) * 0.5f);
+                    boundsMin = center - extent;
+                    boundsMax = center + extent;
+                }
 
-                primIndex++;
+                const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+                const int32_t x = static_cast<int32_t>(std::floor(center.x / params.cellSize));
+                const int32_t z = static_cast<int32_t>(std::floor(center.z / params.cellSize));
+                const uint64_t key = (uint64_t(uint32_t(x)) << 32) | uint32_t(z);
+
+                const auto [it, inserted] = cellIndices.try_emplace(key, static_cast<uint32_t>(cells.size()));
+                if (inserted)
+                    cells.emplace_back();
+                Cell& cell = cells[it->second];
+                cell.boundsMin = glm::min(cell.boundsMin, boundsMin);
+                cell.boundsMax = glm::max(cell.boundsMax, boundsMax);
+                cell.meshes.push_back(entity.meshId);
             }
 
-            return;
+            for (Cell& cell : cells)
+            {
+                std::sort(cell.meshes.begin(), cell.meshes.end());
+                cell.meshes.erase(std::unique(cell.meshes.begin(), cell.meshes.end()), cell.meshes.end());
+            }
+            std::sort(pinnedMeshes.begin(), pinnedMeshes.end());
+            pinnedMeshes.erase(std::unique(pinnedMeshes.begin(), pinnedMeshes.end()), pinnedMeshes.end());
         }
 
-        if (node.mesh > -1)
+        // Requests the unloaded meshes of cells in range, nearest first, and drops requests that left it. Resident
+        // meshes outside the range stay until the budget needs their memory. Returns how many were evicted.
+        // Evicted meshes are appended to changedMeshes
+        void UpdateResidency(imp::Engine& engine, const glm::vec3& viewPosition, Scene& scene, std::vector<uint32_t>& changedMeshes)
         {
-            const auto& mesh = model.meshes[node.mesh];
+            updateIndex++;
+            std::fill(distances.begin(), distances.end(), std::numeric_limits<float>::max());
+            for (const Cell& cell : cells)
+            {
+                const float distance = glm::distance(viewPosition, glm::clamp(viewPosition, cell.boundsMin, cell.boundsMax));
+                if (distance > params.loadRadius)
+                    continue;
+                for (uint32_t m : cell.meshes)
+                    distances[m] = std::min(distances[m], distance);
+            }
+            for (uint32_t m : pinnedMeshes)
+                distances[m] = 0.0f;
 
-			for (const auto& prim : mesh.primitives)
+            std::vector<uint32_t> wanted;
+            for (uint32_t m = 0; m < layout.size(); m++)
             {
-                MeshCreationRequest req;
-				req.id = temporaryMeshCounter.fetch_add(1);
-				req.materialId = prim.material >= 0 ? prim.material : kDefaultMaterialIndex;
-				if (req.materialId >= kMaxMaterialIndex) // last one is reserved for default
-				{
-					req.materialId = kDefaultMaterialIndex;
-					printf("[Scene Loader] Error: Trying to assign material with ID '%u' when max is '%u'. Will assign default material.\n", prim.material, kMaxMaterialIndex);
-				}
+                if (distances[m] == std::numeric_limits<float>::max())
+                    continue;
+                lastWanted[m] = updateIndex;
+                if (residency[m] == Residency::Unloaded)
+                    wanted.push_back(m);
+            }
+            std::sort(wanted.begin(), wanted.end(), [&](uint32_t a, uint32_t b) { return distances[a] < distances[b]; });
 
-                meshIdMap[node.mesh] = req.id; // can keep rewriting this
+            // Requests the worker hasn't taken yet can still be cancelled, taken ones finish and become evictable
+            std::vector<uint32_t> cancelled;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                const auto kept = std::partition(requests.begin(), requests.end(), [&](uint32_t m) { return lastWanted[m] == updateIndex; });
+                cancelled.assign(kept, requests.end());
+                requests.erase(kept, requests.end());
+            }
+            for (uint32_t m : cancelled)
+            {
+                FreeMesh(engine, m);
+                queuedMeshes--;
+            }
 
-                const float* positionBuffer = nullptr;
-                const float* normalsBuffer = nullptr;
-                const float* texCoordsBuffer = nullptr;
-                size_t vertexCount = 0;
+            // Built on the first budget miss, least recently wanted at the back
+            std::vector<uint32_t> evictable;
+            bool evictableBuilt = false;
 
-                if (prim.attributes.find("POSITION") != prim.attributes.end()) 
+            std::vector<uint32_t> queued;
+            for (uint32_t m : wanted)
+            {
+                const VkDeviceSize bytes = GetMeshBytes(m);
+                if (params.geometryBudget && residentBytes + bytes > params.geometryBudget)
                 {
-                    const auto& accessor = model.accessors[prim.attributes.find("POSITION")->second];
-                    const auto& view = model.bufferViews[accessor.bufferView];
-                    positionBuffer = reinterpret_cast<const float*>(&(model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-                    vertexCount = accessor.count;
+                    if (!evictableBuilt)
+                    {
+                        for (uint32_t r = 0; r < layout.size(); r++)
+                            if (residency[r] == Residency::Resident && lastWanted[r] != updateIndex)
+                                evictable.push_back(r);
+                        std::sort(evictable.begin(), evictable.end(), [&](uint32_t a, uint32_t b) { return lastWanted[a] > lastWanted[b]; });
+                        evictableBuilt = true;
+                    }
+                    while (residentBytes + bytes > params.geometryBudget && !evictable.empty())
+                    {
+                        const uint32_t victim = evictable.back();
+                        evictable.pop_back();
+                        FreeMesh(engine, victim);
+                        scene.meshes[victim].indexCount = 0;
+                        changedMeshes.push_back(victim);
+                    }
+                    // Farther meshes would only be bigger misses, they wait until something frees up
+                    if (residentBytes + bytes > params.geometryBudget)
+                        break;
                 }
 
-                if (prim.attributes.find("NORMAL") != prim.attributes.end()) 
+                if (!AllocateMesh(engine, m))
+                    break;
+                residency[m] = Residency::Queued;
+                pendingPieces[m] = GetPieceCount(m);
+                residentBytes += bytes;
+                queuedMeshes++;
+                queued.push_back(m);
+            }
+
+            if (!queued.empty() || !cancelled.empty())
+            {
                 {
-                    const auto& accessor = model.accessors[prim.attributes.find("NORMAL")->second];
-                    const auto& view = model.bufferViews[accessor.bufferView];
-                    normalsBuffer = reinterpret_cast<const float*>(&(model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
+                    std::lock_guard<std::mutex> lock(mutex);
+                    requests.insert(requests.end(), queued.begin(), queued.end());
+                    std::sort(requests.begin(), requests.end(), [&](uint32_t a, uint32_t b) { return distances[a] > distances[b]; });
                 }
+                wake.notify_one();
+            }
+        }
 
-                if (prim.attributes.find("TEXCOORD_0") != prim.attributes.end()) 
+        void RunWorker()
+        {
+            for (;;)
+            {
+                uint32_t m = 0;
                 {
-                    const auto& accessor = model.accessors[prim.attributes.find("TEXCOORD_0")->second];
-                    const auto& view = model.bufferViews[accessor.bufferView];
-                    texCoordsBuffer = reinterpret_cast<const float*>(&(model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]() { return quit || !requests.empty(); });
+                    if (quit)
+                        return;
+                    m = requests.back();
+                    requests.pop_back();
                 }
 
-                for (size_t i = 0; i < vertexCount; i++)
-                {
-                    VU::Vertex vertex;
-                    std::memcpy(&vertex.position, &positionBuffer[i * 3], sizeof(float) * 3);
-                    std::memcpy(&vertex.normals, &normalsBuffer[i * 3], sizeof(float) * 3);
+                const PrimitiveSource& source = gltf.sources[m];
+                decodedBoundsMin[m] = glm::vec3(std::numeric_limits<float>::max());
+                decodedBoundsMax[m] = glm::vec3(std::numeric_limits<float>::lowest());
+                for (size_t first = 0; first < source.vertexCount; first += verticesPerPiece)
+                    if (!StagePiece(m, false, first, std::min(verticesPerPiece, source.vertexCount - first)))
+                        return;
+                for (size_t first = 0; first < source.indexCount; first += indicesPerPiece)
+                    if (!StagePiece(m, true, first, std::min(indicesPerPiece, source.indexCount - first)))
+                        return;
+            }
+        }
+
+        // Decodes a vertex or index range of a mesh into the ring, false when asked to quit
+        bool StagePiece(uint32_t m, bool indices, size_t first, size_t count)
+        {
+            const VkDeviceSize vertexSize = VU::GetVertexSize(vertexFormat);
+            const PrimitiveSource& source = gltf.sources[m];
+            const Mesh& mesh = layout[m];
+            const VkDeviceSize indexSize = GetIndexSize(m);
+            const VkDeviceSize bytes = count * (indices ? indexSize : vertexSize + sizeof(glm::vec3));
+            const VkDeviceSize size = AlignStaging(bytes);
+
+            // Pieces are contiguous, one that doesn't fit before the end starts over at the front
+            VkDeviceSize offset = head;
+            VkDeviceSize ringBytes = size;
+            if (offset + size > capacity)
+            {
+                ringBytes += capacity - offset;
+                offset = 0;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return quit || ringUsed + ringBytes <= capacity; });
+                if (quit)
+                    return false;
+                ringUsed += ringBytes;
+            }
+            head = offset + size;
+
+            StagedPiece stagedPiece {};
+            stagedPiece.mesh = m;
+            stagedPiece.ringBytes = ringBytes;
+            stagedPiece.indices = indices;
+
+            uint8_t* pDst = pStaging + offset;
+            if (indices)
+            {
+                if (mesh.indexType == VK_INDEX_TYPE_UINT16)
+                    DecodePrimitiveIndices(source, first, count, reinterpret_cast<uint16_t*>(pDst));
+                else
+                    DecodePrimitiveIndices(source, first, count, reinterpret_cast<uint32_t*>(pDst));
+
+                stagedPiece.copies[0] = { offset, (mesh.indexOffset + first) * indexSize, bytes };
+            }
+            else
+            {
+                const VkDeviceSize vertexBytes = count * vertexSize;
+                glm::vec3* pPositions = reinterpret_cast<glm::vec3*>(pDst + vertexBytes);
+                DecodeVertexRange(source, vertexFormat, first, count, pDst, pPositions, decodedBoundsMin[m], decodedBoundsMax[m]);
+
+                const VkDeviceSize firstVertex = mesh.vertexOffset + first;
+                stagedPiece.copies[0] = { offset, firstVertex * vertexSize, vertexBytes };
+                stagedPiece.copies[1] = { offset + vertexBytes, firstVertex * sizeof(glm::vec3), count * sizeof(glm::vec3) };
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            staged.push_back(stagedPiece);
+            return true;
+        }
+
+        void StopWorker()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            wake.notify_all();
+            if (worker.joinable())
+                worker.join();
+        }
+    };
+
+    SceneStreamer::SceneStreamer() = default;
+
+    SceneStreamer::~SceneStreamer()
+    {
+        if (m_State)
+            m_State->StopWorker();
+    }
+
+    bool SceneStreamer::Begin(const std::filesystem::path& path, imp::Engine& engine, imp::GeometryPool& geometryPool, const LoadParams& params,
+        const StreamingParams& streamingParams, Scene& scene)
+    {
+        auto state = std::make_unique<State>();
+        state->start = std::chrono::steady_clock::now();
+
+        std::vector<MeshCreationRequest> reqs;
+        if (!ParseGLTF(path, state->gltf, reqs, scene))
+            return false;
+
+        if (params.deduplicateGeometry)
+        {
+            std::unordered_map<uint32_t, GeometryKey> keysById;
+            std::vector<SharedMesh> shared;
+            DeduplicateGeometry(params, nullptr, reqs, state->gltf.sources, scene, keysById, shared);
+        }
+
+        if (params.optimizeMeshes || params.staticBatching || !params.cacheDirectory.empty())
+            printf("[Scene Loader] Streamed scenes skip mesh optimization, static batching and the scene cache.\n");
+
+        VkDeviceSize vertexBufferSize = 0;
+        VkDeviceSize indexBufferSize = 0;
+        LayoutMeshes(params, reqs, &state->gltf.sources, {}, scene, vertexBufferSize, indexBufferSize);
+
+        // A whole scene gets its ranges up front, partitioned meshes get theirs when they are requested
+        state->params = streamingParams;
+        state->partitioned = streamingParams.cellSize > 0.0f;
+        if (!state->partitioned && AllocateSceneGeometry(engine, geometryPool, vertexBufferSize, indexBufferSize, scene.meshes.size(), scene) != VK_SUCCESS)
+            return false;
+        scene.pGeometryPool = &geometryPool;
+        state->pGeometryPool = &geometryPool;
+
+        const size_t meshCount = scene.meshes.size();
+        state->vertexFormat = params.vertexFormat;
+        state->layout = scene.meshes;
+        state->residency.assign(meshCount, State::Residency::Unloaded);
+        state->pendingPieces.assign(meshCount, 0);
+        state->lastWanted.assign(meshCount, 0);
+        state->distances.assign(meshCount, std::numeric_limits<float>::max());
+        state->decodedBoundsMin.assign(meshCount, glm::vec3(std::numeric_limits<float>::max()));
+        state->decodedBoundsMax.assign(meshCount, glm::vec3(std::numeric_limits<float>::lowest()));
+        // Nothing is drawn until it is uploaded
+        for (Mesh& mesh : scene.meshes)
+            mesh.indexCount = 0;
+        BuildInstancedDraws(scene);
 
-                    vertex.normals.x = prim.attributes.find("TEXCOORD_0") != prim.attributes.end() ? texCoordsBuffer[i * 2] : 0.0f;
-                    vertex.normals.y = prim.attributes.find("TEXCOORD_0") != prim.attributes.end() ? texCoordsBuffer[i * 2 + 1] : 0.0f;
-                    //vertex.normals.x = prim.attributes.find("TEXCOORD_0") != prim.attributes.end() ? meshopt_quantizeHalf(texCoordsBuffer[i * 2]) : 0.0f;
-                    //vertex.normals.y = prim.attributes.find("TEXCOORD_0") != prim.attributes.end() ? meshopt_quantizeHalf(texCoordsBuffer[i * 2 + 1]) : 0.0f;
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+        state->capacity = AlignStaging(std::max(streamingParams.stagingBudget, kMinStagingBudget));
+        if (CreateBuffer(engine.GetPhysicalDevice(), device, state->capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, state->staging) != VK_SUCCESS)
+            return false;
+
+        void* pStaging = nullptr;
+        vkMapMemory(device, state->staging.memory, 0, VK_WHOLE_SIZE, 0, &pStaging);
+        state->pStaging = static_cast<uint8_t*>(pStaging);
+
+        const VkDeviceSize vertexSize = VU::GetVertexSize(params.vertexFormat);
+        const VkDeviceSize pieceBytes = state->capacity / kStreamingPieceFraction;
+        state->verticesPerPiece = std::max<size_t>(1, pieceBytes / (vertexSize + sizeof(glm::vec3)));
+        state->indicesPerPiece = std::max<size_t>(1, pieceBytes / sizeof(uint32_t));
+
+        if (state->partitioned)
+        {
+            state->BuildCells(scene);
+            printf("[Scene Loader] World partition of %zu meshes in %zu cells of %.0f units, loading within %.0f units",
+                meshCount, state->cells.size(), streamingParams.cellSize, streamingParams.loadRadius);
+            if (streamingParams.geometryBudget)
+                printf(" under a %.1f MB budget", double(streamingParams.geometryBudget) / (1024.0 * 1024.0));
+            printf(".\n");
+        }
+        else
+        {
+            // Meshes that can't be drawn aren't uploaded at all, the rest in scene order
+            for (uint32_t m = static_cast<uint32_t>(meshCount); m-- > 0;)
+            {
+                if (state->layout[m].indexCount == 0)
+                    continue;
+                state->residency[m] = State::Residency::Queued;
+                state->pendingPieces[m] = state->GetPieceCount(m);
+                state->residentBytes += state->GetMeshBytes(m);
+                state->queuedMeshes++;
+                state->requests.push_back(m);
+            }
+            printf("[Scene Loader] Streaming %zu meshes through a %.1f MB staging ring.\n",
+                state->queuedMeshes, double(state->capacity) / (1024.0 * 1024.0));
+        }
+
+        State& workerState = *state;
+        state->worker = std::thread([&workerState]() { workerState.RunWorker(); });
+        m_State = std::move(state);
+        return true;
+    }
+
+    uint32_t SceneStreamer::Update(imp::Engine& engine, const glm::vec3& viewPosition, Scene& scene, std::vector<uint32_t>& changedMeshes)
+    {
+        changedMeshes.clear();
+        if (!m_State)
+            return 0;
+        State& state = *m_State;
+
+        if (state.partitioned)
+            state.UpdateResidency(engine, viewPosition, scene, changedMeshes);
+
+        std::vector<State::StagedPiece> staged;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            staged.swap(state.staged);
+        }
 
-                    req.vertices.push_back(vertex);
+        if (!staged.empty())
+        {
+            const imp::GeometryPool& pool = *state.pGeometryPool;
+            VkCommandBuffer cb = engine.AcquireCommandBuffer(imp::CommandBufferType::Graphics);
+            for (const State::StagedPiece& piece : staged)
+            {
+                if (piece.indices)
+                {
+                    vkCmdCopyBuffer(cb, state.staging.buffer, pool.GetIndexBuffer(), 1, &piece.copies[0]);
+                    continue;
                 }
+                vkCmdCopyBuffer(cb, state.staging.buffer, pool.GetVertexBuffer(kVertexStream), 1, &piece.copies[0]);
+                vkCmdCopyBuffer(cb, state.staging.buffer, pool.GetVertexBuffer(kPositionStream), 1, &piece.copies[1]);
+            }
 
-                
-				const auto& accessor = model.accessors[prim.indices];
-				const auto& bufferView = model.bufferViews[accessor.bufferView];
-				const auto& buffer = model.buffers[bufferView.buffer];
-
-				const auto indexCount = accessor.count;
-
-				const auto FillIndices = [&](const auto& buf)
-				{
-					for (size_t index = 0; index < accessor.count; index++)
-					{
-						req.indices.push_back(buf[index]);
-					}
-				};
-				switch (accessor.componentType) {
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: 
-				{
-					const uint32_t* buf = reinterpret_cast<const uint32_t*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]);
-					FillIndices(buf);
-					break;
-				}
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: 
-				{
-					const uint16_t* buf = reinterpret_cast<const uint16_t*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]);
-					FillIndices(buf);
-					break;
-				}
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: 
-				{
-					const uint8_t* buf = reinterpret_cast<const uint8_t*>(&buffer.data[accessor.byteOffset + bufferView.byteOffset]);
-					FillIndices(buf);
-					break;
-				}
-				default:
-					printf("[Scene Loader] Error: Index component type %i not supported!\n", accessor.componentType);
-					return;
-				}
-
-                
-                scene.transforms.push_back(transform);
+            const imp::SubmitSync sync = SubmitUploadCommands(engine, cb);
+            state.lastUploadSubmit = sync.submit;
+            state.uploads.push_back({ sync.submit, std::move(staged) });
+        }
 
-                Entity entity;
-                entity.id = static_cast<uint32_t>(scene.entities.size());
-                entity.meshId = req.id;
-                entity.transformId = static_cast<uint32_t>(scene.transforms.size() - 1);
-                entity.materialId = req.materialId;
-                scene.entities.push_back(entity);
+        // The frame pacing waits advance the synced point, uploads finish in submit order
+        const uint64_t lastSynced = engine.GetSubmitSyncManager().GetLastSyncedPoint();
+        uint32_t published = 0;
+        VkDeviceSize freedBytes = 0;
+        while (!state.uploads.empty() && state.uploads.front().submit <= lastSynced)
+        {
+            for (const State::StagedPiece& piece : state.uploads.front().pieces)
+            {
+                freedBytes += piece.ringBytes;
+                if (--state.pendingPieces[piece.mesh] != 0)
+                    continue;
 
-				reqs.push_back(req);
+                const Mesh& layout = state.layout[piece.mesh];
+                Mesh& mesh = scene.meshes[piece.mesh];
+                mesh.vertexOffset = layout.vertexOffset;
+                mesh.indexOffset = layout.indexOffset;
+                mesh.indexCount = layout.indexCount;
+                if (!state.gltf.sources[piece.mesh].hasBounds)
+                {
+                    mesh.boundsMin = state.decodedBoundsMin[piece.mesh];
+                    mesh.boundsMax = state.decodedBoundsMax[piece.mesh];
+                }
+                state.residency[piece.mesh] = State::Residency::Resident;
+                state.queuedMeshes--;
+                changedMeshes.push_back(piece.mesh);
+                published++;
             }
+            state.uploads.pop_front();
         }
+
+        if (freedBytes)
+        {
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.ringUsed -= freedBytes;
+            }
+            state.wake.notify_one();
+        }
+
+        if (published && state.queuedMeshes == 0)
+        {
+            const double streamMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - state.start).count();
+            if (state.partitioned)
+                printf("[Scene Loader] World partition settled, %.1f MB of geometry resident.\n", double(state.residentBytes) / (1024.0 * 1024.0));
+            else
+                printf("[Scene Loader] Streamed %zu meshes in %.2f ms.\n", scene.meshes.size(), streamMs);
+        }
+        return static_cast<uint32_t>(changedMeshes.size());
+    }
+
+    bool SceneStreamer::IsDone() const
+    {
+        return !m_State || (!m_State->partitioned && m_State->queuedMeshes == 0);
+    }
+
+    void SceneStreamer::Shutdown(imp::Engine& engine)
+    {
+        if (!m_State)
+            return;
+
+        m_State->StopWorker();
+
+        // Partitioned meshes own their ranges, the scene has no whole range for ReleaseGeometry to free.
+        // The pool frees at the last submit, which is no earlier than the last upload.
+        if (m_State->partitioned)
+        {
+            for (uint32_t m = 0; m < m_State->layout.size(); m++)
+                if (m_State->residency[m] != State::Residency::Unloaded)
+                    m_State->FreeMesh(engine, m);
+        }
+
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+        vkUnmapMemory(device, m_State->staging.memory);
+
+        imp::VulkanResource res {};
+        res.buffer = m_State->staging.buffer;
+        res.memory = m_State->staging.memory;
+        res.type = imp::VulkanResourceType::Buffer;
+        engine.GetSafeResourceDestroyer().EnqueueResourceForDestruction(res, m_State->lastUploadSubmit);
+
+        m_State.reset();
     }
-}
\ No newline at end of file
+}
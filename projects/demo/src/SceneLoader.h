@@ -1,7 +1,9 @@
 #pragma once
-#include "Tiny_GLTF/tiny_gltf.h"
 #include "vkutilities.h"
+#include "GeometryPool.h"
 #include <filesystem>
+#include <memory>
+#include <vector>
 
 inline constexpr uint32_t kMaxMaterialCount = 128;
 inline constexpr uint32_t kDefaultMaterialIndex = kMaxMaterialCount - 1u;
@@ -9,7 +11,12 @@ inline constexpr uint32_t kMaxMaterialIndex = kDefaultMaterialIndex - 1u;
 
 inline constexpr uint32_t kInvalidId = ~0u;
 
+// Vertex streams of the geometry pool, full or compact vertices and float3 positions for depth-only passes
+inline constexpr uint32_t kVertexStream = 0;
+inline constexpr uint32_t kPositionStream = 1;
+
 class imp::Engine;
+class GeometryRegistry;
 
 namespace SceneLoader
 {
@@ -19,6 +26,8 @@ namespace SceneLoader
         uint32_t meshId         = kInvalidId;
         uint32_t transformId    = kInvalidId;
         uint32_t materialId     = kInvalidId;
+        // Moves at runtime, from nodes with "Dynamic" in their name. Never batched or cached in shadow maps.
+        bool isDynamic          = false;
     };
 
     struct Mesh
@@ -28,6 +37,40 @@ namespace SceneLoader
         uint32_t indexOffset;
         uint32_t vertexCount;
         uint32_t indexCount;
+        // indexOffset is counted in elements of this type
+        VkIndexType indexType   = VK_INDEX_TYPE_UINT32;
+        // Object space bounds, for batched meshes they cover every merged piece in the cell
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+
+    // One draw call for all entities sharing a mesh. DrawData of instance i
+    // lives at firstInstance + i and is fetched with gl_InstanceIndex.
+    struct InstancedDraw
+    {
+        uint32_t meshId         = kInvalidId;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    enum class LightType : uint32_t
+    {
+        Point,
+        Spot
+    };
+
+    // KHR_lights_punctual, position and direction in world space
+    struct Light
+    {
+        LightType type          = LightType::Point;
+        glm::vec3 position      = glm::vec3(0.0f);
+        glm::vec3 direction     = glm::vec3(0.0f, 0.0f, -1.0f);
+        glm::vec3 color         = glm::vec3(1.0f);
+        float intensity         = 1.0f;
+        // 0 means infinite, the light culling picks a range from the intensity then
+        float range             = 0.0f;
+        float innerConeAngle    = 0.0f;
+        float outerConeAngle    = 0.7853981634f;
     };
 
     struct Camera
@@ -45,22 +88,118 @@ namespace SceneLoader
         std::vector<uint32_t> indices;
     };
 
+    struct LoadParams
+    {
+        VU::VertexFormat vertexFormat = VU::VertexFormat::Full;
+        // Meshes with less than 65536 vertices get 16-bit indices
+        bool allow16BitIndices = false;
+        // Weld, vertex cache, overdraw and vertex fetch optimization before upload
+        bool optimizeMeshes = true;
+        // Primitives with identical geometry share one mesh, even across different glTF meshes and with
+        // scenes loaded earlier through the same registry
+        bool deduplicateGeometry = true;
+        // Pre-transforms small single-use meshes sharing a material and spatial cell into one mesh
+        bool staticBatching = false;
+        float staticBatchCellSize = 16.0f;
+        uint32_t staticBatchMaxVertices = 1024;
+        // Baked scenes are read from and written to this directory, empty disables the cache
+        std::filesystem::path cacheDirectory;
+    };
+
+    // Ranges of the geometry pool owned by a scene
+    struct GeometryAllocation
+    {
+        uint32_t firstVertex    = 0;
+        uint32_t vertexCount    = 0;
+        VkDeviceSize indexOffset = 0;
+        VkDeviceSize indexBytes = 0;
+    };
+
     struct Scene
     {
-        VU::Buffer vertexBuffer;
-        VU::Buffer indexBuffer;
+        // Mesh vertex and index offsets point into the pool's buffers, the scene's own ranges start at geometry
+        imp::GeometryPool* pGeometryPool = nullptr;
+        GeometryAllocation geometry;
+        // Set when the scene was loaded through a registry. Its meshes may live in ranges of other scenes,
+        // geometryRanges are the registry ranges it holds a reference on, its own first.
+        GeometryRegistry* pGeometryRegistry = nullptr;
+        std::vector<uint32_t> geometryRanges;
         
         std::vector<Entity> entities;
         std::vector<Mesh> meshes;
         std::vector<glm::mat4x4> transforms;
 
+        std::vector<InstancedDraw> draws;
+        // Entity IDs in instance order, entities of a draw are contiguous
+        std::vector<uint32_t> instanceEntities;
+
         uint32_t indexCount;
+        VU::VertexFormat vertexFormat = VU::VertexFormat::Full;
+
+        std::vector<Light> lights;
+
+        // First directional light, travel direction in world space
+        bool sunWasLoaded = false;
+        glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.3f, -1.0f, -0.2f));
+        glm::vec3 sunColor = glm::vec3(1.0f);
 
         bool cameraWasLoaded = false;
         Camera camera;
     };
 
-    bool LoadScene(const std::filesystem::path& path, imp::Engine& engine, Scene& scene);
-    void LoadGLTFNode(const tinygltf::Node& node, const tinygltf::Model& model, std::unordered_map<uint32_t, uint32_t>& meshIdMap
-        , std::vector<MeshCreationRequest>& reqs, Scene& scene);
+    struct StreamingParams
+    {
+        // Host memory the geometry passes through on its way to the GPU, upload memory never grows past it
+        VkDeviceSize stagingBudget = 32ull << 20;
+        // World partition, 0 streams the whole scene once. Otherwise entities are binned into square cells of
+        // this size on the ground plane and only meshes of cells within loadRadius of the viewer are loaded.
+        float cellSize = 0.0f;
+        float loadRadius = 200.0f;
+        // Pool memory the partitioned geometry may occupy, meshes that left the radius longest ago are evicted
+        // to make room. 0 means no limit.
+        VkDeviceSize geometryBudget = 0;
+    };
+
+    // Renders while loading. Entities, lights and the GPU buffers exist right after Begin, the geometry is
+    // decoded on a worker thread into a fixed size staging ring and uploaded piece by piece. A mesh keeps
+    // indexCount 0, which every draw path skips, until all of its pieces are on the GPU.
+    // With a world partition meshes are requested nearest first as the viewer moves, each gets its own ranges
+    // of the geometry pool and goes back to indexCount 0 when it is evicted.
+    class SceneStreamer
+    {
+    public:
+        SceneStreamer();
+        ~SceneStreamer();
+
+        SceneStreamer(const SceneStreamer&) = delete;
+        SceneStreamer& operator=(const SceneStreamer&) = delete;
+
+        // Mesh optimization, static batching and the scene cache don't apply to streamed scenes. Geometry is only
+        // deduplicated within the file, streamed meshes come and go and aren't shared with other scenes.
+        bool Begin(const std::filesystem::path& path, imp::Engine& engine, imp::GeometryPool& geometryPool, const LoadParams& params,
+            const StreamingParams& streamingParams, Scene& scene);
+        // Call once per frame after the frame pacing wait. Requests and evicts meshes around viewPosition, submits
+        // staged pieces and publishes the meshes whose uploads are done. changedMeshes gets the meshes published or
+        // evicted this call, returns their count. Draws and draw data have to be rebuilt when it isn't 0.
+        uint32_t Update(imp::Engine& engine, const glm::vec3& viewPosition, Scene& scene, std::vector<uint32_t>& changedMeshes);
+        // Never done with a world partition
+        bool IsDone() const;
+        // Stops the worker, the staging ring is retired once its last upload is done. Meshes already on the GPU stay.
+        void Shutdown(imp::Engine& engine);
+
+    private:
+        struct State;
+        std::unique_ptr<State> m_State;
+    };
+
+    // Stream layout the loaders upload into, one pool serves any number of scenes with the same vertex format
+    VkResult InitializeGeometryPool(imp::Engine& engine, VU::VertexFormat vertexFormat, imp::GeometryPool& geometryPool);
+    // The registry belongs to the pool, meshes already uploaded by earlier scenes are shared instead of uploaded again.
+    // Scenes going through the scene cache own all of their geometry so the baked file is complete, and scenes read
+    // from it aren't offered for sharing, the baked file has no keys.
+    bool LoadScene(const std::filesystem::path& path, imp::Engine& engine, imp::GeometryPool& geometryPool, GeometryRegistry& geometryRegistry,
+        const LoadParams& params, Scene& scene);
+    // Hands the scene's ranges back to the pool once the GPU is done with them, shared ranges once no scene uses them
+    void ReleaseGeometry(imp::Engine& engine, Scene& scene);
+    void BuildInstancedDraws(Scene& scene);
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "VertexCompression.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace VU
+{
+    uint16_t QuantizeHalf(float v)
+    {
+        uint32_t ui;
+        std::memcpy(&ui, &v, sizeof(ui));
+
+        const uint32_t s = (ui >> 16) & 0x8000;
+        const uint32_t em = ui & 0x7fffffff;
+
+        // Bias exponent and round to nearest, 112 is the relative exponent bias (127 - 15)
+        uint32_t h = (em - (112u << 23) + (1u << 12)) >> 13;
+        // Underflow flushes to zero, 113 encodes exponent -14
+        h = (em < (113u << 23)) ? 0 : h;
+        // Overflow becomes infinity, 143 encodes exponent 16
+        h = (em >= (143u << 23)) ? 0x7c00 : h;
+        // All NaNs become qNaN
+        h = (em > (255u << 23)) ? 0x7e00 : h;
+
+        return static_cast<uint16_t>(s | h);
+    }
+
+    static int8_t QuantizeSnorm8(float v)
+    {
+        const float clamped = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+        return static_cast<int8_t>(std::lround(clamped * 127.0f));
+    }
+
+    void EncodeOctahedral(const glm::vec3& normal, int8_t& x, int8_t& y)
+    {
+        const float l1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+        if (l1 == 0.0f)
+        {
+            x = 0;
+            y = 0;
+            return;
+        }
+
+        float ox = normal.x / l1;
+        float oy = normal.y / l1;
+
+        // Fold the lower hemisphere over the diagonals
+        if (normal.z < 0.0f)
+        {
+            const float fx = (1.0f - std::fabs(oy)) * (ox >= 0.0f ? 1.0f : -1.0f);
+            const float fy = (1.0f - std::fabs(ox)) * (oy >= 0.0f ? 1.0f : -1.0f);
+            ox = fx;
+            oy = fy;
+        }
+
+        x = QuantizeSnorm8(ox);
+        y = QuantizeSnorm8(oy);
+    }
+
+    CompactVertex CompressVertex(const Vertex& vertex)
+    {
+        CompactVertex cv;
+        cv.position[0] = QuantizeHalf(vertex.position.x);
+        cv.position[1] = QuantizeHalf(vertex.position.y);
+        cv.position[2] = QuantizeHalf(vertex.position.z);
+        EncodeOctahedral(vertex.normals, cv.normal[0], cv.normal[1]);
+        cv.uvs[0] = QuantizeHalf(vertex.uvs.x);
+        cv.uvs[1] = QuantizeHalf(vertex.uvs.y);
+        return cv;
+    }
+
+    void CompressVertices(const Vertex* src, size_t count, CompactVertex* dst)
+    {
+        for (size_t i = 0; i < count; i++)
+            dst[i] = CompressVertex(src[i]);
+    }
+
+    void NarrowIndices(const uint32_t* src, size_t count, uint16_t* dst)
+    {
+        for (size_t i = 0; i < count; i++)
+            dst[i] = static_cast<uint16_t>(src[i]);
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "vkutilities.h"
+
+#include <cstdint>
+
+namespace VU
+{
+    // Round-to-nearest fp32 -> fp16 conversion, same semantics as meshopt_quantizeHalf.
+    uint16_t QuantizeHalf(float v);
+
+    // Octahedral encoding of a unit vector into two snorm8 values.
+    void EncodeOctahedral(const glm::vec3& normal, int8_t& x, int8_t& y);
+
+    CompactVertex CompressVertex(const Vertex& vertex);
+    void CompressVertices(const Vertex* src, size_t count, CompactVertex* dst);
+
+    // Narrows indices to 16 bits, only valid when the mesh has less than 65536 vertices.
+    void NarrowIndices(const uint32_t* src, size_t count, uint16_t* dst);
+
+    inline size_t GetVertexSize(VertexFormat format)
+    {
+        return format == VertexFormat::Compact ? sizeof(CompactVertex) : sizeof(Vertex);
+    }
+}
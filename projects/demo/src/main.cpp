@@ -1,13 +1,34 @@
 #include "SceneLoader.h"
+#include "GeometryRegistry.h"
+#include "RenderQueue.h"
+#include "ClusteredLighting.h"
+#include "CascadedShadows.h"
+#include "DynamicResolution.h"
+#include "MultiView.h"
+#include "Parallel.h"
 #include "Engine.h"
+#include "RenderGraph.h"
+#include "FrameReadback.h"
+#include "FrameExport.h"
 
 #include "shaders/spv/phong_frag.h"
 #include "shaders/spv/phong_vert.h"
-
+#include "shaders/spv/visbuffer_vert.h"
+#include "shaders/spv/visbuffer_frag.h"
+#include "shaders/spv/fullscreen_vert.h"
+#include "shaders/spv/visbuffer_shade_frag.h"
+#include "shaders/spv/cluster_lights_comp.h"
+#include "shaders/spv/shadow_vert.h"
+#include "shaders/spv/multiview_vert.h"
+#include "shaders/spv/multiview_frag.h"
+
+#include <algorithm>
 #include <array>
 #include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <string>
+#include <vector>
 
 struct PushConstants
 {
@@ -15,42 +36,172 @@ struct PushConstants
     float offsetY;
 };
 
+// Binary PPM, the headless images are BGRA
+static void WriteFramePPM(const std::string& directory, const imp::ReadbackFrame& frame)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/frame_%05llu.ppm", directory.c_str(), static_cast<unsigned long long>(frame.frameNumber));
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        printf("[Readback] Failed to open %s\n", path);
+        return;
+    }
+
+    const uint32_t pixelCount = frame.width * frame.height;
+    const uint8_t* pSrc = static_cast<const uint8_t*>(frame.pData);
+    std::vector<uint8_t> rgb(size_t(pixelCount) * 3);
+    for (uint32_t i = 0; i < pixelCount; i++)
+    {
+        rgb[i * 3 + 0] = pSrc[i * 4 + 2];
+        rgb[i * 3 + 1] = pSrc[i * 4 + 1];
+        rgb[i * 3 + 2] = pSrc[i * 4 + 0];
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", frame.width, frame.height);
+    fwrite(rgb.data(), 1, rgb.size(), file);
+    fclose(file);
+}
+
 
 int main(int argc, char* argv[])
 {
     // Get GLTF scene path from command-line arguments
     std::string scenePath;
-    if (argc > 1)
+    SceneLoader::LoadParams loadParams {};
+    SceneLoader::StreamingParams streamingParams {};
+    bool useStreaming = false;
+    bool useRenderQueue = true;
+    bool useVisibilityBuffer = false;
+    uint32_t randomLightCount = 0;
+    bool useDynamicResolution = false;
+    DynamicResolution::ControllerParams resolutionParams {};
+    uint32_t viewCount = 0;
+    uint32_t viewWidth = 512;
+    bool headless = false;
+    uint32_t headlessFrameCount = 0;
+    std::string readbackDirectory;
+    std::string exportSocketPath;
+    for (int i = 1; i < argc; i++)
     {
-        scenePath = argv[1];
+        const std::string arg = argv[i];
+        if (arg == "--compact")
+        {
+            loadParams.vertexFormat = VU::VertexFormat::Compact;
+            loadParams.allow16BitIndices = true;
+        }
+        else if (arg == "--no-optimize")
+            loadParams.optimizeMeshes = false;
+        else if (arg == "--no-deduplicate")
+            loadParams.deduplicateGeometry = false;
+        else if (arg == "--static-batching")
+            loadParams.staticBatching = true;
+        else if (arg == "--scene-cache" && i + 1 < argc)
+            loadParams.cacheDirectory = argv[++i];
+        else if (arg == "--stream" && i + 1 < argc)
+        {
+            useStreaming = true;
+            streamingParams.stagingBudget = VkDeviceSize(std::stoul(argv[++i])) << 20;
+        }
+        else if (arg == "--world-partition" && i + 1 < argc)
+        {
+            useStreaming = true;
+            streamingParams.cellSize = std::stof(argv[++i]);
+        }
+        else if (arg == "--load-radius" && i + 1 < argc)
+            streamingParams.loadRadius = std::stof(argv[++i]);
+        else if (arg == "--geometry-budget" && i + 1 < argc)
+            streamingParams.geometryBudget = VkDeviceSize(std::stoul(argv[++i])) << 20;
+        else if (arg == "--no-render-queue")
+            useRenderQueue = false;
+        else if (arg == "--visibility-buffer")
+            useVisibilityBuffer = true;
+        else if (arg == "--lights" && i + 1 < argc)
+            randomLightCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--dynamic-resolution" && i + 1 < argc)
+        {
+            useDynamicResolution = true;
+            resolutionParams.targetFrameMs = std::stof(argv[++i]);
+        }
+        else if (arg == "--views" && i + 1 < argc)
+            viewCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--view-size" && i + 1 < argc)
+            viewWidth = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--min-scale" && i + 1 < argc)
+            resolutionParams.minScale = std::stof(argv[++i]);
+        else if (arg == "--max-scale" && i + 1 < argc)
+            resolutionParams.maxScale = std::stof(argv[++i]);
+        else if (arg == "--headless")
+            headless = true;
+        else if (arg == "--frames" && i + 1 < argc)
+            headlessFrameCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--readback" && i + 1 < argc)
+            readbackDirectory = argv[++i];
+        else if (arg == "--export" && i + 1 < argc)
+            exportSocketPath = argv[++i];
+        else
+            scenePath = arg;
     }
-    else
+
+    // Batched cameras replace the main camera's forward or visibility buffer frame
+    bool useMultiView = viewCount > 0;
+    if (useMultiView && useDynamicResolution)
     {
-        printf("[Main] Usage: demo.exe <path_to_gltf_scene>\n");
+        printf("[Main] Dynamic resolution is not supported with --views, ignoring it\n");
+        useDynamicResolution = false;
+    }
+
+    // Swapchain images can't be copied from, only the offscreen ring is read back
+    if (!readbackDirectory.empty() && !headless)
+    {
+        printf("[Main] --readback needs --headless, ignoring it\n");
+        readbackDirectory.clear();
+    }
+    if (!exportSocketPath.empty() && !headless)
+    {
+        printf("[Main] --export needs --headless, ignoring it\n");
+        exportSocketPath.clear();
+    }
+    const bool useExport = !exportSocketPath.empty();
+
+    if (scenePath.empty())
+    {
+        printf("[Main] Usage: demo.exe [--compact] [--no-optimize] [--no-deduplicate] [--static-batching] [--scene-cache <directory>] [--stream <staging_mb>] [--world-partition <cell_size> [--load-radius <distance>] [--geometry-budget <mb>]] [--no-render-queue] [--visibility-buffer] [--lights <count>] [--dynamic-resolution <gpu_ms> [--min-scale <scale>] [--max-scale <scale>]] [--views <count> [--view-size <width>]] [--headless [--frames <count>] [--readback <directory>] [--export <socket_path>]] <path_to_gltf_scene>\n");
         return 1;
     }
 
     imp::WindowInitParams windowInitParams {}; // default
+    if (headless)
+    {
+        // Renders into an offscreen image ring, no surface or swapchain
+        windowInitParams.type = imp::WindowType::kHeadlessWindow;
+        windowInitParams.headlessFrameCount = headlessFrameCount;
+    }
 
     imp::PlatformInitParams platformParams {};
     platformParams.pWindowInitParams = &windowInitParams;
 
-    std::initializer_list<const char*> requiredDeviceExtensions = {
+    std::vector<const char*> requiredDeviceExtensions = {
         VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME
     };
+    if (useExport)
+        requiredDeviceExtensions.insert(requiredDeviceExtensions.end(), imp::FrameExporter::kRequiredDeviceExtensions.begin(), imp::FrameExporter::kRequiredDeviceExtensions.end());
 
     imp::EngineCreateParams createParams {};
     createParams.numRequiredExtensions = static_cast<uint32_t>(requiredDeviceExtensions.size());
-    createParams.pRequiredExtensions = requiredDeviceExtensions.begin();
+    createParams.pRequiredExtensions = requiredDeviceExtensions.data();
 
     createParams.pPlatformInitParams = &platformParams;
 
     createParams.requiredFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    // gl_PrimitiveID in the fragment shader
+    createParams.requiredFeatures.features.geometryShader = useVisibilityBuffer ? VK_TRUE : VK_FALSE;
 
     VkPhysicalDeviceVulkan11Features vulkan11Features {};
     vulkan11Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
     vulkan11Features.storageBuffer16BitAccess = VK_TRUE;
     vulkan11Features.shaderDrawParameters = VK_TRUE;
+    vulkan11Features.multiview = useMultiView ? VK_TRUE : VK_FALSE;
     createParams.requiredFeatures.pNext = &vulkan11Features;
 
     VkPhysicalDeviceVulkan12Features features12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
@@ -68,6 +219,16 @@ int main(int argc, char* argv[])
 
     VkDevice device = engine.GetWorkQueue().GetDevice();
 
+    // Upscaled frames and the multi-view grid are blitted into the swapchain, not every surface allows that
+    const bool canBlitToSwapchain = (engine.GetPlatform().GetWindow().GetSwapchain().GetImageUsage() & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0;
+    if (!canBlitToSwapchain && (useDynamicResolution || useMultiView))
+    {
+        printf("[Main] The surface can't be a transfer destination, ignoring --dynamic-resolution and --views\n");
+        useDynamicResolution = false;
+        useMultiView = false;
+        viewCount = 0;
+    }
+
     VkShaderModule vertModule = VK_NULL_HANDLE;
     VkShaderModule fragModule = VK_NULL_HANDLE;
     if (VU::CreateShaderModule(device, phong_vert, sizeof(phong_vert), vertModule) != VK_SUCCESS)
@@ -75,12 +236,56 @@ int main(int argc, char* argv[])
     if (VU::CreateShaderModule(device, phong_frag, sizeof(phong_frag), fragModule) != VK_SUCCESS)
         return 0;
 
+    VkShaderModule clusterLightsModule = VK_NULL_HANDLE;
+    if (VU::CreateShaderModule(device, cluster_lights_comp, sizeof(cluster_lights_comp), clusterLightsModule) != VK_SUCCESS)
+        return 0;
+
+    VkShaderModule shadowModule = VK_NULL_HANDLE;
+    if (VU::CreateShaderModule(device, shadow_vert, sizeof(shadow_vert), shadowModule) != VK_SUCCESS)
+        return 0;
+
+    std::array<VkShaderModule, 4> visibilityModules {};
+    if (useVisibilityBuffer)
+    {
+        if (VU::CreateShaderModule(device, visbuffer_vert, sizeof(visbuffer_vert), visibilityModules[0]) != VK_SUCCESS)
+            return 0;
+        if (VU::CreateShaderModule(device, visbuffer_frag, sizeof(visbuffer_frag), visibilityModules[1]) != VK_SUCCESS)
+            return 0;
+        if (VU::CreateShaderModule(device, fullscreen_vert, sizeof(fullscreen_vert), visibilityModules[2]) != VK_SUCCESS)
+            return 0;
+        if (VU::CreateShaderModule(device, visbuffer_shade_frag, sizeof(visbuffer_shade_frag), visibilityModules[3]) != VK_SUCCESS)
+            return 0;
+    }
+
+    std::array<VkShaderModule, 2> multiViewModules {};
+    if (useMultiView)
+    {
+        if (VU::CreateShaderModule(device, multiview_vert, sizeof(multiview_vert), multiViewModules[0]) != VK_SUCCESS)
+            return 0;
+        if (VU::CreateShaderModule(device, multiview_frag, sizeof(multiview_frag), multiViewModules[1]) != VK_SUCCESS)
+            return 0;
+    }
+
     imp::Swapchain& swapchain = engine.GetPlatform().GetWindow().GetSwapchain();
     imp::Window& window = engine.GetPlatform().GetWindow();
 
-    // Load GLTF scene
+    // Scene geometry lives in ranges of one shared vertex and index buffer set, the registry lets scenes share meshes in it
+    imp::GeometryPool geometryPool {};
+    GeometryRegistry geometryRegistry;
+    if (SceneLoader::InitializeGeometryPool(engine, loadParams.vertexFormat, geometryPool) != VK_SUCCESS)
+    {
+        printf("[Main] Failed to create the geometry pool\n");
+        engine.Shutdown();
+        return 1;
+    }
+
+    // Load GLTF scene, a streamed scene starts out empty and fills in while rendering
     SceneLoader::Scene scenel {};
-    if (!SceneLoader::LoadScene(scenePath, engine, scenel))
+    SceneLoader::SceneStreamer sceneStreamer;
+    const bool sceneLoaded = useStreaming
+        ? sceneStreamer.Begin(scenePath, engine, geometryPool, loadParams, streamingParams, scenel)
+        : SceneLoader::LoadScene(scenePath, engine, geometryPool, geometryRegistry, loadParams, scenel);
+    if (!sceneLoaded)
     {
         printf("[Main] Failed to load GLTF scene: %s\n", scenePath.c_str());
         engine.Shutdown();
@@ -90,41 +295,229 @@ int main(int argc, char* argv[])
     VU::GlobalUniforms globals {};
     VU::SetupGlobalUniforms(engine, globals);
 
+    // Loaded lights stay put, the random ones orbit the scene
+    const size_t firstAnimatedLight = scenel.lights.size();
+    glm::vec3 lightOrbitCenter(0.0f);
+    if (randomLightCount)
+        lightOrbitCenter = ClusteredLighting::AddRandomLights(scenel, randomLightCount, 1337u);
+
     VU::SceneData scene {};
     VU::InitializeSceneData(engine, scene, scenel);
 
+    const std::vector<SceneLoader::Light> baseLights = scenel.lights;
+    std::vector<SceneLoader::Light> frameLights = baseLights;
+
+    ClusteredLighting::LightCuller lightCuller {};
+    if (lightCuller.Initialize(engine, clusterLightsModule, swapchain.GetSwapchainImageCount()) != VK_SUCCESS)
+    {
+        printf("[Main] Failed to create the light culling pipeline\n");
+        engine.Shutdown();
+        return 1;
+    }
+    printf("[Main] %zu lights\n", baseLights.size());
+
+    // Shadow bindings live in the lighting set, so it has to exist first
+    Shadows::CascadedShadowMaps shadows {};
+    if (shadows.Initialize(engine, shadowModule, scenel, swapchain.GetSwapchainImageCount(), lightCuller.GetDescriptorSet()) != VK_SUCCESS)
+    {
+        printf("[Main] Failed to create the shadow maps\n");
+        engine.Shutdown();
+        return 1;
+    }
+
     uint64_t meshCount = scenel.meshes.size();
     VU::RenderingDescriptors renderingData {};
-    VU::SetupRenderingDescriptorSet(engine, renderingData, scenel);
+    VU::SetupRenderingDescriptorSet(engine, renderingData, scenel, swapchain.GetSwapchainImageCount());
 
     VU::PhongPipeline phongPipeline {};
     phongPipeline.pGlobalUniforms = &globals;
     phongPipeline.pRenderingDescriptors = &renderingData;
+    phongPipeline.vertexFormat = scenel.vertexFormat;
+    phongPipeline.lightingDescriptorSetLayout = lightCuller.GetDescriptorSetLayout();
     VU::CreatePhongPipeline(device, vertModule, fragModule, phongPipeline);
 
-    std::vector<VkFramebuffer> framebuffers;
-    framebuffers.resize(swapchain.GetSwapchainImageCount());
-    VU::CreateImage(engine.GetPhysicalDevice(), device, window.GetWidth(), window.GetHeight(),
-        VK_FORMAT_D32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        phongPipeline.depthImage);
-    VU::CreateImageView(device, phongPipeline.depthImage.image, VK_FORMAT_D32_SFLOAT,
-        VK_IMAGE_ASPECT_DEPTH_BIT, phongPipeline.depthImageView);
-    for (uint32_t i = 0; i < swapchain.GetSwapchainImageCount(); i++)
+    // Rasterizes only IDs and depth, then shades each pixel once in a full-screen pass
+    VU::VisibilityPipeline visibilityPipeline {};
+    visibilityPipeline.pGlobalUniforms = &globals;
+    visibilityPipeline.pRenderingDescriptors = &renderingData;
+    visibilityPipeline.vertexFormat = scenel.vertexFormat;
+    visibilityPipeline.colorFormat = swapchain.GetSurfaceFormat();
+    visibilityPipeline.lightingDescriptorSetLayout = lightCuller.GetDescriptorSetLayout();
+    visibilityPipeline.frameCount = swapchain.GetSwapchainImageCount();
+    if (useVisibilityBuffer)
     {
-        VkImageView attachment = swapchain.GetSwapchainImageView(i);
-        std::array<VkImageView, 2> attachments = { attachment, phongPipeline.depthImageView };
-        VU::CreateFramebuffer(device, phongPipeline.renderPass, attachments.size(), attachments.data(), window.GetWidth(), window.GetHeight(), framebuffers[i]);
+        if (VU::CreateVisibilityPipeline(engine, visibilityModules[0], visibilityModules[1], visibilityModules[2], visibilityModules[3], visibilityPipeline) != VK_SUCCESS)
+        {
+            printf("[Main] Failed to create the visibility buffer pipeline\n");
+            engine.Shutdown();
+            return 1;
+        }
     }
 
+    MultiView::ViewSet viewSet {};
+    VU::MultiViewPipeline multiViewPipeline {};
+    multiViewPipeline.pRenderingDescriptors = &renderingData;
+    multiViewPipeline.vertexFormat = scenel.vertexFormat;
+    multiViewPipeline.colorFormat = MultiView::kColorFormat;
+    multiViewPipeline.viewCount = viewCount;
+    if (useMultiView)
+    {
+        if (viewSet.Initialize(engine, viewCount, static_cast<uint32_t>(scenel.entities.size()), swapchain.GetSwapchainImageCount()) != VK_SUCCESS)
+        {
+            printf("[Main] Failed to create the multiview resources\n");
+            engine.Shutdown();
+            return 1;
+        }
+        multiViewPipeline.viewDescriptorSetLayout = viewSet.GetDescriptorSetLayout();
+        if (VU::CreateMultiViewPipeline(device, multiViewModules[0], multiViewModules[1], multiViewPipeline) != VK_SUCCESS)
+        {
+            printf("[Main] Failed to create the multiview pipeline\n");
+            engine.Shutdown();
+            return 1;
+        }
+
+        // Without the render queue nothing is culled, every instance goes to every view
+        if (!useRenderQueue)
+            viewSet.SetInstanceViewMasks(std::vector<uint32_t>(scene.drawDatas.size(), (1u << viewCount) - 1u));
+    }
+    std::vector<uint32_t> instanceViewMasks;
+    std::array<glm::mat4, MultiView::kMaxViews> rigViews {};
+
+    // Per-frame culled and sorted draws, otherwise the static instanced draws built at load
+    Parallel::WorkerPool workerPool;
+    RenderQueue::Queue renderQueue;
+    std::vector<SceneLoader::InstancedDraw> frameDraws = scenel.draws;
+
+    // Framebuffers are created lazily since the depth view belongs to the render graph
+    VU::FramebufferCache framebuffers {};
+
+    imp::RenderGraph renderGraph {};
+
+    imp::RenderGraphImageDesc swapchainDesc {};
+    swapchainDesc.width = window.GetWidth();
+    swapchainDesc.height = window.GetHeight();
+    swapchainDesc.format = swapchain.GetSurfaceFormat();
+
+    // Internal target under dynamic resolution, only the render extent of it is used
+    imp::RenderGraphImageDesc sceneColorDesc = swapchainDesc;
+
+    imp::RenderGraphImageDesc depthDesc {};
+    depthDesc.width = window.GetWidth();
+    depthDesc.height = window.GetHeight();
+    depthDesc.format = VK_FORMAT_D32_SFLOAT;
+    depthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+    imp::RenderGraphImageDesc visibilityDesc {};
+    visibilityDesc.width = window.GetWidth();
+    visibilityDesc.height = window.GetHeight();
+    visibilityDesc.format = VU::kVisibilityBufferFormat;
+
+    imp::RenderGraphImageDesc shadowAtlasDesc {};
+    shadowAtlasDesc.width = Shadows::kAtlasSize;
+    shadowAtlasDesc.height = Shadows::kAtlasSize;
+    shadowAtlasDesc.format = Shadows::kShadowFormat;
+    shadowAtlasDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+    // One layer per view, views keep the window's aspect
+    imp::RenderGraphImageDesc viewColorDesc {};
+    viewColorDesc.width = viewWidth;
+    viewColorDesc.height = std::max(1u, viewWidth * window.GetHeight() / window.GetWidth());
+    viewColorDesc.format = MultiView::kColorFormat;
+    viewColorDesc.arrayLayers = std::max(viewCount, 1u);
+
+    imp::RenderGraphImageDesc viewDepthDesc = viewColorDesc;
+    viewDepthDesc.format = VK_FORMAT_D32_SFLOAT;
+    viewDepthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+    // Acquired images are waited on at color output, presentation needs no further access
+    const imp::RenderGraphResourceState acquiredState = { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED };
+    // Offscreen images are left ready to be copied out
+    const imp::RenderGraphResourceState presentState = { VK_PIPELINE_STAGE_2_NONE, 0,
+        swapchain.IsOffscreen() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR };
+
+    VkViewport viewport {};
+    viewport.width = static_cast<float>(window.GetWidth());
+    viewport.height = static_cast<float>(window.GetHeight());
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D renderArea {};
+    renderArea.extent = { window.GetWidth(), window.GetHeight() };
+
+    // 16-bit and 32-bit meshes share the index buffer, only rebind when the type changes
+    const auto drawScene = [&](VkCommandBuffer cb)
+    {
+        VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+        for (const auto& draw : frameDraws)
+        {
+            const auto& mesh = scenel.meshes[draw.meshId];
+            if (mesh.indexType != boundIndexType)
+            {
+                vkCmdBindIndexBuffer(cb, geometryPool.GetIndexBuffer(), 0, mesh.indexType);
+                boundIndexType = mesh.indexType;
+            }
+            vkCmdDrawIndexed(cb, mesh.indexCount, draw.instanceCount, mesh.indexOffset, mesh.vertexOffset, draw.firstInstance);
+        }
+    };
+
+    DynamicResolution::GpuTimer gpuTimer {};
+    DynamicResolution::Controller resolutionController(resolutionParams);
+    if (useDynamicResolution && gpuTimer.Initialize(engine.GetPhysicalDevice(), device, swapchain.GetSwapchainImageCount()) != VK_SUCCESS)
+    {
+        printf("[Main] Failed to create the GPU timer\n");
+        engine.Shutdown();
+        return 1;
+    }
+
+    // Every frame goes to disk on the readback worker while the next ones render
+    imp::FrameReadbackRing frameReadback {};
+    const bool useReadback = !readbackDirectory.empty();
+    if (useReadback)
+    {
+        imp::FrameReadbackParams readbackParams {};
+        readbackParams.width = window.GetWidth();
+        readbackParams.height = window.GetHeight();
+        readbackParams.format = swapchain.GetSurfaceFormat();
+        readbackParams.slotCount = swapchain.GetSwapchainImageCount() + 1;
+        const auto consumer = [&readbackDirectory](const imp::ReadbackFrame& frame) { WriteFramePPM(readbackDirectory, frame); };
+        if (frameReadback.Initialize(engine, readbackParams, consumer) != VK_SUCCESS)
+        {
+            printf("[Main] Failed to create the frame readback ring\n");
+            engine.Shutdown();
+            return 1;
+        }
+    }
+
+    // While a consumer is connected frames render straight into its shared images
+    imp::FrameExporter frameExporter {};
+    if (useExport)
+    {
+        imp::FrameExportParams exportParams {};
+        exportParams.socketPath = exportSocketPath;
+        exportParams.width = window.GetWidth();
+        exportParams.height = window.GetHeight();
+        exportParams.format = swapchain.GetSurfaceFormat();
+        if (frameExporter.Initialize(engine, exportParams) != VK_SUCCESS)
+        {
+            printf("[Main] Failed to set up frame export\n");
+            engine.Shutdown();
+            return 1;
+        }
+    }
+    const imp::RenderGraphResourceState exportedState = { VK_PIPELINE_STAGE_2_NONE, 0, imp::FrameExportProtocol::kImageLayout };
+
+    // Size dependent targets follow the swapchain, the render graph reallocates them when their descs change
+    uint64_t swapchainGeneration = swapchain.GetGeneration();
+    uint64_t framebufferGeneration = 0;
+
     // Setting up simples form of frame pacing
     std::vector<imp::SubmitSync> simpleFramePacing {};
     uint32_t frameIndex = 0;
     simpleFramePacing.resize(swapchain.GetSwapchainImageCount());
+    std::vector<uint32_t> streamedMeshes;
 
     // Main loop
     auto frameStartTime = std::chrono::high_resolution_clock::now();
+    const auto startTime = frameStartTime;
     while (!engine.GetPlatform().GetWindow().ShouldClose())
     {
         auto frameEndTime = std::chrono::high_resolution_clock::now();
@@ -132,86 +525,442 @@ int main(int argc, char* argv[])
         frameStartTime = frameEndTime;
         engine.GetPlatform().GetWindow().UpdateInfo(frameTimeMs);
         
+        // Minimized, there is nothing to render to until the window comes back
+        if (window.GetWidth() == 0 || window.GetHeight() == 0)
+        {
+            window.WaitEvents();
+            continue;
+        }
+
         engine.PaceFrame(device, simpleFramePacing, frameIndex);
 
+        // Streamed meshes become drawable once their upload is synced, partitioned ones follow the camera
+        if (sceneStreamer.Update(engine, glm::vec3(scene.cameraTransform[3]), scenel, streamedMeshes))
+        {
+            shadows.InvalidateStatic(scenel, streamedMeshes);
+            if (!useRenderQueue)
+            {
+                SceneLoader::BuildInstancedDraws(scenel);
+                VU::BuildDrawData(scene, scenel);
+                frameDraws = scenel.draws;
+            }
+            if (sceneStreamer.IsDone())
+                sceneStreamer.Shutdown(engine);
+        }
+
+        // A grown pool has new buffers. Pacing already waited for the last frame that used this frame's set,
+        // the sets of frames still in flight keep the old buffers until their turn comes.
+        if (geometryPool.GetGeneration() != renderingData.geometryGenerations[frameIndex])
+            VU::WriteGeometryDescriptors(device, renderingData, scenel, frameIndex);
+
+        // Acquiring recreates the swapchain after a resize
         uint32_t imageIndex = 0;
         engine.AcquireNextImage(engine.GetPlatform().GetWindow(), &imageIndex);
 
+        const VkExtent2D outputExtent = swapchain.GetExtent();
+        if (swapchain.GetGeneration() != swapchainGeneration)
+        {
+            swapchainGeneration = swapchain.GetGeneration();
+            for (imp::RenderGraphImageDesc* pDesc : { &swapchainDesc, &sceneColorDesc, &depthDesc, &visibilityDesc })
+            {
+                pDesc->width = outputExtent.width;
+                pDesc->height = outputExtent.height;
+            }
+            viewColorDesc.height = std::max(1u, viewWidth * outputExtent.height / outputExtent.width);
+            viewDepthDesc.height = viewColorDesc.height;
+            VU::UpdateProjection(scene, outputExtent.width, outputExtent.height);
+        }
+
+        // Everything renders into the top left render extent of the window sized targets, then gets upscaled
+        VkExtent2D renderExtent = outputExtent;
+        if (useDynamicResolution)
+        {
+            resolutionController.Update(gpuTimer.Resolve(device, frameIndex));
+            renderExtent = resolutionController.GetRenderExtent(outputExtent.width, outputExtent.height);
+        }
+        viewport.width = static_cast<float>(renderExtent.width);
+        viewport.height = static_cast<float>(renderExtent.height);
+        renderArea.extent = renderExtent;
+
+        uint32_t exportSlot = ~0u;
+        if (useExport)
+        {
+            frameExporter.Poll(engine);
+            exportSlot = frameExporter.AcquireSlot();
+        }
+
         VkCommandBuffer cb = engine.AcquireCommandBuffer(imp::CommandBufferType::Graphics);
 
         float delta = static_cast<float>(frameTimeMs / 1000.0);
         VU::UpdateCamera(engine.GetPlatform().GetWindow(), scene, globals.data, delta);
-        VU::UpdateRenderingDataDescriptorSetByCopy(engine, renderingData, cb, scene.drawDatas);
-        VU::UpdateGlobalDataDescriptorSetByCopy(engine, globals, cb);
-
-        std::array<VkClearValue, 2> clearValues {};
-        clearValues[0].color.float32[0] = 0.0f;
-        clearValues[0].color.float32[1] = 0.0f;
-        clearValues[0].color.float32[2] = 0.0f;
-        clearValues[0].color.float32[3] = 1.0f;
-        clearValues[1].depthStencil.depth = 1.0f;
-
-        VkViewport viewport {};
-        viewport.width = static_cast<float>(window.GetWidth());
-        viewport.height = static_cast<float>(window.GetHeight());
-        viewport.maxDepth = 1.0f;
-
-        VkRenderPassBeginInfo rpbi {};
-        rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        rpbi.renderPass = phongPipeline.renderPass;
-        rpbi.framebuffer = framebuffers[imageIndex];
-        rpbi.renderArea.offset = { 0, 0 };
-        rpbi.renderArea.extent = { window.GetWidth(), window.GetHeight() };
-        rpbi.clearValueCount = static_cast<uint32_t>(clearValues.size());
-        rpbi.pClearValues = clearValues.data();
-
-        std::array<VkImageMemoryBarrier, 2> imageBarriers {};
-        imageBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        imageBarriers[0].srcAccessMask = 0;
-        imageBarriers[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
-        imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        imageBarriers[0].image = swapchain.GetSwapchainImage(imageIndex);
-        imageBarriers[0].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageBarriers[0].subresourceRange.levelCount = 1;
-        imageBarriers[0].subresourceRange.layerCount = 1;
-        imageBarriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        imageBarriers[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-        imageBarriers[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-        imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-        imageBarriers[1].image = phongPipeline.depthImage.image;
-        imageBarriers[1].subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-        imageBarriers[1].subresourceRange.levelCount = 1;
-        imageBarriers[1].subresourceRange.layerCount = 1;
-        vkCmdPipelineBarrier(cb,
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-            0,
-            0, nullptr,
-            0, nullptr,
-            static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
-
-        vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, phongPipeline.pipeline);
-        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, phongPipeline.pipelineLayout, 0, 1, &globals.descriptorSet, 0, nullptr);
-        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, phongPipeline.pipelineLayout, 1, 1, &renderingData.descriptorSet, 0, nullptr);
-        vkCmdSetViewport(cb, 0, 1, &viewport);
-        vkCmdSetScissor(cb, 0, 1, &rpbi.renderArea);
-
-        vkCmdBindIndexBuffer(cb, scenel.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-        for (const auto& mesh : scenel.meshes)
-        {
-            vkCmdDrawIndexed(cb, mesh.indexCount, 1, mesh.indexOffset, mesh.vertexOffset, 0);
-        }
-
-        vkCmdEndRenderPass(cb);
-      
+        if (useMultiView)
+        {
+            MultiView::MakeRigViews(scene.view, viewCount, rigViews.data());
+            viewSet.Update(rigViews.data(), scene.projection, scene.lightPos);
+        }
+
+        if (useRenderQueue && useMultiView)
+        {
+            // One cull for all views, each instance carries the mask of views that see it
+            renderQueue.BuildMultiView(scenel, viewSet.GetViewProjs(), viewCount, scene.nearPlane, scene.farPlane, 0, &workerPool);
+            renderQueue.Emit(scenel, scene.drawDatas, frameDraws, &instanceViewMasks);
+            viewSet.SetInstanceViewMasks(instanceViewMasks);
+        }
+        else if (useRenderQueue)
+        {
+            renderQueue.Build(scenel, globals.data.viewProj, scene.nearPlane, scene.farPlane, 0, &workerPool);
+            renderQueue.Emit(scenel, scene.drawDatas, frameDraws);
+        }
+
+        const float time = std::chrono::duration<float>(frameStartTime - startTime).count();
+        if (firstAnimatedLight < baseLights.size())
+            ClusteredLighting::AnimateLights(baseLights, firstAnimatedLight, lightOrbitCenter, time, frameLights);
+        lightCuller.Update(frameLights, scene.view, scene.projection, scene.nearPlane, scene.farPlane, renderExtent.width, renderExtent.height);
+        if (!useMultiView)
+            shadows.Update(scenel, scene.view, scene.projection, scene.nearPlane, scene.farPlane);
+
+        renderGraph.Reset();
+        // The consumer is done with a free slot, its old contents don't matter
+        const auto backbuffer = exportSlot != ~0u
+            ? renderGraph.ImportImage("Backbuffer", frameExporter.GetImage(exportSlot), frameExporter.GetImageView(exportSlot),
+                swapchainDesc, &acquiredState, &exportedState)
+            : renderGraph.ImportImage("Backbuffer", swapchain.GetSwapchainImage(imageIndex), swapchain.GetSwapchainImageView(imageIndex),
+                swapchainDesc, &acquiredState, &presentState);
+        const auto sceneColor = useDynamicResolution ? renderGraph.CreateImage("SceneColor", sceneColorDesc) : backbuffer;
+        const auto depth = renderGraph.CreateImage("Depth", depthDesc);
+        const auto drawDataBuffer = renderGraph.ImportBuffer("DrawData", renderingData.drawDataBuffer.buffer, VK_WHOLE_SIZE);
+        const auto globalsBuffer = renderGraph.ImportBuffer("Globals", globals.ubo.buffer, VK_WHOLE_SIZE);
+        const auto lightBuffer = renderGraph.ImportBuffer("Lights", lightCuller.GetLightBuffer(), VK_WHOLE_SIZE);
+        const auto clusterUniformBuffer = renderGraph.ImportBuffer("ClusterUniforms", lightCuller.GetUniformBuffer(), VK_WHOLE_SIZE);
+        const auto clusterBuffer = renderGraph.ImportBuffer("ClusterLightCounts", lightCuller.GetClusterBuffer(), VK_WHOLE_SIZE);
+        const auto lightIndexBuffer = renderGraph.ImportBuffer("ClusterLightIndices", lightCuller.GetLightIndexBuffer(), VK_WHOLE_SIZE);
+        const auto shadowInstanceBuffer = renderGraph.ImportBuffer("ShadowInstances", shadows.GetInstanceBuffer(), VK_WHOLE_SIZE);
+        const auto shadowUniformBuffer = renderGraph.ImportBuffer("ShadowUniforms", shadows.GetUniformBuffer(), VK_WHOLE_SIZE);
+        const auto staticShadowAtlas = renderGraph.ImportImage("StaticShadowAtlas", shadows.GetStaticAtlas(), shadows.GetStaticAtlasView(), shadowAtlasDesc);
+        const auto dynamicShadowAtlas = renderGraph.ImportImage("DynamicShadowAtlas", shadows.GetDynamicAtlas(), shadows.GetDynamicAtlasView(), shadowAtlasDesc);
+        const auto viewUniformBuffer = useMultiView ? renderGraph.ImportBuffer("ViewUniforms", viewSet.GetUniformBuffer(), VK_WHOLE_SIZE) : imp::kInvalidRenderGraphResource;
+        const auto viewMaskBuffer = useMultiView ? renderGraph.ImportBuffer("ViewMasks", viewSet.GetViewMaskBuffer(), VK_WHOLE_SIZE) : imp::kInvalidRenderGraphResource;
+
+        imp::RenderGraphPass& uploadPass = renderGraph.AddPass("Upload");
+        uploadPass.Write(drawDataBuffer, imp::RenderGraphUsage::Transfer);
+        uploadPass.Write(globalsBuffer, imp::RenderGraphUsage::Transfer);
+        uploadPass.Write(lightBuffer, imp::RenderGraphUsage::Transfer);
+        uploadPass.Write(clusterUniformBuffer, imp::RenderGraphUsage::Transfer);
+        uploadPass.Write(shadowInstanceBuffer, imp::RenderGraphUsage::Transfer);
+        uploadPass.Write(shadowUniformBuffer, imp::RenderGraphUsage::Transfer);
+        if (useMultiView)
+        {
+            uploadPass.Write(viewUniformBuffer, imp::RenderGraphUsage::Transfer);
+            uploadPass.Write(viewMaskBuffer, imp::RenderGraphUsage::Transfer);
+        }
+        uploadPass.SetExecute([&](VkCommandBuffer cb)
+        {
+            VU::UpdateRenderingDataDescriptorSetByCopy(engine, renderingData, cb, scene.drawDatas);
+            VU::UpdateGlobalDataDescriptorSetByCopy(engine, globals, cb);
+            lightCuller.Upload(cb, frameIndex);
+            shadows.Upload(cb, frameIndex);
+            if (useMultiView)
+                viewSet.Upload(cb, frameIndex);
+        });
+
+        // The static atlas is only touched when a cascade got re-centered or invalidated
+        if (!useMultiView && shadows.HasStaticWork())
+        {
+            imp::RenderGraphPass& staticShadowPass = renderGraph.AddPass("ShadowStatic");
+            staticShadowPass.Read(shadowInstanceBuffer, imp::RenderGraphUsage::VertexShaderResource);
+            staticShadowPass.Write(staticShadowAtlas, imp::RenderGraphUsage::DepthStencilAttachment);
+            staticShadowPass.SetExecute([&](VkCommandBuffer cb)
+            {
+                shadows.RenderStatic(cb, scenel);
+            });
+        }
+
+        // Shadows and clustered lights are fit to the main camera, the batched views don't use them
+        if (!useMultiView)
+        {
+            imp::RenderGraphPass& dynamicShadowPass = renderGraph.AddPass("ShadowDynamic");
+            dynamicShadowPass.Read(shadowInstanceBuffer, imp::RenderGraphUsage::VertexShaderResource);
+            dynamicShadowPass.Write(dynamicShadowAtlas, imp::RenderGraphUsage::DepthStencilAttachment);
+            dynamicShadowPass.SetExecute([&](VkCommandBuffer cb)
+            {
+                shadows.RenderDynamic(cb, scenel);
+            });
+
+            imp::RenderGraphPass& lightCullingPass = renderGraph.AddPass("LightCulling");
+            lightCullingPass.Read(lightBuffer, imp::RenderGraphUsage::ComputeShaderResource);
+            lightCullingPass.Read(clusterUniformBuffer, imp::RenderGraphUsage::UniformBuffer);
+            lightCullingPass.Write(clusterBuffer, imp::RenderGraphUsage::ComputeShaderResource);
+            lightCullingPass.Write(lightIndexBuffer, imp::RenderGraphUsage::ComputeShaderResource);
+            lightCullingPass.SetExecute([&](VkCommandBuffer cb)
+            {
+                lightCuller.Dispatch(cb);
+            });
+        }
+
+        const auto readClusteredLights = [&](imp::RenderGraphPass& pass)
+        {
+            pass.Read(lightBuffer, imp::RenderGraphUsage::FragmentShaderResource);
+            pass.Read(clusterUniformBuffer, imp::RenderGraphUsage::UniformBuffer);
+            pass.Read(clusterBuffer, imp::RenderGraphUsage::FragmentShaderResource);
+            pass.Read(lightIndexBuffer, imp::RenderGraphUsage::FragmentShaderResource);
+            pass.Read(shadowUniformBuffer, imp::RenderGraphUsage::UniformBuffer);
+            pass.Read(staticShadowAtlas, imp::RenderGraphUsage::FragmentShaderResource);
+            pass.Read(dynamicShadowAtlas, imp::RenderGraphUsage::FragmentShaderResource);
+        };
+
+        if (useMultiView)
+        {
+            const auto viewColors = renderGraph.CreateImage("ViewColors", viewColorDesc);
+            const auto viewDepth = renderGraph.CreateImage("ViewDepth", viewDepthDesc);
+
+            imp::RenderGraphPass& multiViewPass = renderGraph.AddPass("MultiView");
+            multiViewPass.Read(drawDataBuffer, imp::RenderGraphUsage::VertexShaderResource);
+            multiViewPass.Read(viewUniformBuffer, imp::RenderGraphUsage::UniformBuffer);
+            multiViewPass.Read(viewMaskBuffer, imp::RenderGraphUsage::VertexShaderResource);
+            multiViewPass.Write(viewColors, imp::RenderGraphUsage::ColorAttachment);
+            multiViewPass.Write(viewDepth, imp::RenderGraphUsage::DepthStencilAttachment);
+            multiViewPass.SetExecute([&](VkCommandBuffer cb)
+            {
+                std::array<VkImageView, 2> attachments = { renderGraph.GetImageView(viewColors), renderGraph.GetImageView(viewDepth) };
+
+                std::array<VkClearValue, 2> clearValues {};
+                clearValues[0].color.float32[3] = 1.0f;
+                clearValues[1].depthStencil.depth = 1.0f;
+
+                VkRect2D viewArea {};
+                viewArea.extent = { viewColorDesc.width, viewColorDesc.height };
+
+                VkViewport viewViewport {};
+                viewViewport.width = static_cast<float>(viewColorDesc.width);
+                viewViewport.height = static_cast<float>(viewColorDesc.height);
+                viewViewport.maxDepth = 1.0f;
+
+                // Multiview framebuffers have one layer, the view mask picks the layers
+                VkRenderPassBeginInfo rpbi {};
+                rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                rpbi.renderPass = multiViewPipeline.renderPass;
+                rpbi.framebuffer = VU::GetFramebuffer(engine, framebuffers, framebufferGeneration, multiViewPipeline.renderPass,
+                    static_cast<uint32_t>(attachments.size()), attachments.data(), viewArea.extent.width, viewArea.extent.height);
+                rpbi.renderArea = viewArea;
+                rpbi.clearValueCount = static_cast<uint32_t>(clearValues.size());
+                rpbi.pClearValues = clearValues.data();
+
+                std::array<VkDescriptorSet, 2> sets = { viewSet.GetDescriptorSet(), renderingData.descriptorSets[frameIndex] };
+
+                vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+                vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, multiViewPipeline.pipeline);
+                vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, multiViewPipeline.pipelineLayout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+                vkCmdSetViewport(cb, 0, 1, &viewViewport);
+                vkCmdSetScissor(cb, 0, 1, &viewArea);
+                drawScene(cb);
+                vkCmdEndRenderPass(cb);
+            });
+
+            // Tiles every view onto the backbuffer for a look, headless users would read back the layers instead
+            imp::RenderGraphPass& mosaicPass = renderGraph.AddPass("ViewMosaic");
+            mosaicPass.Read(viewColors, imp::RenderGraphUsage::Transfer);
+            mosaicPass.Write(backbuffer, imp::RenderGraphUsage::Transfer);
+            mosaicPass.SetExecute([&](VkCommandBuffer cb)
+            {
+                VkImage backbufferImage = renderGraph.GetImage(backbuffer);
+
+                VkClearColorValue clearColor {};
+                VkImageSubresourceRange range {};
+                range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                range.levelCount = 1;
+                range.layerCount = 1;
+                vkCmdClearColorImage(cb, backbufferImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1, &range);
+                VU::InsertPipelineBarrier2(cb, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                    VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+                const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(float(viewCount))));
+                const uint32_t rows = (viewCount + columns - 1) / columns;
+                const float tileScale = std::min(float(outputExtent.width) / float(columns * viewColorDesc.width),
+                                                 float(outputExtent.height) / float(rows * viewColorDesc.height));
+                const int32_t tileWidth = static_cast<int32_t>(viewColorDesc.width * tileScale);
+                const int32_t tileHeight = static_cast<int32_t>(viewColorDesc.height * tileScale);
+
+                std::array<VkImageBlit, MultiView::kMaxViews> regions {};
+                for (uint32_t view = 0; view < viewCount; view++)
+                {
+                    const int32_t x = static_cast<int32_t>(view % columns) * tileWidth;
+                    const int32_t y = static_cast<int32_t>(view / columns) * tileHeight;
+
+                    VkImageBlit& region = regions[view];
+                    region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                    region.srcSubresource.baseArrayLayer = view;
+                    region.srcSubresource.layerCount = 1;
+                    region.srcOffsets[1] = { static_cast<int32_t>(viewColorDesc.width), static_cast<int32_t>(viewColorDesc.height), 1 };
+                    region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                    region.dstSubresource.layerCount = 1;
+                    region.dstOffsets[0] = { x, y, 0 };
+                    region.dstOffsets[1] = { x + tileWidth, y + tileHeight, 1 };
+                }
+
+                vkCmdBlitImage(cb, renderGraph.GetImage(viewColors), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    backbufferImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, viewCount, regions.data(), VK_FILTER_LINEAR);
+            });
+        }
+        else if (!useVisibilityBuffer)
+        {
+            imp::RenderGraphPass& forwardPass = renderGraph.AddPass("Forward");
+            forwardPass.Read(drawDataBuffer, imp::RenderGraphUsage::VertexShaderResource);
+            forwardPass.Read(globalsBuffer, imp::RenderGraphUsage::UniformBuffer);
+            forwardPass.Write(sceneColor, imp::RenderGraphUsage::ColorAttachment);
+            forwardPass.Write(depth, imp::RenderGraphUsage::DepthStencilAttachment);
+            readClusteredLights(forwardPass);
+            forwardPass.SetExecute([&](VkCommandBuffer cb)
+            {
+                std::array<VkImageView, 2> attachments = { renderGraph.GetImageView(sceneColor), renderGraph.GetImageView(depth) };
+
+                std::array<VkClearValue, 2> clearValues {};
+                clearValues[0].color.float32[0] = 0.0f;
+                clearValues[0].color.float32[1] = 0.0f;
+                clearValues[0].color.float32[2] = 0.0f;
+                clearValues[0].color.float32[3] = 1.0f;
+                clearValues[1].depthStencil.depth = 1.0f;
+
+                VkRenderPassBeginInfo rpbi {};
+                rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                rpbi.renderPass = phongPipeline.renderPass;
+                rpbi.framebuffer = VU::GetFramebuffer(engine, framebuffers, framebufferGeneration, phongPipeline.renderPass,
+                    static_cast<uint32_t>(attachments.size()), attachments.data(), outputExtent.width, outputExtent.height);
+                rpbi.renderArea = renderArea;
+                rpbi.clearValueCount = static_cast<uint32_t>(clearValues.size());
+                rpbi.pClearValues = clearValues.data();
+
+                vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+                vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, phongPipeline.pipeline);
+                std::array<VkDescriptorSet, 3> sets = { globals.descriptorSet, renderingData.descriptorSets[frameIndex], lightCuller.GetDescriptorSet() };
+                vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, phongPipeline.pipelineLayout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+                vkCmdSetViewport(cb, 0, 1, &viewport);
+                vkCmdSetScissor(cb, 0, 1, &renderArea);
+                drawScene(cb);
+                vkCmdEndRenderPass(cb);
+            });
+        }
+        else
+        {
+            const auto visibility = renderGraph.CreateImage("Visibility", visibilityDesc);
+
+            imp::RenderGraphPass& geometryPass = renderGraph.AddPass("VisibilityGeometry");
+            geometryPass.Read(drawDataBuffer, imp::RenderGraphUsage::VertexShaderResource);
+            geometryPass.Read(globalsBuffer, imp::RenderGraphUsage::UniformBuffer);
+            geometryPass.Write(visibility, imp::RenderGraphUsage::ColorAttachment);
+            geometryPass.Write(depth, imp::RenderGraphUsage::DepthStencilAttachment);
+            geometryPass.SetExecute([&](VkCommandBuffer cb)
+            {
+                std::array<VkImageView, 2> attachments = { renderGraph.GetImageView(visibility), renderGraph.GetImageView(depth) };
+
+                std::array<VkClearValue, 2> clearValues {};
+                clearValues[0].color.uint32[0] = VU::kVisibilityBufferEmpty;
+                clearValues[0].color.uint32[1] = VU::kVisibilityBufferEmpty;
+                clearValues[1].depthStencil.depth = 1.0f;
+
+                VkRenderPassBeginInfo rpbi {};
+                rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                rpbi.renderPass = visibilityPipeline.geometryRenderPass;
+                rpbi.framebuffer = VU::GetFramebuffer(engine, framebuffers, framebufferGeneration, visibilityPipeline.geometryRenderPass,
+                    static_cast<uint32_t>(attachments.size()), attachments.data(), outputExtent.width, outputExtent.height);
+                rpbi.renderArea = renderArea;
+                rpbi.clearValueCount = static_cast<uint32_t>(clearValues.size());
+                rpbi.pClearValues = clearValues.data();
+
+                vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+                vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipeline.geometryPipeline);
+                vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipeline.geometryPipelineLayout, 0, 1, &globals.descriptorSet, 0, nullptr);
+                vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipeline.geometryPipelineLayout, 1, 1, &renderingData.descriptorSets[frameIndex], 0, nullptr);
+                vkCmdSetViewport(cb, 0, 1, &viewport);
+                vkCmdSetScissor(cb, 0, 1, &renderArea);
+                drawScene(cb);
+                vkCmdEndRenderPass(cb);
+            });
+
+            imp::RenderGraphPass& shadePass = renderGraph.AddPass("VisibilityShade");
+            shadePass.Read(visibility, imp::RenderGraphUsage::FragmentShaderResource);
+            shadePass.Read(drawDataBuffer, imp::RenderGraphUsage::FragmentShaderResource);
+            shadePass.Read(globalsBuffer, imp::RenderGraphUsage::UniformBuffer);
+            shadePass.Write(sceneColor, imp::RenderGraphUsage::ColorAttachment);
+            readClusteredLights(shadePass);
+            shadePass.SetExecute([&](VkCommandBuffer cb)
+            {
+                VU::BindVisibilityBuffer(device, visibilityPipeline, frameIndex, renderGraph.GetImageView(visibility));
+
+                VkImageView attachment = renderGraph.GetImageView(sceneColor);
+
+                VkRenderPassBeginInfo rpbi {};
+                rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                rpbi.renderPass = visibilityPipeline.shadeRenderPass;
+                rpbi.framebuffer = VU::GetFramebuffer(engine, framebuffers, framebufferGeneration, visibilityPipeline.shadeRenderPass,
+                    1, &attachment, outputExtent.width, outputExtent.height);
+                rpbi.renderArea = renderArea;
+
+                std::array<VkDescriptorSet, 4> sets = { globals.descriptorSet, renderingData.descriptorSets[frameIndex], visibilityPipeline.descriptorSets[frameIndex], lightCuller.GetDescriptorSet() };
+
+                vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+                vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipeline.shadePipeline);
+                vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipeline.shadePipelineLayout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+                vkCmdSetViewport(cb, 0, 1, &viewport);
+                vkCmdSetScissor(cb, 0, 1, &renderArea);
+                vkCmdDraw(cb, 3, 1, 0, 0);
+                vkCmdEndRenderPass(cb);
+            });
+        }
+
+        if (useDynamicResolution)
+        {
+            imp::RenderGraphPass& upscalePass = renderGraph.AddPass("Upscale");
+            upscalePass.Read(sceneColor, imp::RenderGraphUsage::Transfer);
+            upscalePass.Write(backbuffer, imp::RenderGraphUsage::Transfer);
+            upscalePass.SetExecute([&](VkCommandBuffer cb)
+            {
+                VkImageBlit region {};
+                region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                region.srcSubresource.layerCount = 1;
+                region.srcOffsets[1] = { static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1 };
+                region.dstSubresource = region.srcSubresource;
+                region.dstOffsets[1] = { static_cast<int32_t>(outputExtent.width), static_cast<int32_t>(outputExtent.height), 1 };
+
+                vkCmdBlitImage(cb, renderGraph.GetImage(sceneColor), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    renderGraph.GetImage(backbuffer), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+            });
+        }
+
+        if (useReadback)
+        {
+            imp::RenderGraphPass& readbackPass = renderGraph.AddPass("Readback");
+            readbackPass.Read(backbuffer, imp::RenderGraphUsage::Transfer);
+            readbackPass.SetSideEffects();
+            readbackPass.SetExecute([&](VkCommandBuffer cb)
+            {
+                frameReadback.Record(cb, renderGraph.GetImage(backbuffer));
+            });
+        }
+
+        renderGraph.Compile(engine);
+        // Framebuffers hold graph and swapchain views, either being recreated drops them
+        framebufferGeneration = renderGraph.GetGeneration() + swapchain.GetGeneration();
+        gpuTimer.Begin(cb, frameIndex);
+        renderGraph.Execute(cb);
+        gpuTimer.End(cb, frameIndex);
+
         vkEndCommandBuffer(cb);
         imp::SubmitParams submitParams {};
         submitParams.commandBufferCount = 1;
         submitParams.pCommandBuffers = &cb;
         submitParams.queue = engine.GetWorkQueue().GetGraphicsQueue();
+        VkSemaphore exportSemaphore = VK_NULL_HANDLE;
+        if (exportSlot != ~0u)
+        {
+            exportSemaphore = frameExporter.GetSemaphore(exportSlot);
+            submitParams.pSignalSemaphores = &exportSemaphore;
+            submitParams.signalSemaphoreCount = 1;
+        }
         imp::SubmitSync sync = engine.Submit(&submitParams, 1);
+        if (exportSlot != ~0u)
+            frameExporter.Publish(exportSlot);
+        if (useReadback)
+            frameReadback.Submit(submitParams.queue);
 
         simpleFramePacing[frameIndex] = sync;
         frameIndex = (frameIndex + 1) % simpleFramePacing.size();
@@ -219,6 +968,17 @@ int main(int argc, char* argv[])
         engine.Present(engine.GetPlatform().GetWindow(), imageIndex);
     }
 
+    vkDeviceWaitIdle(device);
+    sceneStreamer.Shutdown(engine);
+    frameReadback.Shutdown(device);
+    frameExporter.Shutdown(device);
+    geometryPool.Shutdown(device);
+    renderGraph.Destroy(device);
+    lightCuller.Destroy(device);
+    shadows.Destroy(device);
+    gpuTimer.Destroy(device);
+    viewSet.Destroy(device);
+
     engine.Shutdown();
     return 1;
 }
\ No newline at end of file
@@ -0,0 +1,102 @@
+// Shared by the shaders that read or write the light clusters.
+// Define LIGHTING_SET before including.
+
+// Must match ClusteredLighting::kMaxLightsPerCluster
+const uint kMaxLightsPerCluster = 128;
+
+const uint kLightTypePoint = 0;
+const uint kLightTypeSpot = 1;
+
+struct Light
+{
+    vec3 position;
+    float range;
+    vec3 color;
+    float spotScale;
+    vec3 direction;
+    float spotOffset;
+    float cosOuterCone;
+    float sinOuterCone;
+    uint type;
+    uint padding;
+};
+
+layout(set = LIGHTING_SET, binding = 0) readonly buffer Lights
+{
+    Light lights[];
+};
+
+layout(set = LIGHTING_SET, binding = 1) buffer ClusterLightCounts
+{
+    uint clusterLightCounts[];
+};
+
+layout(set = LIGHTING_SET, binding = 2) buffer ClusterLightIndices
+{
+    uint clusterLightIndices[];
+};
+
+layout(set = LIGHTING_SET, binding = 3) uniform ClusterUniforms
+{
+    mat4 view;
+    mat4 inverseProjection;
+    uvec4 gridSize;
+    vec4 screenSize;
+    vec4 depthSlicing;
+} clusters;
+
+uint GetClusterIndex(uvec3 cluster)
+{
+    return cluster.x + cluster.y * clusters.gridSize.x + cluster.z * clusters.gridSize.x * clusters.gridSize.y;
+}
+
+uint GetDepthSlice(float viewDepth)
+{
+    return uint(max(log(viewDepth) * clusters.depthSlicing.x + clusters.depthSlicing.y, 0.0));
+}
+
+#ifndef CLUSTER_BUILD
+
+// Phong lighting from every light binned into the fragment's cluster
+vec3 ShadeClusteredLights(vec3 worldPos, vec3 N, vec3 V, vec3 baseColor, vec2 fragCoord)
+{
+    float viewDepth = -(clusters.view * vec4(worldPos, 1.0)).z;
+
+    uvec3 cluster;
+    cluster.xy = uvec2(fragCoord / clusters.screenSize.xy * vec2(clusters.gridSize.xy));
+    cluster.z = GetDepthSlice(viewDepth);
+    cluster = min(cluster, clusters.gridSize.xyz - 1u);
+
+    uint clusterIndex = GetClusterIndex(cluster);
+    uint count = clusterLightCounts[clusterIndex];
+    uint first = clusterIndex * kMaxLightsPerCluster;
+
+    vec3 color = vec3(0.0);
+    for (uint i = 0u; i < count; i++)
+    {
+        Light light = lights[clusterLightIndices[first + i]];
+
+        vec3 toLight = light.position - worldPos;
+        float distanceSq = max(dot(toLight, toLight), 1e-4);
+        vec3 L = toLight * inversesqrt(distanceSq);
+
+        // Inverse square with the smooth window from KHR_lights_punctual so it reaches 0 at the range
+        float ratio = distanceSq / (light.range * light.range);
+        float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+        float attenuation = window * window / distanceSq;
+
+        float spot = clamp(dot(-L, light.direction) * light.spotScale + light.spotOffset, 0.0, 1.0);
+        attenuation *= spot * spot;
+
+        float diffuse = max(dot(N, L), 0.0);
+
+        vec3 R = reflect(-L, N);
+        float specular = pow(max(dot(R, V), 0.0), 32.0);
+
+        color += (diffuse * baseColor + specular) * light.color * attenuation;
+    }
+
+    return color;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#version 450
+
+layout(location = 0) out vec4 outColor;
+
+layout(location = 0) in vec3 inWorldPos;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec3 inViewVec;
+
+// Must match MultiView::kMaxViews
+const uint kMaxViews = 8;
+
+layout(set = 0, binding = 0) uniform ViewUniforms
+{
+    mat4 viewProj[kMaxViews];
+    vec4 cameraPos[kMaxViews];
+    vec4 lightPos;
+} views;
+
+// Single point light phong, the clustered lights and sun shadows are fit to the main camera only
+void main()
+{
+    vec3 N = normalize(inNormal);
+    vec3 V = normalize(inViewVec);
+    vec3 L = normalize(views.lightPos.xyz - inWorldPos);
+
+    float ambient = 0.1;
+
+    vec3 baseColor = vec3(1.0, 0.8, 0.6);
+
+    float diffuse = max(dot(N, L), 0.0);
+
+    vec3 R = reflect(-L, N);
+    float specular = pow(max(dot(R, V), 0.0), 32.0);
+
+    outColor = vec4((ambient + diffuse) * baseColor + specular, 1.0);
+}
@@ -0,0 +1,105 @@
+#version 450
+
+#extension GL_EXT_multiview: require
+
+layout(location = 0) out vec3 outWorldPos;
+layout(location = 1) out vec3 outNormal;
+layout(location = 2) out vec3 outViewVec;
+
+struct Vertex
+{
+	float vx, vy, vz;
+	float nx, ny, nz;
+    float tu, tv;
+};
+
+struct CompactVertex
+{
+    uint pxy;
+    uint pzn;
+    uint uv;
+};
+
+struct DrawData
+{
+    mat4 Transform;
+    // vertexOffset, indexOffset, is16BitIndices, materialId
+    uvec4 MeshInfo;
+};
+
+// Must match MultiView::kMaxViews
+const uint kMaxViews = 8;
+
+layout(constant_id = 0) const bool kCompactVertices = false;
+
+layout(set = 0, binding = 0) uniform ViewUniforms
+{
+    mat4 viewProj[kMaxViews];
+    vec4 cameraPos[kMaxViews];
+    vec4 lightPos;
+} views;
+
+// Bit v is set when the instance is visible in view v
+layout(set = 0, binding = 1) readonly buffer ViewMasks
+{
+    uint viewMasks[];
+};
+
+layout(set = 1, binding = 0) readonly buffer Vertices
+{
+	Vertex vertices[];
+};
+
+layout(set = 1, binding = 0) readonly buffer CompactVertices
+{
+	CompactVertex compactVertices[];
+};
+
+layout(set = 1, binding = 2) readonly buffer DrawDatas
+{
+    DrawData drawData[];
+};
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    // Culled for this view, z < 0 puts every vertex behind the near plane so the triangle is clipped
+    uint ddi = gl_InstanceIndex;
+    if ((viewMasks[ddi] & (1u << gl_ViewIndex)) == 0u)
+    {
+        gl_Position = vec4(0.0, 0.0, -1.0, 1.0);
+        return;
+    }
+
+    vec3 pos;
+    vec3 norm;
+    if (kCompactVertices)
+    {
+        CompactVertex v = compactVertices[gl_VertexIndex];
+        pos = vec3(unpackHalf2x16(v.pxy), unpackHalf2x16(v.pzn).x);
+        norm = DecodeOctahedral(unpackSnorm4x8(v.pzn).zw);
+    }
+    else
+    {
+        Vertex v = vertices[gl_VertexIndex];
+        pos = vec3(v.vx, v.vy, v.vz);
+        norm = vec3(v.nx, v.ny, v.nz);
+    }
+
+    mat4 model = drawData[ddi].Transform;
+    vec3 worldPos = vec3(model * vec4(pos, 1.0));
+
+    outWorldPos = worldPos;
+    outNormal   = normalize(mat3(model) * norm);
+    outViewVec  = normalize(views.cameraPos[gl_ViewIndex].xyz - worldPos);
+
+    gl_Position = views.viewProj[gl_ViewIndex] * vec4(worldPos, 1.0);
+}
@@ -6,8 +6,7 @@
 
 layout(location = 0) out vec3 outWorldPos;
 layout(location = 1) out vec3 outNormal;
-layout(location = 2) out vec3 outLightVec;
-layout(location = 3) out vec3 outViewVec;
+layout(location = 2) out vec3 outViewVec;
 
 struct Vertex
 {
@@ -16,16 +15,29 @@ struct Vertex
     float tu, tv;
 };
 
+// Mirrors VU::CompactVertex, read as three words:
+// half px, py | half pz, snorm8 octahedral normal | half u, v
+struct CompactVertex
+{
+    uint pxy;
+    uint pzn;
+    uint uv;
+};
+
 struct DrawData
 {
     mat4 Transform;
+    // vertexOffset, indexOffset, is16BitIndices, materialId
+    uvec4 MeshInfo;
 };
 
+layout(constant_id = 0) const bool kCompactVertices = false;
+
 layout (set = 0, binding = 0) uniform Globals
 {
     mat4 viewProj;
-    vec3 cameraPos;
     vec3 lightPos;
+    vec3 cameraPos;
 } globals;
 
 layout(set = 1, binding = 0) readonly buffer Vertices
@@ -33,6 +45,11 @@ layout(set = 1, binding = 0) readonly buffer Vertices
 	Vertex vertices[];
 };
 
+layout(set = 1, binding = 0) readonly buffer CompactVertices
+{
+	CompactVertex compactVertices[];
+};
+
 layout(set = 1, binding = 1) readonly buffer Indices
 {
 	uint indices[];
@@ -43,14 +60,34 @@ layout(set = 1, binding = 2) readonly buffer DrawDatas
     DrawData drawData[];
 };
 
-void main()
+vec3 DecodeOctahedral(vec2 e)
 {
-    Vertex v = vertices[gl_VertexIndex];
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
-    vec3 pos = vec3(vertices[gl_VertexIndex].vx, vertices[gl_VertexIndex].vy, vertices[gl_VertexIndex].vz);
-    vec3 norm = vec3(vertices[gl_VertexIndex].nx, vertices[gl_VertexIndex].ny, vertices[gl_VertexIndex].nz);
-
-    uint ddi = gl_DrawIDARB;
+void main()
+{
+    vec3 pos;
+    vec3 norm;
+    if (kCompactVertices)
+    {
+        CompactVertex v = compactVertices[gl_VertexIndex];
+        pos = vec3(unpackHalf2x16(v.pxy), unpackHalf2x16(v.pzn).x);
+        norm = DecodeOctahedral(unpackSnorm4x8(v.pzn).zw);
+    }
+    else
+    {
+        Vertex v = vertices[gl_VertexIndex];
+        pos = vec3(v.vx, v.vy, v.vz);
+        norm = vec3(v.nx, v.ny, v.nz);
+    }
+
+    // Instanced draws place their DrawData at firstInstance, which gl_InstanceIndex includes
+    uint ddi = gl_InstanceIndex;
 
     mat4 model      = drawData[ddi].Transform;
 
@@ -60,12 +97,10 @@ void main()
     mat3 normalMat = mat3(model);
     vec3 worldNormal = normalize(normalMat * norm);
 
-    vec3 lightVec = normalize(globals.lightPos - worldPos);
     vec3 viewVec  = normalize(globals.cameraPos - worldPos);
 
     outWorldPos = worldPos;
     outNormal   = worldNormal;
-    outLightVec = lightVec;
     outViewVec  = viewVec;
 
     gl_Position = globals.viewProj * vec4(worldPos, 1.0);
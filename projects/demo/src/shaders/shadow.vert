@@ -0,0 +1,18 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+
+layout(set = 0, binding = 0) readonly buffer ShadowInstances
+{
+    mat4 transforms[];
+};
+
+layout(push_constant) uniform PushConstants
+{
+    mat4 viewProj;
+} pc;
+
+void main()
+{
+    gl_Position = pc.viewProj * transforms[gl_InstanceIndex] * vec4(inPosition, 1.0);
+}
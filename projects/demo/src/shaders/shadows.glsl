@@ -0,0 +1,60 @@
+// Sun shadows from the cascaded shadow atlases, include after clustered_lighting.glsl.
+
+// Must match Shadows::kCascadeCount, cascades are 2x2 tiles of the atlas
+const uint kCascadeCount = 4;
+
+layout(set = LIGHTING_SET, binding = 4) uniform ShadowUniforms
+{
+    mat4 cascadeViewProj[kCascadeCount];
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSizes;
+    vec4 sunDirection;
+    vec4 sunColor;
+} shadows;
+
+// Static casters are cached, dynamic ones redrawn every frame, with the same cascade matrices
+layout(set = LIGHTING_SET, binding = 5) uniform sampler2DShadow staticShadowAtlas;
+layout(set = LIGHTING_SET, binding = 6) uniform sampler2DShadow dynamicShadowAtlas;
+
+float GetViewDepth(vec3 worldPos)
+{
+    return -(clusters.view * vec4(worldPos, 1.0)).z;
+}
+
+float SampleSunShadow(vec3 worldPos, vec3 N, float viewDepth)
+{
+    uint cascade = 0u;
+    while (cascade < kCascadeCount && viewDepth > shadows.cascadeSplits[cascade])
+        cascade++;
+    if (cascade == kCascadeCount)
+        return 1.0;
+
+    // Normal offset scaled to the texel size hides most acne on slopes
+    vec3 offsetPos = worldPos + N * shadows.cascadeTexelSizes[cascade] * 1.5;
+    vec4 lightPos = shadows.cascadeViewProj[cascade] * vec4(offsetPos, 1.0);
+    vec3 coord = lightPos.xyz / lightPos.w;
+
+    // Stay half a texel inside the tile so the bilinear footprint doesn't read the neighbour
+    vec2 tileTexel = 0.5 / vec2(textureSize(staticShadowAtlas, 0));
+    vec2 uv = clamp(coord.xy * 0.5 + 0.5, vec2(0.0), vec2(1.0)) * 0.5;
+    uv = clamp(uv, tileTexel, vec2(0.5) - tileTexel);
+    uv += vec2(float(cascade & 1u), float(cascade >> 1u)) * 0.5;
+
+    float staticLit = texture(staticShadowAtlas, vec3(uv, coord.z));
+    float dynamicLit = texture(dynamicShadowAtlas, vec3(uv, coord.z));
+    return min(staticLit, dynamicLit);
+}
+
+vec3 ShadeSun(vec3 worldPos, vec3 N, vec3 V, vec3 baseColor)
+{
+    vec3 L = shadows.sunDirection.xyz;
+    float diffuse = max(dot(N, L), 0.0);
+    if (diffuse <= 0.0)
+        return vec3(0.0);
+
+    vec3 R = reflect(-L, N);
+    float specular = pow(max(dot(R, V), 0.0), 32.0);
+
+    float shadow = SampleSunShadow(worldPos, N, GetViewDepth(worldPos));
+    return (diffuse * baseColor + specular) * shadows.sunColor.rgb * shadow;
+}
@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) out uvec2 outVisibility;
+
+layout(location = 0) flat in uint inDrawId;
+
+void main()
+{
+    // The resolve rebuilds everything else from these two
+    outVisibility = uvec2(inDrawId, gl_PrimitiveID);
+}
@@ -0,0 +1,67 @@
+#version 450
+
+layout(location = 0) flat out uint outDrawId;
+
+struct Vertex
+{
+	float vx, vy, vz;
+	float nx, ny, nz;
+    float tu, tv;
+};
+
+struct CompactVertex
+{
+    uint pxy;
+    uint pzn;
+    uint uv;
+};
+
+struct DrawData
+{
+    mat4 Transform;
+    uvec4 MeshInfo;
+};
+
+layout(constant_id = 0) const bool kCompactVertices = false;
+
+layout (set = 0, binding = 0) uniform Globals
+{
+    mat4 viewProj;
+    vec3 lightPos;
+    vec3 cameraPos;
+} globals;
+
+layout(set = 1, binding = 0) readonly buffer Vertices
+{
+	Vertex vertices[];
+};
+
+layout(set = 1, binding = 0) readonly buffer CompactVertices
+{
+	CompactVertex compactVertices[];
+};
+
+layout(set = 1, binding = 2) readonly buffer DrawDatas
+{
+    DrawData drawData[];
+};
+
+void main()
+{
+    vec3 pos;
+    if (kCompactVertices)
+    {
+        CompactVertex v = compactVertices[gl_VertexIndex];
+        pos = vec3(unpackHalf2x16(v.pxy), unpackHalf2x16(v.pzn).x);
+    }
+    else
+    {
+        Vertex v = vertices[gl_VertexIndex];
+        pos = vec3(v.vx, v.vy, v.vz);
+    }
+
+    uint ddi = gl_InstanceIndex;
+
+    outDrawId = ddi;
+    gl_Position = globals.viewProj * (drawData[ddi].Transform * vec4(pos, 1.0));
+}
@@ -0,0 +1,162 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive: require
+
+#define LIGHTING_SET 3
+#include "clustered_lighting.glsl"
+#include "shadows.glsl"
+
+layout(location = 0) out vec4 outColor;
+
+struct Vertex
+{
+	float vx, vy, vz;
+	float nx, ny, nz;
+    float tu, tv;
+};
+
+struct CompactVertex
+{
+    uint pxy;
+    uint pzn;
+    uint uv;
+};
+
+struct DrawData
+{
+    mat4 Transform;
+    // vertexOffset, indexOffset, is16BitIndices, materialId
+    uvec4 MeshInfo;
+};
+
+// Must match VU::kVisibilityBufferEmpty
+const uint kEmpty = 0xFFFFFFFFu;
+
+layout(constant_id = 0) const bool kCompactVertices = false;
+
+layout (set = 0, binding = 0) uniform Globals
+{
+    mat4 viewProj;
+    vec3 lightPos;
+    vec3 cameraPos;
+} globals;
+
+layout(set = 1, binding = 0) readonly buffer Vertices
+{
+	Vertex vertices[];
+};
+
+layout(set = 1, binding = 0) readonly buffer CompactVertices
+{
+	CompactVertex compactVertices[];
+};
+
+layout(set = 1, binding = 1) readonly buffer Indices
+{
+	uint indices[];
+};
+
+layout(set = 1, binding = 2) readonly buffer DrawDatas
+{
+    DrawData drawData[];
+};
+
+layout(set = 2, binding = 0) uniform usampler2D visibilityBuffer;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+uint FetchIndex(uint element, bool is16Bit)
+{
+    if (!is16Bit)
+        return indices[element];
+
+    // Two 16-bit indices per word, little endian
+    uint word = indices[element >> 1u];
+    return (element & 1u) != 0u ? word >> 16u : word & 0xFFFFu;
+}
+
+void FetchVertex(uint index, out vec3 pos, out vec3 norm)
+{
+    if (kCompactVertices)
+    {
+        CompactVertex v = compactVertices[index];
+        pos = vec3(unpackHalf2x16(v.pxy), unpackHalf2x16(v.pzn).x);
+        norm = DecodeOctahedral(unpackSnorm4x8(v.pzn).zw);
+    }
+    else
+    {
+        Vertex v = vertices[index];
+        pos = vec3(v.vx, v.vy, v.vz);
+        norm = vec3(v.nx, v.ny, v.nz);
+    }
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    uvec2 visibility = texelFetch(visibilityBuffer, pixel, 0).xy;
+    if (visibility.x == kEmpty)
+    {
+        outColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    DrawData dd = drawData[visibility.x];
+    uint firstIndex = dd.MeshInfo.y + visibility.y * 3u;
+    bool is16Bit = dd.MeshInfo.z != 0u;
+
+    vec3 worldPos[3];
+    vec3 worldNormal[3];
+    vec4 clipPos[3];
+    mat3 normalMat = mat3(dd.Transform);
+    for (uint i = 0u; i < 3u; i++)
+    {
+        vec3 pos;
+        vec3 norm;
+        FetchVertex(dd.MeshInfo.x + FetchIndex(firstIndex + i, is16Bit), pos, norm);
+
+        worldPos[i] = vec3(dd.Transform * vec4(pos, 1.0));
+        worldNormal[i] = normalMat * norm;
+        clipPos[i] = globals.viewProj * vec4(worldPos[i], 1.0);
+    }
+
+    // Screen space barycentrics from the pixel center, then corrected for perspective with 1/w.
+    // The render extent can be smaller than the visibility buffer under dynamic resolution.
+    vec2 ndc = (gl_FragCoord.xy / clusters.screenSize.xy) * 2.0 - 1.0;
+    vec3 invW = 1.0 / vec3(clipPos[0].w, clipPos[1].w, clipPos[2].w);
+    vec2 p0 = clipPos[0].xy * invW.x;
+    vec2 p1 = clipPos[1].xy * invW.y;
+    vec2 p2 = clipPos[2].xy * invW.z;
+
+    vec2 e1 = p1 - p0;
+    vec2 e2 = p2 - p0;
+    vec2 d = ndc - p0;
+    float area = e1.x * e2.y - e1.y * e2.x;
+    float b1 = (d.x * e2.y - d.y * e2.x) / area;
+    float b2 = (e1.x * d.y - e1.y * d.x) / area;
+    vec3 bary = vec3(1.0 - b1 - b2, b1, b2) * invW;
+    bary /= bary.x + bary.y + bary.z;
+
+    vec3 P = bary.x * worldPos[0] + bary.y * worldPos[1] + bary.z * worldPos[2];
+    vec3 N = normalize(bary.x * worldNormal[0] + bary.y * worldNormal[1] + bary.z * worldNormal[2]);
+    vec3 V = normalize(globals.cameraPos - P);
+
+    // Same lighting as phong.frag
+    float ambient = 0.1;
+
+    vec3 baseColor = vec3(1.0, 0.8, 0.6);
+
+    vec3 color =
+        ambient * baseColor +
+        ShadeSun(P, N, V, baseColor) +
+        ShadeClusteredLights(P, N, V, baseColor, gl_FragCoord.xy);
+
+    outColor = vec4(color, 1.0);
+}
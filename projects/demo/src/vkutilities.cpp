@@ -7,6 +7,7 @@
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/ext/matrix_clip_space.hpp>
+#include <algorithm>
 #include <array>
 
 namespace VU
@@ -105,6 +106,39 @@ namespace VU
         return vkCreateFramebuffer(device, &fbci, nullptr, &framebuffer);
     }
 
+    VkFramebuffer GetFramebuffer(imp::Engine& engine, FramebufferCache& cache, uint64_t generation, VkRenderPass rp, uint32_t attachmentCount, const VkImageView* pAttachments, uint32_t width, uint32_t height)
+    {
+        if (cache.generation != generation)
+        {
+            const imp::SubmitSync* lastSubmit = engine.GetSubmitSyncManager().GetLastSubmitSync();
+            for (const auto& entry : cache.entries)
+            {
+                imp::VulkanResource res {};
+                res.type = imp::VulkanResourceType::Framebuffer;
+                res.framebuffer = entry.framebuffer;
+                engine.GetSafeResourceDestroyer().EnqueueResourceForDestruction(res, lastSubmit ? lastSubmit->submit : 0);
+            }
+            cache.entries.clear();
+            cache.generation = generation;
+        }
+
+        std::array<VkImageView, 2> attachments {};
+        std::copy(pAttachments, pAttachments + attachmentCount, attachments.begin());
+
+        for (const auto& entry : cache.entries)
+            if (entry.renderPass == rp && entry.attachments == attachments)
+                return entry.framebuffer;
+
+        FramebufferCache::Entry entry {};
+        entry.renderPass = rp;
+        entry.attachments = attachments;
+        if (CreateFramebuffer(engine.GetWorkQueue().GetDevice(), rp, attachmentCount, pAttachments, width, height, entry.framebuffer) != VK_SUCCESS)
+            return VK_NULL_HANDLE;
+
+        cache.entries.push_back(entry);
+        return entry.framebuffer;
+    }
+
     VkResult CreateBuffer(VkPhysicalDevice pDevice, VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Buffer& buffer)
     {
         VkBufferCreateInfo bufferInfo {};
@@ -170,7 +204,7 @@ namespace VU
         binding.binding = 0;
         binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         binding.descriptorCount = 1;
-        binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 
         VkDescriptorSetLayoutCreateInfo dslci {};
         dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -210,6 +244,15 @@ namespace VU
         // Can get from scene loader later
         scene.lightPos = glm::vec3(2.0f, 2.0f, 2.0f);
 
+        // Scenes without punctual lights keep the old single light
+        if (scenel.lights.empty())
+        {
+            SceneLoader::Light light {};
+            light.position = scene.lightPos;
+            light.intensity = 100.0f;
+            scenel.lights.push_back(light);
+        }
+
         static constexpr float defaultCameraYRotationRad = 0.0f;
         if (scenel.cameraWasLoaded)
             scene.cameraTransform = scenel.camera.Model;
@@ -217,16 +260,39 @@ namespace VU
             scene.cameraTransform = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 15.0f)), defaultCameraYRotationRad, glm::vec3(0.0f, 1.0f, 0.0f));
         
         imp::Window& window = engine.GetPlatform().GetWindow();
-        scene.projection = glm::perspective(glm::radians(90.0f), (float)window.GetWidth() / (float)window.GetHeight(), 1.0f, 1000.0f);
-    
-        for (const auto& transform : scenel.transforms)
+        scene.nearPlane = 1.0f;
+        scene.farPlane = 1000.0f;
+        UpdateProjection(scene, window.GetWidth(), window.GetHeight());
+        BuildDrawData(scene, scenel);
+    }
+
+    void BuildDrawData(SceneData& scene, const SceneLoader::Scene& scenel)
+    {
+        // Laid out in instance order so each instanced draw reads a contiguous range
+        scene.drawDatas.clear();
+        for (const auto entityId : scenel.instanceEntities)
         {
-            DrawData drawData {};
-            drawData.transform = transform;
-            scene.drawDatas.push_back(drawData);
+            const SceneLoader::Entity& entity = scenel.entities[entityId];
+            scene.drawDatas.push_back(MakeDrawData(scenel.transforms[entity.transformId], scenel.meshes[entity.meshId], entity.materialId));
         }
     }
 
+    void UpdateProjection(SceneData& scene, uint32_t width, uint32_t height)
+    {
+        scene.projection = glm::perspective(glm::radians(90.0f), (float)width / (float)height, scene.nearPlane, scene.farPlane);
+    }
+
+    DrawData MakeDrawData(const glm::mat4& transform, const SceneLoader::Mesh& mesh, uint32_t materialId)
+    {
+        DrawData drawData {};
+        drawData.transform = transform;
+        drawData.vertexOffset = mesh.vertexOffset;
+        drawData.indexOffset = mesh.indexOffset;
+        drawData.is16BitIndices = mesh.indexType == VK_INDEX_TYPE_UINT16 ? 1 : 0;
+        drawData.materialId = materialId;
+        return drawData;
+    }
+
     void UpdateCamera(imp::Window& window, SceneData& scene, GlobalUniformsData& globalsData, double delta)
     {
         // Vulkan's fixed-function steps expect to look down -Z, Y is "down" and RH
@@ -243,7 +309,9 @@ namespace VU
         const glm::vec3 pos = glm::vec3(scene.cameraTransform[3]);
         glm::mat4 view = glm::lookAtRH(pos, pos + newFront, newUp);
 
+        scene.view = view;
         globalsData.viewPos = pos;
+        globalsData.lightPos = scene.lightPos;
         globalsData.viewProj = scene.projection * view;
 
     }
@@ -265,22 +333,14 @@ namespace VU
         VkBufferCopy copyRegion {};
         copyRegion.size = sizeof(GlobalUniformsData);
         vkCmdCopyBuffer(cb, stagingBuffer.buffer, globals.ubo.buffer, 1, &copyRegion);
-
-        VkMemoryBarrier memoryBarrier {};
-        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        memoryBarrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(cb,
-            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            0,
-            1, &memoryBarrier,
-            0, nullptr,
-            0, nullptr);
     }
 
     void UpdateRenderingDataDescriptorSetByCopy(imp::Engine& engine, const RenderingDescriptors& renderingData, VkCommandBuffer cb, const std::vector<DrawData>& drawData)
     {
+        // Everything can be culled away, nothing to copy then
+        if (drawData.empty())
+            return;
+
         Buffer stagingBuffer {};
         CreateBuffer(engine.GetPhysicalDevice(), engine.GetWorkQueue().GetDevice(),
                                         sizeof(DrawData) * drawData.size(),
@@ -293,24 +353,13 @@ namespace VU
         memcpy(data, drawData.data(), sizeof(DrawData) * drawData.size());
         vkUnmapMemory(engine.GetWorkQueue().GetDevice(), stagingBuffer.memory);
 
-        VkMemoryBarrier memoryBarrier {};
-        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_UNIFORM_READ_BIT;
-        memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        vkCmdPipelineBarrier(cb,
-            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-            0,
-            1, &memoryBarrier,
-            0, nullptr,
-            0, nullptr);
-
+        // Synchronized by the render graph pass that records this
         VkBufferCopy copyRegion {};
         copyRegion.size = sizeof(DrawData) * drawData.size();
         vkCmdCopyBuffer(cb, stagingBuffer.buffer, renderingData.drawDataBuffer.buffer, 1, &copyRegion);
     }
 
-    VkResult SetupRenderingDescriptorSet(imp::Engine& engine, RenderingDescriptors& data, SceneLoader::Scene& scenel)
+    VkResult SetupRenderingDescriptorSet(imp::Engine& engine, RenderingDescriptors& data, SceneLoader::Scene& scenel, uint32_t frameCount)
     {
         VkDevice device = engine.GetWorkQueue().GetDevice();
 
@@ -332,7 +381,7 @@ namespace VU
         bindings[0].binding = 0;
         bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         bindings[0].descriptorCount = 1;
-        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
         bindings[1] = bindings[0];
         bindings[1].binding = 1;
         bindings[2] = bindings[0];
@@ -348,41 +397,83 @@ namespace VU
         if (result != VK_SUCCESS)
             return result;
 
+        const std::vector<VkDescriptorSetLayout> layouts(frameCount, data.descriptorSetLayout);
+        data.descriptorSets.resize(frameCount);
+        data.geometryGenerations.resize(frameCount);
+
         VkDescriptorSetAllocateInfo dsai {};
         dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         dsai.descriptorPool = engine.GetDescriptorPool();
-        dsai.descriptorSetCount = 1;
-        dsai.pSetLayouts = &data.descriptorSetLayout;
+        dsai.descriptorSetCount = frameCount;
+        dsai.pSetLayouts = layouts.data();
 
-        vkAllocateDescriptorSets(device, &dsai, &data.descriptorSet);
+        result = vkAllocateDescriptorSets(device, &dsai, data.descriptorSets.data());
+        if (result != VK_SUCCESS)
+            return result;
 
-        std::array<VkDescriptorBufferInfo, 3> bi {};
-        bi[0].buffer = scenel.vertexBuffer.buffer;
+        VkDescriptorBufferInfo bi {};
+        bi.buffer = drawDataBuffer.buffer;
+        bi.range = VK_WHOLE_SIZE;
+
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            VkWriteDescriptorSet write {};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = data.descriptorSets[frame];
+            write.dstBinding = 2;
+            write.descriptorCount = 1;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write.pBufferInfo = &bi;
+
+            vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+            WriteGeometryDescriptors(device, data, scenel, frame);
+        }
+        return VK_SUCCESS;
+    }
+
+    void WriteGeometryDescriptors(VkDevice device, RenderingDescriptors& data, const SceneLoader::Scene& scenel, uint32_t frame)
+    {
+        std::array<VkDescriptorBufferInfo, 2> bi {};
+        bi[0].buffer = scenel.pGeometryPool->GetVertexBuffer(kVertexStream);
         bi[0].range = VK_WHOLE_SIZE;
-        bi[1].buffer = scenel.indexBuffer.buffer;
+        bi[1].buffer = scenel.pGeometryPool->GetIndexBuffer();
         bi[1].range = VK_WHOLE_SIZE;
-        bi[2].buffer = drawDataBuffer.buffer;
-        bi[2].range = VK_WHOLE_SIZE;
 
         VkWriteDescriptorSet write {};
         write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write.dstSet = data.descriptorSet;
+        write.dstSet = data.descriptorSets[frame];
         write.dstBinding = 0;
-        write.descriptorCount = 3;
+        write.descriptorCount = 2;
         write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         write.pBufferInfo = bi.data();
 
         vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+        data.geometryGenerations[frame] = scenel.pGeometryPool->GetGeneration();
     }
         
     VkResult CreatePhongPipeline(VkDevice device, VkShaderModule vertModule, VkShaderModule fragModule
         , PhongPipeline& pipeline)
     {
+        const VkBool32 compactVertices = pipeline.vertexFormat == VertexFormat::Compact ? VK_TRUE : VK_FALSE;
+
+        VkSpecializationMapEntry specializationEntry {};
+        specializationEntry.constantID = 0;
+        specializationEntry.offset = 0;
+        specializationEntry.size = sizeof(VkBool32);
+
+        VkSpecializationInfo specializationInfo {};
+        specializationInfo.mapEntryCount = 1;
+        specializationInfo.pMapEntries = &specializationEntry;
+        specializationInfo.dataSize = sizeof(VkBool32);
+        specializationInfo.pData = &compactVertices;
+
         VkPipelineShaderStageCreateInfo vertStageInfo {};
         vertStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         vertStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
         vertStageInfo.module = vertModule;
         vertStageInfo.pName = "main";
+        vertStageInfo.pSpecializationInfo = &specializationInfo;
 
         VkPipelineShaderStageCreateInfo fragStageInfo {};
         fragStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -396,14 +487,15 @@ namespace VU
         //pushConstantRange.size = sizeof(PushConstants);
         //pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-        std::array<VkDescriptorSetLayout, 2> setLayouts = {
+        std::array<VkDescriptorSetLayout, 3> setLayouts = {
             pipeline.pGlobalUniforms->descriptorSetLayout,
-            pipeline.pRenderingDescriptors->descriptorSetLayout
+            pipeline.pRenderingDescriptors->descriptorSetLayout,
+            pipeline.lightingDescriptorSetLayout
         };
 
         VkPipelineLayoutCreateInfo plci {};
         plci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        plci.setLayoutCount = 2;
+        plci.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
         plci.pSetLayouts = setLayouts.data();
 
         //plci.pushConstantRangeCount = 0;
@@ -464,13 +556,14 @@ namespace VU
         colorAttachmentDescs[0].samples = VK_SAMPLE_COUNT_1_BIT;
         colorAttachmentDescs[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
         colorAttachmentDescs[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachmentDescs[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachmentDescs[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        // Layout transitions are done by the render graph
+        colorAttachmentDescs[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachmentDescs[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         colorAttachmentDescs[1].format = VK_FORMAT_D32_SFLOAT;
         colorAttachmentDescs[1].samples = VK_SAMPLE_COUNT_1_BIT;
         colorAttachmentDescs[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
         colorAttachmentDescs[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachmentDescs[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachmentDescs[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
         colorAttachmentDescs[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
         std::array<VkAttachmentReference, 2> colorAttachmentRefs {};
@@ -515,6 +608,312 @@ namespace VU
         return result;
     };
 
+    // A non-zero view mask makes it a multiview render pass, every view renders into its own layer
+    static VkResult CreateRenderPass(VkDevice device, VkFormat colorFormat, VkFormat depthFormat, VkAttachmentLoadOp colorLoadOp, VkRenderPass& renderPass,
+        uint32_t viewMask = 0)
+    {
+        // Layout transitions are done by the render graph
+        std::array<VkAttachmentDescription, 2> attachmentDescs {};
+        attachmentDescs[0].format = colorFormat;
+        attachmentDescs[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachmentDescs[0].loadOp = colorLoadOp;
+        attachmentDescs[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachmentDescs[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        attachmentDescs[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        attachmentDescs[1].format = depthFormat;
+        attachmentDescs[1].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachmentDescs[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachmentDescs[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachmentDescs[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        attachmentDescs[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        std::array<VkAttachmentReference, 2> attachmentRefs {};
+        attachmentRefs[0].attachment = 0;
+        attachmentRefs[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        attachmentRefs[1].attachment = 1;
+        attachmentRefs[1].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        const bool hasDepth = depthFormat != VK_FORMAT_UNDEFINED;
+
+        VkSubpassDescription subpassDesc {};
+        subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpassDesc.colorAttachmentCount = 1;
+        subpassDesc.pColorAttachments = &attachmentRefs[0];
+        subpassDesc.pDepthStencilAttachment = hasDepth ? &attachmentRefs[1] : nullptr;
+
+        VkRenderPassCreateInfo rpci {};
+        rpci.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        rpci.attachmentCount = hasDepth ? 2 : 1;
+        rpci.pAttachments = attachmentDescs.data();
+        rpci.subpassCount = 1;
+        rpci.pSubpasses = &subpassDesc;
+
+        // The views see the same scene from nearby, so they are worth rendering concurrently
+        VkRenderPassMultiviewCreateInfo rpmci {};
+        rpmci.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO;
+        rpmci.subpassCount = 1;
+        rpmci.pViewMasks = &viewMask;
+        rpmci.correlationMaskCount = 1;
+        rpmci.pCorrelationMasks = &viewMask;
+        if (viewMask)
+            rpci.pNext = &rpmci;
+
+        return vkCreateRenderPass(device, &rpci, nullptr, &renderPass);
+    }
+
+    static VkResult CreateGraphicsPipeline(VkDevice device, const VkPipelineShaderStageCreateInfo* pStages, VkPipelineLayout layout, VkRenderPass renderPass,
+        bool depthTest, VkCullModeFlags cullMode, VkPipeline& pipeline)
+    {
+        VkPipelineVertexInputStateCreateInfo pvisi {};
+        pvisi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        VkPipelineInputAssemblyStateCreateInfo piasi {};
+        piasi.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        piasi.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        VkPipelineViewportStateCreateInfo pvsi {};
+        pvsi.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        pvsi.viewportCount = 1;
+        pvsi.scissorCount = 1;
+
+        VkPipelineRasterizationStateCreateInfo prsi {};
+        prsi.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        prsi.polygonMode = VK_POLYGON_MODE_FILL;
+        prsi.cullMode = cullMode;
+        prsi.frontFace = VK_FRONT_FACE_CLOCKWISE;
+        prsi.lineWidth = 1.0f;
+
+        VkPipelineMultisampleStateCreateInfo pmsi {};
+        pmsi.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        pmsi.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineColorBlendAttachmentState pcbas {};
+        pcbas.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+        VkPipelineColorBlendStateCreateInfo pcbsci {};
+        pcbsci.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        pcbsci.attachmentCount = 1;
+        pcbsci.pAttachments = &pcbas;
+
+        VkPipelineDepthStencilStateCreateInfo pdsci {};
+        pdsci.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        pdsci.depthTestEnable = depthTest ? VK_TRUE : VK_FALSE;
+        pdsci.depthWriteEnable = depthTest ? VK_TRUE : VK_FALSE;
+        pdsci.depthCompareOp = VK_COMPARE_OP_LESS;
+
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+        VkPipelineDynamicStateCreateInfo pdsci2 {};
+        pdsci2.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        pdsci2.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        pdsci2.pDynamicStates = dynamicStates.data();
+
+        VkGraphicsPipelineCreateInfo gpci {};
+        gpci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        gpci.stageCount = 2;
+        gpci.pStages = pStages;
+        gpci.pVertexInputState = &pvisi;
+        gpci.pInputAssemblyState = &piasi;
+        gpci.pViewportState = &pvsi;
+        gpci.pRasterizationState = &prsi;
+        gpci.pMultisampleState = &pmsi;
+        gpci.pColorBlendState = &pcbsci;
+        gpci.pDepthStencilState = &pdsci;
+        gpci.pDynamicState = &pdsci2;
+        gpci.layout = layout;
+        gpci.renderPass = renderPass;
+
+        return vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &gpci, nullptr, &pipeline);
+    }
+
+    VkResult CreateVisibilityPipeline(imp::Engine& engine, VkShaderModule geometryVertModule, VkShaderModule geometryFragModule,
+        VkShaderModule fullscreenVertModule, VkShaderModule shadeFragModule, VisibilityPipeline& pipeline)
+    {
+        VkDevice device = engine.GetWorkQueue().GetDevice();
+
+        // Vertex fetch in the geometry pass and the resolve both depend on the vertex format
+        const VkBool32 compactVertices = pipeline.vertexFormat == VertexFormat::Compact ? VK_TRUE : VK_FALSE;
+
+        VkSpecializationMapEntry specializationEntry {};
+        specializationEntry.constantID = 0;
+        specializationEntry.offset = 0;
+        specializationEntry.size = sizeof(VkBool32);
+
+        VkSpecializationInfo specializationInfo {};
+        specializationInfo.mapEntryCount = 1;
+        specializationInfo.pMapEntries = &specializationEntry;
+        specializationInfo.dataSize = sizeof(VkBool32);
+        specializationInfo.pData = &compactVertices;
+
+        VkSamplerCreateInfo sci {};
+        sci.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        sci.magFilter = VK_FILTER_NEAREST;
+        sci.minFilter = VK_FILTER_NEAREST;
+        sci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        sci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sci.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sci.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        VkResult result = vkCreateSampler(device, &sci, nullptr, &pipeline.sampler);
+        if (result != VK_SUCCESS)
+            return result;
+
+        VkDescriptorSetLayoutBinding binding {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        binding.pImmutableSamplers = &pipeline.sampler;
+
+        VkDescriptorSetLayoutCreateInfo dslci {};
+        dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        dslci.bindingCount = 1;
+        dslci.pBindings = &binding;
+
+        result = vkCreateDescriptorSetLayout(device, &dslci, nullptr, &pipeline.descriptorSetLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        const std::vector<VkDescriptorSetLayout> layouts(pipeline.frameCount, pipeline.descriptorSetLayout);
+        pipeline.descriptorSets.resize(pipeline.frameCount);
+        pipeline.boundVisibilityViews.assign(pipeline.frameCount, VK_NULL_HANDLE);
+
+        VkDescriptorSetAllocateInfo dsai {};
+        dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        dsai.descriptorPool = engine.GetDescriptorPool();
+        dsai.descriptorSetCount = pipeline.frameCount;
+        dsai.pSetLayouts = layouts.data();
+
+        result = vkAllocateDescriptorSets(device, &dsai, pipeline.descriptorSets.data());
+        if (result != VK_SUCCESS)
+            return result;
+
+        std::array<VkDescriptorSetLayout, 4> setLayouts = {
+            pipeline.pGlobalUniforms->descriptorSetLayout,
+            pipeline.pRenderingDescriptors->descriptorSetLayout,
+            pipeline.descriptorSetLayout,
+            pipeline.lightingDescriptorSetLayout
+        };
+
+        VkPipelineLayoutCreateInfo plci {};
+        plci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        plci.setLayoutCount = 2;
+        plci.pSetLayouts = setLayouts.data();
+
+        result = vkCreatePipelineLayout(device, &plci, nullptr, &pipeline.geometryPipelineLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        plci.setLayoutCount = 4;
+        result = vkCreatePipelineLayout(device, &plci, nullptr, &pipeline.shadePipelineLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        result = CreateRenderPass(device, kVisibilityBufferFormat, VK_FORMAT_D32_SFLOAT, VK_ATTACHMENT_LOAD_OP_CLEAR, pipeline.geometryRenderPass);
+        if (result != VK_SUCCESS)
+            return result;
+
+        // Every pixel is written by the resolve, nothing to load or clear
+        result = CreateRenderPass(device, pipeline.colorFormat, VK_FORMAT_UNDEFINED, VK_ATTACHMENT_LOAD_OP_DONT_CARE, pipeline.shadeRenderPass);
+        if (result != VK_SUCCESS)
+            return result;
+
+        std::array<VkPipelineShaderStageCreateInfo, 2> stages {};
+        stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        stages[0].module = geometryVertModule;
+        stages[0].pName = "main";
+        stages[0].pSpecializationInfo = &specializationInfo;
+        stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        stages[1].module = geometryFragModule;
+        stages[1].pName = "main";
+
+        result = CreateGraphicsPipeline(device, stages.data(), pipeline.geometryPipelineLayout, pipeline.geometryRenderPass,
+            true, VK_CULL_MODE_BACK_BIT, pipeline.geometryPipeline);
+        if (result != VK_SUCCESS)
+            return result;
+
+        stages[0].module = fullscreenVertModule;
+        stages[0].pSpecializationInfo = nullptr;
+        stages[1].module = shadeFragModule;
+        stages[1].pSpecializationInfo = &specializationInfo;
+
+        return CreateGraphicsPipeline(device, stages.data(), pipeline.shadePipelineLayout, pipeline.shadeRenderPass,
+            false, VK_CULL_MODE_NONE, pipeline.shadePipeline);
+    }
+
+    VkResult CreateMultiViewPipeline(VkDevice device, VkShaderModule vertModule, VkShaderModule fragModule, MultiViewPipeline& pipeline)
+    {
+        const VkBool32 compactVertices = pipeline.vertexFormat == VertexFormat::Compact ? VK_TRUE : VK_FALSE;
+
+        VkSpecializationMapEntry specializationEntry {};
+        specializationEntry.constantID = 0;
+        specializationEntry.offset = 0;
+        specializationEntry.size = sizeof(VkBool32);
+
+        VkSpecializationInfo specializationInfo {};
+        specializationInfo.mapEntryCount = 1;
+        specializationInfo.pMapEntries = &specializationEntry;
+        specializationInfo.dataSize = sizeof(VkBool32);
+        specializationInfo.pData = &compactVertices;
+
+        std::array<VkDescriptorSetLayout, 2> setLayouts = {
+            pipeline.viewDescriptorSetLayout,
+            pipeline.pRenderingDescriptors->descriptorSetLayout
+        };
+
+        VkPipelineLayoutCreateInfo plci {};
+        plci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        plci.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        plci.pSetLayouts = setLayouts.data();
+
+        VkResult result = vkCreatePipelineLayout(device, &plci, nullptr, &pipeline.pipelineLayout);
+        if (result != VK_SUCCESS)
+            return result;
+
+        const uint32_t viewMask = (1u << pipeline.viewCount) - 1u;
+        result = CreateRenderPass(device, pipeline.colorFormat, VK_FORMAT_D32_SFLOAT, VK_ATTACHMENT_LOAD_OP_CLEAR, pipeline.renderPass, viewMask);
+        if (result != VK_SUCCESS)
+            return result;
+
+        std::array<VkPipelineShaderStageCreateInfo, 2> stages {};
+        stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        stages[0].module = vertModule;
+        stages[0].pName = "main";
+        stages[0].pSpecializationInfo = &specializationInfo;
+        stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        stages[1].module = fragModule;
+        stages[1].pName = "main";
+
+        return CreateGraphicsPipeline(device, stages.data(), pipeline.pipelineLayout, pipeline.renderPass,
+            true, VK_CULL_MODE_BACK_BIT, pipeline.pipeline);
+    }
+
+    void BindVisibilityBuffer(VkDevice device, VisibilityPipeline& pipeline, uint32_t frame, VkImageView view)
+    {
+        // Only changes when the render graph reallocates, sets of frames in flight keep the old view until their turn
+        if (pipeline.boundVisibilityViews[frame] == view)
+            return;
+
+        VkDescriptorImageInfo ii {};
+        ii.imageView = view;
+        ii.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkWriteDescriptorSet write {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = pipeline.descriptorSets[frame];
+        write.dstBinding = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write.pImageInfo = &ii;
+
+        vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+        pipeline.boundVisibilityViews[frame] = view;
+    }
+
     void InsertPipelineBarrier(VkCommandBuffer cb, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage
         , VkAccessFlags srcAccess, VkAccessFlags dstAccess)
     {
@@ -2,11 +2,13 @@
 #include "Engine.h"
 
 #include <glm/glm.hpp>
+#include <array>
 #include <vector>
 
 namespace SceneLoader
 {
     struct Scene;
+    struct Mesh;
 }
 
 namespace VU
@@ -31,6 +33,22 @@ namespace VU
     };
     static_assert(sizeof(Vertex) == 32);
 
+    // Half-float position, octahedral snorm8 normal and half-float uvs.
+    // Decoded in phong.vert when the kCompactVertices specialization constant is set.
+    struct CompactVertex
+    {
+        uint16_t position[3];
+        int8_t normal[2];
+        uint16_t uvs[2];
+    };
+    static_assert(sizeof(CompactVertex) == 12);
+
+    enum class VertexFormat : uint32_t
+    {
+        Full,
+        Compact
+    };
+
     struct GlobalUniformsData
     {
         glm::mat4 viewProj;
@@ -51,13 +69,22 @@ namespace VU
     struct DrawData
     {
         glm::mat4 transform;
+        // Lets the visibility buffer resolve find the triangle's vertices
+        uint32_t vertexOffset;
+        uint32_t indexOffset;
+        uint32_t is16BitIndices;
+        uint32_t materialId;
     };
+    static_assert(sizeof(DrawData) == 80);
 
     struct SceneData
     {
         glm::mat4 cameraTransform;
+        glm::mat4 view;
         glm::mat4 projection;
         glm::vec3 lightPos;
+        float nearPlane;
+        float farPlane;
 
         std::vector<DrawData> drawDatas;
     };
@@ -65,8 +92,11 @@ namespace VU
     struct RenderingDescriptors
     {
         VkDescriptorSetLayout descriptorSetLayout;
-        VkDescriptorSet descriptorSet;
+        // One per frame in flight, so a grown geometry pool can be pointed at without waiting for other frames
+        std::vector<VkDescriptorSet> descriptorSets;
         Buffer drawDataBuffer;
+        // Geometry pool generation each set's vertex and index bindings were written for
+        std::vector<uint64_t> geometryGenerations;
     };
 
     struct PhongPipeline
@@ -74,11 +104,77 @@ namespace VU
         VkPipeline pipeline;
         VkPipelineLayout pipelineLayout;
         VkRenderPass renderPass;
-        Image depthImage;
-        VkImageView depthImageView;
+
+        VertexFormat vertexFormat;
+
+        GlobalUniforms* pGlobalUniforms;
+        RenderingDescriptors* pRenderingDescriptors;
+        // Clustered lights, set 2
+        VkDescriptorSetLayout lightingDescriptorSetLayout;
+    };
+
+    // (draw data index, primitive id) per pixel, ~0u where nothing was drawn
+    inline constexpr VkFormat kVisibilityBufferFormat = VK_FORMAT_R32G32_UINT;
+    inline constexpr uint32_t kVisibilityBufferEmpty = ~0u;
+
+    struct VisibilityPipeline
+    {
+        // Rasterizes depth and the visibility buffer only
+        VkPipeline geometryPipeline;
+        VkPipelineLayout geometryPipelineLayout;
+        VkRenderPass geometryRenderPass;
+
+        // Full-screen pass that rebuilds the visible triangle and shades each pixel once
+        VkPipeline shadePipeline;
+        VkPipelineLayout shadePipelineLayout;
+        VkRenderPass shadeRenderPass;
+
+        VkDescriptorSetLayout descriptorSetLayout;
+        // One per frame in flight, so a reallocated visibility buffer is picked up without waiting for other frames
+        std::vector<VkDescriptorSet> descriptorSets;
+        VkSampler sampler;
+        // Visibility buffer view each set was written with
+        std::vector<VkImageView> boundVisibilityViews;
+        // Sets to allocate, the number of frames in flight
+        uint32_t frameCount = 1;
+
+        VertexFormat vertexFormat;
+        VkFormat colorFormat;
 
         GlobalUniforms* pGlobalUniforms;
         RenderingDescriptors* pRenderingDescriptors;
+        // Clustered lights, set 3 of the shade pipeline
+        VkDescriptorSetLayout lightingDescriptorSetLayout;
+    };
+
+    // One VK_KHR_multiview pass draws every view into its own layer of the targets
+    struct MultiViewPipeline
+    {
+        VkPipeline pipeline;
+        VkPipelineLayout pipelineLayout;
+        VkRenderPass renderPass;
+
+        VertexFormat vertexFormat;
+        VkFormat colorFormat;
+        uint32_t viewCount;
+
+        RenderingDescriptors* pRenderingDescriptors;
+        // Per-view cameras and instance view masks, set 0
+        VkDescriptorSetLayout viewDescriptorSetLayout;
+    };
+
+    // Framebuffers over render graph images, dropped when the graph reallocates its resources
+    struct FramebufferCache
+    {
+        struct Entry
+        {
+            VkRenderPass renderPass;
+            std::array<VkImageView, 2> attachments;
+            VkFramebuffer framebuffer;
+        };
+
+        std::vector<Entry> entries;
+        uint64_t generation = 0;
     };
 
     VkResult CreateShaderModule(VkDevice device, const uint32_t* source, size_t codeSize, VkShaderModule& shader);
@@ -88,15 +184,31 @@ VkResult CreateImageView(VkDevice device, VkImage image, VkFormat format, VkImag
 
     VkResult CreateFramebuffer(VkDevice device, VkRenderPass rp, uint32_t attachmentCount, const VkImageView* pAttachments, uint32_t width, uint32_t height, VkFramebuffer& framebuffer);
 
+    VkFramebuffer GetFramebuffer(imp::Engine& engine, FramebufferCache& cache, uint64_t generation, VkRenderPass rp, uint32_t attachmentCount, const VkImageView* pAttachments, uint32_t width, uint32_t height);
+
     VkResult CreateBuffer(VkPhysicalDevice pDevice, VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Buffer& buffer);
 
     VkResult SetupGlobalUniforms(imp::Engine& engine, GlobalUniforms& globals);
     void InitializeSceneData(imp::Engine& engine, SceneData& scene, SceneLoader::Scene& scenel);
+    // Draw data of every instance, again after streaming moved meshes to other ranges
+    void BuildDrawData(SceneData& scene, const SceneLoader::Scene& scenel);
+    // Keeps the aspect of the output extent, call again after a resize
+    void UpdateProjection(SceneData& scene, uint32_t width, uint32_t height);
+    DrawData MakeDrawData(const glm::mat4& transform, const SceneLoader::Mesh& mesh, uint32_t materialId);
     void UpdateCamera(imp::Window& window, SceneData& scene, GlobalUniformsData& globalsData, double delta);
     void UpdateGlobalDataDescriptorSetByCopy(imp::Engine& engine, const GlobalUniforms& globals, VkCommandBuffer cb);
-    VkResult SetupRenderingDescriptorSet(imp::Engine& engine, RenderingDescriptors& data, SceneLoader::Scene& scenel);
+    VkResult SetupRenderingDescriptorSet(imp::Engine& engine, RenderingDescriptors& data, SceneLoader::Scene& scenel, uint32_t frameCount);
+    // Points a frame's vertex and index bindings at the scene's geometry pool, again whenever the pool generation changes.
+    // The frame's set must not be in use by the GPU.
+    void WriteGeometryDescriptors(VkDevice device, RenderingDescriptors& data, const SceneLoader::Scene& scenel, uint32_t frame);
 
     VkResult CreatePhongPipeline(VkDevice device, VkShaderModule vertModule, VkShaderModule fragModule, PhongPipeline& pipeline);
+    VkResult CreateVisibilityPipeline(imp::Engine& engine, VkShaderModule geometryVertModule, VkShaderModule geometryFragModule,
+        VkShaderModule fullscreenVertModule, VkShaderModule shadeFragModule, VisibilityPipeline& pipeline);
+    // The visibility buffer is a render graph transient, rebinds a frame's set when the graph hands out a new view.
+    // The frame's set must not be in use by the GPU.
+    void BindVisibilityBuffer(VkDevice device, VisibilityPipeline& pipeline, uint32_t frame, VkImageView view);
+    VkResult CreateMultiViewPipeline(VkDevice device, VkShaderModule vertModule, VkShaderModule fragModule, MultiViewPipeline& pipeline);
 
     void UpdateRenderingDataDescriptorSetByCopy(imp::Engine& engine, const RenderingDescriptors& renderingData, VkCommandBuffer cb, const std::vector<DrawData>& drawData);
 
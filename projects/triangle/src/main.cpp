@@ -169,12 +169,7 @@ int main()
     imp::Window& window = engine.GetPlatform().GetWindow();
 
     std::vector<VkFramebuffer> framebuffers;
-    framebuffers.resize(swapchain.GetSwapchainImageCount());
-    for (uint32_t i = 0; i < swapchain.GetSwapchainImageCount(); i++)
-    {
-        VkImageView attachment = swapchain.GetSwapchainImageView(i);
-        VU::CreateFramebuffer(device, renderPass, 1, &attachment, window.GetWidth(), window.GetHeight(), framebuffers[i]);
-    }
+    uint64_t swapchainGeneration = ~0ull;
 
     // Main loop
     auto frameStartTime = std::chrono::high_resolution_clock::now();
@@ -185,9 +180,38 @@ int main()
         frameStartTime = frameEndTime;
         engine.GetPlatform().GetWindow().UpdateInfo(frameTimeMs);
 
+        // Minimized, there is nothing to render to until the window comes back
+        if (window.GetWidth() == 0 || window.GetHeight() == 0)
+        {
+            window.WaitEvents();
+            continue;
+        }
+
         uint32_t imageIndex = 0;
         engine.AcquireNextImage(engine.GetPlatform().GetWindow(), &imageIndex);
 
+        // The swapchain was recreated, old framebuffers go once the frames using them are done
+        const VkExtent2D extent = swapchain.GetExtent();
+        if (swapchain.GetGeneration() != swapchainGeneration)
+        {
+            swapchainGeneration = swapchain.GetGeneration();
+            const imp::SubmitSync* lastSubmit = engine.GetSubmitSyncManager().GetLastSubmitSync();
+            for (const auto framebuffer : framebuffers)
+            {
+                imp::VulkanResource res {};
+                res.type = imp::VulkanResourceType::Framebuffer;
+                res.framebuffer = framebuffer;
+                engine.GetSafeResourceDestroyer().EnqueueResourceForDestruction(res, lastSubmit ? lastSubmit->submit : 0);
+            }
+
+            framebuffers.resize(swapchain.GetSwapchainImageCount());
+            for (uint32_t i = 0; i < swapchain.GetSwapchainImageCount(); i++)
+            {
+                VkImageView attachment = swapchain.GetSwapchainImageView(i);
+                VU::CreateFramebuffer(device, renderPass, 1, &attachment, extent.width, extent.height, framebuffers[i]);
+            }
+        }
+
         VkCommandBuffer cb = engine.AcquireCommandBuffer(imp::CommandBufferType::Graphics);
 
         std::array<VkClearValue, 1> clearValues {};
@@ -197,8 +221,8 @@ int main()
         clearValues[0].color.float32[3] = 1.0f;
 
         VkViewport viewport {};
-        viewport.width = static_cast<float>(window.GetWidth());
-        viewport.height = static_cast<float>(window.GetHeight());
+        viewport.width = static_cast<float>(extent.width);
+        viewport.height = static_cast<float>(extent.height);
         viewport.maxDepth = 1.0f;
 
         VkRenderPassBeginInfo rpbi {};
@@ -206,7 +230,7 @@ int main()
         rpbi.renderPass = renderPass;
         rpbi.framebuffer = framebuffers[imageIndex];
         rpbi.renderArea.offset = { 0, 0 };
-        rpbi.renderArea.extent = { window.GetWidth(), window.GetHeight() };
+        rpbi.renderArea.extent = extent;
         rpbi.clearValueCount = static_cast<uint32_t>(clearValues.size());
         rpbi.pClearValues = clearValues.data();
 